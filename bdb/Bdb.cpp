@@ -3,6 +3,8 @@
 #include <iomanip>
 #include <boost/thread/tss.hpp>
 #include "Bdb.h"
+#include "RequestTrace.h"
+#include "ValuePatch.h"
 
 Bdb::
 Bdb() :
@@ -143,11 +145,51 @@ get(const std::string& key, std::string& value)
             fprintf(stderr, "Db::get() returned: %s", db_strerror(rc));
             return Error;
         } 
+        TRACE_MARK(RequestTrace::DEADLOCK_RETRY);
     }
     fprintf(stderr, "get failed %d times", numRetries_);
     return Error;
 }
 
+Bdb::ResponseCode Bdb::
+getRange(const std::string& key, uint32_t offset, uint32_t length, std::string& value)
+{
+    if (!inited_) {
+        fprintf(stderr, "getRange called on uninitialized database");
+        return Error;
+    }
+
+    Dbt dbkey, dbval;
+    dbkey.set_data(const_cast<char*>(key.c_str()));
+    dbkey.set_size(key.size());
+    // DB_DBT_MALLOC allocates what the range holds, not what was asked
+    // for, so reading "the rest of the value" with a huge length is cheap.
+    dbval.set_doff(offset);
+    dbval.set_dlen(length);
+    dbval.set_flags(DB_DBT_MALLOC | DB_DBT_PARTIAL);
+
+    int rc = 0;
+    for (uint32_t idx = 0; idx < numRetries_; idx++) {
+        rc = db_->get(NULL, &dbkey, &dbval, 0);
+        if (rc == 0) {
+            value.assign((char*)(dbval.get_data()), dbval.get_size());
+            free(dbval.get_data());
+            return Success;
+        } else if (rc == DB_NOTFOUND) {
+            value.clear();
+            return KeyNotFound;
+        } else if (rc != DB_LOCK_DEADLOCK) {
+            fprintf(stderr, "Db::get() returned: %s", db_strerror(rc));
+            value.clear();
+            return Error;
+        } 
+        TRACE_MARK(RequestTrace::DEADLOCK_RETRY);
+    }
+    fprintf(stderr, "getRange failed %d times", numRetries_);
+    value.clear();
+    return Error;
+}
+
 Bdb::ResponseCode Bdb::
 insert(const std::string& key, const std::string& value)
 {
@@ -172,6 +214,7 @@ insert(const std::string& key, const std::string& value)
             fprintf(stderr, "Db::put() returned: %s", db_strerror(rc));
             return Error;
         }
+        TRACE_MARK(RequestTrace::DEADLOCK_RETRY);
     }
     fprintf(stderr, "insert failed %d times", numRetries_);
     return Error;
@@ -220,6 +263,7 @@ update(const std::string& key, const std::string& value)
                 fprintf(stderr, "Db::get() returned: %s", db_strerror(rc));
                 return Error;
             }
+            TRACE_MARK(RequestTrace::DEADLOCK_RETRY);
             continue;
         }
 
@@ -235,12 +279,89 @@ update(const std::string& key, const std::string& value)
                 fprintf(stderr, "Db::put() returned: %s", db_strerror(rc));
                 return Error;
             }
+            TRACE_MARK(RequestTrace::DEADLOCK_RETRY);
         }
     }
     fprintf(stderr, "update failed %d times", numRetries_);
     return Error;
 }
 
+Bdb::ResponseCode Bdb::
+append(const std::string& key, const std::string& data)
+{
+    return writePartial(key, true, 0, data);
+}
+
+Bdb::ResponseCode Bdb::
+writeAt(const std::string& key, uint32_t offset, const std::string& data)
+{
+    return writePartial(key, false, offset, data);
+}
+
+/**
+ * The get only reads the size of the value, into an empty buffer, and
+ * takes the write lock for the put; a put alone would create missing
+ * records.
+ */
+Bdb::ResponseCode Bdb::
+writePartial(const std::string& key, bool append, uint32_t offset, const std::string& data)
+{
+    if (!inited_) {
+        fprintf(stderr, "writePartial called on uninitialized database");
+        return Error;
+    }
+    if (data.empty()) {
+        // nothing to write, but the record has to exist.
+        std::string value;
+        return getRange(key, 0, 0, value);
+    }
+    DbTxn* txn = NULL;
+
+    Dbt dbkey, dbdata;
+    dbkey.set_data(const_cast<char*>(key.c_str()));
+    dbkey.set_size(key.size());
+    dbdata.set_data(const_cast<char*>(data.c_str()));
+    dbdata.set_size(data.size());
+    dbdata.set_flags(DB_DBT_PARTIAL);
+
+    Dbt currentData;
+    currentData.set_data(NULL);
+    currentData.set_ulen(0);
+    currentData.set_flags(DB_DBT_USERMEM);
+
+    int rc = 0;
+    for (uint32_t idx = 0; idx < numRetries_; idx++) {
+        env_->txn_begin(NULL, &txn, 0);
+        rc = db_->get(txn, &dbkey, &currentData, DB_RMW);
+        if (rc == 0 || rc == DB_BUFFER_SMALL) {
+            uint32_t doff = append ? currentData.get_size() : offset;
+            if (!validPatch(doff, data.size())) {
+                txn->abort();
+                return Error;
+            }
+            // appends replace nothing; writes replace as many bytes as
+            // they write.
+            dbdata.set_doff(doff);
+            dbdata.set_dlen(append ? 0 : data.size());
+            rc = db_->put(txn, &dbkey, &dbdata, 0);
+        }
+        if (rc == 0) {
+            txn->commit(DB_TXN_SYNC);
+            return Success;
+        }
+        txn->abort();
+        if (rc == DB_NOTFOUND) {
+            return KeyNotFound;
+        } else if (rc != DB_LOCK_DEADLOCK) {
+            fprintf(stderr, "writePartial returned: %s", db_strerror(rc));
+            return Error;
+        }
+        TRACE_MARK(RequestTrace::DEADLOCK_RETRY);
+    }
+    fprintf(stderr, "writePartial failed %d times", numRetries_);
+    return Error;
+}
+
 Bdb::ResponseCode Bdb::
 remove(const std::string& key)
 {
@@ -262,6 +383,7 @@ remove(const std::string& key)
             fprintf(stderr, "Db::del() returned: %s", db_strerror(rc));
             return Error;
         }
+        TRACE_MARK(RequestTrace::DEADLOCK_RETRY);
     }
     fprintf(stderr, "update failed %d times", numRetries_);
     return Error;
@@ -48,12 +48,33 @@ public:
     ResponseCode close();
     ResponseCode drop();
     ResponseCode get(const std::string& key, std::string& value);
+
+    /**
+     * Reads length bytes of the value from offset with a DB_DBT_PARTIAL
+     * get, so only the pages holding them are read.
+     */
+    ResponseCode getRange(const std::string& key, uint32_t offset, uint32_t length, std::string& value);
     ResponseCode insert(const std::string& key, const std::string& value);
     ResponseCode update(const std::string& key, const std::string& value);
+
+    /**
+     * Appends data to the value with a DB_DBT_PARTIAL put, so only the
+     * pages at its end are written.
+     */
+    ResponseCode append(const std::string& key, const std::string& data);
+
+    /**
+     * Overwrites the value from offset with a DB_DBT_PARTIAL put. Berkeley
+     * DB pads the value with zero bytes up to offset.
+     */
+    ResponseCode writeAt(const std::string& key, uint32_t offset, const std::string& data);
     ResponseCode remove(const std::string& key);
     Db* getDb();
 
 private:
+    ResponseCode writePartial(const std::string& key, bool append, uint32_t offset,
+                              const std::string& data);
+
     boost::shared_ptr<DbEnv> env_;
     boost::scoped_ptr<Db> db_;
     std::string dbName_;
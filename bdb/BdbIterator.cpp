@@ -45,7 +45,7 @@ BdbIterator::
 BdbIterator::ResponseCode BdbIterator::
 init(Bdb* bdb, const std::string& startKey, bool startKeyIncluded,
         const std::string& endKey, bool endKeyIncluded,
-        mapkeeper::ScanOrder::type order)
+        mapkeeper::ScanOrder::type order, const mapkeeper::ScanOptions& options)
 {
     scanEnded_ = false;
     order_ = order;
@@ -54,6 +54,7 @@ init(Bdb* bdb, const std::string& startKey, bool startKeyIncluded,
     startKeyIncluded_ = startKeyIncluded;
     endKey_ = endKey;
     endKeyIncluded_ = endKeyIncluded;
+    options_ = options;
     bdb_->getDb()->cursor(NULL, &cursor_, DB_READ_COMMITTED);
     if (order_ == mapkeeper::ScanOrder::Ascending) {
         return initAscendingScan();
@@ -72,9 +73,22 @@ next(RecordBuffer& buffer)
     dbkey.set_data(buffer.getKeyBuffer());
     dbkey.set_ulen(buffer.getKeyBufferSize());
     dbkey.set_flags(DB_DBT_USERMEM);
-    dbval.set_data(buffer.getValueBuffer());
-    dbval.set_ulen(buffer.getValueBufferSize());
-    dbval.set_flags(DB_DBT_USERMEM);
+    if (options_.keysOnly) {
+        initEmptyData(dbval);
+    } else {
+        dbval.set_data(buffer.getValueBuffer());
+        dbval.set_ulen(buffer.getValueBufferSize());
+        dbval.set_flags(DB_DBT_USERMEM);
+        if (options_.valueOffset > 0 || options_.valueLength >= 0) {
+            uint32_t length = buffer.getValueBufferSize();
+            if (options_.valueLength >= 0 && (uint32_t)options_.valueLength < length) {
+                length = options_.valueLength;
+            }
+            dbval.set_doff(std::max(options_.valueOffset, 0));
+            dbval.set_dlen(length);
+            dbval.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+        }
+    }
 
     if (order_ == mapkeeper::ScanOrder::Ascending) {
         return nextAscending(buffer, dbkey, dbval);
@@ -89,10 +103,17 @@ nextAscending(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval)
     bool found = false;
     while (!found) {
         int rc = cursor_->get(&dbkey, &dbval, flags_);
+        if (rc == DB_BUFFER_SMALL && dbval.get_size() > dbval.get_ulen()) {
+            // a failed get leaves the cursor where it was.
+            rc = getLargeValue(buffer, dbkey, dbval);
+        }
         if (rc == DB_NOTFOUND) {
             scanEnded_ = true;
             return BdbIterator::ScanEnded;
-        } 
+        } else if (rc != 0) {
+            fprintf(stderr, "Dbc::get() returned: %s\n", db_strerror(rc));
+            return BdbIterator::Error;
+        }
         if (flags_ == DB_CURRENT) {
             flags_ = DB_NEXT;
         }
@@ -124,10 +145,17 @@ nextDescending(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval)
     bool found = false;
     while (!found) {
         int rc = cursor_->get(&dbkey, &dbval, flags_);
+        if (rc == DB_BUFFER_SMALL && dbval.get_size() > dbval.get_ulen()) {
+            // a failed get leaves the cursor where it was.
+            rc = getLargeValue(buffer, dbkey, dbval);
+        }
         if (rc == DB_NOTFOUND) {
             scanEnded_ = true;
             return BdbIterator::ScanEnded;
-        } 
+        } else if (rc != 0) {
+            fprintf(stderr, "Dbc::get() returned: %s\n", db_strerror(rc));
+            return BdbIterator::Error;
+        }
         if (flags_ == DB_CURRENT) {
             flags_ = DB_PREV;
         }
@@ -208,6 +236,19 @@ initDescendingScan()
     return BdbIterator::Success; 
 }
 
+/**
+ * Grows the value buffer, which starts at the server's value buffer
+ * size, to fit the value the cursor is on, and reads it again.
+ */
+int BdbIterator::
+getLargeValue(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval)
+{
+    buffer.reserveValueBuffer(dbval.get_size());
+    dbval.set_data(buffer.getValueBuffer());
+    dbval.set_ulen(buffer.getValueBufferSize());
+    return cursor_->get(&dbkey, &dbval, flags_);
+}
+
 void  BdbIterator::
 initEmptyData(Dbt& data)
 {
@@ -23,11 +23,15 @@ public:
      * startKey is supposed to be smaller than or equal to endKey regardless
      * of the scan order. If startKey is larger than endKey, scan result will
      * be empty.
+     *
+     * next() only reads the part of each value that options ask for,
+     * with a DB_DBT_PARTIAL fetch, and nothing of it for keysOnly.
      */
     ResponseCode init(Bdb* bdb, 
                       const std::string& startKey, bool startKeyIncluded,
                       const std::string& endKey, bool endKeyIncluded,
-                      mapkeeper::ScanOrder::type order);
+                      mapkeeper::ScanOrder::type order,
+                      const mapkeeper::ScanOptions& options = mapkeeper::ScanOptions());
     ResponseCode next(RecordBuffer& buffer);
 
 private:
@@ -38,6 +42,7 @@ private:
     ResponseCode initDescendingScan();
     ResponseCode nextAscending(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval);
     ResponseCode nextDescending(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval);
+    int getLargeValue(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval);
     void initEmptyData(Dbt& data);
     bool inited_;
     bool scanEnded_;
@@ -49,6 +54,7 @@ private:
     bool startKeyIncluded_;
     std::string endKey_;
     bool endKeyIncluded_;
+    mapkeeper::ScanOptions options_;
 };
 
 #endif /* BDB_ITERATOR_H */
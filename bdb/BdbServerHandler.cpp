@@ -1,24 +1,36 @@
 #include <sstream>
 #include <cerrno>
+#include <cstdlib>
 #include <dirent.h>
 #include <endian.h>
 #include <stdio.h>
+#include <algorithm>
+#include <boost/bind.hpp>
 #include <boost/thread/tss.hpp>
 #include <boost/thread/thread.hpp>
-#include <server/TThreadedServer.h>
 #include "BdbServerHandler.h"
 #include "BdbIterator.h"
 #include "RecordBuffer.h"
 #include "MapKeeper.h"
+#include "HandlerChain.h"
+#include "ServerRuntime.h"
+#include "Projection.h"
+#include "RequestTrace.h"
+#include "ScanFilter.h"
+#include "SplitKeys.h"
+#include "ValuePatch.h"
 
 using namespace ::apache::thrift;
 using namespace ::apache::thrift::protocol;
 using namespace ::apache::thrift::transport;
-using namespace ::apache::thrift::server;
 using namespace ::apache::thrift::concurrency;
 
 std::string BdbServerHandler::DBNAME_PREFIX = "mapkeeper_";
 
+// approximate estimates read this many records to find the average
+// record size, and answer exactly if the range is no bigger.
+const uint64_t BdbServerHandler::ESTIMATE_SAMPLE_RECORDS = 1000;
+
 /**
  * Berkeley DB calls this function if it has something useful to say.
  *
@@ -193,6 +205,41 @@ scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::t
             const std::string& startKey, const bool startKeyIncluded,
             const std::string& endKey, const bool endKeyIncluded,
             const int32_t maxRecords, const int32_t maxBytes)
+{
+    scanWithOptions(_return, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+                    maxRecords, maxBytes, ScanOptions());
+}
+
+void BdbServerHandler::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options)
+{
+    RecordListSink sink(_return);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+void BdbServerHandler::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName, const ScanOrder::type order, 
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options)
+{
+    PackedRecordSink sink(_return, options.sharedKeyPrefixes);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+/**
+ * Records go from the iterator's buffer straight into the sink.
+ */
+void BdbServerHandler::
+scanInto(ScanSink& sink, const std::string& mapName, const ScanOrder::type order, 
+         const std::string& startKey, const bool startKeyIncluded,
+         const std::string& endKey, const bool endKeyIncluded,
+         const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options)
 {
     BdbIterator itr;
     boost::thread_specific_ptr<RecordBuffer> buffer;
@@ -202,44 +249,107 @@ scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::t
     if (endKey.empty()) {
     }
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
     boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
     if (mapItr == maps_.end()) {
-        _return.responseCode = ResponseCode::MapNotFound;
+        sink.setResponseCode(ResponseCode::MapNotFound);
         return;
     }
  
-    itr.init(mapItr->second, const_cast<std::string&>(startKey), startKeyIncluded, const_cast<std::string&>(endKey), endKeyIncluded, order);
+    ScanFilter filter(options);
+    if (!filter.valid()) {
+        sink.setResponseCode(ResponseCode::Error);
+        return;
+    }
+    std::string start = startKey;
+    bool startIncluded = startKeyIncluded;
+    std::string end = endKey;
+    bool endIncluded = endKeyIncluded;
+    if (!filter.narrowRange(start, startIncluded, end, endIncluded)) {
+        sink.setResponseCode(ResponseCode::ScanEnded);
+        return;
+    }
 
-    int32_t resultSize = 0;
-    _return.responseCode = ResponseCode::Success;
-    while ((maxRecords == 0 || (int32_t)(_return.records.size()) < maxRecords) && 
-           (maxBytes == 0 || resultSize < maxBytes)) {
+    // value filters need whole values, so the projection is applied
+    // after the fetch.
+    ScanOptions fetchOptions = options;
+    if (filter.needsValue()) {
+        fetchOptions.keysOnly = false;
+        fetchOptions.valueOffset = 0;
+        fetchOptions.valueLength = -1;
+    }
+    itr.init(mapItr->second, start, startIncluded, end, endIncluded, order, fetchOptions);
+
+    ResponseCode::type responseCode = ResponseCode::Success;
+    while (!sink.full(maxRecords, maxBytes)) {
         BdbIterator::ResponseCode rc = itr.next(*buffer);
         if (rc == BdbIterator::ScanEnded) {
-            _return.responseCode = ResponseCode::ScanEnded;
+            responseCode = ResponseCode::ScanEnded;
             break;
         } else if (rc != BdbIterator::Success) {
-            _return.responseCode = ResponseCode::Error;
+            responseCode = ResponseCode::Error;
             break;
         }
-        Record rec;
-        rec.key.assign(buffer->getKeyBuffer(), buffer->getKeySize());
-        rec.value.assign(buffer->getValueBuffer(), buffer->getValueSize());
-        _return.records.push_back(rec);
-        resultSize += buffer->getKeySize() + buffer->getValueSize();
+        ScanFilter::Verdict verdict = filter.examine(buffer->getKeyBuffer(), buffer->getKeySize(),
+                                                     buffer->getValueBuffer(), buffer->getValueSize());
+        if (verdict == ScanFilter::Stop) {
+            break;
+        } else if (verdict == ScanFilter::Reject) {
+            continue;
+        }
+        size_t offset = 0;
+        size_t length = buffer->getValueSize();
+        if (filter.needsValue()) {
+            projectRange(options, buffer->getValueSize(), offset, length);
+        }
+        sink.add(buffer->getKeyBuffer(), buffer->getKeySize(), buffer->getValueBuffer() + offset, length);
     } 
+    sink.setResponseCode(responseCode);
+    if (responseCode == ResponseCode::Success) {
+        sink.setResumeKey(filter.lastExamined());
+    }
+    TRACE_MARK(RequestTrace::ENGINE);
 }
 
 void BdbServerHandler::
 get(BinaryResponse& _return, const std::string& mapName, const std::string& recordName) 
 {
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
     boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
     if (itr == maps_.end()) {
         _return.responseCode = ResponseCode::MapNotFound;
         return;
     }
     Bdb::ResponseCode dbrc = itr->second->get(recordName, _return.value);
+    TRACE_MARK(RequestTrace::ENGINE);
+    if (dbrc == Bdb::Success) {
+        _return.responseCode = ResponseCode::Success;
+    } else if (dbrc == Bdb::KeyNotFound) {
+        _return.responseCode = ResponseCode::RecordNotFound;
+    } else {
+        _return.responseCode = ResponseCode::Error;
+    }
+}
+
+void BdbServerHandler::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& recordName,
+         const int64_t offset, const int32_t length)
+{
+    // DB_DBT_PARTIAL offsets are 32-bit.
+    if (offset < 0 || length < 0 || offset > 0xffffffffLL) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    Bdb::ResponseCode dbrc = itr->second->getRange(recordName, offset, length, _return.value);
+    TRACE_MARK(RequestTrace::ENGINE);
     if (dbrc == Bdb::Success) {
         _return.responseCode = ResponseCode::Success;
     } else if (dbrc == Bdb::KeyNotFound) {
@@ -255,11 +365,13 @@ put(const std::string& mapName,
        const std::string& recordBody) 
 {
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
     boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
     if (itr == maps_.end()) {
         return ResponseCode::MapNotFound;
     }
     Bdb::ResponseCode dbrc = itr->second->insert(recordName, recordBody);
+    TRACE_MARK(RequestTrace::ENGINE);
     if (dbrc == Bdb::KeyExists) {
         return ResponseCode::RecordExists;
     } else if (dbrc != Bdb::Success) {
@@ -274,12 +386,14 @@ insert(const std::string& mapName,
        const std::string& recordBody) 
 {
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
     boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
     if (itr == maps_.end()) {
         return ResponseCode::MapNotFound;
     }
  
     Bdb::ResponseCode dbrc = itr->second->insert(recordName, recordBody);
+    TRACE_MARK(RequestTrace::ENGINE);
     if (dbrc == Bdb::KeyExists) {
         return ResponseCode::RecordExists;
     } else if (dbrc != Bdb::Success) {
@@ -288,24 +402,40 @@ insert(const std::string& mapName,
     return ResponseCode::Success;
 }
 
-ResponseCode::type BdbServerHandler::
-insertMany(const std::string& databaseName, const std::vector<Record> & records)
-{
-    return ResponseCode::Success;
-}
-
 ResponseCode::type BdbServerHandler::
 update(const std::string& mapName, 
        const std::string& recordName, 
        const std::string& recordBody) 
 {
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
     boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
     if (itr == maps_.end()) {
         return ResponseCode::MapNotFound;
     }
  
     Bdb::ResponseCode dbrc = itr->second->update(recordName, recordBody);
+    TRACE_MARK(RequestTrace::ENGINE);
+    if (dbrc == Bdb::Success) {
+        return ResponseCode::Success;
+    } else if (dbrc == Bdb::KeyNotFound) {
+        return ResponseCode::RecordNotFound;
+    } else {
+        return ResponseCode::Error;
+    }
+}
+
+ResponseCode::type BdbServerHandler::
+append(const std::string& mapName, const std::string& recordName, const std::string& data)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    Bdb::ResponseCode dbrc = itr->second->append(recordName, data);
+    TRACE_MARK(RequestTrace::ENGINE);
     if (dbrc == Bdb::Success) {
         return ResponseCode::Success;
     } else if (dbrc == Bdb::KeyNotFound) {
@@ -315,15 +445,48 @@ update(const std::string& mapName,
     }
 }
 
+ResponseCode::type BdbServerHandler::
+writeAt(const std::string& mapName, const std::string& recordName,
+        const int64_t offset, const std::string& data)
+{
+    if (!validPatch(offset, data.size())) {
+        return ResponseCode::Error;
+    }
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    Bdb::ResponseCode dbrc = itr->second->writeAt(recordName, offset, data);
+    TRACE_MARK(RequestTrace::ENGINE);
+    if (dbrc == Bdb::Success) {
+        return ResponseCode::Success;
+    } else if (dbrc == Bdb::KeyNotFound) {
+        return ResponseCode::RecordNotFound;
+    } else {
+        return ResponseCode::Error;
+    }
+}
+
+ResponseCode::type BdbServerHandler::
+putChunk(const std::string& mapName, const std::string& recordName,
+         const int64_t offset, const std::string& data, const bool last)
+{
+    return ResponseCode::Error;
+}
+
 ResponseCode::type BdbServerHandler::
 remove(const std::string& mapName, const std::string& recordName) 
 {
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
     boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
     if (itr == maps_.end()) {
         return ResponseCode::MapNotFound;
     }
     Bdb::ResponseCode dbrc = itr->second->remove(recordName);
+    TRACE_MARK(RequestTrace::ENGINE);
     if (dbrc == Bdb::Success) {
         return ResponseCode::Success;
     } else if (dbrc == Bdb::KeyNotFound) {
@@ -333,8 +496,344 @@ remove(const std::string& mapName, const std::string& recordName)
     }
 }
 
+/**
+ * The multi-key methods look up the map once and hold the read lock for
+ * the whole batch.
+ */
+void BdbServerHandler::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName, const std::vector<std::string>& keys)
+{
+    _return.resize(keys.size());
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (itr == maps_.end()) {
+            _return[i].responseCode = ResponseCode::MapNotFound;
+            continue;
+        }
+        _return[i].responseCode = convertResponseCode(itr->second->get(keys[i], _return[i].value));
+    }
+    TRACE_MARK(RequestTrace::ENGINE);
+}
+
+void BdbServerHandler::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records)
+{
+    _return.resize(records.size());
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    for (size_t i = 0; i < records.size(); i++) {
+        if (itr == maps_.end()) {
+            _return[i] = ResponseCode::MapNotFound;
+            continue;
+        }
+        _return[i] = convertResponseCode(itr->second->insert(records[i].key, records[i].value));
+    }
+    TRACE_MARK(RequestTrace::ENGINE);
+}
+
+void BdbServerHandler::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records)
+{
+    _return.resize(records.size());
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    for (size_t i = 0; i < records.size(); i++) {
+        if (itr == maps_.end()) {
+            _return[i] = ResponseCode::MapNotFound;
+            continue;
+        }
+        _return[i] = convertResponseCode(itr->second->insert(records[i].key, records[i].value));
+    }
+    TRACE_MARK(RequestTrace::ENGINE);
+}
+
+void BdbServerHandler::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records)
+{
+    _return.resize(records.size());
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    for (size_t i = 0; i < records.size(); i++) {
+        if (itr == maps_.end()) {
+            _return[i] = ResponseCode::MapNotFound;
+            continue;
+        }
+        _return[i] = convertResponseCode(itr->second->update(records[i].key, records[i].value));
+    }
+    TRACE_MARK(RequestTrace::ENGINE);
+}
+
+void BdbServerHandler::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<std::string>& keys)
+{
+    _return.resize(keys.size());
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (itr == maps_.end()) {
+            _return[i] = ResponseCode::MapNotFound;
+            continue;
+        }
+        _return[i] = convertResponseCode(itr->second->remove(keys[i]));
+    }
+    TRACE_MARK(RequestTrace::ENGINE);
+}
+
+/**
+ * Reports the environment-wide memory pool, lock and transaction
+ * statistics. BDB allocates the stat structures with malloc(), so the
+ * caller is responsible for freeing them.
+ */
+void BdbServerHandler::
+getStats(StatsResponse& _return)
+{
+    std::map<std::string, int64_t>& counters = _return.counters;
+    DB_MPOOL_STAT* mpoolStat = NULL;
+    int rc = env_->memp_stat(&mpoolStat, NULL, 0);
+    if (rc != 0) {
+        fprintf(stderr, "DbEnv::memp_stat() returned: %s\n", db_strerror(rc));
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    counters["bdb.mpool.cache_hit"] = mpoolStat->st_cache_hit;
+    counters["bdb.mpool.cache_miss"] = mpoolStat->st_cache_miss;
+    counters["bdb.mpool.page_in"] = mpoolStat->st_page_in;
+    counters["bdb.mpool.page_out"] = mpoolStat->st_page_out;
+    counters["bdb.mpool.ro_evict"] = mpoolStat->st_ro_evict;
+    counters["bdb.mpool.rw_evict"] = mpoolStat->st_rw_evict;
+    counters["bdb.mpool.pages"] = mpoolStat->st_pages;
+    counters["bdb.mpool.page_dirty"] = mpoolStat->st_page_dirty;
+    counters["bdb.mpool.cache_bytes"] = ((int64_t)mpoolStat->st_gbytes << 30) + mpoolStat->st_bytes;
+    free(mpoolStat);
+
+    DB_LOCK_STAT* lockStat = NULL;
+    rc = env_->lock_stat(&lockStat, 0);
+    if (rc != 0) {
+        fprintf(stderr, "DbEnv::lock_stat() returned: %s\n", db_strerror(rc));
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    counters["bdb.lock.nlocks"] = lockStat->st_nlocks;
+    counters["bdb.lock.maxnlocks"] = lockStat->st_maxnlocks;
+    counters["bdb.lock.nrequests"] = lockStat->st_nrequests;
+    counters["bdb.lock.nreleases"] = lockStat->st_nreleases;
+    counters["bdb.lock.lock_wait"] = lockStat->st_lock_wait;
+    counters["bdb.lock.lock_nowait"] = lockStat->st_lock_nowait;
+    counters["bdb.lock.ndeadlocks"] = lockStat->st_ndeadlocks;
+    counters["bdb.lock.nlocktimeouts"] = lockStat->st_nlocktimeouts;
+    counters["bdb.lock.ntxntimeouts"] = lockStat->st_ntxntimeouts;
+    free(lockStat);
+
+    DB_TXN_STAT* txnStat = NULL;
+    rc = env_->txn_stat(&txnStat, 0);
+    if (rc != 0) {
+        fprintf(stderr, "DbEnv::txn_stat() returned: %s\n", db_strerror(rc));
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    counters["bdb.txn.nbegins"] = txnStat->st_nbegins;
+    counters["bdb.txn.ncommits"] = txnStat->st_ncommits;
+    counters["bdb.txn.naborts"] = txnStat->st_naborts;
+    counters["bdb.txn.nactive"] = txnStat->st_nactive;
+    counters["bdb.txn.maxnactive"] = txnStat->st_maxnactive;
+    free(txnStat);
+
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);
+    counters["bdb.maps"] = maps_.size();
+    _return.responseCode = ResponseCode::Success;
+}
+
+/**
+ * Ranges of up to EXACT_SPLIT_RECORDS records are read and split exactly.
+ * Larger ones are split by bisecting Db::key_range(), which estimates
+ * the share of the btree before a key from the internal pages it walks
+ * down, without reading the leaves.
+ */
+void BdbServerHandler::
+getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const int32_t numSplits)
+{
+    RecordBuffer buffer(keyBufferSizeBytes_, valueBufferSizeBytes_);
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
+    if (mapItr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    BdbIterator itr;
+    itr.init(mapItr->second, startKey, true, endKey, true, ScanOrder::Ascending);
+    SplitKeySampler sampler(numSplits);
+    BdbIterator::ResponseCode rc = BdbIterator::Success;
+    while (sampler.size() < EXACT_SPLIT_RECORDS &&
+           (rc = itr.next(buffer)) == BdbIterator::Success) {
+        sampler.add(std::string(buffer.getKeyBuffer(), buffer.getKeySize()),
+                    buffer.getKeySize() + buffer.getValueSize());
+    }
+    if (rc == BdbIterator::Success) {
+        BdbIterator lastItr;
+        lastItr.init(mapItr->second, startKey, true, endKey, true, ScanOrder::Descending);
+        if (lastItr.next(buffer) != BdbIterator::Success) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        std::string firstKey = sampler.firstKey();
+        std::string lastKey(buffer.getKeyBuffer(), buffer.getKeySize());
+        Db* db = mapItr->second->getDb();
+        double first = keyPosition(db, firstKey, 0, 1);
+        double last = keyPosition(db, lastKey + '\0', 0, 1);
+        if (first < 0 || last < 0) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        if (last > first) {
+            if (!bisectSplitKeys(firstKey, lastKey, numSplits,
+                                 boost::bind(&BdbServerHandler::keyPosition, db, _1, first, last - first),
+                                 _return.values)) {
+                _return.responseCode = ResponseCode::Error;
+                return;
+            }
+            TRACE_MARK(RequestTrace::ENGINE);
+            _return.responseCode = ResponseCode::Success;
+            return;
+        }
+        // the estimates can't tell the keys apart, so keep reading.
+        while ((rc = itr.next(buffer)) == BdbIterator::Success) {
+            sampler.add(std::string(buffer.getKeyBuffer(), buffer.getKeySize()),
+                        buffer.getKeySize() + buffer.getValueSize());
+        }
+    }
+    if (rc != BdbIterator::ScanEnded) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    sampler.getSplitKeys(_return.values);
+    TRACE_MARK(RequestTrace::ENGINE);
+    _return.responseCode = ResponseCode::Success;
+}
+
+void BdbServerHandler::
+estimateCount(EstimateResponse& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, mapName, startKey, endKey, exact, true);
+}
+
+void BdbServerHandler::
+estimateSize(EstimateResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, mapName, startKey, endKey, exact, false);
+}
+
+/**
+ * Approximate estimates take the share of the btree in the range from
+ * Db::key_range(), and the number of records from Db::stat() with
+ * DB_FAST_STAT, which reads the count saved in the metadata page. Until
+ * BDB has saved one, the count is worked out from the number of pages
+ * and the average size of the first records instead.
+ *
+ * Exact counts use a cursor that doesn't read the values.
+ */
+void BdbServerHandler::
+estimate(EstimateResponse& _return, const std::string& mapName,
+         const std::string& startKey, const std::string& endKey, bool exact, bool count)
+{
+    RecordBuffer buffer(keyBufferSizeBytes_, valueBufferSizeBytes_);
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
+    if (mapItr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    ScanOptions options;
+    options.keysOnly = exact && count;
+    BdbIterator itr;
+    itr.init(mapItr->second, startKey, true, endKey, false, ScanOrder::Ascending, options);
+    uint64_t numRecords = 0;
+    uint64_t bytes = 0;
+    BdbIterator::ResponseCode rc = BdbIterator::Success;
+    while ((exact || numRecords < ESTIMATE_SAMPLE_RECORDS) &&
+           (rc = itr.next(buffer)) == BdbIterator::Success) {
+        numRecords++;
+        bytes += buffer.getKeySize() + buffer.getValueSize();
+    }
+    _return.exact = true;
+    if (rc == BdbIterator::Success) {
+        Db* db = mapItr->second->getDb();
+        double start = keyPosition(db, startKey, 0, 1);
+        double end = endKey.empty() ? 1 : keyPosition(db, endKey, 0, 1);
+        if (start < 0 || end < 0) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        DB_BTREE_STAT* stat = NULL;
+        int ret = db->stat(NULL, &stat, DB_FAST_STAT);
+        if (ret != 0) {
+            fprintf(stderr, "Db::stat() returned: %s\n", db_strerror(ret));
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        double average = (double)bytes / numRecords;
+        double records = stat->bt_ndata > 0 ? stat->bt_ndata * (end - start) :
+            (double)stat->bt_pagecnt * stat->bt_pagesize * (end - start) / average;
+        free(stat);
+        numRecords = std::max(numRecords, (uint64_t)records);
+        bytes = (uint64_t)(numRecords * average);
+        _return.exact = false;
+    } else if (rc != BdbIterator::ScanEnded) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.value = count ? numRecords : bytes;
+    TRACE_MARK(RequestTrace::ENGINE);
+    _return.responseCode = ResponseCode::Success;
+}
+
+/**
+ * Returns the share of the keys in db that are less than key, minus
+ * first, over range, or -1 on errors.
+ */
+double BdbServerHandler::
+keyPosition(Db* db, const std::string& key, double first, double range)
+{
+    Dbt dbkey;
+    dbkey.set_data(const_cast<char*>(key.c_str()));
+    dbkey.set_size(key.size());
+    DB_KEY_RANGE keyRange;
+    int rc = db->key_range(NULL, &dbkey, &keyRange, 0);
+    if (rc != 0) {
+        fprintf(stderr, "Db::key_range() returned: %s\n", db_strerror(rc));
+        return -1;
+    }
+    return std::max(0.0, std::min(1.0, (keyRange.less - first) / range));
+}
+
+ResponseCode::type BdbServerHandler::
+convertResponseCode(Bdb::ResponseCode rc)
+{
+    switch (rc) {
+    case Bdb::Success:
+        return ResponseCode::Success;
+    case Bdb::KeyExists:
+        return ResponseCode::RecordExists;
+    case Bdb::KeyNotFound:
+        return ResponseCode::RecordNotFound;
+    default:
+        return ResponseCode::Error;
+    }
+}
+
 int main(int argc, char **argv) {
-    int port = 9090;
+    ServerOptions options;
+    options.parse(argc, argv);
     std::string homeDir = "data";
     uint32_t pageSizeKb = 16;
     uint32_t numRetries = 100;
@@ -348,11 +847,7 @@ int main(int argc, char **argv) {
     valueBufferSizeBytes,
     checkpointFrequencyMs,
     checkpointMinChangeKb);
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server(processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
+    shared_ptr<TProcessor> processor(buildProcessor(handler, options));
+    runServer(processor, options);
     return 0;
 }
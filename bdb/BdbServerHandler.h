@@ -11,6 +11,7 @@
 #include <db_cxx.h>
 #include "Bdb.h"
 #include "MapKeeper.h"
+#include "ScanSink.h"
 
 using namespace ::apache::thrift;
 using namespace ::apache::thrift::protocol;
@@ -35,14 +36,49 @@ public:
             const std::string& startKey, const bool startKeyIncluded,
             const std::string& endKey, const bool endKeyIncluded,
             const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(RecordListResponse& _return, const std::string& databaseName, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options);
+    void scanPacked(PackedRecordListResponse& _return, const std::string& databaseName, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options);
     void get(BinaryResponse& _return, const std::string& databaseName, const std::string& recordName);
+    void getRange(BinaryResponse& _return, const std::string& databaseName, const std::string& recordName,
+            const int64_t offset, const int32_t length);
     ResponseCode::type put(const std::string& databaseName, const std::string& recordName, const std::string& recordBody);
     ResponseCode::type insert(const std::string& databaseName, const std::string& recordName, const std::string& recordBody);
-    ResponseCode::type insertMany(const std::string& databaseName, const std::vector<Record> & records);
     ResponseCode::type update(const std::string& databaseName, const std::string& recordName, const std::string& recordBody);
+    ResponseCode::type append(const std::string& databaseName, const std::string& recordName,
+                              const std::string& data);
+    ResponseCode::type writeAt(const std::string& databaseName, const std::string& recordName,
+                               const int64_t offset, const std::string& data);
+    ResponseCode::type putChunk(const std::string& databaseName, const std::string& recordName,
+            const int64_t offset, const std::string& data, const bool last);
     ResponseCode::type remove(const std::string& databaseName, const std::string& recordName);
+    void multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName, const std::vector<std::string>& keys);
+    void multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records);
+    void multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records);
+    void multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records);
+    void multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<std::string>& keys);
+    void getStats(StatsResponse& _return);
+    void getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+            const std::string& startKey, const std::string& endKey, const int32_t numSplits);
+    void estimateCount(EstimateResponse& _return, const std::string& mapName,
+            const std::string& startKey, const std::string& endKey, const bool exact);
+    void estimateSize(EstimateResponse& _return, const std::string& mapName,
+            const std::string& startKey, const std::string& endKey, const bool exact);
 
 private:
+    static ResponseCode::type convertResponseCode(Bdb::ResponseCode rc);
+    void scanInto(ScanSink& sink, const std::string& databaseName, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options);
+    static double keyPosition(Db* db, const std::string& key, double first, double range);
+    void estimate(EstimateResponse& _return, const std::string& mapName,
+            const std::string& startKey, const std::string& endKey, bool exact, bool count);
     void checkpoint(uint32_t checkpointFrequencyMs, uint32_t checkpointMinChangeKb);
     void initEnv(const std::string& homeDir);
     static void bdbMessageCallback(const DbEnv *dbenv, const char *errpfx, const char *msg);
@@ -53,4 +89,5 @@ private:
     uint32_t keyBufferSizeBytes_;
     uint32_t valueBufferSizeBytes_;
     static std::string DBNAME_PREFIX;
+    static const uint64_t ESTIMATE_SAMPLE_RECORDS;
 };
@@ -56,3 +56,12 @@ setValueSize(uint32_t valueSize)
 {
     valueSize_ = valueSize;
 }
+
+void RecordBuffer::
+reserveValueBuffer(uint32_t size)
+{
+    if (size > valueBufferSize_) {
+        valueBuffer_.reset(new char[size]);
+        valueBufferSize_ = size;
+    }
+}
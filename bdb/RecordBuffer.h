@@ -16,6 +16,12 @@ public:
     void setKeySize(uint32_t keySize);
     void setValueSize(uint32_t valueSize);
 
+    /**
+     * Makes the value buffer hold at least size bytes. Its contents are
+     * lost if it grows.
+     */
+    void reserveValueBuffer(uint32_t size);
+
 private:
     RecordBuffer(const RecordBuffer&);
     RecordBuffer& operator=(const RecordBuffer&);
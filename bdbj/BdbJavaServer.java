@@ -7,6 +7,7 @@ import org.slf4j.LoggerFactory;
 import org.apache.thrift.*;
 import java.util.Properties;
 import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import com.yahoo.mapkeeper.*;
 import java.io.FileInputStream;
 import com.sleepycat.je.*;
@@ -48,6 +49,11 @@ class BdbJavaServer implements MapKeeper.Iface {
     private final Lock writeLock = this.lock.writeLock();
     private final Logger logger = LoggerFactory.getLogger(BdbJavaServer.class);
 
+    /**
+     * getSplitKeys() cuts a range into at most this many parts.
+     */
+    private static final int MAX_SPLITS = 1024;
+
     public BdbJavaServer(Properties properties)
     {
         logger.info(properties.toString());
@@ -229,6 +235,88 @@ class BdbJavaServer implements MapKeeper.Iface {
         }
     }
 
+    /**
+     * Same as scan(), with resumeKey set. This server doesn't implement
+     * keysOnly, projections or filters, so a scan that sets any of them
+     * returns Error rather than records it didn't ask for.
+     */
+    public RecordListResponse scanWithOptions(String databaseName, ScanOrder order,
+        ByteBuffer startKey, boolean startKeyIncluded,
+        ByteBuffer endKey, boolean endKeyIncluded,
+        int maxRecords, int maxBytes, ScanOptions options) throws TException
+    {
+        if (hasRecordOptions(options)) {
+            RecordListResponse response = new RecordListResponse();
+            response.responseCode = ResponseCode.Error;
+            return response;
+        }
+        RecordListResponse response = scan(databaseName, order, startKey, startKeyIncluded,
+                endKey, endKeyIncluded, maxRecords, maxBytes);
+        if (response.responseCode == ResponseCode.Success && response.records != null &&
+                !response.records.isEmpty()) {
+            response.resumeKey = response.records.get(response.records.size() - 1).key;
+        }
+        return response;
+    }
+
+    /**
+     * Same as scanWithOptions(), with the records packed into one buffer
+     * as common/PackedRecords.h lays it out. Keys are always stored
+     * whole, and values uncompressed; the flags say so.
+     */
+    public PackedRecordListResponse scanPacked(String databaseName, ScanOrder order,
+        ByteBuffer startKey, boolean startKeyIncluded,
+        ByteBuffer endKey, boolean endKeyIncluded,
+        int maxRecords, int maxBytes, ScanOptions options) throws TException
+    {
+        RecordListResponse records = scanWithOptions(databaseName, order, startKey, startKeyIncluded,
+                endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        PackedRecordListResponse response = new PackedRecordListResponse();
+        response.responseCode = records.responseCode;
+        response.resumeKey = records.resumeKey;
+        if (records.responseCode == ResponseCode.Success || records.responseCode == ResponseCode.ScanEnded) {
+            response.records = packRecords(records.records);
+        }
+        return response;
+    }
+
+    /**
+     * | n | flags | key size | value size | key | value | ..., with
+     * little-endian 32-bit integers.
+     */
+    private static ByteBuffer packRecords(List<Record> records)
+    {
+        int numRecords = records == null ? 0 : records.size();
+        int size = 8;
+        for (int i = 0; i < numRecords; i++) {
+            size += 8 + records.get(i).key.remaining() + records.get(i).value.remaining();
+        }
+        ByteBuffer packed = ByteBuffer.allocate(size).order(ByteOrder.LITTLE_ENDIAN);
+        packed.putInt(numRecords);
+        packed.putInt(0);
+        for (int i = 0; i < numRecords; i++) {
+            Record record = records.get(i);
+            packed.putInt(record.key.remaining());
+            packed.putInt(record.value.remaining());
+            packed.put(record.key.duplicate());
+            packed.put(record.value.duplicate());
+        }
+        packed.flip();
+        return packed;
+    }
+
+    /**
+     * Whether options asks for anything but whole records.
+     */
+    private static boolean hasRecordOptions(ScanOptions options)
+    {
+        return options.keysOnly || options.valueOffset != 0 || options.valueLength >= 0 ||
+            (options.keyPrefix != null && options.keyPrefix.remaining() > 0) ||
+            (options.keyRegex != null && options.keyRegex.length() > 0) ||
+            (options.valueFilters != null && !options.valueFilters.isEmpty()) ||
+            options.maxExamined > 0;
+    }
+
     public RecordListResponse scanAscending(Cursor cursor,
         ByteBuffer startKey, boolean startKeyIncluded, 
         ByteBuffer endKey, boolean endKeyIncluded, 
@@ -363,6 +451,63 @@ class BdbJavaServer implements MapKeeper.Iface {
         }
     }
 
+    /**
+     * Retrieves part of a record's value, reading only that part.
+     * 
+     * @param databaseName
+     * @param recordKey
+     * @param offset first byte of the value to return.
+     * @param length number of bytes to return, or fewer if the value ends
+     *               first.
+     * @return BinaryResponse
+     *              responseCode - Success
+     *                             MapNotFound database doesn't exist.
+     *                             RecordNotFound record doesn't exist.
+     *                             Error on any other errors, including a
+     *                             negative offset or length.
+     *              value - the bytes of the value.
+     */
+    public BinaryResponse getRange(String databaseName, ByteBuffer recordKey, long offset, int length)
+        throws TException
+    {
+        BinaryResponse response = new BinaryResponse();
+        if (offset < 0 || length < 0) {
+            response.responseCode = ResponseCode.Error;
+            return response;
+        }
+        if (offset > Integer.MAX_VALUE) {
+            // past the end of any value.
+            offset = Integer.MAX_VALUE;
+            length = 0;
+        }
+        this.readLock.lock();
+        try {
+            Database db = this.db.get(databaseName);
+            if (db == null) {
+                response.responseCode = ResponseCode.MapNotFound;
+                return response;
+            }
+            DatabaseEntry value = new DatabaseEntry();
+            value.setPartial((int)offset, length, true);
+            OperationStatus status = db.get(null,
+                    new DatabaseEntry(recordKey.array(), recordKey.position(), recordKey.remaining()),
+                    value, LockMode.READ_COMMITTED);
+            if (status == OperationStatus.NOTFOUND) {
+                response.responseCode = ResponseCode.RecordNotFound;
+                return response;
+            }
+            response.responseCode = ResponseCode.Success;
+            response.value = ByteBuffer.wrap(value.getData(), 0, value.getSize());
+            return response;
+        } catch (DatabaseException ex) {
+            logger.error(ex.getMessage());
+            response.responseCode = ResponseCode.Error;
+            return response;
+        } finally {
+            this.readLock.unlock();
+        }
+    }
+
     /**
      * Puts a record into a database.
      * 
@@ -498,6 +643,115 @@ class BdbJavaServer implements MapKeeper.Iface {
         }
     }
 
+    /**
+     * Appends bytes to the value of a record.
+     * 
+     * @param databaseName
+     * @param recordKey
+     * @param data bytes to append.
+     * @return Success
+     *          MapNotFound map doesn't exist.
+     *          RecordNotFound
+     *          Error, including a value that would grow past 2^31 - 1 bytes.
+     */
+    public ResponseCode append(String databaseName, ByteBuffer recordKey, ByteBuffer data) throws TException
+    {
+        return patch(databaseName, recordKey, -1, data);
+    }
+
+    /**
+     * Overwrites bytes of the value of a record from offset, with zero
+     * bytes between the old end of the value and offset.
+     * 
+     * @param databaseName
+     * @param recordKey
+     * @param offset where data goes in the value.
+     * @param data bytes to write.
+     * @return Success
+     *          MapNotFound map doesn't exist.
+     *          RecordNotFound
+     *          Error, including a negative offset and a value that would
+     *          grow past 2^31 - 1 bytes.
+     */
+    public ResponseCode writeAt(String databaseName, ByteBuffer recordKey, long offset, ByteBuffer data)
+        throws TException
+    {
+        if (offset < 0) {
+            return ResponseCode.Error;
+        }
+        return patch(databaseName, recordKey, offset, data);
+    }
+
+    /**
+     * Writes data at offset, or at the end of the value if offset is
+     * negative. BDB JE doesn't take partial puts, so the value is read
+     * and rewritten whole, under a write lock on the record.
+     */
+    private ResponseCode patch(String databaseName, ByteBuffer recordKey, long offset, ByteBuffer data)
+    {
+        Transaction txn = null;
+        Cursor cursor = null;
+        this.readLock.lock();
+        try {
+            Database db = this.db.get(databaseName);
+            if (db == null) {
+                return ResponseCode.MapNotFound;
+            }
+            txn = env.beginTransaction(null, null);
+            cursor = db.openCursor(txn, null);
+            DatabaseEntry key = new DatabaseEntry(recordKey.array(), recordKey.position(), recordKey.remaining());
+            DatabaseEntry value = new DatabaseEntry();
+            OperationStatus status = cursor.getSearchKey(key, value, LockMode.RMW);
+            if (status == OperationStatus.NOTFOUND) {
+                return ResponseCode.RecordNotFound;
+            }
+            byte[] current = value.getData();
+            if (offset < 0) {
+                offset = current.length;
+            }
+            if (offset + data.remaining() > Integer.MAX_VALUE) {
+                return ResponseCode.Error;
+            }
+            if (data.remaining() > 0) {
+                byte[] patched = new byte[Math.max(current.length, (int)offset + data.remaining())];
+                System.arraycopy(current, 0, patched, 0, current.length);
+                data.duplicate().get(patched, (int)offset, data.remaining());
+                status = cursor.putCurrent(new DatabaseEntry(patched));
+                if (status != OperationStatus.SUCCESS) {
+                    return ResponseCode.Error;
+                }
+            }
+            cursor.close();
+            cursor = null;
+            txn.commit();
+            txn = null;
+            return ResponseCode.Success;
+        } catch (DatabaseException ex) {
+            logger.error(ex.getMessage());
+            return ResponseCode.Error;
+        } finally {
+            if (cursor != null) {
+                cursor.close();
+            }
+            if (txn != null) {
+                txn.abort();
+            }
+            this.readLock.unlock();
+        }
+    }
+
+    /**
+     * Uploads in pieces are only taken by maps with chunked storage, which
+     * this server doesn't have.
+     * 
+     * @return Error
+     */
+    public ResponseCode putChunk(String databaseName, ByteBuffer recordKey, long offset,
+        ByteBuffer data, boolean last) throws TException
+    {
+        return ResponseCode.Error;
+    }
+
     /**
      * Removes a record from a database.
      * 
@@ -526,6 +780,303 @@ class BdbJavaServer implements MapKeeper.Iface {
         }
     }
 
+    /**
+     * Retrieves multiple records from a database, one get() per key.
+     * 
+     * @param databaseName
+     * @param recordKeys
+     * @return one BinaryResponse per key, in the same order as the keys.
+     */
+    public List<BinaryResponse> multiGet(String databaseName, List<ByteBuffer> recordKeys) throws TException
+    {
+        List<BinaryResponse> responses = new ArrayList<BinaryResponse>(recordKeys.size());
+        for (ByteBuffer recordKey : recordKeys) {
+            responses.add(get(databaseName, recordKey));
+        }
+        return responses;
+    }
+
+    /**
+     * Puts multiple records into a database, one put() per record. The
+     * batch isn't atomic.
+     * 
+     * @param databaseName
+     * @param records
+     * @return one response code per record, in the same order as the records.
+     */
+    public List<ResponseCode> multiPut(String databaseName, List<Record> records) throws TException
+    {
+        List<ResponseCode> responses = new ArrayList<ResponseCode>(records.size());
+        for (Record record : records) {
+            responses.add(put(databaseName, record.key, record.value));
+        }
+        return responses;
+    }
+
+    /**
+     * Inserts multiple records into a database, one insert() per record.
+     * The batch isn't atomic.
+     * 
+     * @param databaseName
+     * @param records
+     * @return one response code per record, in the same order as the records.
+     */
+    public List<ResponseCode> multiInsert(String databaseName, List<Record> records) throws TException
+    {
+        List<ResponseCode> responses = new ArrayList<ResponseCode>(records.size());
+        for (Record record : records) {
+            responses.add(insert(databaseName, record.key, record.value));
+        }
+        return responses;
+    }
+
+    /**
+     * Updates multiple records in a database, one update() per record.
+     * The batch isn't atomic.
+     * 
+     * @param databaseName
+     * @param records
+     * @return one response code per record, in the same order as the records.
+     */
+    public List<ResponseCode> multiUpdate(String databaseName, List<Record> records) throws TException
+    {
+        List<ResponseCode> responses = new ArrayList<ResponseCode>(records.size());
+        for (Record record : records) {
+            responses.add(update(databaseName, record.key, record.value));
+        }
+        return responses;
+    }
+
+    /**
+     * Removes multiple records from a database, one remove() per key.
+     * 
+     * @param databaseName
+     * @param recordKeys
+     * @return one response code per key, in the same order as the keys.
+     */
+    public List<ResponseCode> multiRemove(String databaseName, List<ByteBuffer> recordKeys) throws TException
+    {
+        List<ResponseCode> responses = new ArrayList<ResponseCode>(recordKeys.size());
+        for (ByteBuffer recordKey : recordKeys) {
+            responses.add(remove(databaseName, recordKey));
+        }
+        return responses;
+    }
+
+    /**
+     * Returns statistics about this persistent store.
+     * 
+     * @return StatsResponse
+     *              responseCode - Success
+     *              counters - "maps", the number of databases.
+     *              properties - "je.environment_stats", the report of
+     *                           Environment.getStats().
+     */
+    public StatsResponse getStats() throws TException
+    {
+        this.readLock.lock();
+        try {
+            StatsResponse response = new StatsResponse();
+            response.counters = new HashMap<String, Long>();
+            response.properties = new HashMap<String, String>();
+            response.counters.put("maps", (long)this.db.size());
+            response.properties.put("je.environment_stats", this.env.getStats(null).toString());
+            response.responseCode = ResponseCode.Success;
+            return response;
+        } catch (DatabaseException ex) {
+            logger.error(ex.getMessage());
+            StatsResponse response = new StatsResponse();
+            response.responseCode = ResponseCode.Error;
+            return response;
+        } finally {
+            this.readLock.unlock();
+        }
+    }
+
+    /**
+     * Returns keys that cut [startKey, endKey] into numSplits parts with
+     * about the same number of records each.
+     * 
+     * BDB JE keeps no statistics to estimate the parts from, so this reads
+     * the keys of the range twice, without their values: once to count
+     * them and once to pick the split keys.
+     * 
+     * @param databaseName
+     * @param startKey start of the range. If it's empty, the range starts
+     *                 at the smallest key in the database.
+     * @param endKey end of the range, included. If it's empty, the range
+     *               ends at the largest key in the database.
+     * @param numSplits number of parts, at most 1024.
+     * @return BinaryListResponse
+     *              responseCode - Success
+     *                             MapNotFound database doesn't exist.
+     *                             Error on any other errors.
+     *              values - split keys in ascending order.
+     */
+    public BinaryListResponse getSplitKeys(String databaseName, ByteBuffer startKey,
+        ByteBuffer endKey, int numSplits) throws TException
+    {
+        this.readLock.lock();
+        BinaryListResponse response = new BinaryListResponse();
+        Cursor cursor = null;
+        try {
+            Database db = this.db.get(databaseName);
+            if (db == null) {
+                response.responseCode = ResponseCode.MapNotFound;
+                return response;
+            }
+            numSplits = Math.max(1, Math.min(numSplits, MAX_SPLITS));
+            cursor = db.openCursor(null, null);
+            DatabaseEntry value = new DatabaseEntry();
+            value.setPartial(0, 0, true);
+
+            long numRecords = 0;
+            DatabaseEntry key = new DatabaseEntry(startKey.array(), startKey.position(), startKey.remaining());
+            OperationStatus status = cursor.getSearchKeyRange(key, value, null);
+            while (inRange(status, key, endKey, true)) {
+                numRecords++;
+                status = cursor.getNext(key, value, null);
+            }
+
+            response.values = new ArrayList<ByteBuffer>();
+            long index = 0;
+            long split = 1;
+            key = new DatabaseEntry(startKey.array(), startKey.position(), startKey.remaining());
+            status = cursor.getSearchKeyRange(key, value, null);
+            while (split < numSplits && inRange(status, key, endKey, true)) {
+                // the first key of the range would make an empty part.
+                if (index > 0 && numRecords * split / numSplits <= index) {
+                    response.values.add(ByteBuffer.wrap(key.getData()));
+                    while (split < numSplits && numRecords * split / numSplits <= index) {
+                        split++;
+                    }
+                }
+                index++;
+                status = cursor.getNext(key, value, null);
+            }
+            response.responseCode = ResponseCode.Success;
+            return response;
+        } catch (DatabaseException ex) {
+            logger.error(ex.getMessage());
+            response.values = null;
+            response.responseCode = ResponseCode.Error;
+            return response;
+        } finally {
+            if (cursor != null) {
+                cursor.close();
+            }
+            this.readLock.unlock();
+        }
+    }
+
+    /**
+     * Returns the number of records in [startKey, endKey). BDB JE keeps no
+     * statistics to estimate it from, so the answer is always exact; the
+     * keys are counted without reading their values.
+     * 
+     * @param databaseName
+     * @param startKey start of the range, included. If it's empty, the
+     *                 range starts at the smallest key in the database.
+     * @param endKey end of the range, excluded. If it's empty, the range
+     *               ends after the largest key in the database.
+     * @param exact ignored.
+     * @return EstimateResponse
+     *              responseCode - Success
+     *                             MapNotFound database doesn't exist.
+     *                             Error on any other errors.
+     *              value - number of records.
+     *              exact - true.
+     */
+    public EstimateResponse estimateCount(String databaseName, ByteBuffer startKey,
+        ByteBuffer endKey, boolean exact) throws TException
+    {
+        return estimate(databaseName, startKey, endKey, true);
+    }
+
+    /**
+     * Returns the total size of the keys and values in [startKey, endKey),
+     * in bytes, reading the records of the range. Parameters and responses
+     * are the same as estimateCount().
+     */
+    public EstimateResponse estimateSize(String databaseName, ByteBuffer startKey,
+        ByteBuffer endKey, boolean exact) throws TException
+    {
+        return estimate(databaseName, startKey, endKey, false);
+    }
+
+    private EstimateResponse estimate(String databaseName, ByteBuffer startKey,
+        ByteBuffer endKey, boolean count)
+    {
+        this.readLock.lock();
+        EstimateResponse response = new EstimateResponse();
+        Cursor cursor = null;
+        try {
+            Database db = this.db.get(databaseName);
+            if (db == null) {
+                response.responseCode = ResponseCode.MapNotFound;
+                return response;
+            }
+            cursor = db.openCursor(null, null);
+            DatabaseEntry key = new DatabaseEntry(startKey.array(), startKey.position(), startKey.remaining());
+            DatabaseEntry value = new DatabaseEntry();
+            if (count) {
+                value.setPartial(0, 0, true);
+            }
+            long total = 0;
+            OperationStatus status = cursor.getSearchKeyRange(key, value, null);
+            while (inRange(status, key, endKey, false)) {
+                total += count ? 1 : key.getSize() + value.getSize();
+                status = cursor.getNext(key, value, null);
+            }
+            response.setValue(total);
+            response.setExact(true);
+            response.responseCode = ResponseCode.Success;
+            return response;
+        } catch (DatabaseException ex) {
+            logger.error(ex.getMessage());
+            response.responseCode = ResponseCode.Error;
+            return response;
+        } finally {
+            if (cursor != null) {
+                cursor.close();
+            }
+            this.readLock.unlock();
+        }
+    }
+
+    /**
+     * Whether a cursor found a record that comes before endKey, or at it
+     * if endKeyIncluded. An empty endKey is past every key.
+     */
+    private static boolean inRange(OperationStatus status, DatabaseEntry key,
+        ByteBuffer endKey, boolean endKeyIncluded)
+    {
+        if (status != OperationStatus.SUCCESS) {
+            return false;
+        }
+        if (endKey.remaining() == 0) {
+            return true;
+        }
+        int cmp = compareKeys(key.getData(), endKey);
+        return endKeyIncluded ? cmp <= 0 : cmp < 0;
+    }
+
+    /**
+     * Compares keys bytewise, as unsigned bytes, which is the order BDB JE
+     * keeps them in.
+     */
+    private static int compareKeys(byte[] key, ByteBuffer other)
+    {
+        int length = Math.min(key.length, other.remaining());
+        for (int i = 0; i < length; i++) {
+            int cmp = (key[i] & 0xff) - (other.get(other.position() + i) & 0xff);
+            if (cmp != 0) {
+                return cmp;
+            }
+        }
+        return key.length - other.remaining();
+    }
+
     public static void main(String argv[]) {
         Logger logger = LoggerFactory.getLogger(BdbJavaServer.class);
         try {
@@ -0,0 +1,199 @@
+#ifndef MAPKEEPER_FUTURE_H
+#define MAPKEEPER_FUTURE_H
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
+
+/**
+ * Thrown by Future::get() when the call failed, e.g., because the
+ * connection broke.
+ */
+class FutureError : public std::runtime_error {
+public:
+    FutureError(const std::string& error) :
+        std::runtime_error(error) {
+    }
+};
+
+template <class T> class Promise;
+
+/**
+ * State shared by a Future and its Promise.
+ */
+template <class T>
+struct FutureState {
+    typedef boost::function<void ()> Callback;
+
+    FutureState() :
+        ready(false),
+        failed(false) {
+    }
+
+    boost::mutex mutex;
+    boost::condition_variable readyCondition;
+    bool ready;
+    bool failed;
+    T value;
+    std::string error;
+    std::vector<Callback> callbacks;
+};
+
+/**
+ * The result of an asynchronous call, which is either a value or an
+ * error message. Copies of a future refer to the same result.
+ */
+template <class T>
+class Future {
+public:
+    typedef boost::function<void (const Future<T>&)> Callback;
+
+    /**
+     * Creates a future that isn't attached to any call.
+     */
+    Future() {
+    }
+
+    bool valid() const {
+        return state_.get() != NULL;
+    }
+
+    bool ready() const {
+        boost::mutex::scoped_lock lock(state_->mutex);
+        return state_->ready;
+    }
+
+    void wait() const {
+        boost::mutex::scoped_lock lock(state_->mutex);
+        while (!state_->ready) {
+            state_->readyCondition.wait(lock);
+        }
+    }
+
+    /**
+     * @returns false if the future isn't ready after timeoutMs.
+     */
+    bool timedWait(uint32_t timeoutMs) const {
+        boost::system_time deadline = boost::get_system_time() +
+                                      boost::posix_time::milliseconds(timeoutMs);
+        boost::mutex::scoped_lock lock(state_->mutex);
+        while (!state_->ready) {
+            if (!state_->readyCondition.timed_wait(lock, deadline)) {
+                return state_->ready;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Waits for the result and returns the value.
+     *
+     * @throws FutureError if the call failed.
+     */
+    const T& get() const {
+        wait();
+        if (state_->failed) {
+            throw FutureError(state_->error);
+        }
+        return state_->value;
+    }
+
+    /**
+     * Waits for the result and tells whether the call failed.
+     */
+    bool failed() const {
+        wait();
+        return state_->failed;
+    }
+
+    /**
+     * Waits for the result and returns the error message, if any.
+     */
+    const std::string& error() const {
+        wait();
+        return state_->error;
+    }
+
+    /**
+     * Calls callback with this future once it's ready: right away if it
+     * already is, or otherwise on the thread that completes it, which is
+     * usually a client I/O thread. Callbacks shouldn't block.
+     */
+    void then(const Callback& callback) const {
+        {
+            boost::mutex::scoped_lock lock(state_->mutex);
+            if (!state_->ready) {
+                state_->callbacks.push_back(boost::bind(callback, *this));
+                return;
+            }
+        }
+        callback(*this);
+    }
+
+private:
+    friend class Promise<T>;
+
+    Future(boost::shared_ptr<FutureState<T> > state) :
+        state_(state) {
+    }
+
+    boost::shared_ptr<FutureState<T> > state_;
+};
+
+/**
+ * The producing end of a Future. Only the first setValue() or
+ * setError() counts.
+ */
+template <class T>
+class Promise {
+public:
+    Promise() :
+        state_(new FutureState<T>()) {
+    }
+
+    Future<T> getFuture() const {
+        return Future<T>(state_);
+    }
+
+    void setValue(const T& value) {
+        complete(&value, "");
+    }
+
+    void setError(const std::string& error) {
+        complete(NULL, error);
+    }
+
+private:
+    void complete(const T* value, const std::string& error) {
+        std::vector<typename FutureState<T>::Callback> callbacks;
+        {
+            boost::mutex::scoped_lock lock(state_->mutex);
+            if (state_->ready) {
+                return;
+            }
+            if (value) {
+                state_->value = *value;
+            } else {
+                state_->failed = true;
+                state_->error = error;
+            }
+            state_->ready = true;
+            state_->callbacks.swap(callbacks);
+            state_->readyCondition.notify_all();
+        }
+        for (size_t i = 0; i < callbacks.size(); i++) {
+            callbacks[i]();
+        }
+    }
+
+    boost::shared_ptr<FutureState<T> > state_;
+};
+
+#endif // MAPKEEPER_FUTURE_H
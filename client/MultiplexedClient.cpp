@@ -0,0 +1,958 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include "MultiplexedFrame.h"
+#include "MultiplexedClient.h"
+
+using boost::shared_ptr;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace mapkeeper;
+
+/**
+ * Adapts the recv_ methods that return a ResponseCode to the receiver
+ * signature.
+ */
+static void receiveResponseCode(ResponseCode::type (MapKeeperClient::*receive)(),
+                                MapKeeperClient& client, ResponseCode::type& _return)
+{
+    _return = (client.*receive)();
+}
+
+/**
+ * Sends scanWithOptions or scanPacked, which have more arguments than
+ * boost::bind takes.
+ */
+struct ScanWithOptionsSender {
+    std::string mapName;
+    ScanOrder::type order;
+    std::string startKey;
+    bool startKeyIncluded;
+    std::string endKey;
+    bool endKeyIncluded;
+    int32_t maxRecords;
+    int32_t maxBytes;
+    ScanOptions options;
+    bool packed;
+
+    void operator()(MapKeeperClient& client) const
+    {
+        if (packed) {
+            client.send_scanPacked(mapName, order, startKey, startKeyIncluded,
+                                   endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        } else {
+            client.send_scanWithOptions(mapName, order, startKey, startKeyIncluded,
+                                        endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        }
+    }
+};
+
+template <class T>
+static void completeBatch(const Future<std::vector<T> >& future, const std::vector<Promise<T> >& promises)
+{
+    for (size_t i = 0; i < promises.size(); i++) {
+        Promise<T> promise = promises[i];
+        if (future.failed()) {
+            promise.setError(future.error());
+        } else if (i < future.get().size()) {
+            promise.setValue(future.get()[i]);
+        } else {
+            promise.setError("too few results in the batch response");
+        }
+    }
+}
+
+template <class T>
+class MultiplexedClient::Call : public PendingCall {
+public:
+    Call(MultiplexedClient& client, const Sender& sender,
+         const boost::function<void (MapKeeperClient&, T&)>& receiver,
+         bool retryable, boost::system_time deadline) :
+        PendingCall(deadline),
+        client_(client),
+        sender_(sender),
+        receiver_(receiver),
+        retryable_(retryable),
+        attempt_(0) {
+    }
+
+    /**
+     * Makes a retry, which completes the same future.
+     */
+    Call(const Call& other) :
+        PendingCall(other.deadline),
+        client_(other.client_),
+        sender_(other.sender_),
+        receiver_(other.receiver_),
+        promise_(other.promise_),
+        retryable_(other.retryable_),
+        attempt_(other.attempt_ + 1) {
+    }
+
+    Future<T> getFuture() {
+        return promise_.getFuture();
+    }
+
+    /**
+     * Errors the server reports, e.g., TApplicationException, aren't
+     * retried.
+     */
+    void complete(MapKeeperClient& client) {
+        T result;
+        try {
+            receiver_(client, result);
+        } catch (std::exception& e) {
+            promise_.setError(e.what());
+            return;
+        }
+        promise_.setValue(result);
+    }
+
+    void fail(const std::string& error) {
+        if (retryable_ && attempt_ < client_.options_.maxRetries && !promise_.getFuture().ready()) {
+            boost::system_time retryTime = boost::get_system_time() +
+                boost::posix_time::milliseconds((uint64_t)client_.options_.retryBackoffMs << attempt_);
+            if (retryTime < deadline) {
+                Call* retry = new Call(*this);
+                if (client_.schedule(retryTime, boost::bind(&MultiplexedClient::send, &client_, sender_, retry))) {
+                    return;
+                }
+                delete retry;
+            }
+        }
+        promise_.setError(error);
+    }
+
+private:
+    MultiplexedClient& client_;
+    Sender sender_;
+    boost::function<void (MapKeeperClient&, T&)> receiver_;
+    Promise<T> promise_;
+    bool retryable_;
+    uint32_t attempt_;
+};
+
+MultiplexedClient::Connection::
+Connection(const std::string& host, uint16_t port) :
+    fd_(-1),
+    nextId_(0),
+    sendBuffer_(new TMemoryBuffer()),
+    broken_(false),
+    recvBuffer_(new TMemoryBuffer())
+{
+    sendClient_.reset(new MapKeeperClient(shared_ptr<TProtocol>(new TBinaryProtocol(sendBuffer_))));
+    recvClient_.reset(new MapKeeperClient(shared_ptr<TProtocol>(new TBinaryProtocol(recvBuffer_))));
+    if (!connect(host, port)) {
+        broken_ = true;
+        return;
+    }
+    reader_.reset(new boost::thread(&Connection::run, this));
+}
+
+/**
+ * Shutting down the socket wakes up the reader, which fails the calls
+ * still waiting for a response.
+ */
+MultiplexedClient::Connection::
+~Connection()
+{
+    if (fd_ >= 0) {
+        ::shutdown(fd_, SHUT_RDWR);
+    }
+    if (reader_) {
+        reader_->join();
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+bool MultiplexedClient::Connection::
+broken()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return broken_;
+}
+
+/**
+ * If writing fails, the socket is shut down and the reader fails every
+ * pending call, including this one.
+ */
+void MultiplexedClient::Connection::
+send(const Sender& sender, PendingCall* call)
+{
+    std::string error;
+    {
+        boost::mutex::scoped_lock writeLock(writeMutex_);
+        uint32_t requestId = nextId_++;
+        sendBuffer_->resetBuffer();
+        try {
+            sender(*sendClient_);
+        } catch (std::exception& e) {
+            error = e.what();
+        }
+        if (error.empty()) {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (broken_) {
+                error = error_;
+            } else {
+                pending_[requestId] = call;
+            }
+        }
+        if (error.empty()) {
+            uint8_t* buffer;
+            uint32_t size;
+            sendBuffer_->getBuffer(&buffer, &size);
+            frame_.clear();
+            MultiplexedFrame::appendHeader(frame_, requestId, size);
+            frame_.append((const char*)buffer, size);
+            if (!writeFully(frame_)) {
+                ::shutdown(fd_, SHUT_RDWR);
+            }
+            return;
+        }
+    }
+    // outside the lock, in case a callback sends another call.
+    call->fail(error);
+    delete call;
+}
+
+bool MultiplexedClient::Connection::
+connect(const std::string& host, uint16_t port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses;
+    std::string service = boost::lexical_cast<std::string>(port);
+    int rc = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses);
+    if (rc != 0) {
+        error_ = "failed to resolve " + host + ": " + gai_strerror(rc);
+        return false;
+    }
+    for (struct addrinfo* address = addresses; address; address = address->ai_next) {
+        fd_ = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd_ < 0) {
+            continue;
+        }
+        if (::connect(fd_, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd_);
+        fd_ = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd_ < 0) {
+        error_ = "failed to connect to " + host + ":" + service + ": " + strerror(errno);
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+bool MultiplexedClient::Connection::
+writeFully(const std::string& data)
+{
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t size = ::send(fd_, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (size > 0) {
+            offset += size;
+        } else if (size < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MultiplexedClient::Connection::
+readFully(char* data, size_t size)
+{
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t rc = ::read(fd_, data + offset, size - offset);
+        if (rc > 0) {
+            offset += rc;
+        } else if (rc < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads responses and completes the matching calls until the connection
+ * breaks.
+ */
+void MultiplexedClient::Connection::
+run()
+{
+    char header[MultiplexedFrame::HEADER_BYTES];
+    std::string message;
+    std::string error = "connection closed";
+    while (readFully(header, sizeof(uint32_t))) {
+        uint32_t frameSize = MultiplexedFrame::readUint32(header);
+        if (!(frameSize & MultiplexedFrame::FLAG) ||
+            (frameSize & ~MultiplexedFrame::FLAG) < sizeof(uint32_t)) {
+            error = "unexpected frame; is the server running with --server=epoll?";
+            break;
+        }
+        if (!readFully(header + sizeof(uint32_t), sizeof(uint32_t))) {
+            break;
+        }
+        uint32_t requestId = MultiplexedFrame::readUint32(header + sizeof(uint32_t));
+        message.resize((frameSize & ~MultiplexedFrame::FLAG) - sizeof(uint32_t));
+        if (!message.empty() && !readFully(&message[0], message.size())) {
+            break;
+        }
+        PendingCall* call = take(requestId);
+        if (call == NULL) {
+            continue;
+        }
+        recvBuffer_->resetBuffer((uint8_t*)message.data(), message.size());
+        call->complete(*recvClient_);
+        delete call;
+    }
+    ::shutdown(fd_, SHUT_RDWR);
+    failAll(error);
+}
+
+void MultiplexedClient::Connection::
+expire(boost::system_time now)
+{
+    std::vector<PendingCall*> expired;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        boost::unordered_map<uint32_t, PendingCall*>::iterator itr = pending_.begin();
+        while (itr != pending_.end()) {
+            if (itr->second->deadline <= now) {
+                expired.push_back(itr->second);
+                itr = pending_.erase(itr);
+            } else {
+                itr++;
+            }
+        }
+    }
+    for (size_t i = 0; i < expired.size(); i++) {
+        expired[i]->fail("deadline exceeded");
+        delete expired[i];
+    }
+}
+
+MultiplexedClient::PendingCall* MultiplexedClient::Connection::
+take(uint32_t requestId)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    boost::unordered_map<uint32_t, PendingCall*>::iterator itr = pending_.find(requestId);
+    if (itr == pending_.end()) {
+        return NULL;
+    }
+    PendingCall* call = itr->second;
+    pending_.erase(itr);
+    return call;
+}
+
+void MultiplexedClient::Connection::
+failAll(const std::string& error)
+{
+    boost::unordered_map<uint32_t, PendingCall*> pending;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        broken_ = true;
+        if (error_.empty()) {
+            error_ = error;
+        }
+        pending.swap(pending_);
+    }
+    for (boost::unordered_map<uint32_t, PendingCall*>::iterator itr = pending.begin(); itr != pending.end(); itr++) {
+        itr->second->fail(error);
+        delete itr->second;
+    }
+}
+
+MultiplexedClient::Options::
+Options() :
+    numConnections(2),
+    timeoutMs(0),
+    maxRetries(2),
+    retryBackoffMs(10),
+    batchWindowUs(0),
+    maxBatchSize(64),
+    maxBatchBytes(64 << 10)
+{
+}
+
+MultiplexedClient::
+MultiplexedClient(const std::string& host, uint16_t port, uint32_t numConnections) :
+    host_(host),
+    port_(port),
+    nextConnection_(0),
+    stopped_(false)
+{
+    options_.numConnections = numConnections;
+    init();
+}
+
+MultiplexedClient::
+MultiplexedClient(const std::string& host, uint16_t port, const Options& options) :
+    host_(host),
+    port_(port),
+    options_(options),
+    nextConnection_(0),
+    stopped_(false)
+{
+    init();
+}
+
+/**
+ * The scheduler runs the tasks that are left as soon as it sees
+ * stopped_, and everything they send fails right away.
+ */
+MultiplexedClient::
+~MultiplexedClient()
+{
+    {
+        boost::mutex::scoped_lock lock(schedulerMutex_);
+        stopped_ = true;
+        schedulerCondition_.notify_all();
+    }
+    scheduler_->join();
+
+    // closing the connections fails the calls in flight, whose
+    // callbacks may still look at the connections, so they are closed
+    // outside connectionsMutex_.
+    std::vector<boost::shared_ptr<Connection> > connections;
+    std::vector<boost::shared_ptr<Connection> > retired;
+    {
+        boost::mutex::scoped_lock lock(connectionsMutex_);
+        connections.swap(connections_);
+        retired.swap(retired_);
+    }
+    connections.clear();
+    retired.clear();
+}
+
+void MultiplexedClient::
+init()
+{
+    if (options_.numConnections == 0) {
+        options_.numConnections = 1;
+    }
+    if (options_.maxBatchSize == 0) {
+        options_.maxBatchSize = 1;
+    }
+    for (uint32_t i = 0; i < options_.numConnections; i++) {
+        connections_.push_back(boost::shared_ptr<Connection>(new Connection(host_, port_)));
+        nextReconnect_.push_back(boost::get_system_time());
+    }
+    scheduler_.reset(new boost::thread(&MultiplexedClient::runScheduler, this));
+}
+
+template <class T>
+Future<T> MultiplexedClient::
+call(const Sender& sender, const boost::function<void (MapKeeperClient&, T&)>& receiver,
+     bool retryable)
+{
+    boost::system_time deadline(boost::posix_time::pos_infin);
+    if (options_.timeoutMs > 0) {
+        deadline = boost::get_system_time() + boost::posix_time::milliseconds(options_.timeoutMs);
+    }
+    Call<T>* pending = new Call<T>(*this, sender, receiver, retryable, deadline);
+    Future<T> future = pending->getFuture();
+    send(sender, pending);
+    return future;
+}
+
+void MultiplexedClient::
+send(const Sender& sender, PendingCall* call)
+{
+    if (stopped()) {
+        call->fail("client closed");
+        delete call;
+    } else if (call->deadline <= boost::get_system_time()) {
+        call->fail("deadline exceeded");
+        delete call;
+    } else {
+        pickConnection()->send(sender, call);
+    }
+}
+
+/**
+ * Takes the next connection in the rotation. If it's broken, reopens it
+ * unless that was tried within the last retryBackoffMs, in which case
+ * another connection that works is used. If none does, the call fails
+ * on the broken one, and may be retried later.
+ */
+boost::shared_ptr<MultiplexedClient::Connection> MultiplexedClient::
+pickConnection()
+{
+    boost::system_time now = boost::get_system_time();
+    size_t index;
+    {
+        boost::mutex::scoped_lock lock(connectionsMutex_);
+        index = nextConnection_++ % connections_.size();
+        boost::shared_ptr<Connection> connection = connections_[index];
+        if (!connection->broken()) {
+            return connection;
+        }
+        if (now < nextReconnect_[index]) {
+            for (size_t i = 1; i < connections_.size(); i++) {
+                boost::shared_ptr<Connection> other = connections_[(index + i) % connections_.size()];
+                if (!other->broken()) {
+                    return other;
+                }
+            }
+            return connection;
+        }
+        nextReconnect_[index] = now + boost::posix_time::milliseconds(options_.retryBackoffMs);
+    }
+
+    // connect without holding the lock.
+    boost::shared_ptr<Connection> connection(new Connection(host_, port_));
+    boost::mutex::scoped_lock lock(connectionsMutex_);
+    retired_.push_back(connections_[index]);
+    connections_[index] = connection;
+    return connection;
+}
+
+bool MultiplexedClient::
+schedule(boost::system_time when, const Task& task)
+{
+    boost::mutex::scoped_lock lock(schedulerMutex_);
+    if (stopped_) {
+        return false;
+    }
+    tasks_.insert(std::make_pair(when, task));
+    schedulerCondition_.notify_one();
+    return true;
+}
+
+void MultiplexedClient::
+runScheduler()
+{
+    boost::posix_time::milliseconds interval(options_.timeoutMs > 0 ? 10 : 100);
+    while (true) {
+        std::vector<Task> due;
+        bool stopping;
+        {
+            boost::mutex::scoped_lock lock(schedulerMutex_);
+            boost::system_time wakeup = boost::get_system_time() + interval;
+            if (!tasks_.empty() && tasks_.begin()->first < wakeup) {
+                wakeup = tasks_.begin()->first;
+            }
+            if (!stopped_) {
+                schedulerCondition_.timed_wait(lock, wakeup);
+            }
+            std::multimap<boost::system_time, Task>::iterator end =
+                stopped_ ? tasks_.end() : tasks_.upper_bound(boost::get_system_time());
+            for (std::multimap<boost::system_time, Task>::iterator itr = tasks_.begin(); itr != end; itr++) {
+                due.push_back(itr->second);
+            }
+            tasks_.erase(tasks_.begin(), end);
+            stopping = stopped_;
+        }
+        for (size_t i = 0; i < due.size(); i++) {
+            due[i]();
+        }
+        if (options_.timeoutMs > 0) {
+            expireCalls(boost::get_system_time());
+        }
+        reapConnections();
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void MultiplexedClient::
+expireCalls(boost::system_time now)
+{
+    std::vector<boost::shared_ptr<Connection> > connections;
+    {
+        boost::mutex::scoped_lock lock(connectionsMutex_);
+        connections = connections_;
+        connections.insert(connections.end(), retired_.begin(), retired_.end());
+    }
+    for (size_t i = 0; i < connections.size(); i++) {
+        connections[i]->expire(now);
+    }
+}
+
+/**
+ * Deleting a connection joins its reader thread, which mustn't happen
+ * on the reader thread itself (e.g., in a callback), so only the
+ * scheduler deletes them.
+ */
+void MultiplexedClient::
+reapConnections()
+{
+    std::vector<boost::shared_ptr<Connection> > unused;
+    {
+        boost::mutex::scoped_lock lock(connectionsMutex_);
+        std::vector<boost::shared_ptr<Connection> >::iterator itr = retired_.begin();
+        while (itr != retired_.end()) {
+            if (itr->unique()) {
+                unused.push_back(*itr);
+                itr = retired_.erase(itr);
+            } else {
+                itr++;
+            }
+        }
+    }
+}
+
+bool MultiplexedClient::
+stopped()
+{
+    boost::mutex::scoped_lock lock(schedulerMutex_);
+    return stopped_;
+}
+
+void MultiplexedClient::
+flushGets(const std::string& mapName)
+{
+    GetBatch batch;
+    {
+        boost::mutex::scoped_lock lock(batchMutex_);
+        boost::unordered_map<std::string, GetBatch>::iterator itr = getBatches_.find(mapName);
+        if (itr == getBatches_.end()) {
+            return;
+        }
+        batch.keys.swap(itr->second.keys);
+        batch.promises.swap(itr->second.promises);
+        getBatches_.erase(itr);
+    }
+    sendGets(mapName, batch);
+}
+
+void MultiplexedClient::
+flushPuts(const std::string& mapName)
+{
+    PutBatch batch;
+    {
+        boost::mutex::scoped_lock lock(batchMutex_);
+        boost::unordered_map<std::string, PutBatch>::iterator itr = putBatches_.find(mapName);
+        if (itr == putBatches_.end()) {
+            return;
+        }
+        batch.records.swap(itr->second.records);
+        batch.promises.swap(itr->second.promises);
+        putBatches_.erase(itr);
+    }
+    sendPuts(mapName, batch);
+}
+
+void MultiplexedClient::
+sendGets(const std::string& mapName, GetBatch& batch)
+{
+    if (batch.keys.empty()) {
+        return;
+    }
+    multiGet(mapName, batch.keys).then(boost::bind(&completeBatch<BinaryResponse>, _1, batch.promises));
+}
+
+void MultiplexedClient::
+sendPuts(const std::string& mapName, PutBatch& batch)
+{
+    if (batch.records.empty()) {
+        return;
+    }
+    multiPut(mapName, batch.records).then(boost::bind(&completeBatch<ResponseCode::type>, _1, batch.promises));
+}
+
+Future<ResponseCode::type> MultiplexedClient::
+ping()
+{
+    return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_ping, _1),
+                                    boost::bind(&receiveResponseCode, &MapKeeperClient::recv_ping, _1, _2), true);
+}
+
+Future<ResponseCode::type> MultiplexedClient::
+addMap(const std::string& mapName)
+{
+    return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_addMap, _1, mapName),
+                                    boost::bind(&receiveResponseCode, &MapKeeperClient::recv_addMap, _1, _2), false);
+}
+
+Future<ResponseCode::type> MultiplexedClient::
+dropMap(const std::string& mapName)
+{
+    return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_dropMap, _1, mapName),
+                                    boost::bind(&receiveResponseCode, &MapKeeperClient::recv_dropMap, _1, _2), false);
+}
+
+Future<StringListResponse> MultiplexedClient::
+listMaps()
+{
+    return call<StringListResponse>(boost::bind(&MapKeeperClient::send_listMaps, _1),
+                                    boost::bind(&MapKeeperClient::recv_listMaps, _1, _2), true);
+}
+
+Future<RecordListResponse> MultiplexedClient::
+scan(const std::string& mapName, const ScanOrder::type order,
+     const std::string& startKey, const bool startKeyIncluded,
+     const std::string& endKey, const bool endKeyIncluded,
+     const int32_t maxRecords, const int32_t maxBytes)
+{
+    return call<RecordListResponse>(boost::bind(&MapKeeperClient::send_scan, _1, mapName, order,
+                                                startKey, startKeyIncluded, endKey, endKeyIncluded,
+                                                maxRecords, maxBytes),
+                                    boost::bind(&MapKeeperClient::recv_scan, _1, _2), true);
+}
+
+Future<RecordListResponse> MultiplexedClient::
+scanWithOptions(const std::string& mapName, const ScanOrder::type order,
+                const std::string& startKey, const bool startKeyIncluded,
+                const std::string& endKey, const bool endKeyIncluded,
+                const int32_t maxRecords, const int32_t maxBytes,
+                const ScanOptions& options)
+{
+    ScanWithOptionsSender sender;
+    sender.mapName = mapName;
+    sender.order = order;
+    sender.startKey = startKey;
+    sender.startKeyIncluded = startKeyIncluded;
+    sender.endKey = endKey;
+    sender.endKeyIncluded = endKeyIncluded;
+    sender.maxRecords = maxRecords;
+    sender.maxBytes = maxBytes;
+    sender.options = options;
+    sender.packed = false;
+    return call<RecordListResponse>(sender,
+                                    boost::bind(&MapKeeperClient::recv_scanWithOptions, _1, _2), true);
+}
+
+Future<PackedRecordListResponse> MultiplexedClient::
+scanPacked(const std::string& mapName, const ScanOrder::type order,
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes,
+           const ScanOptions& options)
+{
+    ScanWithOptionsSender sender;
+    sender.mapName = mapName;
+    sender.order = order;
+    sender.startKey = startKey;
+    sender.startKeyIncluded = startKeyIncluded;
+    sender.endKey = endKey;
+    sender.endKeyIncluded = endKeyIncluded;
+    sender.maxRecords = maxRecords;
+    sender.maxBytes = maxBytes;
+    sender.options = options;
+    sender.packed = true;
+    return call<PackedRecordListResponse>(sender,
+                                          boost::bind(&MapKeeperClient::recv_scanPacked, _1, _2), true);
+}
+
+/**
+ * Adds the key to the map's batch, and sends the batch if it's full. The
+ * first key in a batch schedules sending it after batchWindowUs.
+ */
+Future<BinaryResponse> MultiplexedClient::
+get(const std::string& mapName, const std::string& key)
+{
+    if (options_.batchWindowUs == 0) {
+        return call<BinaryResponse>(boost::bind(&MapKeeperClient::send_get, _1, mapName, key),
+                                    boost::bind(&MapKeeperClient::recv_get, _1, _2), true);
+    }
+    Promise<BinaryResponse> promise;
+    GetBatch full;
+    bool first;
+    {
+        boost::mutex::scoped_lock lock(batchMutex_);
+        GetBatch& batch = getBatches_[mapName];
+        first = batch.keys.empty();
+        batch.keys.push_back(key);
+        batch.promises.push_back(promise);
+        batch.bytes += key.size();
+        if (batch.keys.size() >= options_.maxBatchSize || batch.bytes >= options_.maxBatchBytes) {
+            full.keys.swap(batch.keys);
+            full.promises.swap(batch.promises);
+            getBatches_.erase(mapName);
+        }
+    }
+    if (!full.keys.empty()) {
+        sendGets(mapName, full);
+    } else if (first) {
+        boost::system_time when = boost::get_system_time() +
+                                  boost::posix_time::microseconds(options_.batchWindowUs);
+        if (!schedule(when, boost::bind(&MultiplexedClient::flushGets, this, mapName))) {
+            flushGets(mapName);
+        }
+    }
+    return promise.getFuture();
+}
+
+Future<BinaryResponse> MultiplexedClient::
+getRange(const std::string& mapName, const std::string& key, const int64_t offset, const int32_t length)
+{
+    return call<BinaryResponse>(boost::bind(&MapKeeperClient::send_getRange, _1, mapName, key, offset, length),
+                                boost::bind(&MapKeeperClient::recv_getRange, _1, _2), true);
+}
+
+/**
+ * Batched like get(), except for values too big to share a batch.
+ */
+Future<ResponseCode::type> MultiplexedClient::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    size_t bytes = key.size() + value.size();
+    if (options_.batchWindowUs == 0 || bytes >= options_.maxBatchBytes) {
+        return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_put, _1, mapName, key, value),
+                                        boost::bind(&receiveResponseCode, &MapKeeperClient::recv_put, _1, _2), true);
+    }
+    Promise<ResponseCode::type> promise;
+    PutBatch full;
+    bool first;
+    {
+        boost::mutex::scoped_lock lock(batchMutex_);
+        PutBatch& batch = putBatches_[mapName];
+        first = batch.records.empty();
+        batch.records.push_back(Record());
+        batch.records.back().key = key;
+        batch.records.back().value = value;
+        batch.promises.push_back(promise);
+        batch.bytes += bytes;
+        if (batch.records.size() >= options_.maxBatchSize || batch.bytes >= options_.maxBatchBytes) {
+            full.records.swap(batch.records);
+            full.promises.swap(batch.promises);
+            putBatches_.erase(mapName);
+        }
+    }
+    if (!full.records.empty()) {
+        sendPuts(mapName, full);
+    } else if (first) {
+        boost::system_time when = boost::get_system_time() +
+                                  boost::posix_time::microseconds(options_.batchWindowUs);
+        if (!schedule(when, boost::bind(&MultiplexedClient::flushPuts, this, mapName))) {
+            flushPuts(mapName);
+        }
+    }
+    return promise.getFuture();
+}
+
+Future<ResponseCode::type> MultiplexedClient::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_insert, _1, mapName, key, value),
+                                    boost::bind(&receiveResponseCode, &MapKeeperClient::recv_insert, _1, _2), false);
+}
+
+Future<ResponseCode::type> MultiplexedClient::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_update, _1, mapName, key, value),
+                                    boost::bind(&receiveResponseCode, &MapKeeperClient::recv_update, _1, _2), true);
+}
+
+Future<ResponseCode::type> MultiplexedClient::
+putChunk(const std::string& mapName, const std::string& key, const int64_t offset,
+         const std::string& data, const bool last)
+{
+    return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_putChunk, _1, mapName, key, offset, data, last),
+                                    boost::bind(&receiveResponseCode, &MapKeeperClient::recv_putChunk, _1, _2), false);
+}
+
+Future<ResponseCode::type> MultiplexedClient::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_append, _1, mapName, key, data),
+                                    boost::bind(&receiveResponseCode, &MapKeeperClient::recv_append, _1, _2), false);
+}
+
+Future<ResponseCode::type> MultiplexedClient::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset, const std::string& data)
+{
+    return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_writeAt, _1, mapName, key, offset, data),
+                                    boost::bind(&receiveResponseCode, &MapKeeperClient::recv_writeAt, _1, _2), true);
+}
+
+Future<ResponseCode::type> MultiplexedClient::
+remove(const std::string& mapName, const std::string& key)
+{
+    return call<ResponseCode::type>(boost::bind(&MapKeeperClient::send_remove, _1, mapName, key),
+                                    boost::bind(&receiveResponseCode, &MapKeeperClient::recv_remove, _1, _2), false);
+}
+
+Future<std::vector<BinaryResponse> > MultiplexedClient::
+multiGet(const std::string& mapName, const std::vector<std::string>& keys)
+{
+    return call<std::vector<BinaryResponse> >(boost::bind(&MapKeeperClient::send_multiGet, _1, mapName, keys),
+                                              boost::bind(&MapKeeperClient::recv_multiGet, _1, _2), true);
+}
+
+Future<std::vector<ResponseCode::type> > MultiplexedClient::
+multiPut(const std::string& mapName, const std::vector<Record>& records)
+{
+    return call<std::vector<ResponseCode::type> >(boost::bind(&MapKeeperClient::send_multiPut, _1, mapName, records),
+                                                  boost::bind(&MapKeeperClient::recv_multiPut, _1, _2), true);
+}
+
+Future<std::vector<ResponseCode::type> > MultiplexedClient::
+multiInsert(const std::string& mapName, const std::vector<Record>& records)
+{
+    return call<std::vector<ResponseCode::type> >(boost::bind(&MapKeeperClient::send_multiInsert, _1, mapName, records),
+                                                  boost::bind(&MapKeeperClient::recv_multiInsert, _1, _2), false);
+}
+
+Future<std::vector<ResponseCode::type> > MultiplexedClient::
+multiUpdate(const std::string& mapName, const std::vector<Record>& records)
+{
+    return call<std::vector<ResponseCode::type> >(boost::bind(&MapKeeperClient::send_multiUpdate, _1, mapName, records),
+                                                  boost::bind(&MapKeeperClient::recv_multiUpdate, _1, _2), true);
+}
+
+Future<std::vector<ResponseCode::type> > MultiplexedClient::
+multiRemove(const std::string& mapName, const std::vector<std::string>& keys)
+{
+    return call<std::vector<ResponseCode::type> >(boost::bind(&MapKeeperClient::send_multiRemove, _1, mapName, keys),
+                                                  boost::bind(&MapKeeperClient::recv_multiRemove, _1, _2), false);
+}
+
+Future<StatsResponse> MultiplexedClient::
+getStats()
+{
+    return call<StatsResponse>(boost::bind(&MapKeeperClient::send_getStats, _1),
+                               boost::bind(&MapKeeperClient::recv_getStats, _1, _2), true);
+}
+
+Future<BinaryListResponse> MultiplexedClient::
+getSplitKeys(const std::string& mapName, const std::string& startKey, const std::string& endKey,
+             const int32_t numSplits)
+{
+    return call<BinaryListResponse>(boost::bind(&MapKeeperClient::send_getSplitKeys, _1, mapName,
+                                                startKey, endKey, numSplits),
+                                    boost::bind(&MapKeeperClient::recv_getSplitKeys, _1, _2), true);
+}
+
+Future<EstimateResponse> MultiplexedClient::
+estimateCount(const std::string& mapName, const std::string& startKey, const std::string& endKey,
+              const bool exact)
+{
+    return call<EstimateResponse>(boost::bind(&MapKeeperClient::send_estimateCount, _1, mapName,
+                                              startKey, endKey, exact),
+                                  boost::bind(&MapKeeperClient::recv_estimateCount, _1, _2), true);
+}
+
+Future<EstimateResponse> MultiplexedClient::
+estimateSize(const std::string& mapName, const std::string& startKey, const std::string& endKey,
+             const bool exact)
+{
+    return call<EstimateResponse>(boost::bind(&MapKeeperClient::send_estimateSize, _1, mapName,
+                                              startKey, endKey, exact),
+                                  boost::bind(&MapKeeperClient::recv_estimateSize, _1, _2), true);
+}
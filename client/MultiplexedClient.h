@@ -0,0 +1,291 @@
+#ifndef MAPKEEPER_MULTIPLEXED_CLIENT_H
+#define MAPKEEPER_MULTIPLEXED_CLIENT_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <boost/unordered_map.hpp>
+#include <transport/TBufferTransports.h>
+#include "MapKeeper.h"
+#include "Future.h"
+
+/**
+ * An asynchronous MapKeeper client that lets any number of threads share
+ * a small pool of connections.
+ *
+ * Every call returns a future right away. Calls are tagged with a
+ * request id (see common/MultiplexedFrame.h) and spread round-robin over
+ * the connections, so many of them can be in flight on each connection
+ * and the server answers each one as soon as it's done, in any order.
+ * One reader thread per connection completes the futures.
+ *
+ * The server has to run with --server=epoll; the thread-per-connection
+ * server only understands plain frames.
+ *
+ * If a connection breaks, the calls in flight on it are retried on
+ * another connection, up to maxRetries times, waiting retryBackoffMs
+ * before the first retry and twice as long before each following one.
+ * Broken connections are reopened when they come up in the rotation, at
+ * most once per retryBackoffMs. Only calls that can safely be sent
+ * twice are retried: insert, remove, addMap, dropMap, multiInsert and
+ * multiRemove fail instead, since a retry could report RecordExists
+ * (or RecordNotFound, ...) for a change the first attempt made.
+ *
+ * With timeoutMs set, a call that isn't done within timeoutMs, retries
+ * included, fails with "deadline exceeded"; a late response is dropped.
+ *
+ * With batchWindowUs set, gets and puts on the same map issued within
+ * batchWindowUs of each other are sent as one multiGet or multiPut of up
+ * to maxBatchSize keys or maxBatchBytes bytes, which saves round trips
+ * and server work for small records at the cost of up to batchWindowUs
+ * of latency.
+ *
+ * Retries, deadlines and batch flushes run on a scheduler thread. Future
+ * callbacks run on the reader and scheduler threads, so they shouldn't
+ * block.
+ */
+class MultiplexedClient {
+public:
+    struct Options {
+        Options();
+        uint32_t numConnections;  // default 2
+        uint32_t timeoutMs;       // default 0 (no deadline)
+        uint32_t maxRetries;      // default 2
+        uint32_t retryBackoffMs;  // default 10
+        uint32_t batchWindowUs;   // default 0 (no batching)
+        uint32_t maxBatchSize;    // default 64
+        uint32_t maxBatchBytes;   // default 64KB
+    };
+
+    MultiplexedClient(const std::string& host, uint16_t port, uint32_t numConnections);
+    MultiplexedClient(const std::string& host, uint16_t port, const Options& options);
+
+    /**
+     * Fails the calls that are still in flight.
+     */
+    ~MultiplexedClient();
+
+    Future<mapkeeper::ResponseCode::type> ping();
+    Future<mapkeeper::ResponseCode::type> addMap(const std::string& mapName);
+    Future<mapkeeper::ResponseCode::type> dropMap(const std::string& mapName);
+    Future<mapkeeper::StringListResponse> listMaps();
+    Future<mapkeeper::RecordListResponse> scan(const std::string& mapName,
+                                               const mapkeeper::ScanOrder::type order,
+                                               const std::string& startKey, const bool startKeyIncluded,
+                                               const std::string& endKey, const bool endKeyIncluded,
+                                               const int32_t maxRecords, const int32_t maxBytes);
+    Future<mapkeeper::RecordListResponse> scanWithOptions(const std::string& mapName,
+                                                          const mapkeeper::ScanOrder::type order,
+                                                          const std::string& startKey, const bool startKeyIncluded,
+                                                          const std::string& endKey, const bool endKeyIncluded,
+                                                          const int32_t maxRecords, const int32_t maxBytes,
+                                                          const mapkeeper::ScanOptions& options);
+    /**
+     * Records come back packed into one buffer; read them with
+     * PackedRecordReader.
+     */
+    Future<mapkeeper::PackedRecordListResponse> scanPacked(const std::string& mapName,
+                                                           const mapkeeper::ScanOrder::type order,
+                                                           const std::string& startKey, const bool startKeyIncluded,
+                                                           const std::string& endKey, const bool endKeyIncluded,
+                                                           const int32_t maxRecords, const int32_t maxBytes,
+                                                           const mapkeeper::ScanOptions& options);
+    Future<mapkeeper::BinaryResponse> get(const std::string& mapName, const std::string& key);
+
+    /**
+     * Never batched. A large value downloads fastest with the ranges of
+     * several chunks in flight at once.
+     */
+    Future<mapkeeper::BinaryResponse> getRange(const std::string& mapName, const std::string& key,
+                                               const int64_t offset, const int32_t length);
+    Future<mapkeeper::ResponseCode::type> put(const std::string& mapName, const std::string& key,
+                                              const std::string& value);
+    Future<mapkeeper::ResponseCode::type> insert(const std::string& mapName, const std::string& key,
+                                                 const std::string& value);
+    Future<mapkeeper::ResponseCode::type> update(const std::string& mapName, const std::string& key,
+                                                 const std::string& value);
+
+    /**
+     * Isn't retried. Since calls on different connections may reach the
+     * server in any order, send each piece of an upload once the one
+     * before it is done.
+     */
+    Future<mapkeeper::ResponseCode::type> putChunk(const std::string& mapName, const std::string& key,
+                                                   const int64_t offset, const std::string& data,
+                                                   const bool last);
+
+    /**
+     * Isn't retried, since a retried append could add data twice.
+     * writeAt() is.
+     */
+    Future<mapkeeper::ResponseCode::type> append(const std::string& mapName, const std::string& key,
+                                                 const std::string& data);
+    Future<mapkeeper::ResponseCode::type> writeAt(const std::string& mapName, const std::string& key,
+                                                  const int64_t offset, const std::string& data);
+    Future<mapkeeper::ResponseCode::type> remove(const std::string& mapName, const std::string& key);
+    Future<std::vector<mapkeeper::BinaryResponse> > multiGet(const std::string& mapName,
+                                                             const std::vector<std::string>& keys);
+    Future<std::vector<mapkeeper::ResponseCode::type> > multiPut(const std::string& mapName,
+                                                                 const std::vector<mapkeeper::Record>& records);
+    Future<std::vector<mapkeeper::ResponseCode::type> > multiInsert(const std::string& mapName,
+                                                                    const std::vector<mapkeeper::Record>& records);
+    Future<std::vector<mapkeeper::ResponseCode::type> > multiUpdate(const std::string& mapName,
+                                                                    const std::vector<mapkeeper::Record>& records);
+    Future<std::vector<mapkeeper::ResponseCode::type> > multiRemove(const std::string& mapName,
+                                                                    const std::vector<std::string>& keys);
+    Future<mapkeeper::StatsResponse> getStats();
+    Future<mapkeeper::BinaryListResponse> getSplitKeys(const std::string& mapName,
+                                                       const std::string& startKey,
+                                                       const std::string& endKey,
+                                                       const int32_t numSplits);
+    Future<mapkeeper::EstimateResponse> estimateCount(const std::string& mapName,
+                                                      const std::string& startKey,
+                                                      const std::string& endKey, const bool exact);
+    Future<mapkeeper::EstimateResponse> estimateSize(const std::string& mapName,
+                                                     const std::string& startKey,
+                                                     const std::string& endKey, const bool exact);
+
+private:
+    typedef boost::function<void (mapkeeper::MapKeeperClient&)> Sender;
+    typedef boost::function<void ()> Task;
+
+    /**
+     * A call waiting for its response.
+     */
+    class PendingCall {
+    public:
+        PendingCall(boost::system_time deadline) :
+            deadline(deadline) {
+        }
+        virtual ~PendingCall() {}
+
+        /**
+         * Reads the response from client.
+         */
+        virtual void complete(mapkeeper::MapKeeperClient& client) = 0;
+
+        /**
+         * Called when the call couldn't be sent, the connection broke
+         * or the deadline passed. The call may be retried.
+         */
+        virtual void fail(const std::string& error) = 0;
+
+        const boost::system_time deadline;
+    };
+
+    template <class T> class Call;
+
+    class Connection {
+    public:
+        Connection(const std::string& host, uint16_t port);
+        ~Connection();
+        bool broken();
+
+        /**
+         * Serializes a request with sender and sends it. call gets the
+         * response, and is deleted afterwards.
+         */
+        void send(const Sender& sender, PendingCall* call);
+
+        /**
+         * Fails the calls whose deadline is before now.
+         */
+        void expire(boost::system_time now);
+
+    private:
+        bool connect(const std::string& host, uint16_t port);
+        bool writeFully(const std::string& data);
+        bool readFully(char* data, size_t size);
+        void run();
+        PendingCall* take(uint32_t requestId);
+        void failAll(const std::string& error);
+
+        int fd_;
+        boost::mutex writeMutex_;  // protects the fields used to send
+        uint32_t nextId_;
+        boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> sendBuffer_;
+        boost::scoped_ptr<mapkeeper::MapKeeperClient> sendClient_;
+        std::string frame_;
+
+        boost::mutex mutex_;      // protects pending_, broken_ and error_
+        boost::unordered_map<uint32_t, PendingCall*> pending_;
+        bool broken_;
+        std::string error_;
+
+        // only used by the reader thread.
+        boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> recvBuffer_;
+        boost::scoped_ptr<mapkeeper::MapKeeperClient> recvClient_;
+        boost::scoped_ptr<boost::thread> reader_;
+    };
+
+    /**
+     * Gets or puts on one map waiting to be sent together.
+     */
+    struct GetBatch {
+        GetBatch() : bytes(0) {}
+        std::vector<std::string> keys;
+        std::vector<Promise<mapkeeper::BinaryResponse> > promises;
+        size_t bytes;
+    };
+
+    struct PutBatch {
+        PutBatch() : bytes(0) {}
+        std::vector<mapkeeper::Record> records;
+        std::vector<Promise<mapkeeper::ResponseCode::type> > promises;
+        size_t bytes;
+    };
+
+    void init();
+    template <class T>
+    Future<T> call(const Sender& sender,
+                   const boost::function<void (mapkeeper::MapKeeperClient&, T&)>& receiver,
+                   bool retryable);
+    void send(const Sender& sender, PendingCall* call);
+    boost::shared_ptr<Connection> pickConnection();
+
+    /**
+     * Runs task on the scheduler thread at the given time. Returns
+     * false if the client is shutting down.
+     */
+    bool schedule(boost::system_time when, const Task& task);
+    void runScheduler();
+    void expireCalls(boost::system_time now);
+    void reapConnections();
+    bool stopped();
+
+    void flushGets(const std::string& mapName);
+    void flushPuts(const std::string& mapName);
+    void sendGets(const std::string& mapName, GetBatch& batch);
+    void sendPuts(const std::string& mapName, PutBatch& batch);
+
+    std::string host_;
+    uint16_t port_;
+    Options options_;
+
+    boost::mutex connectionsMutex_; // protects the fields below
+    std::vector<boost::shared_ptr<Connection> > connections_;
+    std::vector<boost::system_time> nextReconnect_;
+    // replaced connections, to be deleted by the scheduler thread once
+    // nobody uses them.
+    std::vector<boost::shared_ptr<Connection> > retired_;
+    uint32_t nextConnection_;
+
+    boost::mutex batchMutex_;       // protects the batches
+    boost::unordered_map<std::string, GetBatch> getBatches_;
+    boost::unordered_map<std::string, PutBatch> putBatches_;
+
+    boost::mutex schedulerMutex_;   // protects tasks_ and stopped_
+    boost::condition_variable schedulerCondition_;
+    std::multimap<boost::system_time, Task> tasks_;
+    bool stopped_;
+    boost::scoped_ptr<boost::thread> scheduler_;
+};
+
+#endif // MAPKEEPER_MULTIPLEXED_CLIENT_H
@@ -1,9 +1,16 @@
 /**
  * A sample client.
  */
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
 #include <cassert>
+#include <cstring>
 #include "MapKeeper.h"
+#include "MultiplexedClient.h"
+#include "PackedRecords.h"
+#include "ShardedClient.h"
+#include "ValueCodec.h"
 #include <protocol/TBinaryProtocol.h>
 #include <transport/TServerSocket.h>
 #include <transport/TSocket.h>
@@ -111,7 +118,537 @@ void testScan(mapkeeper::MapKeeperClient& client) {
     assert(mapkeeper::ResponseCode::Success == client.dropMap("scan_test"));
 }
 
+/**
+ * Scans a map whose smallest key is the empty string in descending
+ * order. The 16 records fill MySqlClient's first page exactly, so the
+ * scan has to continue below "" rather than start over from the top.
+ */
+void testScanEmptyKey(mapkeeper::MapKeeperClient& client) {
+    std::string mapName("empty_key_scan_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "", "empty"));
+    for (int i = 10; i < 25; i++) {
+        std::string key = "key" + boost::lexical_cast<std::string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, "val"));
+    }
+
+    mapkeeper::RecordListResponse scanResponse;
+    client.scan(scanResponse, mapName, mapkeeper::ScanOrder::Descending, "", true, "", true, 1000, 1000000);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 16);
+    assert(scanResponse.records[0].key == "key24");
+    assert(scanResponse.records[15].key == "");
+    assert(scanResponse.records[15].value == "empty");
+
+    // the last page holds just the empty key.
+    client.scan(scanResponse, mapName, mapkeeper::ScanOrder::Descending, "", true, "key10", false, 1, 1000000);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success ||
+           scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 1);
+    assert(scanResponse.records[0].key == "");
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testMulti(mapkeeper::MapKeeperClient& client) {
+    std::string mapName("multi_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    std::vector<mapkeeper::Record> records;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 10; i++) {
+        mapkeeper::Record record;
+        record.key = "key" + boost::lexical_cast<std::string>(i);
+        record.value = "val" + boost::lexical_cast<std::string>(i);
+        records.push_back(record);
+        keys.push_back(record.key);
+    }
+    keys.push_back("missing");
+
+    std::vector<mapkeeper::ResponseCode::type> results;
+    client.multiInsert(results, mapName, records);
+    assert(results.size() == 10);
+    for (int i = 0; i < 10; i++) {
+        assert(results[i] == mapkeeper::ResponseCode::Success);
+    }
+    client.multiInsert(results, mapName, records);
+    for (int i = 0; i < 10; i++) {
+        assert(results[i] == mapkeeper::ResponseCode::RecordExists);
+    }
+
+    std::vector<mapkeeper::BinaryResponse> values;
+    client.multiGet(values, mapName, keys);
+    assert(values.size() == 11);
+    for (int i = 0; i < 10; i++) {
+        assert(values[i].responseCode == mapkeeper::ResponseCode::Success);
+        assert(values[i].value == records[i].value);
+    }
+    assert(values[10].responseCode == mapkeeper::ResponseCode::RecordNotFound);
+
+    for (int i = 0; i < 10; i++) {
+        records[i].value = "new" + boost::lexical_cast<std::string>(i);
+    }
+    client.multiUpdate(results, mapName, records);
+    for (int i = 0; i < 10; i++) {
+        assert(results[i] == mapkeeper::ResponseCode::Success);
+    }
+    client.multiGet(values, mapName, keys);
+    for (int i = 0; i < 10; i++) {
+        assert(values[i].value == records[i].value);
+    }
+
+    client.multiRemove(results, mapName, keys);
+    assert(results.size() == 11);
+    for (int i = 0; i < 10; i++) {
+        assert(results[i] == mapkeeper::ResponseCode::Success);
+    }
+    assert(results[10] == mapkeeper::ResponseCode::RecordNotFound);
+    client.multiGet(values, mapName, keys);
+    for (int i = 0; i < 11; i++) {
+        assert(values[i].responseCode == mapkeeper::ResponseCode::RecordNotFound);
+    }
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+/**
+ * Needs a server running with --server=epoll.
+ */
+void testMultiplexed() {
+    MultiplexedClient::Options options;
+    options.timeoutMs = 1000;
+    options.batchWindowUs = 200;
+    MultiplexedClient client("localhost", 9090, options);
+    std::string mapName("multiplexed_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName).get());
+
+    // all the calls are in flight at once over the two connections, and
+    // the gets go out in multiGet batches.
+    std::vector<Future<mapkeeper::ResponseCode::type> > inserts;
+    for (int i = 0; i < 100; i++) {
+        std::string key = "key" + boost::lexical_cast<std::string>(i);
+        std::string val = "val" + boost::lexical_cast<std::string>(i);
+        inserts.push_back(client.insert(mapName, key, val));
+    }
+    for (int i = 0; i < 100; i++) {
+        assert(inserts[i].get() == mapkeeper::ResponseCode::Success);
+    }
+    Future<mapkeeper::RecordListResponse> scan =
+        client.scan(mapName, ScanOrder::Ascending, "", true, "", true, 1000, 100000);
+    std::vector<Future<mapkeeper::BinaryResponse> > gets;
+    for (int i = 0; i < 100; i++) {
+        gets.push_back(client.get(mapName, "key" + boost::lexical_cast<std::string>(i)));
+    }
+    for (int i = 0; i < 100; i++) {
+        assert(gets[i].get().responseCode == mapkeeper::ResponseCode::Success);
+        assert(gets[i].get().value == "val" + boost::lexical_cast<std::string>(i));
+    }
+    assert(scan.get().records.size() == 100);
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName).get());
+}
+
+/**
+ * Needs a server running with --server=epoll at each of servers.
+ */
+void testSharded(const std::vector<std::string>& servers) {
+    MultiplexedClient::Options options;
+    options.timeoutMs = 1000;
+    ShardedClient client(servers, 64, options);
+    std::string mapName("sharded_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    std::vector<Record> records;
+    for (int i = 0; i < 100; i++) {
+        Record record;
+        record.key = "key" + boost::lexical_cast<std::string>(100 + i);
+        record.value = "val" + boost::lexical_cast<std::string>(i);
+        records.push_back(record);
+    }
+    std::vector<mapkeeper::ResponseCode::type> results;
+    client.multiInsert(results, mapName, records);
+    assert(results.size() == 100);
+    for (int i = 0; i < 100; i++) {
+        assert(results[i] == mapkeeper::ResponseCode::Success);
+    }
+
+    std::vector<std::string> keys;
+    keys.push_back("key150");
+    keys.push_back("key100");
+    keys.push_back("nokey");
+    std::vector<mapkeeper::BinaryResponse> values;
+    client.multiGet(values, mapName, keys);
+    assert(values.size() == 3);
+    assert(values[0].value == "val50");
+    assert(values[1].value == "val0");
+    assert(values[2].responseCode == mapkeeper::ResponseCode::RecordNotFound);
+
+    // the merged scan comes back in order whatever server owns each key.
+    mapkeeper::RecordListResponse scanResponse;
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "key110", true, "", true, 10, 0);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(scanResponse.records.size() == 10);
+    for (int i = 0; i < 10; i++) {
+        assert(scanResponse.records[i].key == "key" + boost::lexical_cast<std::string>(110 + i));
+    }
+    client.scan(scanResponse, mapName, ScanOrder::Descending, "", true, "key189", false, 1000, 0);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 89);
+    for (int i = 0; i < 89; i++) {
+        assert(scanResponse.records[i].key == "key" + boost::lexical_cast<std::string>(188 - i));
+    }
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testEstimates(mapkeeper::MapKeeperClient& client) {
+    std::string mapName("estimate_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 100; i++) {
+        std::string key = "key" + boost::lexical_cast<std::string>(100 + i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, "value"));
+    }
+    mapkeeper::EstimateResponse estimate;
+    client.estimateCount(estimate, mapName, "", "", true);
+    assert(estimate.responseCode == mapkeeper::ResponseCode::Success);
+    assert(estimate.exact);
+    assert(estimate.value == 100);
+    client.estimateCount(estimate, mapName, "key110", "key120", true);
+    assert(estimate.value == 10);
+    client.estimateSize(estimate, mapName, "key110", "key120", true);
+    assert(estimate.value == 10 * (6 + 5));
+    client.estimateCount(estimate, mapName, "", "", false);
+    assert(estimate.responseCode == mapkeeper::ResponseCode::Success);
+    client.estimateCount(estimate, "no_such_map", "", "", false);
+    assert(estimate.responseCode == mapkeeper::ResponseCode::MapNotFound);
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testScanOptions(mapkeeper::MapKeeperClient& client) {
+    std::string mapName("scan_options_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 10; i++) {
+        std::string key = "key" + boost::lexical_cast<std::string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, "value" + boost::lexical_cast<std::string>(i)));
+    }
+    mapkeeper::RecordListResponse scanResponse;
+    mapkeeper::ScanOptions options;
+    options.keysOnly = true;
+    client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 0, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 10);
+    for (int i = 0; i < 10; i++) {
+        assert(scanResponse.records[i].key == "key" + boost::lexical_cast<std::string>(i));
+        assert(scanResponse.records[i].value.empty());
+    }
+
+    // maxBytes counts the returned bytes: 4 records of 4 + 2 bytes.
+    options.keysOnly = false;
+    options.valueOffset = 3;
+    options.valueLength = 2;
+    client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 24, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(scanResponse.records.size() == 4);
+    for (int i = 0; i < 4; i++) {
+        assert(scanResponse.records[i].value == "ue");
+    }
+    options.valueOffset = 5;
+    options.valueLength = -1;
+    client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Descending, "key7", true, "", true, 1000, 0, options);
+    assert(scanResponse.records.size() == 3);
+    assert(scanResponse.records[0].value == "9");
+    options.valueOffset = 100;
+    client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1, 0, options);
+    assert(scanResponse.records.size() == 1);
+    assert(scanResponse.records[0].value.empty());
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testScanFilters(mapkeeper::MapKeeperClient& client) {
+    std::string mapName("scan_filter_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 100; i++) {
+        std::string key = (i % 2 ? "a" : "b") + boost::lexical_cast<std::string>(100 + i);
+        std::string value = i % 10 == 0 ? "marked" : "plain";
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, value));
+    }
+    mapkeeper::RecordListResponse scanResponse;
+    mapkeeper::ScanOptions options;
+    options.keyPrefix = "b1";
+    client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 0, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 50);
+    assert(scanResponse.records[0].key == "b100");
+
+    options.keyPrefix = "";
+    options.keyRegex = "^a1[0-4]";
+    client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Descending, "", true, "", true, 1000, 0, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 25);
+    assert(scanResponse.records[0].key == "a149");
+
+    options.keyRegex = "";
+    mapkeeper::ValueFilter filter;
+    filter.op = mapkeeper::CompareOp::Contains;
+    filter.operand = "mark";
+    options.valueFilters.push_back(filter);
+    options.keysOnly = true;
+    client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 0, options);
+    assert(scanResponse.records.size() == 10);
+    assert(scanResponse.records[0].key == "b100");
+    assert(scanResponse.records[0].value.empty());
+
+    // with a budget of 30 records, the scan resumes from resumeKey.
+    options.maxExamined = 30;
+    std::string startKey;
+    bool startKeyIncluded = true;
+    size_t numRecords = 0;
+    int numScans = 0;
+    do {
+        client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Ascending, startKey, startKeyIncluded, "", true, 1000, 0, options);
+        assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success ||
+               scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+        numRecords += scanResponse.records.size();
+        startKey = scanResponse.resumeKey;
+        startKeyIncluded = false;
+        numScans++;
+    } while (scanResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(numRecords == 10);
+    assert(numScans == 4);
+
+    options.keyRegex = "(";
+    client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 0, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::Error);
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+/**
+ * Reads scanPacked() responses in place and compares them with
+ * scanWithOptions().
+ */
+void testScanPacked(mapkeeper::MapKeeperClient& client) {
+    std::string mapName("scan_packed_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 10; i++) {
+        std::string key = "key" + boost::lexical_cast<std::string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, "value" + boost::lexical_cast<std::string>(i)));
+    }
+    mapkeeper::RecordListResponse scanResponse;
+    mapkeeper::PackedRecordListResponse packedResponse;
+    mapkeeper::ScanOptions options;
+    client.scanWithOptions(scanResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 0, options);
+    client.scanPacked(packedResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 0, options);
+    assert(packedResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    PackedRecordReader reader(packedResponse.records);
+    assert(reader.valid());
+    assert(reader.size() == scanResponse.records.size());
+    for (size_t i = 0; reader.next(); i++) {
+        assert(std::string(reader.key(), reader.keySize()) == scanResponse.records[i].key);
+        assert(std::string(reader.value(), reader.valueSize()) == scanResponse.records[i].value);
+    }
+
+    client.scanPacked(packedResponse, mapName, mapkeeper::ScanOrder::Descending, "", true, "", true, 3, 0, options);
+    assert(packedResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(packedResponse.resumeKey == "key7");
+    PackedRecordReader page(packedResponse.records);
+    assert(page.size() == 3);
+    assert(page.next());
+    assert(std::string(page.key(), page.keySize()) == "key9");
+
+    options.keysOnly = true;
+    client.scanPacked(packedResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 0, options);
+    PackedRecordReader keys(packedResponse.records);
+    assert(keys.size() == 10);
+    while (keys.next()) {
+        assert(keys.valueSize() == 0);
+    }
+
+    // with shared key prefixes, "key0" takes 4 bytes and each later key
+    // 1 byte, so 8 bytes fit 5 keys.
+    options.sharedKeyPrefixes = true;
+    client.scanPacked(packedResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 8, options);
+    assert(packedResponse.responseCode == mapkeeper::ResponseCode::Success);
+    PackedRecordReader shared(packedResponse.records);
+    assert(shared.valid());
+    assert(shared.size() == 5);
+    for (int i = 0; shared.next(); i++) {
+        assert(std::string(shared.key(), shared.keySize()) == "key" + boost::lexical_cast<std::string>(i));
+    }
+
+    // servers only compress the values of maps they're told to
+    // (--compress), and say so in the response.
+    options = mapkeeper::ScanOptions();
+    options.compressedValues = true;
+    client.scanPacked(packedResponse, mapName, mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 0, options);
+    PackedRecordReader compressed(packedResponse.records);
+    assert(compressed.valid());
+    assert(compressed.size() == scanResponse.records.size());
+    ValueCodec codec(ValueCodec::ZLIB, 6, 0, "");
+    std::string value;
+    for (size_t i = 0; compressed.next(); i++) {
+        value.assign(compressed.value(), compressed.valueSize());
+        if (compressed.compressedValues()) {
+            assert(codec.decode(compressed.value(), compressed.valueSize(), value));
+        }
+        assert(value == scanResponse.records[i].value);
+    }
+    client.scanPacked(packedResponse, "no_such_map", mapkeeper::ScanOrder::Ascending, "", true, "", true, 1000, 0, options);
+    assert(packedResponse.responseCode == mapkeeper::ResponseCode::MapNotFound);
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+/**
+ * Scans [startKey, endKey) of the map in pages on a connection of its
+ * own, and adds the number of records to count. An empty endKey means
+ * the end of the map.
+ */
+void scanPart(const std::string& mapName, const std::string& startKey, const std::string& endKey,
+              uint64_t* count) {
+    boost::shared_ptr<TSocket> socket(new TSocket("localhost", 9090));
+    boost::shared_ptr<TTransport> transport(new TFramedTransport(socket));
+    boost::shared_ptr<TProtocol> protocol(new TBinaryProtocol(transport));
+    mapkeeper::MapKeeperClient client(protocol);
+    transport->open();
+    std::string key = startKey;
+    bool keyIncluded = true;
+    mapkeeper::RecordListResponse scanResponse;
+    do {
+        client.scan(scanResponse, mapName, ScanOrder::Ascending, key, keyIncluded, endKey, false, 1000, 0);
+        assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success ||
+               scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+        *count += scanResponse.records.size();
+        if (!scanResponse.records.empty()) {
+            key = scanResponse.records.back().key;
+            keyIncluded = false;
+        }
+    } while (scanResponse.responseCode == mapkeeper::ResponseCode::Success);
+    transport->close();
+}
+
+/**
+ * Downloads a value in ranges, and uploads one in pieces if the server
+ * stores the map in chunks (--chunk=range_test:<bytes>). Against
+ * mapkeeper_bdb with --chunk, the whole-value reads go through the
+ * chunk manifest and Bdb::getRange().
+ */
+void testGetRange(mapkeeper::MapKeeperClient& client) {
+    std::string mapName("range_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    std::string value;
+    for (int i = 0; i < 10000; i++) {
+        value += boost::lexical_cast<std::string>(i);
+    }
+    assert(mapkeeper::ResponseCode::Success == client.put(mapName, "k", value));
+
+    mapkeeper::BinaryResponse rangeResponse;
+    std::string downloaded;
+    do {
+        client.getRange(rangeResponse, mapName, "k", downloaded.size(), 4096);
+        assert(rangeResponse.responseCode == mapkeeper::ResponseCode::Success);
+        downloaded += rangeResponse.value;
+    } while (rangeResponse.value.size() == 4096);
+    assert(downloaded == value);
+    client.getRange(rangeResponse, mapName, "k", 100, 0x7fffffff);
+    assert(rangeResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(rangeResponse.value == value.substr(100));
+    mapkeeper::BinaryResponse wholeResponse;
+    client.get(wholeResponse, mapName, "k");
+    assert(wholeResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(wholeResponse.value == value);
+    client.getRange(rangeResponse, mapName, "k", value.size() + 10, 10);
+    assert(rangeResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(rangeResponse.value.empty());
+    client.getRange(rangeResponse, mapName, "k", -1, 10);
+    assert(rangeResponse.responseCode == mapkeeper::ResponseCode::Error);
+    client.getRange(rangeResponse, mapName, "missing", 0, 10);
+    assert(rangeResponse.responseCode == mapkeeper::ResponseCode::RecordNotFound);
+
+    mapkeeper::ResponseCode::type rc = client.putChunk(mapName, "u", 0, value.substr(0, 5000), false);
+    if (rc == mapkeeper::ResponseCode::Success) {
+        assert(mapkeeper::ResponseCode::Error == client.putChunk(mapName, "u", 4000, "x", false));
+        assert(mapkeeper::ResponseCode::Success == client.putChunk(mapName, "u", 5000, value.substr(5000), true));
+        mapkeeper::BinaryResponse getResponse;
+        client.get(getResponse, mapName, "u");
+        assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+        assert(getResponse.value == value);
+    } else {
+        assert(rc == mapkeeper::ResponseCode::Error);
+    }
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+/**
+ * Grows a value with append() and overwrites parts of it with writeAt().
+ */
+void testAppend(mapkeeper::MapKeeperClient& client) {
+    std::string mapName("append_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    assert(mapkeeper::ResponseCode::RecordNotFound == client.append(mapName, "k", "abc"));
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "k", "abc"));
+    assert(mapkeeper::ResponseCode::Success == client.append(mapName, "k", "def"));
+    assert(mapkeeper::ResponseCode::Success == client.writeAt(mapName, "k", 1, "XY"));
+    assert(mapkeeper::ResponseCode::Success == client.writeAt(mapName, "k", 8, "gh"));
+    assert(mapkeeper::ResponseCode::Error == client.writeAt(mapName, "k", -1, "x"));
+    assert(mapkeeper::ResponseCode::RecordNotFound == client.writeAt(mapName, "missing", 0, "x"));
+    mapkeeper::BinaryResponse getResponse;
+    client.get(getResponse, mapName, "k");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(getResponse.value == std::string("aXYdef\0\0gh", 10));
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+/**
+ * Cuts the whole map into parts with getSplitKeys() and scans them in
+ * parallel, one thread per part.
+ */
+void testParallelScan(mapkeeper::MapKeeperClient& client, uint32_t numThreads) {
+    std::string mapName("parallel_scan_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    std::vector<Record> records;
+    for (int i = 0; i < 10000; i++) {
+        Record record;
+        record.key = "key" + boost::lexical_cast<std::string>(10000 + i);
+        record.value = "val" + boost::lexical_cast<std::string>(i);
+        records.push_back(record);
+    }
+    std::vector<mapkeeper::ResponseCode::type> results;
+    client.multiPut(results, mapName, records);
+
+    mapkeeper::BinaryListResponse splitResponse;
+    client.getSplitKeys(splitResponse, mapName, "", "", numThreads);
+    assert(splitResponse.responseCode == mapkeeper::ResponseCode::Success);
+    std::vector<std::string>& splitKeys = splitResponse.values;
+    assert(splitKeys.size() < numThreads);
+    std::vector<uint64_t> counts(splitKeys.size() + 1, 0);
+    boost::thread_group threads;
+    for (size_t i = 0; i <= splitKeys.size(); i++) {
+        std::string startKey = i == 0 ? "" : splitKeys[i - 1];
+        std::string endKey = i == splitKeys.size() ? "" : splitKeys[i];
+        threads.create_thread(boost::bind(scanPart, mapName, startKey, endKey, &counts[i]));
+    }
+    threads.join_all();
+    uint64_t total = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        total += counts[i];
+    }
+    assert(total == records.size());
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
 int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--multiplexed") == 0) {
+        testMultiplexed();
+        return 0;
+    }
+    if (argc > 1 && strncmp(argv[1], "--sharded=", 10) == 0) {
+        std::vector<std::string> servers;
+        std::string list(argv[1] + 10);
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t comma = list.find(',', start);
+            if (comma == std::string::npos) {
+                comma = list.size();
+            }
+            servers.push_back(list.substr(start, comma - start));
+            start = comma + 1;
+        }
+        testSharded(servers);
+        return 0;
+    }
     boost::shared_ptr<TSocket> socket(new TSocket("localhost", 9090));
     boost::shared_ptr<TTransport> transport(new TFramedTransport(socket));
     boost::shared_ptr<TProtocol> protocol(new TBinaryProtocol(transport));
@@ -152,6 +689,29 @@ int main(int argc, char **argv) {
  
     // test scan
     testScan(client);
+    testScanEmptyKey(client);
+
+    // test multi-key methods
+    testMulti(client);
+
+    // test estimateCount and estimateSize
+    testEstimates(client);
+
+    // test keys-only and projected scans
+    testScanOptions(client);
+
+    // test scan filters
+    testScanFilters(client);
+
+    // test packed scans
+    testScanPacked(client);
+
+    // test getRange and putChunk
+    testGetRange(client);
+    testAppend(client);
+
+    // test getSplitKeys
+    testParallelScan(client, 8);
 
     // test remove
     assert(mapkeeper::ResponseCode::Success == client.remove("db1", "k1"));
@@ -159,6 +719,11 @@ int main(int argc, char **argv) {
     assert(mapkeeper::ResponseCode::RecordNotFound== client.remove("db1", "k2"));
     assert(mapkeeper::ResponseCode::MapNotFound == client.remove("db2", "k1"));
 
+    // test getStats
+    mapkeeper::StatsResponse statsResponse;
+    client.getStats(statsResponse);
+    assert(statsResponse.responseCode == mapkeeper::ResponseCode::Success);
+
     // test dropMap
     assert(mapkeeper::ResponseCode::Success == client.dropMap("db1"));
     assert(mapkeeper::ResponseCode::MapNotFound == client.dropMap("db1"));
@@ -0,0 +1,542 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <boost/lexical_cast.hpp>
+#include "ScanSink.h"
+#include "ShardedClient.h"
+
+using namespace mapkeeper;
+
+/**
+ * 64-bit FNV-1a followed by MurmurHash3's finalizer, which spreads
+ * similar keys (e.g., "user1", "user2") over the whole ring.
+ */
+static uint64_t hashKey(const std::string& key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.size(); i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static const std::string& keyOf(const std::string& key)
+{
+    return key;
+}
+
+static const std::string& keyOf(const Record& record)
+{
+    return record.key;
+}
+
+/**
+ * Tells whether key a comes before key b in the scan order.
+ */
+static bool before(ScanOrder::type order, const std::string& a, const std::string& b)
+{
+    return order == ScanOrder::Ascending ? a < b : b < a;
+}
+
+/**
+ * before() for keys read in place from packed responses.
+ */
+static bool before(ScanOrder::type order, const char* a, size_t aSize, const char* b, size_t bSize)
+{
+    int result = memcmp(a, b, std::min(aSize, bSize));
+    if (result == 0) {
+        result = aSize < bSize ? -1 : (aSize > bSize ? 1 : 0);
+    }
+    return order == ScanOrder::Ascending ? result < 0 : result > 0;
+}
+
+ShardedClient::
+ShardedClient(const std::vector<std::string>& servers, uint32_t virtualNodes,
+              const MultiplexedClient::Options& options) :
+    servers_(servers)
+{
+    if (servers.empty()) {
+        fprintf(stderr, "ShardedClient needs at least one server\n");
+        exit(1);
+    }
+    if (virtualNodes == 0) {
+        virtualNodes = 1;
+    }
+    for (uint32_t i = 0; i < servers.size(); i++) {
+        size_t colon = servers[i].rfind(':');
+        if (colon == std::string::npos) {
+            fprintf(stderr, "invalid server: %s (expected host:port)\n", servers[i].c_str());
+            exit(1);
+        }
+        uint16_t port = atoi(servers[i].c_str() + colon + 1);
+        shards_.push_back(new MultiplexedClient(servers[i].substr(0, colon), port, options));
+
+        // the points only depend on the server's address, so listing
+        // the servers in another order doesn't move any keys.
+        for (uint32_t j = 0; j < virtualNodes; j++) {
+            ring_.push_back(std::make_pair(hashKey(servers[i] + "#" + boost::lexical_cast<std::string>(j)), i));
+        }
+    }
+    std::sort(ring_.begin(), ring_.end());
+}
+
+uint32_t ShardedClient::
+getShard(const std::string& key) const
+{
+    std::vector<std::pair<uint64_t, uint32_t> >::const_iterator itr =
+        std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(hashKey(key), (uint32_t)0));
+    if (itr == ring_.end()) {
+        itr = ring_.begin();
+    }
+    return itr->second;
+}
+
+ResponseCode::type ShardedClient::
+ping()
+{
+    std::vector<Future<ResponseCode::type> > futures;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        futures.push_back(shards_[i].ping());
+    }
+    for (size_t i = 0; i < futures.size(); i++) {
+        if (futures[i].get() != ResponseCode::Success) {
+            return futures[i].get();
+        }
+    }
+    return ResponseCode::Success;
+}
+
+ResponseCode::type ShardedClient::
+addMap(const std::string& mapName)
+{
+    return broadcast(&MultiplexedClient::addMap, mapName);
+}
+
+ResponseCode::type ShardedClient::
+dropMap(const std::string& mapName)
+{
+    return broadcast(&MultiplexedClient::dropMap, mapName);
+}
+
+void ShardedClient::
+listMaps(StringListResponse& _return)
+{
+    std::vector<Future<StringListResponse> > futures;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        futures.push_back(shards_[i].listMaps());
+    }
+    std::set<std::string> names;
+    _return.responseCode = ResponseCode::Success;
+    for (size_t i = 0; i < futures.size(); i++) {
+        const StringListResponse& response = futures[i].get();
+        if (response.responseCode != ResponseCode::Success) {
+            _return.responseCode = response.responseCode;
+        }
+        names.insert(response.values.begin(), response.values.end());
+    }
+    _return.values.assign(names.begin(), names.end());
+}
+
+void ShardedClient::
+scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+     const std::string& startKey, const bool startKeyIncluded,
+     const std::string& endKey, const bool endKeyIncluded,
+     const int32_t maxRecords, const int32_t maxBytes)
+{
+    scanWithOptions(_return, mapName, order, startKey, startKeyIncluded,
+                    endKey, endKeyIncluded, maxRecords, maxBytes, ScanOptions());
+}
+
+void ShardedClient::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+                const std::string& startKey, const bool startKeyIncluded,
+                const std::string& endKey, const bool endKeyIncluded,
+                const int32_t maxRecords, const int32_t maxBytes,
+                const ScanOptions& options)
+{
+    RecordListSink sink(_return);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+void ShardedClient::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes,
+           const ScanOptions& options)
+{
+    PackedRecordSink sink(_return, options.sharedKeyPrefixes,
+                          PackedRecordSink::wantsCompressedValues(options));
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+/**
+ * The servers are asked for packed responses, which are merged without
+ * building a Record for every record they return.
+ *
+ * A server that didn't reach the end of the range may have records
+ * after the last one it examined (its resumeKey, or its last record for
+ * servers that don't set one), so the merged result stops at the
+ * earliest such key.
+ */
+void ShardedClient::
+scanInto(ScanSink& sink, const std::string& mapName, const ScanOrder::type order,
+         const std::string& startKey, const bool startKeyIncluded,
+         const std::string& endKey, const bool endKeyIncluded,
+         const int32_t maxRecords, const int32_t maxBytes,
+         const ScanOptions& options)
+{
+    ScanOptions shardOptions = options;
+    shardOptions.compressedValues = sink.compressedValues();
+    std::vector<Future<PackedRecordListResponse> > futures;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        futures.push_back(shards_[i].scanPacked(mapName, order, startKey, startKeyIncluded,
+                                                endKey, endKeyIncluded, maxRecords, maxBytes,
+                                                shardOptions));
+    }
+    std::vector<PackedRecordReader> readers;
+    bool more = false;
+    bool hasCutoff = false;
+    std::string cutoff;
+    for (size_t i = 0; i < futures.size(); i++) {
+        const PackedRecordListResponse& response = futures[i].get();
+        readers.push_back(PackedRecordReader(response.records));
+        const PackedRecordReader& reader = readers.back();
+        if (response.responseCode != ResponseCode::Success &&
+            response.responseCode != ResponseCode::ScanEnded) {
+            sink.setResponseCode(response.responseCode);
+            return;
+        }
+        if (!reader.valid() || (reader.compressedValues() && !sink.compressedValues())) {
+            fprintf(stderr, "malformed scanPacked response from %s\n", servers_[i].c_str());
+            sink.setResponseCode(ResponseCode::Error);
+            return;
+        }
+        if (response.responseCode == ResponseCode::Success &&
+            (!response.resumeKey.empty() || reader.size() > 0)) {
+            more = true;
+            std::string last = response.resumeKey;
+            if (last.empty()) {
+                PackedRecordReader tail = reader;
+                while (tail.next()) {
+                    last.assign(tail.key(), tail.keySize());
+                }
+            }
+            if (!hasCutoff || before(order, last, cutoff)) {
+                cutoff = last;
+                hasCutoff = true;
+            }
+        }
+    }
+
+    // each reader sits on its server's next record, if it has one.
+    std::vector<bool> pending(readers.size());
+    for (size_t i = 0; i < readers.size(); i++) {
+        pending[i] = readers[i].next();
+    }
+    std::string lastKey;
+    bool full = false;
+    while (true) {
+        PackedRecordReader* next = NULL;
+        size_t nextShard = 0;
+        for (size_t i = 0; i < readers.size(); i++) {
+            if (pending[i] &&
+                (next == NULL || before(order, readers[i].key(), readers[i].keySize(),
+                                        next->key(), next->keySize()))) {
+                next = &readers[i];
+                nextShard = i;
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        if (hasCutoff && before(order, cutoff.data(), cutoff.size(), next->key(), next->keySize())) {
+            break;
+        }
+        if (sink.full(maxRecords, maxBytes)) {
+            more = true;
+            full = true;
+            break;
+        }
+        sink.add(*next);
+        lastKey.assign(next->key(), next->keySize());
+        pending[nextShard] = next->next();
+    }
+    sink.setResponseCode(more ? ResponseCode::Success : ResponseCode::ScanEnded);
+    if (more) {
+        // every server has examined the range up to the cutoff.
+        sink.setResumeKey(full ? lastKey : cutoff);
+    }
+}
+
+void ShardedClient::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    _return = shards_[getShard(key)].get(mapName, key).get();
+}
+
+void ShardedClient::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+         const int64_t offset, const int32_t length)
+{
+    _return = shards_[getShard(key)].getRange(mapName, key, offset, length).get();
+}
+
+ResponseCode::type ShardedClient::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return shards_[getShard(key)].put(mapName, key, value).get();
+}
+
+ResponseCode::type ShardedClient::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return shards_[getShard(key)].insert(mapName, key, value).get();
+}
+
+ResponseCode::type ShardedClient::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return shards_[getShard(key)].update(mapName, key, value).get();
+}
+
+ResponseCode::type ShardedClient::
+putChunk(const std::string& mapName, const std::string& key, const int64_t offset,
+         const std::string& data, const bool last)
+{
+    return shards_[getShard(key)].putChunk(mapName, key, offset, data, last).get();
+}
+
+ResponseCode::type ShardedClient::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    return shards_[getShard(key)].append(mapName, key, data).get();
+}
+
+ResponseCode::type ShardedClient::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+        const std::string& data)
+{
+    return shards_[getShard(key)].writeAt(mapName, key, offset, data).get();
+}
+
+ResponseCode::type ShardedClient::
+remove(const std::string& mapName, const std::string& key)
+{
+    return shards_[getShard(key)].remove(mapName, key).get();
+}
+
+void ShardedClient::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName,
+         const std::vector<std::string>& keys)
+{
+    std::vector<std::vector<std::string> > keysByShard;
+    std::vector<std::vector<size_t> > positionsByShard;
+    split(keys, keysByShard, positionsByShard);
+    std::vector<Future<std::vector<BinaryResponse> > > futures(shards_.size());
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (!keysByShard[i].empty()) {
+            futures[i] = shards_[i].multiGet(mapName, keysByShard[i]);
+        }
+    }
+    _return.assign(keys.size(), BinaryResponse());
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (!futures[i].valid()) {
+            continue;
+        }
+        const std::vector<BinaryResponse>& responses = futures[i].get();
+        for (size_t j = 0; j < positionsByShard[i].size(); j++) {
+            if (j < responses.size()) {
+                _return[positionsByShard[i][j]] = responses[j];
+            } else {
+                _return[positionsByShard[i][j]].responseCode = ResponseCode::Error;
+            }
+        }
+    }
+}
+
+void ShardedClient::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+         const std::vector<Record>& records)
+{
+    multiWrite(_return, &MultiplexedClient::multiPut, mapName, records);
+}
+
+void ShardedClient::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    multiWrite(_return, &MultiplexedClient::multiInsert, mapName, records);
+}
+
+void ShardedClient::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    multiWrite(_return, &MultiplexedClient::multiUpdate, mapName, records);
+}
+
+void ShardedClient::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<std::string>& keys)
+{
+    multiWrite(_return, &MultiplexedClient::multiRemove, mapName, keys);
+}
+
+void ShardedClient::
+getStats(StatsResponse& _return)
+{
+    std::vector<Future<StatsResponse> > futures;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        futures.push_back(shards_[i].getStats());
+    }
+    _return.responseCode = ResponseCode::Success;
+    for (size_t i = 0; i < futures.size(); i++) {
+        const StatsResponse& response = futures[i].get();
+        if (response.responseCode != ResponseCode::Success) {
+            _return.responseCode = response.responseCode;
+        }
+        for (std::map<std::string, int64_t>::const_iterator itr = response.counters.begin();
+             itr != response.counters.end(); itr++) {
+            _return.counters[itr->first] += itr->second;
+        }
+        for (std::map<std::string, std::string>::const_iterator itr = response.properties.begin();
+             itr != response.properties.end(); itr++) {
+            _return.properties[servers_[i] + "." + itr->first] = itr->second;
+        }
+    }
+}
+
+void ShardedClient::
+getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const int32_t numSplits)
+{
+    std::vector<Future<BinaryListResponse> > futures;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        futures.push_back(shards_[i].getSplitKeys(mapName, startKey, endKey, numSplits));
+    }
+    std::vector<std::string> keys;
+    _return.responseCode = ResponseCode::Success;
+    for (size_t i = 0; i < futures.size(); i++) {
+        const BinaryListResponse& response = futures[i].get();
+        if (response.responseCode != ResponseCode::Success) {
+            _return.responseCode = response.responseCode;
+        }
+        keys.insert(keys.end(), response.values.begin(), response.values.end());
+    }
+    if (_return.responseCode != ResponseCode::Success) {
+        return;
+    }
+    std::sort(keys.begin(), keys.end());
+    size_t numShards = shards_.size();
+    for (size_t i = numShards / 2; i < keys.size(); i += numShards) {
+        if (_return.values.empty() || _return.values.back() != keys[i]) {
+            _return.values.push_back(keys[i]);
+        }
+    }
+}
+
+void ShardedClient::
+estimateCount(EstimateResponse& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, &MultiplexedClient::estimateCount, mapName, startKey, endKey, exact);
+}
+
+void ShardedClient::
+estimateSize(EstimateResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, &MultiplexedClient::estimateSize, mapName, startKey, endKey, exact);
+}
+
+void ShardedClient::
+estimate(EstimateResponse& _return, EstimateCall method, const std::string& mapName,
+         const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    std::vector<Future<EstimateResponse> > futures;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        futures.push_back((shards_[i].*method)(mapName, startKey, endKey, exact));
+    }
+    _return.value = 0;
+    _return.exact = true;
+    _return.responseCode = ResponseCode::Success;
+    for (size_t i = 0; i < futures.size(); i++) {
+        const EstimateResponse& response = futures[i].get();
+        if (response.responseCode != ResponseCode::Success) {
+            _return.responseCode = response.responseCode;
+        }
+        _return.value += response.value;
+        _return.exact = _return.exact && response.exact;
+    }
+}
+
+ResponseCode::type ShardedClient::
+broadcast(MapCall method, const std::string& mapName)
+{
+    std::vector<Future<ResponseCode::type> > futures;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        futures.push_back((shards_[i].*method)(mapName));
+    }
+    ResponseCode::type rc = ResponseCode::Success;
+    for (size_t i = 0; i < futures.size(); i++) {
+        if (rc == ResponseCode::Success) {
+            rc = futures[i].get();
+        } else {
+            futures[i].wait();
+        }
+    }
+    return rc;
+}
+
+template <class Item>
+void ShardedClient::
+multiWrite(std::vector<ResponseCode::type>& _return,
+           Future<std::vector<ResponseCode::type> >
+               (MultiplexedClient::*method)(const std::string&, const std::vector<Item>&),
+           const std::string& mapName, const std::vector<Item>& items)
+{
+    std::vector<std::vector<Item> > itemsByShard;
+    std::vector<std::vector<size_t> > positionsByShard;
+    split(items, itemsByShard, positionsByShard);
+    std::vector<Future<std::vector<ResponseCode::type> > > futures(shards_.size());
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (!itemsByShard[i].empty()) {
+            futures[i] = (shards_[i].*method)(mapName, itemsByShard[i]);
+        }
+    }
+    _return.assign(items.size(), ResponseCode::Error);
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (!futures[i].valid()) {
+            continue;
+        }
+        const std::vector<ResponseCode::type>& results = futures[i].get();
+        for (size_t j = 0; j < positionsByShard[i].size() && j < results.size(); j++) {
+            _return[positionsByShard[i][j]] = results[j];
+        }
+    }
+}
+
+template <class Item>
+void ShardedClient::
+split(const std::vector<Item>& items, std::vector<std::vector<Item> >& itemsByShard,
+      std::vector<std::vector<size_t> >& positionsByShard) const
+{
+    itemsByShard.assign(shards_.size(), std::vector<Item>());
+    positionsByShard.assign(shards_.size(), std::vector<size_t>());
+    for (size_t i = 0; i < items.size(); i++) {
+        uint32_t shard = getShard(keyOf(items[i]));
+        itemsByShard[shard].push_back(items[i]);
+        positionsByShard[shard].push_back(i);
+    }
+}
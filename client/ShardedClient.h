@@ -0,0 +1,143 @@
+#ifndef MAPKEEPER_SHARDED_CLIENT_H
+#define MAPKEEPER_SHARDED_CLIENT_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include "MapKeeper.h"
+#include "MultiplexedClient.h"
+
+class ScanSink;
+
+/**
+ * Spreads records over several MapKeeper servers by consistent hashing
+ * of the key, so that adding a server only moves about 1/n of the keys.
+ * Each server gets virtualNodes points on the hash ring, which evens
+ * out the share of keys each one owns.
+ *
+ * Single key calls go straight to the server that owns the key. Multi
+ * key calls are split by server and sent to all of them at once. Scans
+ * go to every server and the results are merged in key order, honoring
+ * the scan order, maxRecords and maxBytes; ScanEnded means every server
+ * ran out of records. addMap, dropMap and ping go to every server and
+ * return the first response that isn't Success.
+ *
+ * Each server is reached through a MultiplexedClient, so they have to
+ * run with --server=epoll. Calls throw FutureError if a server can't be
+ * reached.
+ */
+class ShardedClient : public mapkeeper::MapKeeperIf {
+public:
+    /**
+     * @param servers       "host:port" of each server.
+     * @param virtualNodes  points on the hash ring per server.
+     */
+    ShardedClient(const std::vector<std::string>& servers, uint32_t virtualNodes,
+                  const MultiplexedClient::Options& options);
+
+    mapkeeper::ResponseCode::type ping();
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName);
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName);
+    void listMaps(mapkeeper::StringListResponse& _return);
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+                         const mapkeeper::ScanOrder::type order,
+                         const std::string& startKey, const bool startKeyIncluded,
+                         const std::string& endKey, const bool endKeyIncluded,
+                         const int32_t maxRecords, const int32_t maxBytes,
+                         const mapkeeper::ScanOptions& options);
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName,
+                    const mapkeeper::ScanOrder::type order,
+                    const std::string& startKey, const bool startKeyIncluded,
+                    const std::string& endKey, const bool endKeyIncluded,
+                    const int32_t maxRecords, const int32_t maxBytes,
+                    const mapkeeper::ScanOptions& options);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+    void getRange(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length);
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key,
+                                           const int64_t offset, const std::string& data, const bool last);
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key,
+                                          const int64_t offset, const std::string& data);
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                  const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<std::string>& keys);
+
+    /**
+     * Counters are summed over the servers; properties are prefixed
+     * with "<host:port>.".
+     */
+    void getStats(mapkeeper::StatsResponse& _return);
+
+    /**
+     * Every server splits its share of the range into numSplits parts,
+     * and since hashing spreads the keys evenly, the split keys of part
+     * i from all the servers end up close together. The middle one of
+     * each group is returned.
+     */
+    void getSplitKeys(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const int32_t numSplits);
+
+    /**
+     * Sums the answers of the servers, which are exact if all of them
+     * are.
+     */
+    void estimateCount(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                       const std::string& startKey, const std::string& endKey, const bool exact);
+    void estimateSize(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const bool exact);
+
+    /**
+     * Returns the index of the server that owns key.
+     */
+    uint32_t getShard(const std::string& key) const;
+
+private:
+    typedef Future<mapkeeper::ResponseCode::type> (MultiplexedClient::*MapCall)(const std::string&);
+    typedef Future<mapkeeper::EstimateResponse> (MultiplexedClient::*EstimateCall)(
+        const std::string&, const std::string&, const std::string&, const bool);
+
+    mapkeeper::ResponseCode::type broadcast(MapCall method, const std::string& mapName);
+    void scanInto(ScanSink& sink, const std::string& mapName, const mapkeeper::ScanOrder::type order,
+                  const std::string& startKey, const bool startKeyIncluded,
+                  const std::string& endKey, const bool endKeyIncluded,
+                  const int32_t maxRecords, const int32_t maxBytes,
+                  const mapkeeper::ScanOptions& options);
+    void estimate(mapkeeper::EstimateResponse& _return, EstimateCall method, const std::string& mapName,
+                  const std::string& startKey, const std::string& endKey, const bool exact);
+    template <class Item>
+    void multiWrite(std::vector<mapkeeper::ResponseCode::type>& _return,
+                    Future<std::vector<mapkeeper::ResponseCode::type> >
+                        (MultiplexedClient::*method)(const std::string&, const std::vector<Item>&),
+                    const std::string& mapName, const std::vector<Item>& items);
+    template <class Item>
+    void split(const std::vector<Item>& items, std::vector<std::vector<Item> >& itemsByShard,
+               std::vector<std::vector<size_t> >& positionsByShard) const;
+
+    std::vector<std::string> servers_;
+    boost::ptr_vector<MultiplexedClient> shards_;
+
+    // (hash, shard) pairs sorted by hash. A key belongs to the first
+    // point at or after its hash, wrapping around.
+    std::vector<std::pair<uint64_t, uint32_t> > ring_;
+};
+
+#endif // MAPKEEPER_SHARDED_CLIENT_H
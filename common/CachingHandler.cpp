@@ -0,0 +1,521 @@
+#include <cstdio>
+#include <algorithm>
+#include <arpa/inet.h> // htonl
+#include "CachingHandler.h"
+#include "RequestTrace.h"
+
+using namespace mapkeeper;
+
+CachingHandler::Stats::
+Stats() :
+    hits(0),
+    negativeHits(0),
+    misses(0),
+    admissions(0),
+    rejections(0),
+    evictions(0),
+    invalidations(0),
+    entries(0),
+    bytes(0)
+{
+}
+
+double CachingHandler::Stats::
+hitRate() const
+{
+    if (hits + misses == 0) {
+        return 0;
+    }
+    return (double)hits / (hits + misses);
+}
+
+CachingHandler::FrequencySketch::
+FrequencySketch() :
+    mask_(0),
+    numAdditions_(0),
+    sampleSize_(0)
+{
+}
+
+void CachingHandler::FrequencySketch::
+init(uint32_t width)
+{
+    uint32_t size = 1;
+    while (size < width) {
+        size <<= 1;
+    }
+    counters_.assign(DEPTH * size, 0);
+    mask_ = size - 1;
+    numAdditions_ = 0;
+
+    // halve the counters after seeing about ten accesses per slot.
+    sampleSize_ = 10 * (uint64_t)size;
+}
+
+uint32_t CachingHandler::FrequencySketch::
+index(uint64_t hash, uint32_t row) const
+{
+    // double hashing: h1 + row * h2 gives DEPTH different slots.
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    return row * (mask_ + 1) + ((h1 + row * h2) & mask_);
+}
+
+void CachingHandler::FrequencySketch::
+increment(uint64_t hash)
+{
+    for (uint32_t row = 0; row < DEPTH; row++) {
+        uint8_t& counter = counters_[index(hash, row)];
+        if (counter < MAX_COUNT) {
+            counter++;
+        }
+    }
+    numAdditions_++;
+    if (numAdditions_ >= sampleSize_) {
+        age();
+    }
+}
+
+uint32_t CachingHandler::FrequencySketch::
+estimate(uint64_t hash) const
+{
+    uint32_t frequency = MAX_COUNT;
+    for (uint32_t row = 0; row < DEPTH; row++) {
+        frequency = std::min(frequency, (uint32_t)counters_[index(hash, row)]);
+    }
+    return frequency;
+}
+
+void CachingHandler::FrequencySketch::
+age()
+{
+    for (std::vector<uint8_t>::iterator itr = counters_.begin(); itr != counters_.end(); itr++) {
+        *itr >>= 1;
+    }
+    numAdditions_ /= 2;
+}
+
+CachingHandler::Shard::
+Shard() :
+    capacity(0),
+    usage(0),
+    generation(0)
+{
+}
+
+CachingHandler::
+CachingHandler(boost::shared_ptr<MapKeeperIf> handler, 
+               uint64_t capacityBytes, uint32_t numShards, uint32_t statsIntervalSec) :
+    ForwardingHandler(handler),
+    shards_(new Shard[numShards]),
+    numShards_(numShards)
+{
+    // size the sketch for roughly one slot per 512 bytes of cache.
+    uint64_t shardCapacity = capacityBytes / numShards;
+    for (uint32_t i = 0; i < numShards_; i++) {
+        shards_[i].capacity = shardCapacity;
+        shards_[i].sketch.init((uint32_t)std::max((uint64_t)1024, shardCapacity / 512));
+    }
+    if (statsIntervalSec > 0) {
+        reporter_.reset(new boost::thread(&CachingHandler::reportStats, this, statsIntervalSec));
+    }
+}
+
+CachingHandler::
+~CachingHandler()
+{
+    if (reporter_) {
+        reporter_->interrupt();
+        reporter_->join();
+    }
+}
+
+ResponseCode::type CachingHandler::
+dropMap(const std::string& mapName)
+{
+    ResponseCode::type rc = handler_->dropMap(mapName);
+    invalidateMap(mapName);
+    return rc;
+}
+
+void CachingHandler::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    std::string cacheKey = makeCacheKey(mapName, key);
+    uint64_t hash = hashKey(cacheKey);
+    uint64_t generation;
+    bool hit = lookup(cacheKey, hash, _return, generation);
+    TRACE_MARK(RequestTrace::CACHE);
+    if (hit) {
+        return;
+    }
+    handler_->get(_return, mapName, key);
+    fill(cacheKey, hash, generation, _return);
+}
+
+ResponseCode::type CachingHandler::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    ResponseCode::type rc = handler_->put(mapName, key, value);
+    invalidate(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CachingHandler::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    ResponseCode::type rc = handler_->insert(mapName, key, value);
+    invalidate(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CachingHandler::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    ResponseCode::type rc = handler_->update(mapName, key, value);
+    invalidate(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CachingHandler::
+putChunk(const std::string& mapName, const std::string& key,
+         const int64_t offset, const std::string& data, const bool last)
+{
+    ResponseCode::type rc = handler_->putChunk(mapName, key, offset, data, last);
+    if (last) {
+        invalidate(mapName, key);
+    }
+    return rc;
+}
+
+ResponseCode::type CachingHandler::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    ResponseCode::type rc = handler_->append(mapName, key, data);
+    invalidate(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CachingHandler::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+        const std::string& data)
+{
+    ResponseCode::type rc = handler_->writeAt(mapName, key, offset, data);
+    invalidate(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CachingHandler::
+remove(const std::string& mapName, const std::string& key)
+{
+    ResponseCode::type rc = handler_->remove(mapName, key);
+    invalidate(mapName, key);
+    return rc;
+}
+
+void CachingHandler::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName, 
+         const std::vector<std::string>& keys)
+{
+    _return.resize(keys.size());
+    std::vector<size_t> misses;
+    std::vector<std::string> missedKeys;
+    std::vector<std::string> cacheKeys(keys.size());
+    std::vector<uint64_t> hashes(keys.size());
+    std::vector<uint64_t> generations(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        cacheKeys[i] = makeCacheKey(mapName, keys[i]);
+        hashes[i] = hashKey(cacheKeys[i]);
+        if (!lookup(cacheKeys[i], hashes[i], _return[i], generations[i])) {
+            misses.push_back(i);
+            missedKeys.push_back(keys[i]);
+        }
+    }
+    TRACE_MARK(RequestTrace::CACHE);
+    if (misses.empty()) {
+        return;
+    }
+    std::vector<BinaryResponse> responses;
+    handler_->multiGet(responses, mapName, missedKeys);
+    for (size_t i = 0; i < misses.size(); i++) {
+        size_t idx = misses[i];
+        if (i >= responses.size()) {
+            // a default response would read as an empty record.
+            _return[idx].responseCode = ResponseCode::Error;
+            continue;
+        }
+        _return[idx] = responses[i];
+        fill(cacheKeys[idx], hashes[idx], generations[idx], _return[idx]);
+    }
+}
+
+void CachingHandler::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+         const std::vector<Record>& records)
+{
+    handler_->multiPut(_return, mapName, records);
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        invalidate(mapName, itr->key);
+    }
+}
+
+void CachingHandler::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+            const std::vector<Record>& records)
+{
+    handler_->multiInsert(_return, mapName, records);
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        invalidate(mapName, itr->key);
+    }
+}
+
+void CachingHandler::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+            const std::vector<Record>& records)
+{
+    handler_->multiUpdate(_return, mapName, records);
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        invalidate(mapName, itr->key);
+    }
+}
+
+void CachingHandler::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+            const std::vector<std::string>& keys)
+{
+    handler_->multiRemove(_return, mapName, keys);
+    for (std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++) {
+        invalidate(mapName, *itr);
+    }
+}
+
+void CachingHandler::
+getStats(Stats& stats)
+{
+    stats = Stats();
+    for (uint32_t i = 0; i < numShards_; i++) {
+        Shard& shard = shards_[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        stats.hits += shard.stats.hits;
+        stats.negativeHits += shard.stats.negativeHits;
+        stats.misses += shard.stats.misses;
+        stats.admissions += shard.stats.admissions;
+        stats.rejections += shard.stats.rejections;
+        stats.evictions += shard.stats.evictions;
+        stats.invalidations += shard.stats.invalidations;
+        stats.entries += shard.entries.size();
+        stats.bytes += shard.usage;
+    }
+}
+
+void CachingHandler::
+getStats(StatsResponse& _return)
+{
+    handler_->getStats(_return);
+    Stats stats;
+    getStats(stats);
+    _return.counters["cache.hits"] = stats.hits;
+    _return.counters["cache.negative_hits"] = stats.negativeHits;
+    _return.counters["cache.misses"] = stats.misses;
+    _return.counters["cache.admissions"] = stats.admissions;
+    _return.counters["cache.rejections"] = stats.rejections;
+    _return.counters["cache.evictions"] = stats.evictions;
+    _return.counters["cache.invalidations"] = stats.invalidations;
+    _return.counters["cache.entries"] = stats.entries;
+    _return.counters["cache.bytes"] = stats.bytes;
+    char hitRate[32];
+    snprintf(hitRate, sizeof(hitRate), "%.4f", stats.hitRate());
+    _return.properties["cache.hit_rate"] = hitRate;
+}
+
+/**
+ * Map names are length-prefixed so that ("ab", "c") and ("a", "bc")
+ * don't end up with the same cache key.
+ */
+std::string CachingHandler::
+makeCacheKey(const std::string& mapName, const std::string& key)
+{
+    uint32_t length = htonl(mapName.size());
+    std::string cacheKey;
+    cacheKey.reserve(sizeof(length) + mapName.size() + key.size());
+    cacheKey.append((const char*)&length, sizeof(length));
+    cacheKey.append(mapName);
+    cacheKey.append(key);
+    return cacheKey;
+}
+
+/**
+ * 64-bit FNV-1a followed by the MurmurHash3 finalizer, so that both
+ * halves of the hash are usable for shard selection and the sketch.
+ */
+uint64_t CachingHandler::
+hashKey(const std::string& cacheKey)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (std::string::const_iterator itr = cacheKey.begin(); itr != cacheKey.end(); itr++) {
+        hash ^= (uint8_t)*itr;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+bool CachingHandler::
+isCacheable(ResponseCode::type responseCode)
+{
+    return responseCode == ResponseCode::Success || 
+           responseCode == ResponseCode::RecordNotFound;
+}
+
+CachingHandler::Shard& CachingHandler::
+getShard(uint64_t hash)
+{
+    return shards_[(hash >> 40) % numShards_];
+}
+
+/**
+ * Looks up a record in the cache. On a miss, generation is set to the
+ * current generation of the shard, which has to be passed to fill().
+ */
+bool CachingHandler::
+lookup(const std::string& cacheKey, uint64_t hash, BinaryResponse& response, uint64_t& generation)
+{
+    Shard& shard = getShard(hash);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    shard.sketch.increment(hash);
+    EntryMap::iterator itr = shard.entries.find(cacheKey);
+    if (itr == shard.entries.end()) {
+        shard.stats.misses++;
+        generation = shard.generation;
+        return false;
+    }
+    Entry& entry = itr->second;
+    shard.lru.splice(shard.lru.begin(), shard.lru, entry.lruPosition);
+    shard.stats.hits++;
+    if (entry.negative) {
+        shard.stats.negativeHits++;
+        response.responseCode = ResponseCode::RecordNotFound;
+        response.value.clear();
+    } else {
+        response.responseCode = ResponseCode::Success;
+        response.value = entry.value;
+    }
+    return true;
+}
+
+void CachingHandler::
+fill(const std::string& cacheKey, uint64_t hash, uint64_t generation, const BinaryResponse& response)
+{
+    if (!isCacheable(response.responseCode)) {
+        return;
+    }
+    bool negative = response.responseCode == ResponseCode::RecordNotFound;
+    uint64_t charge = cacheKey.size() + ENTRY_OVERHEAD + (negative ? 0 : response.value.size());
+    Shard& shard = getShard(hash);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    if (shard.generation != generation) {
+        // a write went through this shard while we were reading from the
+        // backend, so the response may already be stale.
+        return;
+    }
+    if (shard.entries.find(cacheKey) != shard.entries.end()) {
+        return;
+    }
+    if (charge > shard.capacity) {
+        shard.stats.rejections++;
+        return;
+    }
+
+    // TinyLFU admission: walk the LRU list from the tail and only admit
+    // the new entry if it is more popular than every entry it'd evict.
+    uint32_t frequency = shard.sketch.estimate(hash);
+    uint64_t freed = 0;
+    LruList::reverse_iterator victim = shard.lru.rbegin();
+    while (shard.usage - freed + charge > shard.capacity) {
+        const Entry& entry = shard.entries.find(**victim)->second;
+        if (shard.sketch.estimate(entry.hash) >= frequency) {
+            shard.stats.rejections++;
+            return;
+        }
+        freed += entry.charge;
+        victim++;
+    }
+    while (shard.usage + charge > shard.capacity) {
+        evict(shard, shard.entries.find(*shard.lru.back()));
+        shard.stats.evictions++;
+    }
+
+    std::pair<EntryMap::iterator, bool> result = shard.entries.insert(std::make_pair(cacheKey, Entry()));
+    Entry& entry = result.first->second;
+    if (!negative) {
+        entry.value = response.value;
+    }
+    entry.negative = negative;
+    entry.hash = hash;
+    entry.charge = charge;
+    shard.lru.push_front(&result.first->first);
+    entry.lruPosition = shard.lru.begin();
+    shard.usage += charge;
+    shard.stats.admissions++;
+}
+
+void CachingHandler::
+evict(Shard& shard, EntryMap::iterator itr)
+{
+    shard.usage -= itr->second.charge;
+    shard.lru.erase(itr->second.lruPosition);
+    shard.entries.erase(itr);
+}
+
+void CachingHandler::
+invalidate(const std::string& mapName, const std::string& key)
+{
+    std::string cacheKey = makeCacheKey(mapName, key);
+    Shard& shard = getShard(hashKey(cacheKey));
+    boost::mutex::scoped_lock lock(shard.mutex);
+    shard.generation++;
+    EntryMap::iterator itr = shard.entries.find(cacheKey);
+    if (itr != shard.entries.end()) {
+        evict(shard, itr);
+        shard.stats.invalidations++;
+    }
+}
+
+void CachingHandler::
+invalidateMap(const std::string& mapName)
+{
+    std::string prefix = makeCacheKey(mapName, "");
+    for (uint32_t i = 0; i < numShards_; i++) {
+        Shard& shard = shards_[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        shard.generation++;
+        EntryMap::iterator itr = shard.entries.begin();
+        while (itr != shard.entries.end()) {
+            EntryMap::iterator current = itr++;
+            if (current->first.compare(0, prefix.size(), prefix) == 0) {
+                evict(shard, current);
+                shard.stats.invalidations++;
+            }
+        }
+    }
+}
+
+void CachingHandler::
+reportStats(uint32_t statsIntervalSec)
+{
+    while (true) {
+        boost::this_thread::sleep(boost::posix_time::seconds(statsIntervalSec));
+        Stats stats;
+        getStats(stats);
+        fprintf(stderr, "cache: hit rate %.2f%% hits %lu (negative %lu) misses %lu "
+                "admissions %lu rejections %lu evictions %lu invalidations %lu "
+                "entries %lu bytes %lu\n",
+                100 * stats.hitRate(), stats.hits, stats.negativeHits, stats.misses,
+                stats.admissions, stats.rejections, stats.evictions, stats.invalidations,
+                stats.entries, stats.bytes);
+    }
+}
@@ -0,0 +1,149 @@
+#ifndef CACHING_HANDLER_H
+#define CACHING_HANDLER_H
+
+#include <list>
+#include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include "ForwardingHandler.h"
+
+/**
+ * Read-through cache of individual records in front of any backend.
+ *
+ * The cache is split into shards, each with its own mutex and LRU list,
+ * so concurrent gets on different keys rarely contend. Admission is
+ * controlled by TinyLFU: a new entry only gets in if it has been 
+ * requested more often than the entries it would evict, which keeps
+ * one-off reads from flushing the hot keys of a skewed workload. 
+ *
+ * RecordNotFound is cached as well (negative caching). Every write that
+ * goes through this handler invalidates the key after the backend write,
+ * and a read that raced with a write is not cached. Writes that bypass 
+ * this process (for example directly to MySQL) are not seen.
+ */
+class CachingHandler : public ForwardingHandler {
+public:
+    struct Stats {
+        Stats();
+        double hitRate() const;
+        uint64_t hits;           // gets answered from the cache
+        uint64_t negativeHits;   // hits on a cached RecordNotFound
+        uint64_t misses;
+        uint64_t admissions;
+        uint64_t rejections;     // entries refused by TinyLFU
+        uint64_t evictions;
+        uint64_t invalidations;
+        uint64_t entries;
+        uint64_t bytes;
+    };
+
+    /**
+     * @param capacityBytes total size of cached keys and values.
+     * @param numShards number of independently locked shards.
+     * @param statsIntervalSec if non-zero, cache statistics are printed
+     *                         to stderr every statsIntervalSec seconds.
+     */
+    CachingHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> handler, 
+                   uint64_t capacityBytes, uint32_t numShards, uint32_t statsIntervalSec);
+    ~CachingHandler();
+
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key,
+                                           const int64_t offset, const std::string& data, const bool last);
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key,
+                                          const int64_t offset, const std::string& data);
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName, 
+                  const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                  const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                     const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                     const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                     const std::vector<std::string>& keys);
+
+    /**
+     * Adds the cache statistics to the backend's under "cache.".
+     */
+    void getStats(mapkeeper::StatsResponse& _return);
+
+    void getStats(Stats& stats);
+
+private:
+    /**
+     * Count-min sketch of access frequencies with small saturating 
+     * counters. All the counters are halved periodically so that old
+     * popularity fades away.
+     */
+    class FrequencySketch {
+    public:
+        FrequencySketch();
+        void init(uint32_t width);
+        void increment(uint64_t hash);
+        uint32_t estimate(uint64_t hash) const;
+
+    private:
+        static const uint32_t DEPTH = 4;
+        static const uint8_t MAX_COUNT = 15;
+        uint32_t index(uint64_t hash, uint32_t row) const;
+        void age();
+        std::vector<uint8_t> counters_;
+        uint32_t mask_;
+        uint64_t numAdditions_;
+        uint64_t sampleSize_;
+    };
+
+    // the LRU list points to the keys stored in the entry map.
+    typedef std::list<const std::string*> LruList;
+
+    struct Entry {
+        std::string value;
+        bool negative;
+        uint64_t hash;
+        uint64_t charge;
+        LruList::iterator lruPosition;
+    };
+    typedef boost::unordered_map<std::string, Entry> EntryMap;
+
+    struct Shard {
+        Shard();
+        boost::mutex mutex;
+        EntryMap entries;
+        LruList lru;  // most recently used first
+        FrequencySketch sketch;
+        uint64_t capacity;
+        uint64_t usage;
+        uint64_t generation; // bumped on every invalidation
+        Stats stats;
+    };
+
+    static const uint64_t ENTRY_OVERHEAD = 64;
+    static std::string makeCacheKey(const std::string& mapName, const std::string& key);
+    static uint64_t hashKey(const std::string& cacheKey);
+    static bool isCacheable(mapkeeper::ResponseCode::type responseCode);
+    Shard& getShard(uint64_t hash);
+    bool lookup(const std::string& cacheKey, uint64_t hash, mapkeeper::BinaryResponse& response, 
+                uint64_t& generation);
+    void fill(const std::string& cacheKey, uint64_t hash, uint64_t generation, 
+              const mapkeeper::BinaryResponse& response);
+    void evict(Shard& shard, EntryMap::iterator itr);
+    void invalidate(const std::string& mapName, const std::string& key);
+    void invalidateMap(const std::string& mapName);
+    void reportStats(uint32_t statsIntervalSec);
+
+    boost::scoped_array<Shard> shards_;
+    uint32_t numShards_;
+    boost::scoped_ptr<boost::thread> reporter_;
+};
+
+#endif // CACHING_HANDLER_H
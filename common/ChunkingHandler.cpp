@@ -0,0 +1,967 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <endian.h>
+#include "ChunkingHandler.h"
+#include "Projection.h"
+#include "ScanFilter.h"
+#include "ValuePatch.h"
+
+using namespace mapkeeper;
+
+// tag, value size, generation and chunk size.
+static const uint32_t MANIFEST_SIZE = 1 + 2 * sizeof(uint64_t) + sizeof(uint32_t);
+static const uint64_t WHOLE_VALUE = ~(uint64_t)0;
+static const std::string CHUNK_MAP_SUFFIX = "__chunks";
+
+// reads that keep finding the chunks of a value gone give up after this
+// many tries; each means a write replaced the value in the meantime.
+static const int MAX_READ_ATTEMPTS = 8;
+
+ChunkingHandler::Manifest::
+Manifest() :
+    size(0),
+    generation(0),
+    chunkSize(0)
+{
+}
+
+uint32_t ChunkingHandler::Manifest::
+numChunks() const
+{
+    return (size + chunkSize - 1) / chunkSize;
+}
+
+ChunkingHandler::Upload::
+Upload() :
+    numChunks(0),
+    lastActive(0)
+{
+}
+
+ChunkingHandler::
+ChunkingHandler(boost::shared_ptr<MapKeeperIf> handler, const ChunkSizes& chunkSizes,
+                uint32_t uploadTimeoutSec, uint32_t maxUploads) :
+    ForwardingHandler(handler),
+    chunkSizes_(chunkSizes),
+    nextGeneration_(0),
+    uploadTimeoutSec_(uploadTimeoutSec),
+    maxUploads_(maxUploads),
+    lastSweep_(0),
+    numChunksWritten_(0),
+    numChunksRead_(0),
+    numChunksRemoved_(0),
+    numUploads_(0),
+    numAbandonedUploads_(0),
+    numExpiredUploads_(0),
+    numReadRetries_(0)
+{
+}
+
+std::string ChunkingHandler::
+chunkMapName(const std::string& mapName)
+{
+    return mapName + CHUNK_MAP_SUFFIX;
+}
+
+ResponseCode::type ChunkingHandler::
+addMap(const std::string& mapName)
+{
+    ResponseCode::type rc = handler_->addMap(mapName);
+    if (rc != ResponseCode::Success || findChunkSize(mapName) == 0) {
+        return rc;
+    }
+    rc = handler_->addMap(chunkMapName(mapName));
+    return rc == ResponseCode::MapExists ? ResponseCode::Success : rc;
+}
+
+ResponseCode::type ChunkingHandler::
+dropMap(const std::string& mapName)
+{
+    ResponseCode::type rc = handler_->dropMap(mapName);
+    if (rc == ResponseCode::Success && findChunkSize(mapName) != 0) {
+        handler_->dropMap(chunkMapName(mapName));
+    }
+    return rc;
+}
+
+void ChunkingHandler::
+listMaps(StringListResponse& _return)
+{
+    handler_->listMaps(_return);
+    std::vector<std::string> maps;
+    for (size_t i = 0; i < _return.values.size(); i++) {
+        const std::string& name = _return.values[i];
+        if (name.size() > CHUNK_MAP_SUFFIX.size() &&
+            name.compare(name.size() - CHUNK_MAP_SUFFIX.size(), std::string::npos, CHUNK_MAP_SUFFIX) == 0 &&
+            findChunkSize(name.substr(0, name.size() - CHUNK_MAP_SUFFIX.size())) != 0) {
+            continue;
+        }
+        maps.push_back(name);
+    }
+    _return.values.swap(maps);
+}
+
+void ChunkingHandler::
+scan(RecordListResponse& _return, const std::string& mapName,
+     const ScanOrder::type order,
+     const std::string& startKey, const bool startKeyIncluded,
+     const std::string& endKey, const bool endKeyIncluded,
+     const int32_t maxRecords, const int32_t maxBytes)
+{
+    if (findChunkSize(mapName) == 0) {
+        handler_->scan(_return, mapName, order, startKey, startKeyIncluded,
+                       endKey, endKeyIncluded, maxRecords, maxBytes);
+        return;
+    }
+    RecordListSink sink(_return);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, ScanOptions());
+}
+
+void ChunkingHandler::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName,
+                const ScanOrder::type order,
+                const std::string& startKey, const bool startKeyIncluded,
+                const std::string& endKey, const bool endKeyIncluded,
+                const int32_t maxRecords, const int32_t maxBytes,
+                const ScanOptions& options)
+{
+    if (findChunkSize(mapName) == 0) {
+        handler_->scanWithOptions(_return, mapName, order, startKey, startKeyIncluded,
+                                  endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        return;
+    }
+    RecordListSink sink(_return);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+void ChunkingHandler::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName,
+           const ScanOrder::type order,
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes,
+           const ScanOptions& options)
+{
+    if (findChunkSize(mapName) == 0) {
+        handler_->scanPacked(_return, mapName, order, startKey, startKeyIncluded,
+                             endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        return;
+    }
+    PackedRecordSink sink(_return, options.sharedKeyPrefixes);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+/**
+ * The backend scans with the options that don't look at values, and
+ * returns inline values and manifests unless the scan is keysOnly.
+ * maxBytes counts those in the backend, and values as returned here.
+ */
+void ChunkingHandler::
+scanInto(ScanSink& sink, const std::string& mapName,
+         const ScanOrder::type order,
+         const std::string& startKey, const bool startKeyIncluded,
+         const std::string& endKey, const bool endKeyIncluded,
+         const int32_t maxRecords, const int32_t maxBytes,
+         const ScanOptions& options)
+{
+    ScanOptions storedOptions = options;
+    storedOptions.keysOnly = options.keysOnly && options.valueFilters.empty();
+    storedOptions.valueOffset = 0;
+    storedOptions.valueLength = -1;
+    storedOptions.valueFilters.clear();
+    storedOptions.sharedKeyPrefixes = false;
+    storedOptions.compressedValues = false;
+    if (!options.valueFilters.empty() && options.maxExamined <= 0) {
+        // value filters alone wouldn't give the backend a budget.
+        storedOptions.maxExamined = ScanFilter::DEFAULT_MAX_EXAMINED;
+    }
+    PackedRecordListResponse response;
+    handler_->scanPacked(response, mapName, order, startKey, startKeyIncluded,
+                         endKey, endKeyIncluded, maxRecords, maxBytes, storedOptions);
+    if (response.responseCode != ResponseCode::Success &&
+        response.responseCode != ResponseCode::ScanEnded) {
+        sink.setResponseCode(response.responseCode);
+        return;
+    }
+    PackedRecordReader reader(response.records);
+    if (!reader.valid()) {
+        fprintf(stderr, "malformed scanPacked response for %s\n", mapName.c_str());
+        sink.setResponseCode(ResponseCode::Error);
+        return;
+    }
+
+    std::string value;
+    std::string lastKey;
+    while (reader.next()) {
+        if (sink.full(maxRecords, maxBytes)) {
+            sink.setResponseCode(ResponseCode::Success);
+            sink.setResumeKey(lastKey);
+            return;
+        }
+        lastKey.assign(reader.key(), reader.keySize());
+        if (storedOptions.keysOnly) {
+            sink.add(reader.key(), reader.keySize(), reader.value(), 0);
+            continue;
+        }
+        const char* stored = reader.value();
+        Manifest manifest;
+        bool projected = false;
+        if (reader.valueSize() >= 1 && stored[0] == INLINE) {
+            value.assign(stored + 1, reader.valueSize() - 1);
+        } else if (decodeManifest(stored, reader.valueSize(), manifest)) {
+            // without value filters, only the part that's returned is read.
+            size_t offset = 0;
+            size_t length = manifest.size;
+            projected = options.valueFilters.empty();
+            if (projected) {
+                projectRange(options, manifest.size, offset, length);
+            }
+            ResponseCode::type rc = readChunks(mapName, lastKey, manifest, offset, length, value);
+            if (rc == ResponseCode::RecordNotFound) {
+                rc = readRecord(mapName, lastKey, offset, length, value);
+            }
+            if (rc == ResponseCode::RecordNotFound) {
+                continue; // removed since the backend scanned it
+            }
+            if (rc != ResponseCode::Success) {
+                sink.clear();
+                sink.setResponseCode(ResponseCode::Error);
+                return;
+            }
+        } else {
+            fprintf(stderr, "malformed chunked value in %s\n", mapName.c_str());
+            sink.clear();
+            sink.setResponseCode(ResponseCode::Error);
+            return;
+        }
+        bool matches = true;
+        for (size_t i = 0; matches && i < options.valueFilters.size(); i++) {
+            matches = ScanFilter::matchesValue(options.valueFilters[i], value.data(), value.size());
+        }
+        if (!matches) {
+            continue;
+        }
+        size_t offset = 0;
+        size_t length = value.size();
+        if (!projected) {
+            projectRange(options, value.size(), offset, length);
+        }
+        sink.add(reader.key(), reader.keySize(), value.data() + offset, length);
+    }
+    sink.setResponseCode(response.responseCode);
+    if (response.responseCode == ResponseCode::Success) {
+        sink.setResumeKey(response.resumeKey.empty() ? lastKey : response.resumeKey);
+    }
+}
+
+void ChunkingHandler::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    if (findChunkSize(mapName) == 0) {
+        handler_->get(_return, mapName, key);
+        return;
+    }
+    _return.responseCode = readRecord(mapName, key, 0, WHOLE_VALUE, _return.value);
+}
+
+void ChunkingHandler::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+         const int64_t offset, const int32_t length)
+{
+    if (findChunkSize(mapName) == 0) {
+        handler_->getRange(_return, mapName, key, offset, length);
+        return;
+    }
+    if (offset < 0 || length < 0) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.responseCode = readRecord(mapName, key, offset, length, _return.value);
+}
+
+ResponseCode::type ChunkingHandler::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return write(PUT, mapName, key, value);
+}
+
+ResponseCode::type ChunkingHandler::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return write(INSERT, mapName, key, value);
+}
+
+ResponseCode::type ChunkingHandler::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return write(UPDATE, mapName, key, value);
+}
+
+ResponseCode::type ChunkingHandler::
+putChunk(const std::string& mapName, const std::string& key,
+         const int64_t offset, const std::string& data, const bool last)
+{
+    uint32_t chunkSize = findChunkSize(mapName);
+    if (chunkSize == 0) {
+        return handler_->putChunk(mapName, key, offset, data, last);
+    }
+    if (offset < 0) {
+        return ResponseCode::Error;
+    }
+    expireUploads();
+
+    // the key's mutex keeps other writes of the key, and with them every
+    // other use of its upload, out until this piece is in.
+    boost::mutex::scoped_lock keyLock(keyMutex(mapName, key));
+    UploadKey uploadKey(mapName, key);
+    Upload abandoned;
+    Uploads::iterator itr;
+    {
+        boost::mutex::scoped_lock lock(uploadsMutex_);
+        itr = uploads_.find(uploadKey);
+        if (offset == 0) {
+            if (itr != uploads_.end()) {
+                abandoned = itr->second;
+                uploads_.erase(itr);
+            } else if (maxUploads_ > 0 && uploads_.size() >= maxUploads_) {
+                fprintf(stderr, "putChunk to %s: too many open uploads\n", mapName.c_str());
+                return ResponseCode::Error;
+            }
+            itr = uploads_.insert(std::make_pair(uploadKey, Upload())).first;
+        } else if (itr == uploads_.end() || itr->second.manifest.size != (uint64_t)offset) {
+            fprintf(stderr, "putChunk at %ld doesn't continue an upload to %s\n",
+                    offset, mapName.c_str());
+            return ResponseCode::Error;
+        }
+        itr->second.lastActive = time(NULL);
+    }
+    if (abandoned.numChunks > 0) {
+        __sync_fetch_and_add(&numAbandonedUploads_, 1);
+        removeChunks(mapName, key, abandoned.manifest.generation, abandoned.numChunks);
+    }
+    Upload& upload = itr->second;
+    if (offset == 0) {
+        __sync_fetch_and_add(&numUploads_, 1);
+        upload.manifest.generation = newGeneration();
+        upload.manifest.chunkSize = chunkSize;
+    }
+
+    // full chunks of data are written straight from it, and the rest
+    // goes through the tail.
+    bool ok = true;
+    const char* next = data.data();
+    uint32_t remaining = data.size();
+    while (ok && remaining > 0) {
+        if (upload.tail.empty() && remaining >= chunkSize) {
+            ok = writeChunk(mapName, key, upload.manifest.generation, upload.numChunks, next, chunkSize);
+            upload.numChunks++;
+            next += chunkSize;
+            remaining -= chunkSize;
+            continue;
+        }
+        uint32_t size = std::min(chunkSize - (uint32_t)upload.tail.size(), remaining);
+        upload.tail.append(next, size);
+        next += size;
+        remaining -= size;
+        if (upload.tail.size() == chunkSize) {
+            ok = writeChunk(mapName, key, upload.manifest.generation, upload.numChunks,
+                            upload.tail.data(), upload.tail.size());
+            upload.numChunks++;
+            upload.tail.clear();
+        }
+    }
+    upload.manifest.size += data.size();
+
+    ResponseCode::type rc = ResponseCode::Success;
+    if (!ok) {
+        rc = ResponseCode::Error;
+        removeChunks(mapName, key, upload.manifest.generation, upload.numChunks);
+    } else if (last) {
+        std::string stored;
+        if (upload.numChunks == 0) {
+            stored.assign(1, (char)INLINE);
+            stored.append(upload.tail);
+            rc = commit(PUT, mapName, key, stored, NULL);
+        } else if (!upload.tail.empty() &&
+                   !writeChunk(mapName, key, upload.manifest.generation, upload.numChunks,
+                               upload.tail.data(), upload.tail.size())) {
+            rc = ResponseCode::Error;
+            removeChunks(mapName, key, upload.manifest.generation, upload.numChunks + 1);
+        } else {
+            // commit() removes the chunks if the put fails.
+            encodeManifest(upload.manifest, stored);
+            rc = commit(PUT, mapName, key, stored, &upload.manifest);
+        }
+    }
+    if (last || rc != ResponseCode::Success) {
+        boost::mutex::scoped_lock lock(uploadsMutex_);
+        uploads_.erase(itr);
+    }
+    return rc;
+}
+
+ResponseCode::type ChunkingHandler::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    if (findChunkSize(mapName) == 0) {
+        return handler_->append(mapName, key, data);
+    }
+    return patch(mapName, key, -1, data);
+}
+
+ResponseCode::type ChunkingHandler::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+        const std::string& data)
+{
+    if (findChunkSize(mapName) == 0) {
+        return handler_->writeAt(mapName, key, offset, data);
+    }
+    if (offset < 0) {
+        return ResponseCode::Error;
+    }
+    return patch(mapName, key, offset, data);
+}
+
+ResponseCode::type ChunkingHandler::
+remove(const std::string& mapName, const std::string& key)
+{
+    if (findChunkSize(mapName) == 0) {
+        return handler_->remove(mapName, key);
+    }
+    boost::mutex::scoped_lock keyLock(keyMutex(mapName, key));
+    Manifest old;
+    bool chunked = readManifest(mapName, key, old);
+    ResponseCode::type rc = handler_->remove(mapName, key);
+    if (rc == ResponseCode::Success && chunked) {
+        removeChunks(mapName, key, old.generation, old.numChunks());
+    }
+    return rc;
+}
+
+void ChunkingHandler::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName,
+         const std::vector<std::string>& keys)
+{
+    if (findChunkSize(mapName) == 0) {
+        handler_->multiGet(_return, mapName, keys);
+        return;
+    }
+    _return.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        _return[i].responseCode = readRecord(mapName, keys[i], 0, WHOLE_VALUE, _return[i].value);
+    }
+}
+
+void ChunkingHandler::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+         const std::vector<Record>& records)
+{
+    writeRecords(_return, PUT, mapName, records);
+}
+
+void ChunkingHandler::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    writeRecords(_return, INSERT, mapName, records);
+}
+
+void ChunkingHandler::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    writeRecords(_return, UPDATE, mapName, records);
+}
+
+void ChunkingHandler::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<std::string>& keys)
+{
+    if (findChunkSize(mapName) == 0) {
+        handler_->multiRemove(_return, mapName, keys);
+        return;
+    }
+    _return.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        _return[i] = remove(mapName, keys[i]);
+    }
+}
+
+void ChunkingHandler::
+getStats(StatsResponse& _return)
+{
+    handler_->getStats(_return);
+    _return.counters["chunking.chunks_written"] = __sync_fetch_and_add(&numChunksWritten_, 0);
+    _return.counters["chunking.chunks_read"] = __sync_fetch_and_add(&numChunksRead_, 0);
+    _return.counters["chunking.chunks_removed"] = __sync_fetch_and_add(&numChunksRemoved_, 0);
+    _return.counters["chunking.uploads"] = __sync_fetch_and_add(&numUploads_, 0);
+    _return.counters["chunking.abandoned_uploads"] = __sync_fetch_and_add(&numAbandonedUploads_, 0);
+    _return.counters["chunking.expired_uploads"] = __sync_fetch_and_add(&numExpiredUploads_, 0);
+    _return.counters["chunking.read_retries"] = __sync_fetch_and_add(&numReadRetries_, 0);
+    boost::mutex::scoped_lock lock(uploadsMutex_);
+    _return.counters["chunking.open_uploads"] = uploads_.size();
+}
+
+uint32_t ChunkingHandler::
+findChunkSize(const std::string& mapName) const
+{
+    ChunkSizes::const_iterator itr = chunkSizes_.find(mapName);
+    return itr == chunkSizes_.end() ? 0 : itr->second;
+}
+
+/**
+ * Generations start from the time the server started, so that they don't
+ * repeat across restarts.
+ */
+uint64_t ChunkingHandler::
+newGeneration()
+{
+    static const uint64_t startTime = time(NULL);
+    return (startTime << 32) + __sync_fetch_and_add(&nextGeneration_, 1);
+}
+
+boost::mutex& ChunkingHandler::
+keyMutex(const std::string& mapName, const std::string& key)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < mapName.size(); i++) {
+        hash = (hash ^ (uint8_t)mapName[i]) * 16777619u;
+    }
+    for (size_t i = 0; i < key.size(); i++) {
+        hash = (hash ^ (uint8_t)key[i]) * 16777619u;
+    }
+    return keyMutexes_[hash % NUM_KEY_MUTEXES];
+}
+
+std::string ChunkingHandler::
+chunkKey(const std::string& key, uint64_t generation, uint32_t index)
+{
+    uint32_t keySize = htobe32(key.size());
+    generation = htobe64(generation);
+    index = htobe32(index);
+    std::string chunkKey;
+    chunkKey.reserve(sizeof(keySize) + key.size() + sizeof(generation) + sizeof(index));
+    chunkKey.append((const char*)&keySize, sizeof(keySize));
+    chunkKey.append(key);
+    chunkKey.append((const char*)&generation, sizeof(generation));
+    chunkKey.append((const char*)&index, sizeof(index));
+    return chunkKey;
+}
+
+void ChunkingHandler::
+encodeManifest(const Manifest& manifest, std::string& stored)
+{
+    uint64_t size = htobe64(manifest.size);
+    uint64_t generation = htobe64(manifest.generation);
+    uint32_t chunkSize = htobe32(manifest.chunkSize);
+    stored.assign(1, (char)MANIFEST);
+    stored.append((const char*)&size, sizeof(size));
+    stored.append((const char*)&generation, sizeof(generation));
+    stored.append((const char*)&chunkSize, sizeof(chunkSize));
+}
+
+bool ChunkingHandler::
+decodeManifest(const char* stored, uint32_t size, Manifest& manifest)
+{
+    if (size != MANIFEST_SIZE || stored[0] != MANIFEST) {
+        return false;
+    }
+    memcpy(&manifest.size, stored + 1, sizeof(manifest.size));
+    memcpy(&manifest.generation, stored + 1 + sizeof(uint64_t), sizeof(manifest.generation));
+    memcpy(&manifest.chunkSize, stored + 1 + 2 * sizeof(uint64_t), sizeof(manifest.chunkSize));
+    manifest.size = be64toh(manifest.size);
+    manifest.generation = be64toh(manifest.generation);
+    manifest.chunkSize = be32toh(manifest.chunkSize);
+    return manifest.chunkSize > 0 && manifest.size <= (uint64_t)manifest.chunkSize * 0xffffffffULL;
+}
+
+/**
+ * Reads [offset, offset + length) of a value. Inline values are read in
+ * one backend call; it reads at least as much as a manifest takes, and
+ * at most the range or the largest inline record, whichever is less.
+ */
+ResponseCode::type ChunkingHandler::
+readRecord(const std::string& mapName, const std::string& key,
+           uint64_t offset, uint64_t length, std::string& value)
+{
+    uint64_t prefix = std::max(1 + (uint64_t)findChunkSize(mapName), (uint64_t)MANIFEST_SIZE);
+    if (offset < prefix && length < prefix - offset - 1) {
+        prefix = std::max(1 + offset + length, (uint64_t)MANIFEST_SIZE);
+    }
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        if (attempt > 0) {
+            __sync_fetch_and_add(&numReadRetries_, 1);
+        }
+        BinaryResponse stored;
+        handler_->getRange(stored, mapName, key, 0, prefix);
+        if (stored.responseCode != ResponseCode::Success) {
+            value.clear();
+            return stored.responseCode;
+        }
+        if (!stored.value.empty() && stored.value[0] == INLINE) {
+            if (offset + 1 >= stored.value.size()) {
+                value.clear();
+            } else {
+                value.assign(stored.value, offset + 1, length);
+            }
+            return ResponseCode::Success;
+        }
+        Manifest manifest;
+        if (!decodeManifest(stored.value.data(), stored.value.size(), manifest)) {
+            fprintf(stderr, "malformed chunked value in %s\n", mapName.c_str());
+            value.clear();
+            return ResponseCode::Error;
+        }
+        ResponseCode::type rc = readChunks(mapName, key, manifest, offset, length, value);
+        if (rc != ResponseCode::RecordNotFound) {
+            return rc;
+        }
+    }
+    fprintf(stderr, "chunks of a value in %s keep going away\n", mapName.c_str());
+    value.clear();
+    return ResponseCode::Error;
+}
+
+/**
+ * Reads [offset, offset + length) of a chunked value, one chunk at a
+ * time.
+ *
+ * @returns RecordNotFound if a chunk is missing, as it is when a write
+ *          replaced the value after its manifest was read.
+ */
+ResponseCode::type ChunkingHandler::
+readChunks(const std::string& mapName, const std::string& key, const Manifest& manifest,
+           uint64_t offset, uint64_t length, std::string& value)
+{
+    value.clear();
+    if (offset >= manifest.size) {
+        return ResponseCode::Success;
+    }
+    uint64_t end = offset + std::min(length, manifest.size - offset);
+    value.reserve(end - offset);
+    std::string chunkMap = chunkMapName(mapName);
+    for (uint32_t index = offset / manifest.chunkSize; (uint64_t)index * manifest.chunkSize < end; index++) {
+        uint64_t chunkBegin = (uint64_t)index * manifest.chunkSize;
+        uint64_t from = std::max(offset, chunkBegin) - chunkBegin;
+        uint64_t to = std::min(end, chunkBegin + manifest.chunkSize) - chunkBegin;
+        BinaryResponse chunk;
+        handler_->getRange(chunk, chunkMap, chunkKey(key, manifest.generation, index), from, to - from);
+        __sync_fetch_and_add(&numChunksRead_, 1);
+        if (chunk.responseCode != ResponseCode::Success) {
+            value.clear();
+            return chunk.responseCode == ResponseCode::RecordNotFound ?
+                ResponseCode::RecordNotFound : ResponseCode::Error;
+        }
+        if (chunk.value.size() != to - from) {
+            fprintf(stderr, "chunk %u of a value in %s is %lu bytes short\n",
+                    index, mapName.c_str(), to - from - chunk.value.size());
+            value.clear();
+            return ResponseCode::Error;
+        }
+        value.append(chunk.value);
+    }
+    return ResponseCode::Success;
+}
+
+/**
+ * @returns whether the record exists and holds a manifest.
+ */
+bool ChunkingHandler::
+readManifest(const std::string& mapName, const std::string& key, Manifest& manifest)
+{
+    BinaryResponse stored;
+    handler_->getRange(stored, mapName, key, 0, MANIFEST_SIZE);
+    return stored.responseCode == ResponseCode::Success &&
+        decodeManifest(stored.value.data(), stored.value.size(), manifest);
+}
+
+bool ChunkingHandler::
+writeChunk(const std::string& mapName, const std::string& key, uint64_t generation,
+           uint32_t index, const char* data, uint32_t size)
+{
+    ResponseCode::type rc = handler_->insert(chunkMapName(mapName), chunkKey(key, generation, index),
+                                             std::string(data, size));
+    if (rc != ResponseCode::Success) {
+        fprintf(stderr, "can't write chunk %u of a value in %s: %d\n", index, mapName.c_str(), rc);
+        return false;
+    }
+    __sync_fetch_and_add(&numChunksWritten_, 1);
+    return true;
+}
+
+void ChunkingHandler::
+removeChunks(const std::string& mapName, const std::string& key,
+             uint64_t generation, uint32_t numChunks, uint32_t firstIndex)
+{
+    std::string chunkMap = chunkMapName(mapName);
+    for (uint32_t index = firstIndex; index < numChunks; index++) {
+        // chunks that were never written are already gone.
+        if (handler_->remove(chunkMap, chunkKey(key, generation, index)) == ResponseCode::Success) {
+            __sync_fetch_and_add(&numChunksRemoved_, 1);
+        }
+    }
+}
+
+/**
+ * Drops the uploads that have been idle for uploadTimeoutSec_, looking
+ * at most once a second. An upload is only touched under its key's
+ * mutex, so the expired ones are collected first, and each is checked
+ * again under its mutex in case a piece arrived in the meantime.
+ */
+void ChunkingHandler::
+expireUploads()
+{
+    if (uploadTimeoutSec_ == 0) {
+        return;
+    }
+    time_t now = time(NULL);
+    std::vector<UploadKey> expired;
+    {
+        boost::mutex::scoped_lock lock(uploadsMutex_);
+        if (now == lastSweep_) {
+            return;
+        }
+        lastSweep_ = now;
+        for (Uploads::const_iterator itr = uploads_.begin(); itr != uploads_.end(); itr++) {
+            if (now - itr->second.lastActive >= (time_t)uploadTimeoutSec_) {
+                expired.push_back(itr->first);
+            }
+        }
+    }
+    for (std::vector<UploadKey>::const_iterator uploadKey = expired.begin();
+         uploadKey != expired.end(); uploadKey++) {
+        const std::string& mapName = uploadKey->first;
+        const std::string& key = uploadKey->second;
+        boost::mutex::scoped_lock keyLock(keyMutex(mapName, key));
+        Upload upload;
+        {
+            boost::mutex::scoped_lock lock(uploadsMutex_);
+            Uploads::iterator itr = uploads_.find(*uploadKey);
+            if (itr == uploads_.end() || now - itr->second.lastActive < (time_t)uploadTimeoutSec_) {
+                continue;
+            }
+            upload = itr->second;
+            uploads_.erase(itr);
+        }
+        __sync_fetch_and_add(&numExpiredUploads_, 1);
+        removeChunks(mapName, key, upload.manifest.generation, upload.numChunks);
+    }
+}
+
+ResponseCode::type ChunkingHandler::
+write(WriteOp op, const std::string& mapName, const std::string& key, const std::string& value)
+{
+    uint32_t chunkSize = findChunkSize(mapName);
+    if (chunkSize == 0) {
+        switch (op) {
+        case PUT:
+            return handler_->put(mapName, key, value);
+        case INSERT:
+            return handler_->insert(mapName, key, value);
+        default:
+            return handler_->update(mapName, key, value);
+        }
+    }
+    boost::mutex::scoped_lock keyLock(keyMutex(mapName, key));
+    std::string stored;
+    if (value.size() <= chunkSize) {
+        stored.assign(1, (char)INLINE);
+        stored.append(value);
+        return commit(op, mapName, key, stored, NULL);
+    }
+    Manifest manifest;
+    manifest.size = value.size();
+    manifest.generation = newGeneration();
+    manifest.chunkSize = chunkSize;
+    uint32_t numChunks = manifest.numChunks();
+    for (uint32_t index = 0; index < numChunks; index++) {
+        uint64_t begin = (uint64_t)index * chunkSize;
+        if (!writeChunk(mapName, key, manifest.generation, index, value.data() + begin,
+                        std::min((uint64_t)chunkSize, value.size() - begin))) {
+            removeChunks(mapName, key, manifest.generation, index);
+            return ResponseCode::Error;
+        }
+    }
+    encodeManifest(manifest, stored);
+    return commit(op, mapName, key, stored, &manifest);
+}
+
+/**
+ * Writes a record of a chunked map, with the key's mutex held, and
+ * removes the chunks of the value it replaces. If the write fails, the
+ * chunks of manifest are removed instead.
+ */
+ResponseCode::type ChunkingHandler::
+commit(WriteOp op, const std::string& mapName, const std::string& key,
+       const std::string& stored, const Manifest* manifest)
+{
+    Manifest old;
+    bool chunked = op != INSERT && readManifest(mapName, key, old);
+    ResponseCode::type rc;
+    switch (op) {
+    case PUT:
+        rc = handler_->put(mapName, key, stored);
+        break;
+    case INSERT:
+        rc = handler_->insert(mapName, key, stored);
+        break;
+    default:
+        rc = handler_->update(mapName, key, stored);
+        break;
+    }
+    if (rc != ResponseCode::Success) {
+        if (manifest != NULL) {
+            removeChunks(mapName, key, manifest->generation, manifest->numChunks());
+        }
+        return rc;
+    }
+    if (chunked) {
+        removeChunks(mapName, key, old.generation, old.numChunks());
+    }
+    return rc;
+}
+
+/**
+ * Writes data at offset, or at the end of the value if offset is
+ * negative.
+ */
+ResponseCode::type ChunkingHandler::
+patch(const std::string& mapName, const std::string& key, int64_t offset, const std::string& data)
+{
+    uint32_t chunkSize = findChunkSize(mapName);
+    boost::mutex::scoped_lock keyLock(keyMutex(mapName, key));
+    BinaryResponse stored;
+    handler_->get(stored, mapName, key);
+    if (stored.responseCode != ResponseCode::Success) {
+        return stored.responseCode;
+    }
+    Manifest manifest;
+    bool chunked = decodeManifest(stored.value.data(), stored.value.size(), manifest);
+    if (!chunked && (stored.value.empty() || stored.value[0] != INLINE)) {
+        fprintf(stderr, "malformed chunked value in %s\n", mapName.c_str());
+        return ResponseCode::Error;
+    }
+    uint64_t size = chunked ? manifest.size : stored.value.size() - 1;
+    if (offset < 0) {
+        offset = size;
+    }
+    if (!validPatch(offset, data.size())) {
+        return ResponseCode::Error;
+    }
+    if (data.empty()) {
+        return ResponseCode::Success;
+    }
+    uint64_t end = offset + data.size();
+    if (!chunked && std::max(size, end) <= chunkSize) {
+        // past the tag byte.
+        return (uint64_t)offset == size ? handler_->append(mapName, key, data) :
+            handler_->writeAt(mapName, key, offset + 1, data);
+    }
+
+    if (!chunked) {
+        // the value's bytes so far become its first chunks.
+        manifest.size = size;
+        manifest.generation = newGeneration();
+        manifest.chunkSize = chunkSize;
+        uint32_t numChunks = manifest.numChunks();
+        for (uint32_t index = 0; index < numChunks; index++) {
+            uint64_t begin = (uint64_t)index * chunkSize;
+            if (!writeChunk(mapName, key, manifest.generation, index, stored.value.data() + 1 + begin,
+                            std::min((uint64_t)chunkSize, size - begin))) {
+                removeChunks(mapName, key, manifest.generation, index);
+                return ResponseCode::Error;
+            }
+        }
+    }
+    // patchChunks() removes the chunks it adds if it fails, so only the
+    // ones made from an inline value are left to remove.
+    uint32_t oldNumChunks = manifest.numChunks();
+    if (!patchChunks(mapName, key, manifest, offset, data)) {
+        if (!chunked) {
+            removeChunks(mapName, key, manifest.generation, oldNumChunks);
+        }
+        return ResponseCode::Error;
+    }
+    if (chunked && manifest.size == size) {
+        return ResponseCode::Success;
+    }
+    std::string newStored;
+    encodeManifest(manifest, newStored);
+    ResponseCode::type rc = handler_->update(mapName, key, newStored);
+    if (rc != ResponseCode::Success) {
+        removeChunks(mapName, key, manifest.generation, manifest.numChunks(), chunked ? oldNumChunks : 0);
+    }
+    return rc;
+}
+
+/**
+ * Writes data at offset into the chunks of manifest, one chunk at a
+ * time, and grows manifest to cover it. The gap between the old end of
+ * the value and offset is filled with zero bytes.
+ */
+bool ChunkingHandler::
+patchChunks(const std::string& mapName, const std::string& key, Manifest& manifest,
+            uint64_t offset, const std::string& data)
+{
+    std::string chunkMap = chunkMapName(mapName);
+    uint64_t begin = std::min(manifest.size, offset);
+    uint64_t end = offset + data.size();
+    uint32_t oldNumChunks = manifest.numChunks();
+    std::string piece;
+    for (uint64_t index = begin / manifest.chunkSize; index * manifest.chunkSize < end; index++) {
+        uint64_t chunkBegin = index * manifest.chunkSize;
+        uint64_t from = std::max(begin, chunkBegin);
+        uint64_t to = std::min(end, chunkBegin + manifest.chunkSize);
+        piece.clear();
+        if (from < offset) {
+            piece.append(std::min(offset, to) - from, '\0');
+        }
+        if (to > offset) {
+            uint64_t dataFrom = std::max(from, offset) - offset;
+            piece.append(data, dataFrom, to - offset - dataFrom);
+        }
+        std::string chunk = chunkKey(key, manifest.generation, index);
+        ResponseCode::type rc = chunkBegin < manifest.size ?
+            handler_->writeAt(chunkMap, chunk, from - chunkBegin, piece) :
+            handler_->insert(chunkMap, chunk, piece);
+        if (rc != ResponseCode::Success) {
+            fprintf(stderr, "can't write chunk %lu of a value in %s: %d\n", index, mapName.c_str(), rc);
+            // the manifest doesn't cover the chunks added past the end.
+            removeChunks(mapName, key, manifest.generation, index, oldNumChunks);
+            return false;
+        }
+        __sync_fetch_and_add(&numChunksWritten_, 1);
+    }
+    manifest.size = std::max(manifest.size, end);
+    return true;
+}
+
+void ChunkingHandler::
+writeRecords(std::vector<ResponseCode::type>& _return, WriteOp op,
+             const std::string& mapName, const std::vector<Record>& records)
+{
+    if (findChunkSize(mapName) == 0) {
+        switch (op) {
+        case PUT:
+            handler_->multiPut(_return, mapName, records);
+            break;
+        case INSERT:
+            handler_->multiInsert(_return, mapName, records);
+            break;
+        default:
+            handler_->multiUpdate(_return, mapName, records);
+            break;
+        }
+        return;
+    }
+    _return.resize(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        _return[i] = write(op, mapName, records[i].key, records[i].value);
+    }
+}
@@ -0,0 +1,240 @@
+#ifndef CHUNKING_HANDLER_H
+#define CHUNKING_HANDLER_H
+
+#include <ctime>
+#include <map>
+#include <utility>
+#include <boost/thread/mutex.hpp>
+#include "ForwardingHandler.h"
+#include "ScanSink.h"
+
+/**
+ * Splits the large values of some maps into chunk records, so that no
+ * backend record, and no buffer behind getRange() or putChunk(), is
+ * larger than the map's chunk size.
+ *
+ * Every value of a chunked map starts with a tag byte:
+ *
+ *   | INLINE | value |
+ *   | MANIFEST | value size | generation | chunk size |
+ *
+ * Values up to the chunk size are stored inline. Larger values go into
+ * the companion map <map>__chunks, one record per chunk, keyed by
+ *
+ *   | key size | key | generation | chunk index |
+ *
+ * and the record itself holds a manifest. All integers are big-endian;
+ * sizes and chunk indexes are 32 bits, value sizes and generations 64.
+ * Every write of a large value gets a new generation, and the chunks of
+ * the old one are removed once the manifest that replaces it is in, so
+ * readers that race with a write either see the old value or retry.
+ *
+ * Writes of the same key through this handler are serialized. Chunks
+ * are orphaned if the server stops between writing them and writing the
+ * manifest, and values written to a map around this handler, or before
+ * it had chunking, can't be read through it. Uploads that get no piece
+ * for a while are dropped along with their chunks.
+ *
+ * get() and put() still hold the whole value; only getRange() and
+ * putChunk() are bounded by the chunk size. Scans read the chunks of the
+ * part of each value they return, and whole values when they have value
+ * filters.
+ */
+class ChunkingHandler : public ForwardingHandler {
+public:
+    typedef std::map<std::string, uint32_t> ChunkSizes;
+
+    /**
+     * @param chunkSizes the chunk size of each map with chunked storage.
+     *                   Maps that aren't in it are passed through.
+     * @param uploadTimeoutSec putChunk() uploads idle for this long are
+     *                   dropped (0 keeps them until they're finished).
+     * @param maxUploads putChunk() fails to start an upload while this
+     *                   many are open (0 means no limit).
+     */
+    ChunkingHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> handler, const ChunkSizes& chunkSizes,
+                    uint32_t uploadTimeoutSec = 300, uint32_t maxUploads = 1024);
+
+    /**
+     * Name of the map that holds the chunks of mapName.
+     */
+    static std::string chunkMapName(const std::string& mapName);
+
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName);
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName);
+
+    /**
+     * Leaves out the maps that hold chunks.
+     */
+    void listMaps(mapkeeper::StringListResponse& _return);
+
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+                         const mapkeeper::ScanOrder::type order,
+                         const std::string& startKey, const bool startKeyIncluded,
+                         const std::string& endKey, const bool endKeyIncluded,
+                         const int32_t maxRecords, const int32_t maxBytes,
+                         const mapkeeper::ScanOptions& options);
+
+    /**
+     * Never returns values compressed, since a chunked value isn't stored
+     * in one piece.
+     */
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName,
+                    const mapkeeper::ScanOrder::type order,
+                    const std::string& startKey, const bool startKeyIncluded,
+                    const std::string& endKey, const bool endKeyIncluded,
+                    const int32_t maxRecords, const int32_t maxBytes,
+                    const mapkeeper::ScanOptions& options);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+
+    /**
+     * Reads only the chunks the range overlaps.
+     */
+    void getRange(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length);
+
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+
+    /**
+     * Writes each full chunk as soon as its pieces arrive, and keeps at
+     * most a chunk of an upload in memory. The value is put when the
+     * last piece arrives.
+     */
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key,
+                                           const int64_t offset, const std::string& data, const bool last);
+
+    /**
+     * Inline values that stay inline are patched in place by the
+     * backend. Otherwise only the chunks that data overlaps are written,
+     * and the manifest if the value grows; an inline value that outgrows
+     * the chunk size becomes chunks first.
+     *
+     * Unlike put(), these aren't atomic: the chunks of the current
+     * generation are written in place, to avoid copying the whole value.
+     * Readers of a chunked value may see part of a write that's under
+     * way, and a write that fails partway may leave the bytes it covered
+     * within the old size partly written. Chunks it added past the old
+     * size are removed, so the value keeps its old size.
+     */
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key,
+                                          const int64_t offset, const std::string& data);
+
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                  const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<std::string>& keys);
+
+    /**
+     * Adds "chunking.*" counters to the backend's statistics.
+     */
+    void getStats(mapkeeper::StatsResponse& _return);
+
+private:
+    enum Tag {
+        INLINE = 0,
+        MANIFEST = 1,
+    };
+
+    enum WriteOp {
+        PUT,
+        INSERT,
+        UPDATE,
+    };
+
+    struct Manifest {
+        Manifest();
+        uint32_t numChunks() const;
+
+        uint64_t size;
+        uint64_t generation;
+        uint32_t chunkSize;
+    };
+
+    /**
+     * An unfinished putChunk() upload. Its chunks are written under the
+     * generation the final manifest will have.
+     */
+    struct Upload {
+        Upload();
+
+        Manifest manifest;      // size is the number of bytes received
+        uint32_t numChunks;     // written so far
+        std::string tail;       // bytes received after the last full chunk
+        time_t lastActive;      // when the last piece arrived
+    };
+
+    typedef std::pair<std::string, std::string> UploadKey; // map and key
+    typedef std::map<UploadKey, Upload> Uploads;
+
+    static const uint32_t NUM_KEY_MUTEXES = 64;
+
+    uint32_t findChunkSize(const std::string& mapName) const;
+    uint64_t newGeneration();
+    boost::mutex& keyMutex(const std::string& mapName, const std::string& key);
+    static std::string chunkKey(const std::string& key, uint64_t generation, uint32_t index);
+    static void encodeManifest(const Manifest& manifest, std::string& stored);
+    static bool decodeManifest(const char* stored, uint32_t size, Manifest& manifest);
+
+    mapkeeper::ResponseCode::type readRecord(const std::string& mapName, const std::string& key,
+                                             uint64_t offset, uint64_t length, std::string& value);
+    mapkeeper::ResponseCode::type readChunks(const std::string& mapName, const std::string& key,
+                                             const Manifest& manifest, uint64_t offset, uint64_t length,
+                                             std::string& value);
+    bool readManifest(const std::string& mapName, const std::string& key, Manifest& manifest);
+    bool writeChunk(const std::string& mapName, const std::string& key, uint64_t generation,
+                    uint32_t index, const char* data, uint32_t size);
+    void removeChunks(const std::string& mapName, const std::string& key,
+                      uint64_t generation, uint32_t numChunks, uint32_t firstIndex = 0);
+    void expireUploads();
+    mapkeeper::ResponseCode::type write(WriteOp op, const std::string& mapName,
+                                        const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type commit(WriteOp op, const std::string& mapName, const std::string& key,
+                                         const std::string& stored, const Manifest* manifest);
+    mapkeeper::ResponseCode::type patch(const std::string& mapName, const std::string& key,
+                                        int64_t offset, const std::string& data);
+    bool patchChunks(const std::string& mapName, const std::string& key, Manifest& manifest,
+                     uint64_t offset, const std::string& data);
+    void writeRecords(std::vector<mapkeeper::ResponseCode::type>& _return, WriteOp op,
+                      const std::string& mapName, const std::vector<mapkeeper::Record>& records);
+    void scanInto(ScanSink& sink, const std::string& mapName,
+                  const mapkeeper::ScanOrder::type order,
+                  const std::string& startKey, const bool startKeyIncluded,
+                  const std::string& endKey, const bool endKeyIncluded,
+                  const int32_t maxRecords, const int32_t maxBytes,
+                  const mapkeeper::ScanOptions& options);
+
+    ChunkSizes chunkSizes_;
+    uint32_t nextGeneration_;
+    boost::mutex keyMutexes_[NUM_KEY_MUTEXES];
+    uint32_t uploadTimeoutSec_;
+    uint32_t maxUploads_;
+    boost::mutex uploadsMutex_; // protects the map and the upload times,
+                                // not the rest of the uploads in it
+    Uploads uploads_;
+    time_t lastSweep_;          // when expireUploads() last looked
+    uint64_t numChunksWritten_;
+    uint64_t numChunksRead_;
+    uint64_t numChunksRemoved_;
+    uint64_t numUploads_;
+    uint64_t numAbandonedUploads_;
+    uint64_t numExpiredUploads_;
+    uint64_t numReadRetries_;
+};
+
+#endif // CHUNKING_HANDLER_H
@@ -0,0 +1,304 @@
+#include <arpa/inet.h> // htonl
+#include "CoalescingHandler.h"
+
+using namespace mapkeeper;
+
+namespace {
+
+struct GetCall {
+    MapKeeperIf* handler;
+    const std::string& mapName;
+    const std::string& key;
+
+    GetCall(MapKeeperIf* handler, const std::string& mapName, const std::string& key) :
+        handler(handler), mapName(mapName), key(key) {}
+
+    void operator()(BinaryResponse& response) const
+    {
+        handler->get(response, mapName, key);
+    }
+};
+
+}
+
+struct CoalescingHandler::ScanCall {
+    MapKeeperIf* handler;
+    const std::string& mapName;
+    ScanOrder::type order;
+    const std::string& startKey;
+    bool startKeyIncluded;
+    const std::string& endKey;
+    bool endKeyIncluded;
+    int32_t maxRecords;
+    int32_t maxBytes;
+    const ScanOptions* options; // NULL for plain scans
+
+    ScanCall(MapKeeperIf* handler, const std::string& mapName, ScanOrder::type order,
+             const std::string& startKey, bool startKeyIncluded,
+             const std::string& endKey, bool endKeyIncluded,
+             int32_t maxRecords, int32_t maxBytes, const ScanOptions* options) :
+        handler(handler), mapName(mapName), order(order),
+        startKey(startKey), startKeyIncluded(startKeyIncluded),
+        endKey(endKey), endKeyIncluded(endKeyIncluded),
+        maxRecords(maxRecords), maxBytes(maxBytes), options(options) {}
+
+    void operator()(RecordListResponse& response) const
+    {
+        if (options) {
+            handler->scanWithOptions(response, mapName, order, startKey, startKeyIncluded, 
+                                     endKey, endKeyIncluded, maxRecords, maxBytes, *options);
+        } else {
+            handler->scan(response, mapName, order, startKey, startKeyIncluded, 
+                          endKey, endKeyIncluded, maxRecords, maxBytes);
+        }
+    }
+
+    void operator()(PackedRecordListResponse& response) const
+    {
+        handler->scanPacked(response, mapName, order, startKey, startKeyIncluded, 
+                            endKey, endKeyIncluded, maxRecords, maxBytes, *options);
+    }
+};
+
+CoalescingHandler::
+CoalescingHandler(boost::shared_ptr<MapKeeperIf> handler) :
+    ForwardingHandler(handler),
+    gets_(false),
+    scans_(true),
+    packedScans_(true),
+    numCoalesced_(0)
+{
+}
+
+ResponseCode::type CoalescingHandler::
+dropMap(const std::string& mapName)
+{
+    ResponseCode::type rc = handler_->dropMap(mapName);
+    detachMap(mapName);
+    return rc;
+}
+
+void CoalescingHandler::
+scan(RecordListResponse& _return, const std::string& mapName, 
+     const ScanOrder::type order,
+     const std::string& startKey, const bool startKeyIncluded,
+     const std::string& endKey, const bool endKeyIncluded,
+     const int32_t maxRecords, const int32_t maxBytes)
+{
+    ScanCall call(handler_.get(), mapName, order, startKey, startKeyIncluded,
+                  endKey, endKeyIncluded, maxRecords, maxBytes, NULL);
+    if (!scans_.run(mapName, makeScanKey(call), _return, call)) {
+        __sync_fetch_and_add(&numCoalesced_, 1);
+    }
+}
+
+void CoalescingHandler::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName, 
+                const ScanOrder::type order,
+                const std::string& startKey, const bool startKeyIncluded,
+                const std::string& endKey, const bool endKeyIncluded,
+                const int32_t maxRecords, const int32_t maxBytes,
+                const ScanOptions& options)
+{
+    ScanCall call(handler_.get(), mapName, order, startKey, startKeyIncluded,
+                  endKey, endKeyIncluded, maxRecords, maxBytes, &options);
+    if (!scans_.run(mapName, makeScanKey(call), _return, call)) {
+        __sync_fetch_and_add(&numCoalesced_, 1);
+    }
+}
+
+void CoalescingHandler::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName, 
+           const ScanOrder::type order,
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes,
+           const ScanOptions& options)
+{
+    ScanCall call(handler_.get(), mapName, order, startKey, startKeyIncluded,
+                  endKey, endKeyIncluded, maxRecords, maxBytes, &options);
+    if (!packedScans_.run(mapName, makeScanKey(call), _return, call)) {
+        __sync_fetch_and_add(&numCoalesced_, 1);
+    }
+}
+
+std::string CoalescingHandler::
+makeScanKey(const ScanCall& call)
+{
+    std::string flightKey;
+    appendString(flightKey, call.startKey);
+    appendString(flightKey, call.endKey);
+    // plain scans and scans with default options return the same records,
+    // so they share a flight.
+    ScanOptions options = call.options ? *call.options : ScanOptions();
+    int32_t args[] = {call.order, call.startKeyIncluded, call.endKeyIncluded,
+                      call.maxRecords, call.maxBytes,
+                      options.keysOnly, options.valueOffset, options.valueLength,
+                      options.maxExamined, (int32_t)options.valueFilters.size(),
+                      options.sharedKeyPrefixes, options.compressedValues};
+    flightKey.append((const char*)args, sizeof(args));
+    appendString(flightKey, options.keyPrefix);
+    appendString(flightKey, options.keyRegex);
+    for (size_t i = 0; i < options.valueFilters.size(); i++) {
+        const ValueFilter& filter = options.valueFilters[i];
+        int32_t filterArgs[] = {filter.offset, filter.length, filter.op};
+        flightKey.append((const char*)filterArgs, sizeof(filterArgs));
+        appendString(flightKey, filter.operand);
+    }
+    return flightKey;
+}
+
+void CoalescingHandler::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    GetCall call(handler_.get(), mapName, key);
+    if (!gets_.run(mapName, key, _return, call)) {
+        __sync_fetch_and_add(&numCoalesced_, 1);
+    }
+}
+
+ResponseCode::type CoalescingHandler::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    ResponseCode::type rc = handler_->put(mapName, key, value);
+    detachKey(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CoalescingHandler::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    ResponseCode::type rc = handler_->insert(mapName, key, value);
+    detachKey(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CoalescingHandler::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    ResponseCode::type rc = handler_->update(mapName, key, value);
+    detachKey(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CoalescingHandler::
+putChunk(const std::string& mapName, const std::string& key,
+         const int64_t offset, const std::string& data, const bool last)
+{
+    ResponseCode::type rc = handler_->putChunk(mapName, key, offset, data, last);
+    if (last) {
+        detachKey(mapName, key);
+    }
+    return rc;
+}
+
+ResponseCode::type CoalescingHandler::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    ResponseCode::type rc = handler_->append(mapName, key, data);
+    detachKey(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CoalescingHandler::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+        const std::string& data)
+{
+    ResponseCode::type rc = handler_->writeAt(mapName, key, offset, data);
+    detachKey(mapName, key);
+    return rc;
+}
+
+ResponseCode::type CoalescingHandler::
+remove(const std::string& mapName, const std::string& key)
+{
+    ResponseCode::type rc = handler_->remove(mapName, key);
+    detachKey(mapName, key);
+    return rc;
+}
+
+void CoalescingHandler::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+         const std::vector<Record>& records)
+{
+    handler_->multiPut(_return, mapName, records);
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        gets_.detach(mapName, itr->key);
+    }
+    detachScans(mapName);
+}
+
+void CoalescingHandler::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+            const std::vector<Record>& records)
+{
+    handler_->multiInsert(_return, mapName, records);
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        gets_.detach(mapName, itr->key);
+    }
+    detachScans(mapName);
+}
+
+void CoalescingHandler::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+            const std::vector<Record>& records)
+{
+    handler_->multiUpdate(_return, mapName, records);
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        gets_.detach(mapName, itr->key);
+    }
+    detachScans(mapName);
+}
+
+void CoalescingHandler::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+            const std::vector<std::string>& keys)
+{
+    handler_->multiRemove(_return, mapName, keys);
+    for (std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++) {
+        gets_.detach(mapName, *itr);
+    }
+    detachScans(mapName);
+}
+
+uint64_t CoalescingHandler::
+getNumCoalesced()
+{
+    return __sync_fetch_and_add(&numCoalesced_, 0);
+}
+
+void CoalescingHandler::
+getStats(StatsResponse& _return)
+{
+    handler_->getStats(_return);
+    _return.counters["coalesce.shared_reads"] = getNumCoalesced();
+}
+
+void CoalescingHandler::
+appendString(std::string& out, const std::string& str)
+{
+    uint32_t length = htonl(str.size());
+    out.append((const char*)&length, sizeof(length));
+    out.append(str);
+}
+
+void CoalescingHandler::
+detachKey(const std::string& mapName, const std::string& key)
+{
+    gets_.detach(mapName, key);
+    detachScans(mapName);
+}
+
+void CoalescingHandler::
+detachMap(const std::string& mapName)
+{
+    gets_.detachGroup(mapName);
+    detachScans(mapName);
+}
+
+void CoalescingHandler::
+detachScans(const std::string& mapName)
+{
+    scans_.detachGroup(mapName);
+    packedScans_.detachGroup(mapName);
+}
@@ -0,0 +1,85 @@
+#ifndef COALESCING_HANDLER_H
+#define COALESCING_HANDLER_H
+
+#include "ForwardingHandler.h"
+#include "SingleFlight.h"
+
+/**
+ * Coalesces concurrent identical reads into a single backend call.
+ *
+ * When many threads ask for the same key at the same time (e.g., right
+ * after a hot key falls out of the cache), only one of them goes to
+ * the backend and the rest share its response. Scans with identical
+ * arguments are deduplicated the same way.
+ *
+ * A read never returns data older than a write that completed before
+ * the read started: every write detaches the in-flight reads it may
+ * affect, so later readers start a new backend call.
+ */
+class CoalescingHandler : public ForwardingHandler {
+public:
+    CoalescingHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> handler);
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName);
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName, 
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName, 
+                         const mapkeeper::ScanOrder::type order,
+                         const std::string& startKey, const bool startKeyIncluded,
+                         const std::string& endKey, const bool endKeyIncluded,
+                         const int32_t maxRecords, const int32_t maxBytes,
+                         const mapkeeper::ScanOptions& options);
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName, 
+                    const mapkeeper::ScanOrder::type order,
+                    const std::string& startKey, const bool startKeyIncluded,
+                    const std::string& endKey, const bool endKeyIncluded,
+                    const int32_t maxRecords, const int32_t maxBytes,
+                    const mapkeeper::ScanOptions& options);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key,
+                                           const int64_t offset, const std::string& data, const bool last);
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key,
+                                          const int64_t offset, const std::string& data);
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                  const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                     const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                     const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                     const std::vector<std::string>& keys);
+
+    /**
+     * Number of reads that were served by another thread's backend call.
+     */
+    uint64_t getNumCoalesced();
+
+    /**
+     * Adds "coalesce.shared_reads" to the backend's statistics.
+     */
+    void getStats(mapkeeper::StatsResponse& _return);
+
+private:
+    struct ScanCall;
+    static std::string makeScanKey(const ScanCall& call);
+    static void appendString(std::string& out, const std::string& str);
+    void detachKey(const std::string& mapName, const std::string& key);
+    void detachMap(const std::string& mapName);
+    void detachScans(const std::string& mapName);
+
+    // flights are grouped by map. Every write detaches the scans of its
+    // map, so they're kept in one shard per map.
+    SingleFlight<mapkeeper::BinaryResponse> gets_;
+    SingleFlight<mapkeeper::RecordListResponse> scans_;
+    SingleFlight<mapkeeper::PackedRecordListResponse> packedScans_;
+    uint64_t numCoalesced_;
+};
+
+#endif // COALESCING_HANDLER_H
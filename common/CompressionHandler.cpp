@@ -0,0 +1,393 @@
+#include <cstdio>
+#include <boost/functional/hash.hpp>
+#include "CompressionHandler.h"
+#include "Projection.h"
+#include "ScanFilter.h"
+#include "ValuePatch.h"
+
+using namespace mapkeeper;
+
+CompressionHandler::
+CompressionHandler(boost::shared_ptr<MapKeeperIf> handler, const Codecs& codecs) :
+    ForwardingHandler(handler),
+    codecs_(codecs),
+    numRawBytes_(0),
+    numStoredBytes_(0),
+    numDecoded_(0),
+    numDecodeErrors_(0)
+{
+}
+
+void CompressionHandler::
+scan(RecordListResponse& _return, const std::string& mapName,
+     const ScanOrder::type order,
+     const std::string& startKey, const bool startKeyIncluded,
+     const std::string& endKey, const bool endKeyIncluded,
+     const int32_t maxRecords, const int32_t maxBytes)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        handler_->scan(_return, mapName, order, startKey, startKeyIncluded,
+                       endKey, endKeyIncluded, maxRecords, maxBytes);
+        return;
+    }
+    RecordListSink sink(_return);
+    scanInto(sink, *codec, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, ScanOptions());
+}
+
+void CompressionHandler::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName,
+                const ScanOrder::type order,
+                const std::string& startKey, const bool startKeyIncluded,
+                const std::string& endKey, const bool endKeyIncluded,
+                const int32_t maxRecords, const int32_t maxBytes,
+                const ScanOptions& options)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        handler_->scanWithOptions(_return, mapName, order, startKey, startKeyIncluded,
+                                  endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        return;
+    }
+    RecordListSink sink(_return);
+    scanInto(sink, *codec, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+void CompressionHandler::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName,
+           const ScanOrder::type order,
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes,
+           const ScanOptions& options)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        handler_->scanPacked(_return, mapName, order, startKey, startKeyIncluded,
+                             endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        return;
+    }
+    PackedRecordSink sink(_return, options.sharedKeyPrefixes,
+                          PackedRecordSink::wantsCompressedValues(options));
+    scanInto(sink, *codec, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+/**
+ * The backend scans with the options that don't look at values, and
+ * returns whole compressed values unless the scan is keysOnly. The
+ * response is cut short here when the values outgrow maxBytes.
+ */
+void CompressionHandler::
+scanInto(ScanSink& sink, const ValueCodec& codec, const std::string& mapName,
+         const ScanOrder::type order,
+         const std::string& startKey, const bool startKeyIncluded,
+         const std::string& endKey, const bool endKeyIncluded,
+         const int32_t maxRecords, const int32_t maxBytes,
+         const ScanOptions& options)
+{
+    ScanOptions storedOptions = options;
+    storedOptions.keysOnly = options.keysOnly && options.valueFilters.empty();
+    storedOptions.valueOffset = 0;
+    storedOptions.valueLength = -1;
+    storedOptions.valueFilters.clear();
+    storedOptions.sharedKeyPrefixes = false;
+    storedOptions.compressedValues = false;
+    if (!options.valueFilters.empty() && options.maxExamined <= 0) {
+        // value filters alone wouldn't give the backend a budget.
+        storedOptions.maxExamined = ScanFilter::DEFAULT_MAX_EXAMINED;
+    }
+    PackedRecordListResponse response;
+    handler_->scanPacked(response, mapName, order, startKey, startKeyIncluded,
+                         endKey, endKeyIncluded, maxRecords, maxBytes, storedOptions);
+    if (response.responseCode != ResponseCode::Success &&
+        response.responseCode != ResponseCode::ScanEnded) {
+        sink.setResponseCode(response.responseCode);
+        return;
+    }
+    PackedRecordReader reader(response.records);
+    if (!reader.valid()) {
+        fprintf(stderr, "malformed scanPacked response for %s\n", mapName.c_str());
+        sink.setResponseCode(ResponseCode::Error);
+        return;
+    }
+
+    bool needsValue = !options.valueFilters.empty() ||
+        (!sink.compressedValues() && !storedOptions.keysOnly);
+    std::string value;
+    std::string lastKey;
+    while (reader.next()) {
+        if (sink.full(maxRecords, maxBytes)) {
+            sink.setResponseCode(ResponseCode::Success);
+            sink.setResumeKey(lastKey);
+            return;
+        }
+        lastKey.assign(reader.key(), reader.keySize());
+        if (needsValue && !decode(codec, mapName, reader.value(), reader.valueSize(), value)) {
+            sink.clear();
+            sink.setResponseCode(ResponseCode::Error);
+            return;
+        }
+        bool matches = true;
+        for (size_t i = 0; matches && i < options.valueFilters.size(); i++) {
+            matches = ScanFilter::matchesValue(options.valueFilters[i], value.data(), value.size());
+        }
+        if (!matches) {
+            continue;
+        }
+        if (sink.compressedValues()) {
+            sink.add(reader.key(), reader.keySize(), reader.value(), reader.valueSize());
+        } else {
+            size_t offset;
+            size_t length;
+            projectRange(options, value.size(), offset, length);
+            sink.add(reader.key(), reader.keySize(), value.data() + offset, length);
+        }
+    }
+    sink.setResponseCode(response.responseCode);
+    if (response.responseCode == ResponseCode::Success) {
+        sink.setResumeKey(response.resumeKey.empty() ? lastKey : response.resumeKey);
+    }
+}
+
+void CompressionHandler::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    handler_->get(_return, mapName, key);
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL || _return.responseCode != ResponseCode::Success) {
+        return;
+    }
+    std::string value;
+    if (!decode(*codec, mapName, _return.value.data(), _return.value.size(), value)) {
+        _return.responseCode = ResponseCode::Error;
+        _return.value.clear();
+        return;
+    }
+    _return.value.swap(value);
+}
+
+void CompressionHandler::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+         const int64_t offset, const int32_t length)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        handler_->getRange(_return, mapName, key, offset, length);
+        return;
+    }
+    if (offset < 0 || length < 0) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    get(_return, mapName, key);
+    if (_return.responseCode != ResponseCode::Success) {
+        return;
+    }
+    if ((uint64_t)offset >= _return.value.size()) {
+        _return.value.clear();
+        return;
+    }
+    _return.value = _return.value.substr(offset, length);
+}
+
+ResponseCode::type CompressionHandler::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        return handler_->put(mapName, key, value);
+    }
+    std::string stored;
+    encode(*codec, value, stored);
+    return handler_->put(mapName, key, stored);
+}
+
+ResponseCode::type CompressionHandler::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        return handler_->insert(mapName, key, value);
+    }
+    std::string stored;
+    encode(*codec, value, stored);
+    return handler_->insert(mapName, key, stored);
+}
+
+ResponseCode::type CompressionHandler::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        return handler_->update(mapName, key, value);
+    }
+    std::string stored;
+    encode(*codec, value, stored);
+    return handler_->update(mapName, key, stored);
+}
+
+ResponseCode::type CompressionHandler::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        return handler_->append(mapName, key, data);
+    }
+    return patch(*codec, mapName, key, -1, data);
+}
+
+ResponseCode::type CompressionHandler::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+        const std::string& data)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        return handler_->writeAt(mapName, key, offset, data);
+    }
+    if (offset < 0) {
+        return ResponseCode::Error;
+    }
+    return patch(*codec, mapName, key, offset, data);
+}
+
+void CompressionHandler::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName,
+         const std::vector<std::string>& keys)
+{
+    handler_->multiGet(_return, mapName, keys);
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        return;
+    }
+    std::string value;
+    for (size_t i = 0; i < _return.size(); i++) {
+        BinaryResponse& response = _return[i];
+        if (response.responseCode != ResponseCode::Success) {
+            continue;
+        }
+        if (!decode(*codec, mapName, response.value.data(), response.value.size(), value)) {
+            response.responseCode = ResponseCode::Error;
+            response.value.clear();
+            continue;
+        }
+        response.value.swap(value);
+    }
+}
+
+void CompressionHandler::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+         const std::vector<Record>& records)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        handler_->multiPut(_return, mapName, records);
+        return;
+    }
+    std::vector<Record> stored;
+    encodeRecords(*codec, records, stored);
+    handler_->multiPut(_return, mapName, stored);
+}
+
+void CompressionHandler::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        handler_->multiInsert(_return, mapName, records);
+        return;
+    }
+    std::vector<Record> stored;
+    encodeRecords(*codec, records, stored);
+    handler_->multiInsert(_return, mapName, stored);
+}
+
+void CompressionHandler::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    const ValueCodec* codec = findCodec(mapName);
+    if (codec == NULL) {
+        handler_->multiUpdate(_return, mapName, records);
+        return;
+    }
+    std::vector<Record> stored;
+    encodeRecords(*codec, records, stored);
+    handler_->multiUpdate(_return, mapName, stored);
+}
+
+void CompressionHandler::
+getStats(StatsResponse& _return)
+{
+    handler_->getStats(_return);
+    _return.counters["compression.raw_bytes"] = __sync_fetch_and_add(&numRawBytes_, 0);
+    _return.counters["compression.stored_bytes"] = __sync_fetch_and_add(&numStoredBytes_, 0);
+    _return.counters["compression.decoded_values"] = __sync_fetch_and_add(&numDecoded_, 0);
+    _return.counters["compression.decode_errors"] = __sync_fetch_and_add(&numDecodeErrors_, 0);
+}
+
+const ValueCodec* CompressionHandler::
+findCodec(const std::string& mapName) const
+{
+    Codecs::const_iterator itr = codecs_.find(mapName);
+    return itr == codecs_.end() ? NULL : itr->second.get();
+}
+
+void CompressionHandler::
+encode(const ValueCodec& codec, const std::string& value, std::string& stored)
+{
+    codec.encode(value.data(), value.size(), stored);
+    __sync_fetch_and_add(&numRawBytes_, value.size());
+    __sync_fetch_and_add(&numStoredBytes_, stored.size());
+}
+
+bool CompressionHandler::
+decode(const ValueCodec& codec, const std::string& mapName,
+       const char* stored, uint32_t size, std::string& value)
+{
+    if (!codec.decode(stored, size, value)) {
+        fprintf(stderr, "can't decompress a value of %s\n", mapName.c_str());
+        __sync_fetch_and_add(&numDecodeErrors_, 1);
+        return false;
+    }
+    __sync_fetch_and_add(&numDecoded_, 1);
+    return true;
+}
+
+/**
+ * Writes data at offset, or at the end of the value if offset is
+ * negative.
+ */
+ResponseCode::type CompressionHandler::
+patch(const ValueCodec& codec, const std::string& mapName, const std::string& key,
+      int64_t offset, const std::string& data)
+{
+    size_t hash = boost::hash<std::string>()(mapName);
+    boost::hash_combine(hash, key);
+    boost::mutex::scoped_lock lock(patchMutexes_[hash % NUM_PATCH_MUTEXES]);
+    BinaryResponse response;
+    get(response, mapName, key);
+    if (response.responseCode != ResponseCode::Success) {
+        return response.responseCode;
+    }
+    if (!patchValue(response.value, offset < 0 ? response.value.size() : offset, data)) {
+        return ResponseCode::Error;
+    }
+    std::string stored;
+    encode(codec, response.value, stored);
+    return handler_->update(mapName, key, stored);
+}
+
+void CompressionHandler::
+encodeRecords(const ValueCodec& codec, const std::vector<Record>& records,
+              std::vector<Record>& stored)
+{
+    stored.resize(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        stored[i].key = records[i].key;
+        encode(codec, records[i].value, stored[i].value);
+    }
+}
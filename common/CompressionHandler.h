@@ -0,0 +1,115 @@
+#ifndef COMPRESSION_HANDLER_H
+#define COMPRESSION_HANDLER_H
+
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include "ForwardingHandler.h"
+#include "ScanSink.h"
+#include "ValueCodec.h"
+
+/**
+ * Compresses the values of some maps before they reach the backend and
+ * decompresses them on the way back, so storage engines and their
+ * caches hold fewer bytes of large, repetitive values.
+ *
+ * Values are only decompressed when they're returned or a value filter
+ * looks at them: keysOnly scans skip them, and scanPacked() hands them
+ * over compressed to clients that set compressedValues. Value filters
+ * and projections run here rather than in the backend, which only sees
+ * compressed bytes; maxBytes counts compressed bytes in the backend and
+ * values as returned here.
+ *
+ * Values written to a map before it had compression, or around this
+ * handler, can't be read through it.
+ */
+class CompressionHandler : public ForwardingHandler {
+public:
+    typedef std::map<std::string, boost::shared_ptr<ValueCodec> > Codecs;
+
+    /**
+     * @param codecs the codec of each map with compression. Maps that
+     *               aren't in it are passed through.
+     */
+    CompressionHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> handler, const Codecs& codecs);
+
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+                         const mapkeeper::ScanOrder::type order,
+                         const std::string& startKey, const bool startKeyIncluded,
+                         const std::string& endKey, const bool endKeyIncluded,
+                         const int32_t maxRecords, const int32_t maxBytes,
+                         const mapkeeper::ScanOptions& options);
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName,
+                    const mapkeeper::ScanOrder::type order,
+                    const std::string& startKey, const bool startKeyIncluded,
+                    const std::string& endKey, const bool endKeyIncluded,
+                    const int32_t maxRecords, const int32_t maxBytes,
+                    const mapkeeper::ScanOptions& options);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+
+    /**
+     * Decompresses the whole value; under ChunkingHandler, that's at
+     * most a chunk.
+     */
+    void getRange(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length);
+
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+
+    /**
+     * Compressed values are decompressed, patched and written back whole.
+     * That's atomic with other appends and writeAts of the same key
+     * through this handler, but not with puts and updates.
+     */
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key,
+                                          const int64_t offset, const std::string& data);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                  const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+
+    /**
+     * Adds "compression.*" counters to the backend's statistics.
+     */
+    void getStats(mapkeeper::StatsResponse& _return);
+
+private:
+    static const uint32_t NUM_PATCH_MUTEXES = 64;
+
+    const ValueCodec* findCodec(const std::string& mapName) const;
+    void encode(const ValueCodec& codec, const std::string& value, std::string& stored);
+    bool decode(const ValueCodec& codec, const std::string& mapName,
+                const char* stored, uint32_t size, std::string& value);
+    mapkeeper::ResponseCode::type patch(const ValueCodec& codec, const std::string& mapName,
+                                        const std::string& key, int64_t offset, const std::string& data);
+    void encodeRecords(const ValueCodec& codec, const std::vector<mapkeeper::Record>& records,
+                       std::vector<mapkeeper::Record>& stored);
+    void scanInto(ScanSink& sink, const ValueCodec& codec, const std::string& mapName,
+                  const mapkeeper::ScanOrder::type order,
+                  const std::string& startKey, const bool startKeyIncluded,
+                  const std::string& endKey, const bool endKeyIncluded,
+                  const int32_t maxRecords, const int32_t maxBytes,
+                  const mapkeeper::ScanOptions& options);
+
+    Codecs codecs_;
+    boost::mutex patchMutexes_[NUM_PATCH_MUTEXES];
+    uint64_t numRawBytes_;      // of values written
+    uint64_t numStoredBytes_;   // of the same values, compressed
+    uint64_t numDecoded_;
+    uint64_t numDecodeErrors_;
+};
+
+#endif // COMPRESSION_HANDLER_H
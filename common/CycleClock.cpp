@@ -0,0 +1,31 @@
+#include <boost/thread/once.hpp>
+#include "CycleClock.h"
+
+static double cyclesPerMicro = 0;
+static boost::once_flag calibrated = BOOST_ONCE_INIT;
+
+static uint64_t nowNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void calibrate()
+{
+    uint64_t startNanos = nowNanos();
+    uint64_t startCycles = CycleClock::now();
+    uint64_t elapsedNanos = 0;
+    while (elapsedNanos < 10 * 1000 * 1000) {
+        elapsedNanos = nowNanos() - startNanos;
+    }
+    uint64_t elapsedCycles = CycleClock::now() - startCycles;
+    cyclesPerMicro = elapsedCycles * 1000.0 / elapsedNanos;
+}
+
+double CycleClock::
+getCyclesPerMicro()
+{
+    boost::call_once(calibrate, calibrated);
+    return cyclesPerMicro;
+}
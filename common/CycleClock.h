@@ -0,0 +1,41 @@
+#ifndef CYCLE_CLOCK_H
+#define CYCLE_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * A cheap timestamp for timing short intervals.
+ *
+ * On x86 this is the time stamp counter, which takes a few nanoseconds
+ * to read, as opposed to a few tens for clock_gettime(). Modern CPUs
+ * run the counter at a constant rate regardless of frequency scaling,
+ * and getCyclesPerMicro() measures that rate once against the
+ * monotonic clock. Elsewhere it falls back to clock_gettime() in
+ * nanoseconds.
+ */
+class CycleClock {
+public:
+    static inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        uint32_t lo, hi;
+        __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+        return ((uint64_t)hi << 32) | lo;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    }
+
+    /**
+     * Calibrates the clock on the first call, which takes about 10ms.
+     */
+    static double getCyclesPerMicro();
+
+    static double toMicros(uint64_t cycles) {
+        return cycles / getCyclesPerMicro();
+    }
+};
+
+#endif // CYCLE_CLOCK_H
@@ -0,0 +1,641 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include "EpollServer.h"
+
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT 15
+#endif
+
+using boost::shared_ptr;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+
+static const size_t READ_BUFFER_BYTES = 64 << 10;
+static const int MAX_EVENTS = 256;
+
+static void setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        fprintf(stderr, "fcntl(O_NONBLOCK) failed: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+EpollServer::Connection::
+Connection(int fd, IoThread* ioThread) :
+    fd(fd),
+    ioThread(ioThread),
+    inputOffset(0),
+    checkedOffset(0),
+    outputOffset(0),
+    numRunning(0),
+    ordered(false),
+    closed(false),
+    reading(true),
+    writing(false),
+    pending(NULL)
+{
+}
+
+EpollServer::RequestRunner::
+RequestRunner(EpollServer& server) :
+    server_(server),
+    input_(new TMemoryBuffer()),
+    output_(new TMemoryBuffer()),
+    inputProtocol_(server.protocolFactory_->getProtocol(input_)),
+    outputProtocol_(server.protocolFactory_->getProtocol(output_))
+{
+}
+
+void EpollServer::RequestRunner::
+run(Request& request)
+{
+    input_->resetBuffer((uint8_t*)request.frame.data(), request.frame.size());
+    output_->resetBuffer();
+    try {
+        request.failed = !server_.processor_->process(inputProtocol_, outputProtocol_);
+    } catch (std::exception& e) {
+        fprintf(stderr, "processor failed: %s\n", e.what());
+        request.failed = true;
+    }
+    uint8_t* buffer;
+    uint32_t size;
+    output_->getBuffer(&buffer, &size);
+    request.response.assign((char*)buffer, size);
+}
+
+EpollServer::IoThread::
+IoThread(EpollServer& server, uint16_t port) :
+    server_(server),
+    epollFd_(-1),
+    listenFd_(-1),
+    eventFd_(-1),
+    stopped_(false),
+    runner_(server)
+{
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) {
+        fprintf(stderr, "socket() failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    int on = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+        fprintf(stderr, "setsockopt(SO_REUSEPORT) failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd_, 1024) != 0) {
+        fprintf(stderr, "failed to listen on port %d: %s\n", port, strerror(errno));
+        exit(1);
+    }
+    setNonBlocking(listenFd_);
+
+    eventFd_ = eventfd(0, EFD_NONBLOCK);
+    epollFd_ = epoll_create(MAX_EVENTS);
+    if (eventFd_ < 0 || epollFd_ < 0) {
+        fprintf(stderr, "failed to create epoll: %s\n", strerror(errno));
+        exit(1);
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &listenFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &event);
+    event.data.ptr = &eventFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, eventFd_, &event);
+}
+
+/**
+ * By now the workers have stopped, so nothing refers to the
+ * connections anymore.
+ */
+EpollServer::IoThread::
+~IoThread()
+{
+    for (std::vector<Request*>::iterator itr = completions_.begin(); itr != completions_.end(); itr++) {
+        delete *itr;
+    }
+    for (std::set<Connection*>::iterator itr = connections_.begin(); itr != connections_.end(); itr++) {
+        if (!(*itr)->closed) {
+            ::close((*itr)->fd);
+        }
+        delete (*itr)->pending;
+        delete *itr;
+    }
+    ::close(listenFd_);
+    ::close(eventFd_);
+    ::close(epollFd_);
+}
+
+void EpollServer::IoThread::
+run()
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopped_) {
+        int numEvents = epoll_wait(epollFd_, events, MAX_EVENTS, -1);
+        if (numEvents < 0) {
+            if (errno != EINTR) {
+                fprintf(stderr, "epoll_wait() failed: %s\n", strerror(errno));
+                exit(1);
+            }
+            continue;
+        }
+        for (int i = 0; i < numEvents; i++) {
+            void* ptr = events[i].data.ptr;
+            if (ptr == &listenFd_) {
+                accept();
+            } else if (ptr == &eventFd_) {
+                uint64_t value;
+                while (::read(eventFd_, &value, sizeof(value)) > 0) {
+                }
+                drainCompletions();
+                retryBlocked();
+            } else {
+                Connection* connection = static_cast<Connection*>(ptr);
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    close(connection);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    write(connection);
+                }
+                if (!connection->closed && (events[i].events & EPOLLIN)) {
+                    read(connection);
+                }
+            }
+        }
+
+        // connections are deleted only here so that nothing above has to
+        // worry about using one that has just been closed.
+        for (std::vector<Connection*>::iterator itr = closed_.begin(); itr != closed_.end(); itr++) {
+            connections_.erase(*itr);
+            delete *itr;
+        }
+        closed_.clear();
+    }
+}
+
+void EpollServer::IoThread::
+stop()
+{
+    stopped_ = true;
+    uint64_t value = 1;
+    ssize_t rc = ::write(eventFd_, &value, sizeof(value));
+    (void)rc;
+}
+
+void EpollServer::IoThread::
+complete(Request* request)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        completions_.push_back(request);
+    }
+    uint64_t value = 1;
+    ssize_t rc = ::write(eventFd_, &value, sizeof(value));
+    (void)rc;
+}
+
+void EpollServer::IoThread::
+wake()
+{
+    uint64_t value = 1;
+    ssize_t rc = ::write(eventFd_, &value, sizeof(value));
+    (void)rc;
+}
+
+void EpollServer::IoThread::
+accept()
+{
+    while (true) {
+        int fd = ::accept(listenFd_, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                fprintf(stderr, "accept() failed: %s\n", strerror(errno));
+            }
+            return;
+        }
+        setNonBlocking(fd);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        Connection* connection = new Connection(fd, this);
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+            fprintf(stderr, "epoll_ctl() failed: %s\n", strerror(errno));
+            ::close(fd);
+            delete connection;
+            continue;
+        }
+        connections_.insert(connection);
+    }
+}
+
+void EpollServer::IoThread::
+read(Connection* connection)
+{
+    char buffer[READ_BUFFER_BYTES];
+    while (true) {
+        ssize_t size = ::read(connection->fd, buffer, sizeof(buffer));
+        if (size > 0) {
+            connection->input.append(buffer, size);
+            if (!checkFrames(connection)) {
+                return;
+            }
+            // dispatch() stops reading while there's more than a frame
+            // waiting.
+            if ((size_t)size < sizeof(buffer) ||
+                connection->input.size() - connection->inputOffset > server_.maxFrameBytes_) {
+                break;
+            }
+        } else if (size == 0) {
+            close(connection);
+            return;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            close(connection);
+            return;
+        }
+    }
+    dispatch(connection);
+}
+
+/**
+ * Checks the size of every frame whose header has arrived, so that a
+ * frame that's too large is refused before it's buffered, even if it has
+ * to wait for the requests before it. Closes the connection and returns
+ * false if one is.
+ */
+bool EpollServer::IoThread::
+checkFrames(Connection* connection)
+{
+    const std::string& input = connection->input;
+    while (connection->checkedOffset + sizeof(uint32_t) <= input.size()) {
+        uint32_t frameSize = MultiplexedFrame::readUint32(input.data() + connection->checkedOffset);
+        bool multiplexed = (frameSize & MultiplexedFrame::FLAG) != 0;
+        frameSize &= ~MultiplexedFrame::FLAG;
+        if (frameSize > server_.maxFrameBytes_ || (multiplexed && frameSize < sizeof(uint32_t))) {
+            fprintf(stderr, "closing connection with a %u byte frame\n", frameSize);
+            close(connection);
+            return false;
+        }
+        connection->checkedOffset += sizeof(uint32_t) + frameSize;
+    }
+    return true;
+}
+
+void EpollServer::IoThread::
+write(Connection* connection)
+{
+    while (connection->outputOffset < connection->output.size()) {
+        ssize_t size = ::write(connection->fd, connection->output.data() + connection->outputOffset,
+                               connection->output.size() - connection->outputOffset);
+        if (size > 0) {
+            connection->outputOffset += size;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            setWriting(connection, true);
+            return;
+        } else if (errno != EINTR) {
+            close(connection);
+            return;
+        }
+    }
+    connection->output.clear();
+    connection->outputOffset = 0;
+    setWriting(connection, false);
+}
+
+/**
+ * Starts as many of the complete frames on the connection as it may
+ * have running, and reads more only if what's left is less than a
+ * frame. If the worker queue is full, the next request is left pending
+ * and the connection isn't read from until retryBlocked() submits it.
+ */
+void EpollServer::IoThread::
+dispatch(Connection* connection)
+{
+    while (!connection->closed && connection->pending == NULL) {
+        Request* request = nextRequest(connection);
+        if (request == NULL) {
+            setReading(connection, connection->input.size() - connection->inputOffset <=
+                                   server_.maxFrameBytes_);
+            return;
+        }
+        connection->numRunning++;
+        if (!request->multiplexed) {
+            connection->ordered = true;
+        }
+        if (server_.numWorkers_ == 0) {
+            runner_.run(*request);
+            finish(request);
+        } else if (!server_.submit(request)) {
+            connection->pending = request;
+            blocked_.push_back(connection);
+            setReading(connection, false);
+        }
+    }
+}
+
+/**
+ * Submits the pending requests of the blocked connections, oldest
+ * first, while the worker queue has room.
+ */
+void EpollServer::IoThread::
+retryBlocked()
+{
+    std::vector<Connection*> blocked;
+    blocked.swap(blocked_);
+    for (size_t i = 0; i < blocked.size(); i++) {
+        Connection* connection = blocked[i];
+        Request* request = connection->pending;
+        if (connection->closed) {
+            connection->pending = NULL;
+            finish(request);
+            continue;
+        }
+        if (!blocked_.empty() || !server_.submit(request)) {
+            blocked_.push_back(connection);
+            continue;
+        }
+        connection->pending = NULL;
+        dispatch(connection);
+    }
+}
+
+/**
+ * Takes the next frame off the connection's input, or returns NULL if
+ * it's incomplete or has to wait for the requests before it. Its size
+ * has been checked by checkFrames().
+ */
+EpollServer::Request* EpollServer::IoThread::
+nextRequest(Connection* connection)
+{
+    if (connection->ordered || connection->numRunning >= MAX_REQUESTS_PER_CONNECTION) {
+        return NULL;
+    }
+    std::string& input = connection->input;
+    size_t available = input.size() - connection->inputOffset;
+    if (available < sizeof(uint32_t)) {
+        return NULL;
+    }
+    uint32_t frameSize = MultiplexedFrame::readUint32(input.data() + connection->inputOffset);
+    bool multiplexed = (frameSize & MultiplexedFrame::FLAG) != 0;
+    frameSize &= ~MultiplexedFrame::FLAG;
+    if (!multiplexed && connection->numRunning > 0) {
+        return NULL;
+    }
+    if (available < sizeof(uint32_t) + frameSize) {
+        return NULL;
+    }
+    Request* request = new Request();
+    request->connection = connection;
+    request->multiplexed = multiplexed;
+    request->requestId = 0;
+    request->failed = false;
+    size_t offset = connection->inputOffset + sizeof(uint32_t);
+    if (multiplexed) {
+        request->requestId = MultiplexedFrame::readUint32(input.data() + offset);
+        offset += sizeof(uint32_t);
+        frameSize -= sizeof(uint32_t);
+    }
+    request->frame.assign(input, offset, frameSize);
+    connection->inputOffset = offset + frameSize;
+    if (connection->inputOffset == input.size()) {
+        input.clear();
+        connection->checkedOffset -= connection->inputOffset;
+        connection->inputOffset = 0;
+    } else if (connection->inputOffset > input.size() / 2) {
+        input.erase(0, connection->inputOffset);
+        connection->checkedOffset -= connection->inputOffset;
+        connection->inputOffset = 0;
+    }
+    return request;
+}
+
+void EpollServer::IoThread::
+finish(Request* request)
+{
+    Connection* connection = request->connection;
+    connection->numRunning--;
+    if (!request->multiplexed) {
+        connection->ordered = false;
+    }
+    if (connection->closed) {
+        if (connection->numRunning == 0) {
+            closed_.push_back(connection);
+        }
+        delete request;
+        return;
+    }
+    if (request->failed) {
+        delete request;
+        close(connection);
+        return;
+    }
+
+    // oneway calls have no response.
+    if (!request->response.empty()) {
+        if (request->multiplexed) {
+            MultiplexedFrame::appendHeader(connection->output, request->requestId,
+                                           request->response.size());
+        } else {
+            uint32_t frameSize = htonl(request->response.size());
+            connection->output.append((const char*)&frameSize, sizeof(frameSize));
+        }
+        connection->output.append(request->response);
+    }
+    delete request;
+    if (!connection->writing) {
+        write(connection);
+    }
+}
+
+void EpollServer::IoThread::
+drainCompletions()
+{
+    std::vector<Request*> completions;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        completions.swap(completions_);
+    }
+    for (std::vector<Request*>::iterator itr = completions.begin(); itr != completions.end(); itr++) {
+        Connection* connection = (*itr)->connection;
+        finish(*itr);
+        dispatch(connection);
+    }
+}
+
+/**
+ * A connection with requests in flight is kept around until they
+ * complete, and is then deleted by run().
+ */
+void EpollServer::IoThread::
+close(Connection* connection)
+{
+    if (connection->closed) {
+        return;
+    }
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, connection->fd, NULL);
+    ::close(connection->fd);
+    connection->closed = true;
+    if (connection->numRunning == 0) {
+        closed_.push_back(connection);
+    }
+}
+
+void EpollServer::IoThread::
+setReading(Connection* connection, bool reading)
+{
+    if (connection->reading == reading) {
+        return;
+    }
+    connection->reading = reading;
+    updateEvents(connection);
+}
+
+void EpollServer::IoThread::
+setWriting(Connection* connection, bool writing)
+{
+    if (connection->writing == writing) {
+        return;
+    }
+    connection->writing = writing;
+    updateEvents(connection);
+}
+
+void EpollServer::IoThread::
+updateEvents(Connection* connection)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (connection->reading ? EPOLLIN : 0) | (connection->writing ? EPOLLOUT : 0);
+    event.data.ptr = connection;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+EpollServer::
+EpollServer(shared_ptr<TProcessor> processor, shared_ptr<TProtocolFactory> protocolFactory,
+            uint16_t port, uint32_t numIoThreads, uint32_t numWorkers,
+            uint32_t maxQueuedRequests, uint32_t maxFrameBytes) :
+    processor_(processor),
+    protocolFactory_(protocolFactory),
+    port_(port),
+    numIoThreads_(numIoThreads == 0 ? 1 : numIoThreads),
+    numWorkers_(numWorkers),
+    maxQueuedRequests_(std::max<uint32_t>(maxQueuedRequests, 1)),
+    maxFrameBytes_(maxFrameBytes),
+    stopped_(false)
+{
+}
+
+EpollServer::
+~EpollServer()
+{
+    stop();
+}
+
+void EpollServer::
+serve()
+{
+    for (uint32_t i = 0; i < numIoThreads_; i++) {
+        ioThreads_.push_back(new IoThread(*this, port_));
+    }
+    boost::thread_group ioThreads;
+    for (uint32_t i = 0; i < numIoThreads_; i++) {
+        ioThreads.create_thread(boost::bind(&IoThread::run, &ioThreads_[i]));
+    }
+    for (uint32_t i = 0; i < numWorkers_; i++) {
+        threads_.create_thread(boost::bind(&EpollServer::work, this));
+    }
+    ioThreads.join_all();
+
+    // the I/O threads are done; let the workers finish what they're
+    // running and drop the rest.
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopped_ = true;
+        queueNotEmpty_.notify_all();
+    }
+    threads_.join_all();
+    for (std::deque<Request*>::iterator itr = queue_.begin(); itr != queue_.end(); itr++) {
+        delete *itr;
+    }
+    queue_.clear();
+    ioThreads_.clear();
+}
+
+void EpollServer::
+stop()
+{
+    for (size_t i = 0; i < ioThreads_.size(); i++) {
+        ioThreads_[i].stop();
+    }
+}
+
+/**
+ * Returns false if the queue is full.
+ */
+bool EpollServer::
+submit(Request* request)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    if (queue_.size() >= maxQueuedRequests_) {
+        return false;
+    }
+    queue_.push_back(request);
+    queueNotEmpty_.notify_one();
+    return true;
+}
+
+void EpollServer::
+work()
+{
+    RequestRunner runner(*this);
+    while (true) {
+        Request* request = NULL;
+        bool wasFull;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            while (queue_.empty() && !stopped_) {
+                queueNotEmpty_.wait(lock);
+            }
+            if (stopped_) {
+                return;
+            }
+            wasFull = queue_.size() >= maxQueuedRequests_;
+            request = queue_.front();
+            queue_.pop_front();
+        }
+        // the I/O threads may have connections waiting for this slot.
+        if (wasFull) {
+            for (size_t i = 0; i < ioThreads_.size(); i++) {
+                ioThreads_[i].wake();
+            }
+        }
+        runner.run(*request);
+        request->connection->ioThread->complete(request);
+    }
+}
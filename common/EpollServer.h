@@ -0,0 +1,182 @@
+#ifndef EPOLL_SERVER_H
+#define EPOLL_SERVER_H
+
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <TProcessor.h>
+#include <protocol/TProtocol.h>
+#include <transport/TBufferTransports.h>
+#include "MultiplexedFrame.h"
+
+/**
+ * A Thrift server for framed transport that multiplexes connections over
+ * a few epoll threads and runs requests on a bounded worker pool.
+ *
+ * Each I/O thread has its own epoll instance and its own listening
+ * socket bound with SO_REUSEPORT, so the kernel spreads new connections
+ * across the I/O threads and they share no state. An I/O thread reads
+ * whole frames and hands them to the worker pool, which runs the
+ * processor (and hence the possibly blocking storage engine call); the
+ * response goes back to the I/O thread to be written out. The number of
+ * threads doesn't depend on the number of connections.
+ *
+ * Plain requests on a connection are processed one at a time, in order,
+ * as Thrift clients expect. Multiplexed requests (see MultiplexedFrame.h)
+ * carry a request id instead, so up to MAX_REQUESTS_PER_CONNECTION of
+ * them run concurrently and each response is sent as soon as it's ready;
+ * a slow scan doesn't hold up the gets sent after it. If the worker queue
+ * is full, the connection's next request waits for room in it, and the
+ * connection isn't read from until then; the I/O thread goes on serving
+ * its other connections. Requests are only run on the I/O thread if
+ * there are no workers.
+ *
+ * A connection is closed as soon as the header of a frame larger than
+ * maxFrameBytes arrives, and isn't read from while it has more than a
+ * frame of input waiting for the requests before it.
+ */
+class EpollServer {
+public:
+    /**
+     * @param numIoThreads      number of epoll threads.
+     * @param numWorkers        number of threads that run requests.
+     * @param maxQueuedRequests requests that may wait for a worker (at
+     *                          least 1); connections with more wait to
+     *                          be read from.
+     * @param maxFrameBytes     connections that send a larger frame are
+     *                          closed.
+     */
+    EpollServer(boost::shared_ptr<apache::thrift::TProcessor> processor,
+                boost::shared_ptr<apache::thrift::protocol::TProtocolFactory> protocolFactory,
+                uint16_t port, uint32_t numIoThreads, uint32_t numWorkers,
+                uint32_t maxQueuedRequests, uint32_t maxFrameBytes);
+    ~EpollServer();
+
+    /**
+     * Blocks until stop() is called.
+     */
+    void serve();
+    void stop();
+
+private:
+    static const uint32_t MAX_REQUESTS_PER_CONNECTION = 256;
+
+    class IoThread;
+    struct Request;
+
+    struct Connection {
+        Connection(int fd, IoThread* ioThread);
+        int fd;
+        IoThread* ioThread;
+        std::string input;      // bytes read but not dispatched yet
+        size_t inputOffset;
+        size_t checkedOffset;   // first frame whose size isn't checked yet
+        std::string output;     // bytes to be written
+        size_t outputOffset;
+        uint32_t numRunning;    // requests being processed
+        bool ordered;           // a plain request is being processed
+        bool closed;            // closed while requests are running;
+                                // delete when they're done
+        bool reading;           // registered for EPOLLIN
+        bool writing;           // registered for EPOLLOUT
+        Request* pending;       // waiting for room in the worker queue
+    };
+
+    struct Request {
+        Connection* connection;
+        bool multiplexed;
+        uint32_t requestId;     // for multiplexed requests
+        std::string frame;
+        std::string response;
+        bool failed;
+    };
+
+    /**
+     * Memory transports and protocols to run requests with. Each thread
+     * that runs requests has its own.
+     */
+    class RequestRunner {
+    public:
+        RequestRunner(EpollServer& server);
+        void run(Request& request);
+
+    private:
+        EpollServer& server_;
+        boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> input_;
+        boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> output_;
+        boost::shared_ptr<apache::thrift::protocol::TProtocol> inputProtocol_;
+        boost::shared_ptr<apache::thrift::protocol::TProtocol> outputProtocol_;
+    };
+
+    class IoThread {
+    public:
+        IoThread(EpollServer& server, uint16_t port);
+        ~IoThread();
+        void run();
+        void stop();
+
+        /**
+         * Called by a worker when it's done with a request.
+         */
+        void complete(Request* request);
+
+        /**
+         * Called by a worker when the worker queue has room again.
+         */
+        void wake();
+
+    private:
+        void accept();
+        void read(Connection* connection);
+        bool checkFrames(Connection* connection);
+        void write(Connection* connection);
+        void dispatch(Connection* connection);
+        Request* nextRequest(Connection* connection);
+        void finish(Request* request);
+        void drainCompletions();
+        void retryBlocked();
+        void close(Connection* connection);
+        void setReading(Connection* connection, bool reading);
+        void setWriting(Connection* connection, bool writing);
+        void updateEvents(Connection* connection);
+
+        EpollServer& server_;
+        int epollFd_;
+        int listenFd_;
+        int eventFd_;     // wakes up epoll_wait for completions and stop()
+        volatile bool stopped_;
+        RequestRunner runner_;
+        std::set<Connection*> connections_;
+        std::vector<Connection*> closed_; // to be deleted after this round of events
+        std::vector<Connection*> blocked_; // with a pending request, in order
+        boost::mutex mutex_; // protects completions_
+        std::vector<Request*> completions_;
+    };
+
+    void work();
+    bool submit(Request* request);
+
+    boost::shared_ptr<apache::thrift::TProcessor> processor_;
+    boost::shared_ptr<apache::thrift::protocol::TProtocolFactory> protocolFactory_;
+    uint16_t port_;
+    uint32_t numIoThreads_;
+    uint32_t numWorkers_;
+    uint32_t maxQueuedRequests_;
+    uint32_t maxFrameBytes_;
+
+    boost::ptr_vector<IoThread> ioThreads_;
+    boost::thread_group threads_;
+
+    boost::mutex mutex_; // protects queue_ and stopped_
+    boost::condition_variable queueNotEmpty_;
+    std::deque<Request*> queue_;
+    bool stopped_;
+};
+
+#endif // EPOLL_SERVER_H
@@ -0,0 +1,189 @@
+#include "ForwardingHandler.h"
+
+using namespace mapkeeper;
+
+ForwardingHandler::
+ForwardingHandler(boost::shared_ptr<MapKeeperIf> handler) :
+    handler_(handler)
+{
+}
+
+ForwardingHandler::
+~ForwardingHandler()
+{
+}
+
+ResponseCode::type ForwardingHandler::
+ping()
+{
+    return handler_->ping();
+}
+
+ResponseCode::type ForwardingHandler::
+addMap(const std::string& mapName)
+{
+    return handler_->addMap(mapName);
+}
+
+ResponseCode::type ForwardingHandler::
+dropMap(const std::string& mapName)
+{
+    return handler_->dropMap(mapName);
+}
+
+void ForwardingHandler::
+listMaps(StringListResponse& _return)
+{
+    handler_->listMaps(_return);
+}
+
+void ForwardingHandler::
+scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+     const std::string& startKey, const bool startKeyIncluded,
+     const std::string& endKey, const bool endKeyIncluded,
+     const int32_t maxRecords, const int32_t maxBytes)
+{
+    handler_->scan(_return, mapName, order, startKey, startKeyIncluded, 
+                   endKey, endKeyIncluded, maxRecords, maxBytes);
+}
+
+void ForwardingHandler::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+                const std::string& startKey, const bool startKeyIncluded,
+                const std::string& endKey, const bool endKeyIncluded,
+                const int32_t maxRecords, const int32_t maxBytes,
+                const ScanOptions& options)
+{
+    handler_->scanWithOptions(_return, mapName, order, startKey, startKeyIncluded, 
+                              endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
+void ForwardingHandler::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes,
+           const ScanOptions& options)
+{
+    handler_->scanPacked(_return, mapName, order, startKey, startKeyIncluded, 
+                         endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
+void ForwardingHandler::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    handler_->get(_return, mapName, key);
+}
+
+void ForwardingHandler::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+         const int64_t offset, const int32_t length)
+{
+    handler_->getRange(_return, mapName, key, offset, length);
+}
+
+ResponseCode::type ForwardingHandler::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return handler_->put(mapName, key, value);
+}
+
+ResponseCode::type ForwardingHandler::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return handler_->insert(mapName, key, value);
+}
+
+ResponseCode::type ForwardingHandler::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return handler_->update(mapName, key, value);
+}
+
+ResponseCode::type ForwardingHandler::
+putChunk(const std::string& mapName, const std::string& key,
+         const int64_t offset, const std::string& data, const bool last)
+{
+    return handler_->putChunk(mapName, key, offset, data, last);
+}
+
+ResponseCode::type ForwardingHandler::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    return handler_->append(mapName, key, data);
+}
+
+ResponseCode::type ForwardingHandler::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+        const std::string& data)
+{
+    return handler_->writeAt(mapName, key, offset, data);
+}
+
+ResponseCode::type ForwardingHandler::
+remove(const std::string& mapName, const std::string& key)
+{
+    return handler_->remove(mapName, key);
+}
+
+void ForwardingHandler::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName, 
+         const std::vector<std::string>& keys)
+{
+    handler_->multiGet(_return, mapName, keys);
+}
+
+void ForwardingHandler::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+         const std::vector<Record>& records)
+{
+    handler_->multiPut(_return, mapName, records);
+}
+
+void ForwardingHandler::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+            const std::vector<Record>& records)
+{
+    handler_->multiInsert(_return, mapName, records);
+}
+
+void ForwardingHandler::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+            const std::vector<Record>& records)
+{
+    handler_->multiUpdate(_return, mapName, records);
+}
+
+void ForwardingHandler::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, 
+            const std::vector<std::string>& keys)
+{
+    handler_->multiRemove(_return, mapName, keys);
+}
+
+void ForwardingHandler::
+getStats(StatsResponse& _return)
+{
+    handler_->getStats(_return);
+}
+
+void ForwardingHandler::
+getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const int32_t numSplits)
+{
+    handler_->getSplitKeys(_return, mapName, startKey, endKey, numSplits);
+}
+
+void ForwardingHandler::
+estimateCount(EstimateResponse& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    handler_->estimateCount(_return, mapName, startKey, endKey, exact);
+}
+
+void ForwardingHandler::
+estimateSize(EstimateResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    handler_->estimateSize(_return, mapName, startKey, endKey, exact);
+}
@@ -0,0 +1,77 @@
+#ifndef FORWARDING_HANDLER_H
+#define FORWARDING_HANDLER_H
+
+#include <boost/shared_ptr.hpp>
+#include "MapKeeper.h"
+
+/**
+ * A MapKeeperIf that forwards every call to another MapKeeperIf.
+ *
+ * This is the base class for handlers that wrap a backend (caching,
+ * statistics, etc.). Subclasses override the methods they care about
+ * and inherit plain forwarding for the rest.
+ */
+class ForwardingHandler : virtual public mapkeeper::MapKeeperIf {
+public:
+    ForwardingHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> handler);
+    virtual ~ForwardingHandler();
+    mapkeeper::ResponseCode::type ping();
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName);
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName);
+    void listMaps(mapkeeper::StringListResponse& _return);
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName, 
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName, 
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const mapkeeper::ScanOptions& options);
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName, 
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const mapkeeper::ScanOptions& options);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+    void getRange(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length);
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key,
+                                           const int64_t offset, const std::string& data, const bool last);
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key,
+                                          const int64_t offset, const std::string& data);
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName, 
+                  const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                  const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                     const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                     const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, 
+                     const std::vector<std::string>& keys);
+    void getStats(mapkeeper::StatsResponse& _return);
+    void getSplitKeys(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const int32_t numSplits);
+    void estimateCount(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                       const std::string& startKey, const std::string& endKey, const bool exact);
+    void estimateSize(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const bool exact);
+
+protected:
+    boost::shared_ptr<mapkeeper::MapKeeperIf> handler_;
+
+private:
+    ForwardingHandler(const ForwardingHandler&);
+    ForwardingHandler& operator=(const ForwardingHandler&);
+};
+
+#endif // FORWARDING_HANDLER_H
@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "HandlerChain.h"
+#include "CachingHandler.h"
+#include "ChunkingHandler.h"
+#include "CoalescingHandler.h"
+#include "CompressionHandler.h"
+#include "HotKeyHandler.h"
+#include "StatsHandler.h"
+#include "TracingHandler.h"
+
+using boost::shared_ptr;
+using apache::thrift::TProcessor;
+using namespace mapkeeper;
+
+static std::vector<std::string>
+split(const std::string& str, char separator)
+{
+    std::vector<std::string> parts;
+    size_t begin = 0;
+    while (true) {
+        size_t end = str.find(separator, begin);
+        parts.push_back(str.substr(begin, end == std::string::npos ? end : end - begin));
+        if (end == std::string::npos) {
+            return parts;
+        }
+        begin = end + 1;
+    }
+}
+
+static std::string
+readDictionary(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        fprintf(stderr, "can't open compression dictionary %s\n", path.c_str());
+        exit(1);
+    }
+    std::string dictionary;
+    char buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        dictionary.append(buffer, size);
+    }
+    fclose(file);
+    return dictionary;
+}
+
+/**
+ * Parses the --compress option; see HandlerChain.h.
+ */
+static CompressionHandler::Codecs
+parseCodecs(const std::string& spec)
+{
+    CompressionHandler::Codecs codecs;
+    std::vector<std::string> maps = split(spec, ',');
+    for (size_t i = 0; i < maps.size(); i++) {
+        std::vector<std::string> fields = split(maps[i], ':');
+        ValueCodec::Codec codec;
+        if (fields.size() < 2 || fields.size() > 5 || fields[0].empty() ||
+            !ValueCodec::parseCodec(fields[1], codec)) {
+            fprintf(stderr, "invalid compression spec: %s\n", maps[i].c_str());
+            exit(1);
+        }
+        int64_t level = fields.size() > 2 ? atoll(fields[2].c_str()) : 6;
+        int64_t minSize = fields.size() > 3 ? atoll(fields[3].c_str()) : 64;
+        std::string dictionary = fields.size() > 4 ? readDictionary(fields[4]) : "";
+        if (level < 1 || level > 9 || minSize < 0) {
+            fprintf(stderr, "invalid compression options for %s: level %ld, min bytes %ld\n",
+                    fields[0].c_str(), level, minSize);
+            exit(1);
+        }
+        codecs[fields[0]].reset(new ValueCodec(codec, level, minSize, dictionary));
+    }
+    return codecs;
+}
+
+/**
+ * Parses the --chunk option; see HandlerChain.h.
+ */
+static ChunkingHandler::ChunkSizes
+parseChunkSizes(const std::string& spec)
+{
+    ChunkingHandler::ChunkSizes chunkSizes;
+    if (spec.empty()) {
+        return chunkSizes;
+    }
+    std::vector<std::string> maps = split(spec, ',');
+    for (size_t i = 0; i < maps.size(); i++) {
+        std::vector<std::string> fields = split(maps[i], ':');
+        int64_t chunkSize = fields.size() == 2 ? atoll(fields[1].c_str()) : 0;
+        if (fields[0].empty() || chunkSize <= 0 || chunkSize > (1 << 30)) {
+            fprintf(stderr, "invalid chunk spec: %s\n", maps[i].c_str());
+            exit(1);
+        }
+        chunkSizes[fields[0]] = chunkSize;
+    }
+    return chunkSizes;
+}
+
+shared_ptr<MapKeeperIf> 
+buildHandlerChain(shared_ptr<MapKeeperIf> backend, const ServerOptions& options)
+{
+    shared_ptr<MapKeeperIf> handler = backend;
+
+    // compression goes right above the backend so that everything else,
+    // the cache in particular, sees uncompressed values.
+    std::string compress = options.getString("compress", "");
+    std::string chunk = options.getString("chunk", "");
+    ChunkingHandler::ChunkSizes chunkSizes = parseChunkSizes(chunk);
+    if (!compress.empty()) {
+        CompressionHandler::Codecs codecs = parseCodecs(compress);
+        // chunks are compressed like the values they come from.
+        for (ChunkingHandler::ChunkSizes::const_iterator itr = chunkSizes.begin();
+             itr != chunkSizes.end(); itr++) {
+            CompressionHandler::Codecs::const_iterator codec = codecs.find(itr->first);
+            if (codec != codecs.end()) {
+                codecs[ChunkingHandler::chunkMapName(itr->first)] = codec->second;
+            }
+        }
+        handler.reset(new CompressionHandler(handler, codecs));
+    }
+    // chunking goes above compression so that each chunk is compressed
+    // on its own, and getRange() decompresses at most a chunk.
+    if (!chunkSizes.empty()) {
+        handler.reset(new ChunkingHandler(handler, chunkSizes,
+                                          options.getInt("chunk-upload-timeout-sec", 300),
+                                          options.getInt("chunk-max-uploads", 1024)));
+    }
+    // coalescing goes under the cache so that a burst of misses for the
+    // same key turns into a single backend read.
+    if (options.getBool("coalesce-reads", false)) {
+        handler.reset(new CoalescingHandler(handler));
+    }
+    int64_t cacheMb = options.getInt("cache-mb", 0);
+    if (cacheMb > 0) {
+        int64_t numShards = options.getInt("cache-shards", 16);
+        int64_t statsIntervalSec = options.getInt("cache-stats-interval", 0);
+        if (numShards <= 0 || statsIntervalSec < 0) {
+            fprintf(stderr, "invalid cache options: shards %ld, stats interval %ld\n", 
+                    numShards, statsIntervalSec);
+            exit(1);
+        }
+        handler.reset(new CachingHandler(handler, cacheMb << 20, numShards, statsIntervalSec));
+    }
+
+    // hot keys are sampled above the cache so that keys the cache
+    // absorbs still show up.
+    if (options.getBool("hotkeys", false)) {
+        int64_t sampleEvery = options.getInt("hotkeys-sample", 16);
+        int64_t capacity = options.getInt("hotkeys-capacity", 256);
+        int64_t prefixBytes = options.getInt("hotkeys-prefix", 0);
+        int64_t decaySec = options.getInt("hotkeys-decay-sec", 60);
+        if (sampleEvery <= 0 || capacity <= 0 || prefixBytes < 0 || decaySec < 0) {
+            fprintf(stderr, "invalid hot key options: sample %ld, capacity %ld, prefix %ld, decay %ld\n",
+                    sampleEvery, capacity, prefixBytes, decaySec);
+            exit(1);
+        }
+        handler.reset(new HotKeyHandler(handler, sampleEvery, capacity, prefixBytes, decaySec));
+    }
+
+    // stats go on top so that the latencies include the cache.
+    int64_t statsPort = options.getInt("stats-port", 0);
+    if (statsPort < 0 || statsPort > 65535) {
+        fprintf(stderr, "invalid stats port: %ld\n", statsPort);
+        exit(1);
+    }
+    if (options.getBool("stats", true)) {
+        handler.reset(new StatsHandler(handler, statsPort));
+    } else if (statsPort != 0) {
+        fprintf(stderr, "--stats-port requires --stats\n");
+        exit(1);
+    }
+    return handler;
+}
+
+shared_ptr<TProcessor>
+buildProcessor(shared_ptr<MapKeeperIf> backend, const ServerOptions& options)
+{
+    shared_ptr<MapKeeperIf> handler = buildHandlerChain(backend, options);
+    int64_t sampleEvery = options.getInt("trace-sample", 0);
+    int64_t slowRequestUs = options.getInt("slow-request-us", 0);
+    if (sampleEvery < 0 || slowRequestUs < 0) {
+        fprintf(stderr, "invalid trace options: sample %ld, slow request %ld us\n",
+                sampleEvery, slowRequestUs);
+        exit(1);
+    }
+    if (sampleEvery == 0 && slowRequestUs == 0) {
+        return shared_ptr<TProcessor>(new MapKeeperProcessor(handler));
+    }
+    shared_ptr<TracingHandler> tracer(new TracingHandler(handler, sampleEvery, slowRequestUs));
+    shared_ptr<TProcessor> processor(new MapKeeperProcessor(tracer));
+    processor->setEventHandler(tracer);
+    return processor;
+}
@@ -0,0 +1,67 @@
+#ifndef HANDLER_CHAIN_H
+#define HANDLER_CHAIN_H
+
+#include <boost/shared_ptr.hpp>
+#include <TProcessor.h>
+#include "MapKeeper.h"
+#include "ServerOptions.h"
+
+/**
+ * Wraps a backend handler with the decorators enabled in options.
+ *
+ * Recognized options:
+ *
+ *   --compress=<map>:<codec>[:<level>[:<min-bytes>[:<dictionary>]]][,...]
+ *                                  compress the values of these maps with
+ *                                  codec (zlib) at level (default 6), if
+ *                                  they're at least min-bytes long (default
+ *                                  64), using the preset dictionary in the
+ *                                  given file
+ *   --chunk=<map>:<bytes>[,...]    store the values of these maps that are
+ *                                  longer than bytes in chunks of that size,
+ *                                  and accept putChunk() uploads to them
+ *   --chunk-upload-timeout-sec=<sec>  drop putChunk() uploads that get no
+ *                                  piece for this long, and their chunks
+ *                                  (default 300, 0 disables it)
+ *   --chunk-max-uploads=<n>        refuse new putChunk() uploads while this
+ *                                  many are open (default 1024, 0 means no
+ *                                  limit)
+ *   --cache-mb=<n>                 size of the read-through cache (0 disables it)
+ *   --cache-shards=<n>             number of independently locked cache shards
+ *   --cache-stats-interval=<sec>   print cache stats to stderr (0 disables it)
+ *   --coalesce-reads               share one backend call among concurrent
+ *                                  identical gets and scans
+ *   --hotkeys                      track the most frequently accessed keys
+ *                                  and report them through getStats()
+ *   --hotkeys-sample=<n>           sample every n-th key (default 16)
+ *   --hotkeys-capacity=<n>         keys tracked per operation type (default 256)
+ *   --hotkeys-prefix=<bytes>       also track hot key prefixes of this length
+ *                                  (0 disables it)
+ *   --hotkeys-decay-sec=<sec>      halve the key counts this often (default 60,
+ *                                  0 disables it)
+ *   --stats=false                  don't keep per-method latency histograms
+ *                                  and per-map counters for getStats()
+ *   --stats-port=<port>            serve getStats() in the Prometheus text
+ *                                  format on 127.0.0.1 (0 disables it)
+ */
+boost::shared_ptr<mapkeeper::MapKeeperIf> 
+buildHandlerChain(boost::shared_ptr<mapkeeper::MapKeeperIf> backend, 
+                  const ServerOptions& options);
+
+/**
+ * Builds the handler chain and a processor for it, with request tracing
+ * if it's enabled in options.
+ *
+ * Recognized options, in addition to the ones above:
+ *
+ *   --trace-sample=<n>             trace every n-th request on each thread
+ *                                  and report the stage totals through
+ *                                  getStats() (0 disables it)
+ *   --slow-request-us=<us>         log the stage breakdown of requests
+ *                                  slower than this (0 disables it)
+ */
+boost::shared_ptr<apache::thrift::TProcessor>
+buildProcessor(boost::shared_ptr<mapkeeper::MapKeeperIf> backend,
+               const ServerOptions& options);
+
+#endif // HANDLER_CHAIN_H
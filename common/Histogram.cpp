@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include "Histogram.h"
+
+Histogram::
+Histogram(int64_t highestTrackableValue, int significantDigits) :
+    highestTrackableValue_(highestTrackableValue),
+    totalCount_(0),
+    min_(std::numeric_limits<int64_t>::max()),
+    max_(0),
+    sum_(0)
+{
+    if (significantDigits < 1 || significantDigits > 5 || highestTrackableValue < 2) {
+        fprintf(stderr, "invalid histogram parameters: highest %ld, digits %d\n",
+                highestTrackableValue, significantDigits);
+        abort();
+    }
+
+    // we need 2 * 10^digits sub-buckets to tell apart values that differ
+    // by one unit in the last significant digit.
+    int64_t largestSingleUnitResolution = 2;
+    for (int i = 0; i < significantDigits; i++) {
+        largestSingleUnitResolution *= 10;
+    }
+    uint32_t subBucketCountMagnitude = 0;
+    while ((1LL << subBucketCountMagnitude) < largestSingleUnitResolution) {
+        subBucketCountMagnitude++;
+    }
+    subBucketHalfCountMagnitude_ = subBucketCountMagnitude - 1;
+    subBucketHalfCount_ = 1 << subBucketHalfCountMagnitude_;
+    int64_t subBucketCount = 1LL << subBucketCountMagnitude;
+    subBucketMask_ = subBucketCount - 1;
+
+    // each bucket covers twice the range of the previous one.
+    uint32_t bucketCount = 1;
+    int64_t smallestUntrackableValue = subBucketCount;
+    while (smallestUntrackableValue <= highestTrackableValue) {
+        if (smallestUntrackableValue > std::numeric_limits<int64_t>::max() / 2) {
+            bucketCount++;
+            break;
+        }
+        smallestUntrackableValue <<= 1;
+        bucketCount++;
+    }
+    counts_.resize((bucketCount + 1) * subBucketHalfCount_, 0);
+}
+
+void Histogram::
+record(int64_t value)
+{
+    recordMany(value, 1);
+}
+
+void Histogram::
+recordMany(int64_t value, uint64_t count)
+{
+    value = clamp(value);
+    counts_[getCountsIndex(value)] += count;
+    totalCount_ += count;
+    sum_ += value * count;
+    if (value < min_) {
+        min_ = value;
+    }
+    if (value > max_) {
+        max_ = value;
+    }
+}
+
+/**
+ * There is a single writer, so plain read-modify-write sequences are
+ * fine as long as each store is atomic with respect to the readers.
+ */
+void Histogram::
+recordSingleWriter(int64_t value)
+{
+    value = clamp(value);
+    uint64_t& count = counts_[getCountsIndex(value)];
+    __atomic_store_n(&count, count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&sum_, sum_ + value, __ATOMIC_RELAXED);
+    if (value < min_) {
+        __atomic_store_n(&min_, value, __ATOMIC_RELAXED);
+    }
+    if (value > max_) {
+        __atomic_store_n(&max_, value, __ATOMIC_RELAXED);
+    }
+
+    // readers use the total count to decide whether there's anything to
+    // read, so publish it last.
+    __atomic_store_n(&totalCount_, totalCount_ + 1, __ATOMIC_RELEASE);
+}
+
+void Histogram::
+addConcurrent(const Histogram& other)
+{
+    if (other.counts_.size() != counts_.size()) {
+        fprintf(stderr, "adding histograms with different parameters\n");
+        abort();
+    }
+    uint64_t otherCount = __atomic_load_n(&other.totalCount_, __ATOMIC_ACQUIRE);
+    if (otherCount == 0) {
+        return;
+    }
+    uint64_t numCounted = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+        uint64_t count = __atomic_load_n(&other.counts_[i], __ATOMIC_RELAXED);
+        counts_[i] += count;
+        numCounted += count;
+    }
+    totalCount_ += numCounted;
+    sum_ += __atomic_load_n(&other.sum_, __ATOMIC_RELAXED);
+    int64_t otherMin = __atomic_load_n(&other.min_, __ATOMIC_RELAXED);
+    int64_t otherMax = __atomic_load_n(&other.max_, __ATOMIC_RELAXED);
+    if (otherMin < min_) {
+        min_ = otherMin;
+    }
+    if (otherMax > max_) {
+        max_ = otherMax;
+    }
+}
+
+void Histogram::
+add(const Histogram& other)
+{
+    if (other.counts_.size() != counts_.size()) {
+        fprintf(stderr, "adding histograms with different parameters\n");
+        abort();
+    }
+    for (size_t i = 0; i < counts_.size(); i++) {
+        counts_[i] += other.counts_[i];
+    }
+    totalCount_ += other.totalCount_;
+    sum_ += other.sum_;
+    if (other.min_ < min_) {
+        min_ = other.min_;
+    }
+    if (other.max_ > max_) {
+        max_ = other.max_;
+    }
+}
+
+void Histogram::
+reset()
+{
+    std::fill(counts_.begin(), counts_.end(), 0);
+    totalCount_ = 0;
+    min_ = std::numeric_limits<int64_t>::max();
+    max_ = 0;
+    sum_ = 0;
+}
+
+uint64_t Histogram::
+getCount() const
+{
+    return totalCount_;
+}
+
+int64_t Histogram::
+getMin() const
+{
+    return totalCount_ == 0 ? 0 : min_;
+}
+
+int64_t Histogram::
+getMax() const
+{
+    return max_;
+}
+
+double Histogram::
+getMean() const
+{
+    return totalCount_ == 0 ? 0 : (double)sum_ / totalCount_;
+}
+
+int64_t Histogram::
+getValueAtPercentile(double percentile) const
+{
+    if (totalCount_ == 0) {
+        return 0;
+    }
+    if (percentile > 100) {
+        percentile = 100;
+    }
+    uint64_t countAtPercentile = (uint64_t)ceil(percentile / 100 * totalCount_);
+    if (countAtPercentile == 0) {
+        countAtPercentile = 1;
+    }
+    uint64_t runningCount = 0;
+    for (uint32_t i = 0; i < counts_.size(); i++) {
+        runningCount += counts_[i];
+        if (runningCount >= countAtPercentile) {
+            // report the highest value that maps to this slot, but never
+            // more than what was actually recorded.
+            int64_t value = getValueFromIndex(i + 1) - 1;
+            if (value > max_) {
+                value = max_;
+            }
+            return value < min_ ? min_ : value;
+        }
+    }
+    return max_;
+}
+
+int64_t Histogram::
+clamp(int64_t value) const
+{
+    if (value < 0) {
+        return 0;
+    } else if (value > highestTrackableValue_) {
+        return highestTrackableValue_;
+    }
+    return value;
+}
+
+uint32_t Histogram::
+getCountsIndex(int64_t value) const
+{
+    int32_t pow2Ceiling = 64 - __builtin_clzll(value | subBucketMask_);
+    int32_t bucketIndex = pow2Ceiling - (subBucketHalfCountMagnitude_ + 1);
+    int32_t subBucketIndex = value >> bucketIndex;
+    return ((bucketIndex + 1) << subBucketHalfCountMagnitude_) + 
+           (subBucketIndex - subBucketHalfCount_);
+}
+
+int64_t Histogram::
+getValueFromIndex(uint32_t index) const
+{
+    int32_t bucketIndex = (index >> subBucketHalfCountMagnitude_) - 1;
+    int64_t subBucketIndex = (index & (subBucketHalfCount_ - 1)) + subBucketHalfCount_;
+    if (bucketIndex < 0) {
+        subBucketIndex -= subBucketHalfCount_;
+        bucketIndex = 0;
+    }
+    return subBucketIndex << bucketIndex;
+}
@@ -0,0 +1,79 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <vector>
+#include <stdint.h>
+
+/**
+ * A high dynamic range histogram of non-negative integers.
+ *
+ * Values are recorded with a fixed number of significant decimal digits
+ * across the whole range, e.g., with 3 digits a 10us latency is accurate
+ * to 0.01us and a 10s latency to 10ms. Recording a value is a couple of
+ * shifts and an increment, and memory usage only depends on the range
+ * and precision, not on the number of recorded values.
+ *
+ * This class is not thread-safe. Use one histogram per thread and add()
+ * them together when reporting. If the per-thread histograms have to be
+ * read while they're being updated, record with recordSingleWriter() and
+ * read with addConcurrent().
+ */
+class Histogram {
+public:
+    /**
+     * @param highestTrackableValue larger values are recorded as this value.
+     * @param significantDigits     between 1 and 5.
+     */
+    Histogram(int64_t highestTrackableValue, int significantDigits);
+
+    void record(int64_t value);
+    void recordMany(int64_t value, uint64_t count);
+
+    /**
+     * Same as record(), but other threads may read this histogram with
+     * addConcurrent() at the same time. Only one thread may write.
+     */
+    void recordSingleWriter(int64_t value);
+
+    /**
+     * Adds the values recorded in other to this histogram. Both 
+     * histograms must have the same range and precision.
+     */
+    void add(const Histogram& other);
+
+    /**
+     * Same as add(), but other may be updated with recordSingleWriter()
+     * at the same time. The result is not an atomic snapshot; the total
+     * count may be off by the few values recorded during the copy.
+     */
+    void addConcurrent(const Histogram& other);
+    void reset();
+
+    uint64_t getCount() const;
+    int64_t getMin() const;
+    int64_t getMax() const;
+    double getMean() const;
+
+    /**
+     * Returns the smallest recorded value v such that at least percentile%
+     * of the recorded values are less than or equal to v.
+     */
+    int64_t getValueAtPercentile(double percentile) const;
+
+private:
+    int64_t clamp(int64_t value) const;
+    uint32_t getCountsIndex(int64_t value) const;
+    int64_t getValueFromIndex(uint32_t index) const;
+
+    int64_t highestTrackableValue_;
+    uint32_t subBucketHalfCountMagnitude_;
+    uint32_t subBucketHalfCount_;
+    int64_t subBucketMask_;
+    std::vector<uint64_t> counts_;
+    uint64_t totalCount_;
+    int64_t min_;
+    int64_t max_;
+    int64_t sum_;
+};
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,358 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "HotKeyHandler.h"
+
+using namespace mapkeeper;
+
+static const char* SAMPLE_TYPE_NAMES[] = {
+    "get",
+    "write",
+    "scan",
+};
+
+// how many items of each summary getStats() reports.
+static const uint32_t NUM_REPORTED = 20;
+
+static __thread uint32_t numThreadKeys;
+
+HotKeyHandler::
+HotKeyHandler(boost::shared_ptr<MapKeeperIf> handler,
+              uint32_t sampleEvery, uint32_t capacity,
+              uint32_t prefixBytes, uint32_t decaySec) :
+    ForwardingHandler(handler),
+    sampleEvery_(sampleEvery == 0 ? 1 : sampleEvery),
+    prefixBytes_(prefixBytes),
+    decaySec_(decaySec),
+    ring_(new Sample[RING_SIZE]),
+    head_(0),
+    tail_(0),
+    numSamples_(0),
+    numDropped_(0),
+    ranges_(capacity)
+{
+    for (uint32_t i = 0; i < RING_SIZE; i++) {
+        ring_[i].sequence = i;
+    }
+    for (int i = 0; i < NUM_SAMPLE_TYPES; i++) {
+        summaries_.push_back(new SpaceSaving(capacity));
+    }
+    drainer_.reset(new boost::thread(&HotKeyHandler::run, this));
+}
+
+HotKeyHandler::
+~HotKeyHandler()
+{
+    drainer_->interrupt();
+    drainer_->join();
+}
+
+void HotKeyHandler::
+scan(RecordListResponse& _return, const std::string& mapName,
+     const ScanOrder::type order,
+     const std::string& startKey, const bool startKeyIncluded,
+     const std::string& endKey, const bool endKeyIncluded,
+     const int32_t maxRecords, const int32_t maxBytes)
+{
+    // a descending scan starts at the end key.
+    sample(SCAN, mapName, order == ScanOrder::Ascending ? startKey : endKey);
+    handler_->scan(_return, mapName, order, startKey, startKeyIncluded,
+                   endKey, endKeyIncluded, maxRecords, maxBytes);
+}
+
+void HotKeyHandler::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName,
+                const ScanOrder::type order,
+                const std::string& startKey, const bool startKeyIncluded,
+                const std::string& endKey, const bool endKeyIncluded,
+                const int32_t maxRecords, const int32_t maxBytes,
+                const ScanOptions& options)
+{
+    sample(SCAN, mapName, order == ScanOrder::Ascending ? startKey : endKey);
+    handler_->scanWithOptions(_return, mapName, order, startKey, startKeyIncluded,
+                              endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
+void HotKeyHandler::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName,
+           const ScanOrder::type order,
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes,
+           const ScanOptions& options)
+{
+    sample(SCAN, mapName, order == ScanOrder::Ascending ? startKey : endKey);
+    handler_->scanPacked(_return, mapName, order, startKey, startKeyIncluded,
+                         endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
+void HotKeyHandler::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    sample(GET, mapName, key);
+    handler_->get(_return, mapName, key);
+}
+
+/**
+ * A download takes many getRange() calls, so only its first one counts.
+ */
+void HotKeyHandler::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+         const int64_t offset, const int32_t length)
+{
+    if (offset == 0) {
+        sample(GET, mapName, key);
+    }
+    handler_->getRange(_return, mapName, key, offset, length);
+}
+
+ResponseCode::type HotKeyHandler::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    sample(WRITE, mapName, key);
+    return handler_->put(mapName, key, value);
+}
+
+ResponseCode::type HotKeyHandler::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    sample(WRITE, mapName, key);
+    return handler_->insert(mapName, key, value);
+}
+
+ResponseCode::type HotKeyHandler::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    sample(WRITE, mapName, key);
+    return handler_->update(mapName, key, value);
+}
+
+ResponseCode::type HotKeyHandler::
+putChunk(const std::string& mapName, const std::string& key,
+         const int64_t offset, const std::string& data, const bool last)
+{
+    if (last) {
+        sample(WRITE, mapName, key);
+    }
+    return handler_->putChunk(mapName, key, offset, data, last);
+}
+
+ResponseCode::type HotKeyHandler::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    sample(WRITE, mapName, key);
+    return handler_->append(mapName, key, data);
+}
+
+ResponseCode::type HotKeyHandler::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+        const std::string& data)
+{
+    sample(WRITE, mapName, key);
+    return handler_->writeAt(mapName, key, offset, data);
+}
+
+ResponseCode::type HotKeyHandler::
+remove(const std::string& mapName, const std::string& key)
+{
+    sample(WRITE, mapName, key);
+    return handler_->remove(mapName, key);
+}
+
+void HotKeyHandler::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName,
+         const std::vector<std::string>& keys)
+{
+    for (std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++) {
+        sample(GET, mapName, *itr);
+    }
+    handler_->multiGet(_return, mapName, keys);
+}
+
+void HotKeyHandler::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+         const std::vector<Record>& records)
+{
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        sample(WRITE, mapName, itr->key);
+    }
+    handler_->multiPut(_return, mapName, records);
+}
+
+void HotKeyHandler::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        sample(WRITE, mapName, itr->key);
+    }
+    handler_->multiInsert(_return, mapName, records);
+}
+
+void HotKeyHandler::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        sample(WRITE, mapName, itr->key);
+    }
+    handler_->multiUpdate(_return, mapName, records);
+}
+
+void HotKeyHandler::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<std::string>& keys)
+{
+    for (std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++) {
+        sample(WRITE, mapName, *itr);
+    }
+    handler_->multiRemove(_return, mapName, keys);
+}
+
+void HotKeyHandler::
+getStats(StatsResponse& _return)
+{
+    handler_->getStats(_return);
+    _return.counters["hotkeys.samples"] = __sync_fetch_and_add(&numSamples_, 0);
+    _return.counters["hotkeys.dropped"] = __sync_fetch_and_add(&numDropped_, 0);
+    boost::mutex::scoped_lock lock(mutex_);
+    for (int i = 0; i < NUM_SAMPLE_TYPES; i++) {
+        report(summaries_[i], _return.properties[std::string("hotkeys.") + SAMPLE_TYPE_NAMES[i]]);
+    }
+    if (prefixBytes_ > 0) {
+        report(ranges_, _return.properties["hotkeys.range"]);
+    }
+}
+
+void HotKeyHandler::
+sample(SampleType type, const std::string& mapName, const std::string& key)
+{
+    if (++numThreadKeys % sampleEvery_ == 0) {
+        push(type, mapName, key);
+    }
+}
+
+/**
+ * Claims the slot at tail_, unless the consumer hasn't read it yet, in
+ * which case the ring is full and the sample is dropped.
+ */
+void HotKeyHandler::
+push(SampleType type, const std::string& mapName, const std::string& key)
+{
+    uint64_t pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+    Sample* sample = NULL;
+    while (true) {
+        sample = &ring_[pos % RING_SIZE];
+        uint64_t sequence = __atomic_load_n(&sample->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == pos) {
+            if (__atomic_compare_exchange_n(&tail_, &pos, pos + 1, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            // pos now holds the current tail; try again.
+        } else if (sequence < pos) {
+            __sync_fetch_and_add(&numDropped_, 1);
+            return;
+        } else {
+            pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+        }
+    }
+    sample->type = type;
+    sample->mapSize = std::min<size_t>(mapName.size(), MAX_MAP_BYTES);
+    sample->keySize = std::min<size_t>(key.size(), MAX_KEY_BYTES);
+    memcpy(sample->map, mapName.data(), sample->mapSize);
+    memcpy(sample->key, key.data(), sample->keySize);
+    __atomic_store_n(&sample->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Summary items are the map name, prefixed by its length, followed by
+ * the key.
+ */
+void HotKeyHandler::
+drain()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    std::string item;
+    uint64_t numDrained = 0;
+    while (true) {
+        Sample& sample = ring_[head_ % RING_SIZE];
+        if (__atomic_load_n(&sample.sequence, __ATOMIC_ACQUIRE) != head_ + 1) {
+            break;
+        }
+        item.assign(1, (char)sample.mapSize);
+        item.append(sample.map, sample.mapSize);
+        size_t mapBytes = item.size();
+        item.append(sample.key, sample.keySize);
+        // a producer may rewrite the slot as soon as it's released.
+        uint8_t type = sample.type;
+        __atomic_store_n(&sample.sequence, head_ + RING_SIZE, __ATOMIC_RELEASE);
+        head_++;
+
+        summaries_[type].add(item);
+        if (prefixBytes_ > 0) {
+            item.resize(std::min<size_t>(item.size(), mapBytes + prefixBytes_));
+            ranges_.add(item);
+        }
+        numDrained++;
+    }
+    __sync_fetch_and_add(&numSamples_, numDrained);
+}
+
+void HotKeyHandler::
+run()
+{
+    uint32_t numDrains = 0;
+    uint32_t drainsPerDecay = decaySec_ * 100;
+    try {
+        while (true) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+            drain();
+            if (drainsPerDecay > 0 && ++numDrains == drainsPerDecay) {
+                numDrains = 0;
+                boost::mutex::scoped_lock lock(mutex_);
+                for (int i = 0; i < NUM_SAMPLE_TYPES; i++) {
+                    summaries_[i].decay();
+                }
+                ranges_.decay();
+            }
+        }
+    } catch (boost::thread_interrupted& e) {
+    }
+}
+
+void HotKeyHandler::
+report(const SpaceSaving& summary, std::string& out)
+{
+    std::vector<SpaceSaving::Entry> top;
+    summary.getTop(NUM_REPORTED, top);
+    for (std::vector<SpaceSaving::Entry>::iterator itr = top.begin(); itr != top.end(); itr++) {
+        if (itr->count == 0) {
+            break;
+        }
+        size_t mapSize = (uint8_t)itr->item[0];
+        char counts[64];
+        snprintf(counts, sizeof(counts), " %lu %lu\n",
+                 (unsigned long)(itr->count * sampleEvery_),
+                 (unsigned long)(itr->error * sampleEvery_));
+        out += escape(itr->item.data() + 1, mapSize) + " " +
+               escape(itr->item.data() + 1 + mapSize, itr->item.size() - 1 - mapSize) + counts;
+    }
+}
+
+std::string HotKeyHandler::
+escape(const char* data, size_t size)
+{
+    std::string escaped;
+    for (size_t i = 0; i < size; i++) {
+        unsigned char c = data[i];
+        if (c > ' ' && c < 0x7f && c != '\\') {
+            escaped += c;
+        } else {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\x%02x", c);
+            escaped += hex;
+        }
+    }
+    return escaped;
+}
@@ -0,0 +1,135 @@
+#ifndef HOT_KEY_HANDLER_H
+#define HOT_KEY_HANDLER_H
+
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "ForwardingHandler.h"
+#include "SpaceSaving.h"
+
+/**
+ * Finds the most frequently accessed keys and key ranges.
+ *
+ * Every sampleEvery-th key on each thread is copied into a fixed-size
+ * lock-free ring; a background thread drains the ring into Space-Saving
+ * summaries (see SpaceSaving.h), one each for gets, writes and scan
+ * start keys. If prefixBytes is non-zero, the first prefixBytes bytes
+ * of every sampled key also go into a fourth summary, which shows hot
+ * ranges. When the ring is full samples are dropped rather than making
+ * requests wait. Memory usage is fixed: ring size plus capacity entries
+ * per summary.
+ *
+ * Counts are halved every decaySec seconds so that the summaries follow
+ * shifts in the workload.
+ *
+ * getStats() reports the samples as
+ *
+ *   hotkeys.samples, hotkeys.dropped     counters
+ *   hotkeys.{get,write,scan,range}       properties, one line per item,
+ *                                        most frequent first:
+ *                                        <map> <key> <count> <error>
+ *
+ * with counts scaled back up by the sampling rate, and non-printable
+ * bytes in names and keys escaped as \xNN.
+ */
+class HotKeyHandler : public ForwardingHandler {
+public:
+    HotKeyHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> handler,
+                  uint32_t sampleEvery, uint32_t capacity,
+                  uint32_t prefixBytes, uint32_t decaySec);
+    ~HotKeyHandler();
+
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+                         const mapkeeper::ScanOrder::type order,
+                         const std::string& startKey, const bool startKeyIncluded,
+                         const std::string& endKey, const bool endKeyIncluded,
+                         const int32_t maxRecords, const int32_t maxBytes,
+                         const mapkeeper::ScanOptions& options);
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName,
+                    const mapkeeper::ScanOrder::type order,
+                    const std::string& startKey, const bool startKeyIncluded,
+                    const std::string& endKey, const bool endKeyIncluded,
+                    const int32_t maxRecords, const int32_t maxBytes,
+                    const mapkeeper::ScanOptions& options);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+    void getRange(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length);
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key,
+                                           const int64_t offset, const std::string& data, const bool last);
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key,
+                                          const int64_t offset, const std::string& data);
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                  const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<std::string>& keys);
+    void getStats(mapkeeper::StatsResponse& _return);
+
+private:
+    enum SampleType {
+        GET,
+        WRITE,
+        SCAN,
+        NUM_SAMPLE_TYPES
+    };
+
+    // longer map names and keys are truncated.
+    static const uint32_t MAX_MAP_BYTES = 64;
+    static const uint32_t MAX_KEY_BYTES = 128;
+    static const uint32_t RING_SIZE = 8192;
+
+    /**
+     * A slot in the ring. sequence tells producers and the consumer
+     * whose turn it is (Vyukov's bounded queue): a producer may claim
+     * slot i when sequence == i, and the consumer may read it when
+     * sequence == i + 1.
+     */
+    struct Sample {
+        uint64_t sequence;
+        uint8_t type;
+        uint8_t mapSize;
+        uint8_t keySize;
+        char map[MAX_MAP_BYTES];
+        char key[MAX_KEY_BYTES];
+    };
+
+    void sample(SampleType type, const std::string& mapName, const std::string& key);
+    void push(SampleType type, const std::string& mapName, const std::string& key);
+    void drain();
+    void run();
+    void report(const SpaceSaving& summary, std::string& out);
+    static std::string escape(const char* data, size_t size);
+
+    uint32_t sampleEvery_;
+    uint32_t prefixBytes_;
+    uint32_t decaySec_;
+    boost::scoped_array<Sample> ring_;
+    uint64_t head_;       // next slot to read; only touched by the consumer
+    uint64_t tail_;       // next slot to claim
+    uint64_t numSamples_;
+    uint64_t numDropped_;
+
+    boost::mutex mutex_; // protects the summaries
+    boost::ptr_vector<SpaceSaving> summaries_; // one per SampleType
+    SpaceSaving ranges_;
+    boost::scoped_ptr<boost::thread> drainer_;
+};
+
+#endif // HOT_KEY_HANDLER_H
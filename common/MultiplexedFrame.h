@@ -0,0 +1,50 @@
+#ifndef MULTIPLEXED_FRAME_H
+#define MULTIPLEXED_FRAME_H
+
+#include <cstring>
+#include <string>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+/**
+ * Framing for multiplexed connections, shared by EpollServer and the
+ * C++ client library.
+ *
+ * A plain Thrift frame is a 4 byte big-endian length followed by the
+ * message. A multiplexed frame sets the top bit of the length, and the
+ * first 4 bytes of the message are a request id chosen by the client:
+ *
+ *   | 1 | length (31 bits) | request id (32 bits) | message |
+ *
+ * where length counts the request id and the message. The server
+ * answers a multiplexed frame with a multiplexed frame carrying the same
+ * request id, possibly before answering requests sent earlier. Since a
+ * plain frame never has the top bit set, both kinds can be told apart
+ * frame by frame.
+ */
+class MultiplexedFrame {
+public:
+    static const uint32_t FLAG = 0x80000000;
+    static const uint32_t HEADER_BYTES = 2 * sizeof(uint32_t);
+
+    /**
+     * Appends the header of a multiplexed frame holding a message of the
+     * given size.
+     */
+    static void appendHeader(std::string& out, uint32_t requestId, uint32_t messageSize)
+    {
+        uint32_t header[2];
+        header[0] = htonl(FLAG | (messageSize + sizeof(uint32_t)));
+        header[1] = htonl(requestId);
+        out.append((const char*)header, sizeof(header));
+    }
+
+    static uint32_t readUint32(const char* data)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return ntohl(value);
+    }
+};
+
+#endif // MULTIPLEXED_FRAME_H
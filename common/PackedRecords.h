@@ -0,0 +1,267 @@
+#ifndef PACKED_RECORDS_H
+#define PACKED_RECORDS_H
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <endian.h>
+#include <stdint.h>
+
+/**
+ * The records of a scanPacked() response, shared by the servers and the
+ * C++ client library.
+ *
+ * Instead of a list of Records, with two strings to allocate, write and
+ * read for every record, the records are packed into one buffer:
+ *
+ *   | n | flags |
+ *   | key size | value size | key | value |   (once per record)
+ *
+ * where n, flags and sizes are 32-bit little-endian integers. With
+ * SHARED_KEY_PREFIXES set in flags, each key only stores what follows
+ * the prefix it shares with the previous key, as in LevelDB's blocks:
+ *
+ *   | shared | suffix size | value size | suffix | value |
+ *
+ * The lengths are fixed-width rather than varints, so a reader rebuilds
+ * a key with one memcpy of its suffix and no per-byte branches. Servers
+ * append records as their iterators advance, and clients read them in
+ * place.
+ *
+ * With COMPRESSED_VALUES set, the values are as a map with compression
+ * stores them, and ValueCodec::decode() turns them back into values.
+ */
+class PackedRecordWriter {
+public:
+    enum Flags {
+        SHARED_KEY_PREFIXES = 1,
+        COMPRESSED_VALUES = 2,
+    };
+
+    static const size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+
+    /**
+     * Clears buffer and appends the records to it.
+     */
+    PackedRecordWriter(std::string& buffer, bool sharedKeyPrefixes = false,
+                       bool compressedValues = false) :
+        buffer_(buffer),
+        numRecords_(0),
+        sharedKeyPrefixes_(sharedKeyPrefixes),
+        compressedValues_(compressedValues)
+    {
+        buffer_.assign(HEADER_SIZE, '\0');
+    }
+
+    /**
+     * @returns the number of key and value bytes written, which leaves
+     *          out the shared prefix and the sizes.
+     */
+    uint32_t add(const char* key, uint32_t keySize, const char* value, uint32_t valueSize)
+    {
+        uint32_t shared = 0;
+        if (sharedKeyPrefixes_) {
+            uint32_t limit = std::min(keySize, (uint32_t)lastKey_.size());
+            while (shared < limit && lastKey_[shared] == key[shared]) {
+                shared++;
+            }
+            lastKey_.assign(key, keySize);
+            uint32_t sizes[3] = {htole32(shared), htole32(keySize - shared), htole32(valueSize)};
+            buffer_.append((const char*)sizes, sizeof(sizes));
+        } else {
+            uint32_t sizes[2] = {htole32(keySize), htole32(valueSize)};
+            buffer_.append((const char*)sizes, sizeof(sizes));
+        }
+        buffer_.append(key + shared, keySize - shared);
+        buffer_.append(value, valueSize);
+        numRecords_++;
+        return keySize - shared + valueSize;
+    }
+
+    /**
+     * Drops the records added so far.
+     */
+    void clear()
+    {
+        buffer_.assign(HEADER_SIZE, '\0');
+        numRecords_ = 0;
+        lastKey_.clear();
+    }
+
+    /**
+     * Fills in the header. No records can be added after this.
+     */
+    void finish()
+    {
+        uint32_t flags = (sharedKeyPrefixes_ ? SHARED_KEY_PREFIXES : 0) |
+                         (compressedValues_ ? COMPRESSED_VALUES : 0);
+        uint32_t header[2] = {htole32(numRecords_), htole32(flags)};
+        memcpy(&buffer_[0], header, sizeof(header));
+    }
+
+private:
+    std::string& buffer_;
+    uint32_t numRecords_;
+    bool sharedKeyPrefixes_;
+    bool compressedValues_;
+    std::string lastKey_;
+};
+
+/**
+ * Reads packed records in order without copying them, except for keys
+ * with shared prefixes, which are rebuilt in a buffer of the reader's.
+ * The records buffer has to outlive the reader, and a record's pointers
+ * are good until the next call to next().
+ */
+class PackedRecordReader {
+public:
+    /**
+     * Checks that every size stays inside the buffer and every shared
+     * prefix inside the previous key; a reader of a malformed buffer
+     * has no records and valid() false.
+     */
+    PackedRecordReader(const std::string& buffer) :
+        data_(buffer.data()),
+        end_(buffer.data() + buffer.size()),
+        position_(NULL),
+        numRecords_(0),
+        numRead_(0),
+        sharedKeyPrefixes_(false),
+        compressedValues_(false),
+        valid_(false),
+        keyData_(NULL),
+        keySize_(0),
+        value_(NULL),
+        valueSize_(0)
+    {
+        if (buffer.size() < PackedRecordWriter::HEADER_SIZE) {
+            return;
+        }
+        uint32_t numRecords = readUint32(data_);
+        uint32_t flags = readUint32(data_ + sizeof(uint32_t));
+        if (flags & ~(uint32_t)(PackedRecordWriter::SHARED_KEY_PREFIXES |
+                                PackedRecordWriter::COMPRESSED_VALUES)) {
+            return;
+        }
+        bool sharedKeyPrefixes = flags & PackedRecordWriter::SHARED_KEY_PREFIXES;
+        size_t headerSize = (sharedKeyPrefixes ? 3 : 2) * sizeof(uint32_t);
+        const char* position = data_ + PackedRecordWriter::HEADER_SIZE;
+        uint64_t lastKeySize = 0;
+        for (uint32_t i = 0; i < numRecords; i++) {
+            if ((size_t)(end_ - position) < headerSize) {
+                return;
+            }
+            uint64_t shared = sharedKeyPrefixes ? readUint32(position) : 0;
+            const char* sizes = position + headerSize - 2 * sizeof(uint32_t);
+            uint64_t keySize = readUint32(sizes);
+            uint64_t valueSize = readUint32(sizes + sizeof(uint32_t));
+            if (shared > lastKeySize || keySize + valueSize > (uint64_t)(end_ - position) - headerSize) {
+                return;
+            }
+            position += headerSize + keySize + valueSize;
+            lastKeySize = shared + keySize;
+        }
+        if (position != end_) {
+            return;
+        }
+        position_ = data_ + PackedRecordWriter::HEADER_SIZE;
+        numRecords_ = numRecords;
+        sharedKeyPrefixes_ = sharedKeyPrefixes;
+        compressedValues_ = flags & PackedRecordWriter::COMPRESSED_VALUES;
+        valid_ = true;
+    }
+
+    bool valid() const
+    {
+        return valid_;
+    }
+
+    uint32_t size() const
+    {
+        return numRecords_;
+    }
+
+    /**
+     * Whether the values are stored compressed; see ValueCodec.
+     */
+    bool compressedValues() const
+    {
+        return compressedValues_;
+    }
+
+    /**
+     * Moves to the next record, or the first one on the first call.
+     *
+     * @returns false if there are no more records.
+     */
+    bool next()
+    {
+        if (numRead_ == numRecords_) {
+            return false;
+        }
+        numRead_++;
+        if (sharedKeyPrefixes_) {
+            uint32_t shared = readUint32(position_);
+            uint32_t suffixSize = readUint32(position_ + sizeof(uint32_t));
+            valueSize_ = readUint32(position_ + 2 * sizeof(uint32_t));
+            position_ += 3 * sizeof(uint32_t);
+            key_.resize(shared);
+            key_.append(position_, suffixSize);
+            keySize_ = key_.size();
+            position_ += suffixSize;
+        } else {
+            keySize_ = readUint32(position_);
+            valueSize_ = readUint32(position_ + sizeof(uint32_t));
+            position_ += 2 * sizeof(uint32_t);
+            keyData_ = position_;
+            position_ += keySize_;
+        }
+        value_ = position_;
+        position_ += valueSize_;
+        return true;
+    }
+
+    const char* key() const
+    {
+        return sharedKeyPrefixes_ ? key_.data() : keyData_;
+    }
+
+    uint32_t keySize() const
+    {
+        return keySize_;
+    }
+
+    const char* value() const
+    {
+        return value_;
+    }
+
+    uint32_t valueSize() const
+    {
+        return valueSize_;
+    }
+
+private:
+    static uint32_t readUint32(const char* data)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return le32toh(value);
+    }
+
+    const char* data_;
+    const char* end_;
+    const char* position_;   // of the next record
+    uint32_t numRecords_;
+    uint32_t numRead_;
+    bool sharedKeyPrefixes_;
+    bool compressedValues_;
+    bool valid_;
+    const char* keyData_;    // without shared prefixes
+    std::string key_;        // with shared prefixes
+    uint32_t keySize_;
+    const char* value_;
+    uint32_t valueSize_;
+};
+
+#endif // PACKED_RECORDS_H
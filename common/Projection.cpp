@@ -0,0 +1,32 @@
+#include "Projection.h"
+
+bool
+wholeValues(const mapkeeper::ScanOptions& options)
+{
+    return !options.keysOnly && options.valueOffset <= 0 && options.valueLength < 0;
+}
+
+void
+projectRange(const mapkeeper::ScanOptions& options, size_t size, size_t& offset, size_t& length)
+{
+    offset = options.valueOffset > 0 ? options.valueOffset : 0;
+    if (options.keysOnly || offset >= size) {
+        offset = 0;
+        length = 0;
+        return;
+    }
+    length = size - offset;
+    if (options.valueLength >= 0 && (size_t)options.valueLength < length) {
+        length = options.valueLength;
+    }
+}
+
+void
+projectValue(const mapkeeper::ScanOptions& options, const char* value, size_t size,
+             std::string& projected)
+{
+    size_t offset;
+    size_t length;
+    projectRange(options, size, offset, length);
+    projected.assign(value + offset, length);
+}
@@ -0,0 +1,29 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <string>
+#include "MapKeeper.h"
+
+/**
+ * Helpers for scanWithOptions(), for storage engines that can't leave
+ * the unwanted part of a value unread.
+ */
+
+/**
+ * Whether options ask for whole values, as scan() returns them.
+ */
+bool wholeValues(const mapkeeper::ScanOptions& options);
+
+/**
+ * Sets [offset, offset + length) to the part of a value of the given
+ * size that options ask for.
+ */
+void projectRange(const mapkeeper::ScanOptions& options, size_t size, size_t& offset, size_t& length);
+
+/**
+ * Sets projected to the part of the value that options ask for.
+ */
+void projectValue(const mapkeeper::ScanOptions& options, const char* value, size_t size,
+                  std::string& projected);
+
+#endif // PROJECTION_H
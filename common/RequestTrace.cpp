@@ -0,0 +1,43 @@
+#include "RequestTrace.h"
+
+__thread RequestTrace* RequestTrace::current_ = NULL;
+
+static const char* STAGE_NAMES[] = {
+    "read",
+    "cache",
+    "lock",
+    "engine",
+    "deadlock_retry",
+    "handler",
+    "write",
+};
+
+void RequestTrace::
+getBreakdown(uint64_t cycles[NUM_STAGES], uint32_t counts[NUM_STAGES]) const
+{
+    for (int i = 0; i < NUM_STAGES; i++) {
+        cycles[i] = 0;
+        counts[i] = 0;
+    }
+    uint64_t previous = startCycles_;
+    for (uint32_t i = 0; i < numMarks_; i++) {
+        cycles[marks_[i].stage] += marks_[i].cycles - previous;
+        counts[marks_[i].stage] += marks_[i].count;
+        previous = marks_[i].cycles;
+    }
+}
+
+uint64_t RequestTrace::
+getTotalCycles() const
+{
+    if (numMarks_ == 0) {
+        return 0;
+    }
+    return marks_[numMarks_ - 1].cycles - startCycles_;
+}
+
+const char* RequestTrace::
+getStageName(Stage stage)
+{
+    return STAGE_NAMES[stage];
+}
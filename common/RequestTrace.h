@@ -0,0 +1,110 @@
+#ifndef REQUEST_TRACE_H
+#define REQUEST_TRACE_H
+
+#include <cstddef>
+#include "CycleClock.h"
+
+/**
+ * Timestamps of the stages a single request went through.
+ *
+ * A trace is a sequence of marks. Each mark closes a stage: the time
+ * since the previous mark (or the start of the request) is charged to
+ * the stage named by the mark. For example, a handler marks LOCK right
+ * after it acquires a lock and ENGINE right after the storage engine
+ * returns, so that lock waits and engine time show up separately.
+ *
+ * Code on the request path marks stages with TRACE_MARK(). The trace
+ * lives in a thread-local pointer that is only set while a traced
+ * request is being processed, so a mark in an untraced request costs a
+ * thread-local load and a branch.
+ */
+class RequestTrace {
+public:
+    enum Stage {
+        READ,           // deserializing the arguments
+        CACHE,          // up to and including a cache lookup
+        LOCK,           // up to and including acquiring a lock on the maps
+        ENGINE,         // storage engine call
+        DEADLOCK_RETRY, // an engine call attempt that hit a deadlock
+        HANDLER,        // rest of the handler
+        WRITE,          // serializing and sending the response
+        NUM_STAGES
+    };
+
+    static const uint32_t MAX_MARKS = 64;
+
+    void start() {
+        numMarks_ = 0;
+        error_ = false;
+        startCycles_ = CycleClock::now();
+    }
+
+    /**
+     * Consecutive marks of the same stage (e.g., one per key in a batch)
+     * are merged into one, so that a trace doesn't run out of marks.
+     */
+    void mark(Stage stage) {
+        uint64_t now = CycleClock::now();
+        if (numMarks_ > 0 && marks_[numMarks_ - 1].stage == stage) {
+            marks_[numMarks_ - 1].cycles = now;
+            marks_[numMarks_ - 1].count++;
+        } else if (numMarks_ < MAX_MARKS) {
+            marks_[numMarks_].stage = stage;
+            marks_[numMarks_].cycles = now;
+            marks_[numMarks_].count = 1;
+            numMarks_++;
+        }
+    }
+
+    void setError() {
+        error_ = true;
+    }
+
+    bool hasError() const {
+        return error_;
+    }
+
+    /**
+     * Total cycles charged to each stage, and the number of marks of
+     * each stage (e.g., the number of deadlock retries).
+     */
+    void getBreakdown(uint64_t cycles[NUM_STAGES], uint32_t counts[NUM_STAGES]) const;
+
+    /**
+     * Cycles between start() and the last mark.
+     */
+    uint64_t getTotalCycles() const;
+
+    static const char* getStageName(Stage stage);
+
+    static RequestTrace* current() {
+        return current_;
+    }
+
+    static void setCurrent(RequestTrace* trace) {
+        current_ = trace;
+    }
+
+private:
+    struct Mark {
+        Stage stage;
+        uint32_t count;
+        uint64_t cycles;
+    };
+
+    static __thread RequestTrace* current_;
+    uint64_t startCycles_;
+    uint32_t numMarks_;
+    bool error_;
+    Mark marks_[MAX_MARKS];
+};
+
+#define TRACE_MARK(stage) \
+    do { \
+        RequestTrace* trace_ = RequestTrace::current(); \
+        if (trace_ != NULL) { \
+            trace_->mark(stage); \
+        } \
+    } while (0)
+
+#endif // REQUEST_TRACE_H
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "ScanFilter.h"
+
+using namespace mapkeeper;
+
+ScanFilter::
+ScanFilter(const ScanOptions& options) :
+    options_(options),
+    hasRegex_(!options.keyRegex.empty()),
+    valid_(true),
+    maxExamined_(0),
+    numExamined_(0)
+{
+    if (hasRegex_) {
+        int rc = regcomp(&regex_, options.keyRegex.c_str(), REG_EXTENDED | REG_NOSUB);
+        if (rc != 0) {
+            char error[256];
+            regerror(rc, &regex_, error, sizeof(error));
+            fprintf(stderr, "bad key regex %s: %s\n", options.keyRegex.c_str(), error);
+            hasRegex_ = false;
+            valid_ = false;
+        }
+    }
+    if (options.maxExamined > 0) {
+        maxExamined_ = options.maxExamined;
+    } else if (!options.keyPrefix.empty() || !options.keyRegex.empty() ||
+               !options.valueFilters.empty()) {
+        maxExamined_ = DEFAULT_MAX_EXAMINED;
+    }
+}
+
+ScanFilter::
+~ScanFilter()
+{
+    if (hasRegex_) {
+        regfree(&regex_);
+    }
+}
+
+bool ScanFilter::
+valid() const
+{
+    return valid_;
+}
+
+bool ScanFilter::
+narrowRange(std::string& startKey, bool& startKeyIncluded,
+            std::string& endKey, bool& endKeyIncluded) const
+{
+    const std::string& prefix = options_.keyPrefix;
+    if (prefix.empty()) {
+        return true;
+    }
+    if (startKey < prefix) {
+        startKey = prefix;
+        startKeyIncluded = true;
+    }
+
+    // the smallest key after all the keys with the prefix, if any.
+    std::string successor = prefix;
+    while (!successor.empty() && (unsigned char)successor[successor.size() - 1] == 0xff) {
+        successor.erase(successor.size() - 1);
+    }
+    if (!successor.empty()) {
+        successor[successor.size() - 1]++;
+        if (endKey.empty() || successor <= endKey) {
+            endKey = successor;
+            endKeyIncluded = false;
+        }
+    }
+    if (endKey.empty()) {
+        return true;
+    }
+    int result = startKey.compare(endKey);
+    return result < 0 || (result == 0 && startKeyIncluded && endKeyIncluded);
+}
+
+bool ScanFilter::
+needsValue() const
+{
+    return !options_.valueFilters.empty();
+}
+
+ScanFilter::Verdict ScanFilter::
+examine(const char* key, size_t keySize, const char* value, size_t valueSize)
+{
+    if (maxExamined_ > 0 && numExamined_ >= maxExamined_) {
+        return Stop;
+    }
+    numExamined_++;
+    lastExamined_.assign(key, keySize);
+    const std::string& prefix = options_.keyPrefix;
+    if (keySize < prefix.size() || memcmp(key, prefix.data(), prefix.size()) != 0) {
+        return Reject;
+    }
+    if (hasRegex_) {
+        regmatch_t range;
+        range.rm_so = 0;
+        range.rm_eo = keySize;
+        if (regexec(&regex_, key, 1, &range, REG_STARTEND) != 0) {
+            return Reject;
+        }
+    }
+    for (size_t i = 0; i < options_.valueFilters.size(); i++) {
+        if (!matchesValue(options_.valueFilters[i], value, valueSize)) {
+            return Reject;
+        }
+    }
+    return Accept;
+}
+
+const std::string& ScanFilter::
+lastExamined() const
+{
+    return lastExamined_;
+}
+
+bool ScanFilter::
+matchesValue(const ValueFilter& filter, const char* value, size_t size)
+{
+    size_t offset = std::min<size_t>(std::max(filter.offset, 0), size);
+    size_t length = size - offset;
+    if (filter.length >= 0 && (size_t)filter.length < length) {
+        length = filter.length;
+    }
+    const char* bytes = value + offset;
+    const std::string& operand = filter.operand;
+    if (filter.op == CompareOp::Contains) {
+        return std::search(bytes, bytes + length, operand.data(), operand.data() + operand.size()) !=
+            bytes + length;
+    }
+    int result = memcmp(bytes, operand.data(), std::min(length, operand.size()));
+    if (result == 0) {
+        result = length < operand.size() ? -1 : (length > operand.size() ? 1 : 0);
+    }
+    switch (filter.op) {
+    case CompareOp::Equal:
+        return result == 0;
+    case CompareOp::NotEqual:
+        return result != 0;
+    case CompareOp::Less:
+        return result < 0;
+    case CompareOp::LessOrEqual:
+        return result <= 0;
+    case CompareOp::Greater:
+        return result > 0;
+    case CompareOp::GreaterOrEqual:
+        return result >= 0;
+    default:
+        return false;
+    }
+}
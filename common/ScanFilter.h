@@ -0,0 +1,86 @@
+#ifndef SCAN_FILTER_H
+#define SCAN_FILTER_H
+
+#include <string>
+#include <regex.h>
+#include <stdint.h>
+#include "MapKeeper.h"
+
+/**
+ * Evaluates the filters of scanWithOptions() (key prefix, key regex,
+ * value filters) and its budget of examined records, inside the storage
+ * engines' iterator loops so rejected records are never copied.
+ *
+ * This class is not thread-safe; each scan makes its own.
+ */
+class ScanFilter {
+public:
+    enum Verdict {
+        Accept,
+        Reject,
+        Stop,    // the budget is spent; end the scan with Success
+    };
+
+    // budget of filtered scans that don't set maxExamined.
+    static const uint32_t DEFAULT_MAX_EXAMINED = 100000;
+
+    ScanFilter(const mapkeeper::ScanOptions& options);
+    ~ScanFilter();
+
+    /**
+     * False if keyRegex doesn't compile; the scan should fail with
+     * Error.
+     */
+    bool valid() const;
+
+    /**
+     * Narrows [startKey, endKey] to the keys that start with keyPrefix,
+     * so the engines seek past the rest instead of examining it.
+     *
+     * @returns false if no key in the range has the prefix.
+     */
+    bool narrowRange(std::string& startKey, bool& startKeyIncluded,
+                     std::string& endKey, bool& endKeyIncluded) const;
+
+    /**
+     * Whether examine() looks at values; engines that skip reading
+     * values (keysOnly, projections) have to read them whole when it
+     * does.
+     */
+    bool needsValue() const;
+
+    /**
+     * Looks at the next record in scan order, whose key and value are
+     * only read during the call. value may be NULL unless needsValue().
+     * keyRegex is matched against all keySize bytes of the key, so keys
+     * with NUL bytes (like ChunkingHandler's chunk keys) aren't cut
+     * short.
+     */
+    Verdict examine(const char* key, size_t keySize, const char* value, size_t valueSize);
+
+    /**
+     * The key of the last record examine() accepted or rejected, which
+     * the engines return as resumeKey.
+     */
+    const std::string& lastExamined() const;
+
+    /**
+     * Whether a value passes filter, for callers that only have the
+     * value after the engine's scan, such as CompressionHandler.
+     */
+    static bool matchesValue(const mapkeeper::ValueFilter& filter, const char* value, size_t size);
+
+private:
+    ScanFilter(const ScanFilter&);
+    ScanFilter& operator=(const ScanFilter&);
+
+    const mapkeeper::ScanOptions& options_;
+    bool hasRegex_;
+    bool valid_;
+    regex_t regex_;
+    uint64_t maxExamined_;    // 0 for no limit
+    uint64_t numExamined_;
+    std::string lastExamined_;
+};
+
+#endif // SCAN_FILTER_H
@@ -0,0 +1,210 @@
+#ifndef SCAN_SINK_H
+#define SCAN_SINK_H
+
+#include <string>
+#include <stdint.h>
+#include "MapKeeper.h"
+#include "PackedRecords.h"
+#include "ValueCodec.h"
+
+/**
+ * The response of a scan being built. Storage engines add records to a
+ * sink as their iterators advance, so the same loop serves scan(),
+ * scanWithOptions() and scanPacked().
+ */
+class ScanSink {
+public:
+    ScanSink() :
+        numRecords_(0),
+        numBytes_(0)
+    {
+    }
+
+    virtual ~ScanSink() {}
+
+    /**
+     * Copies a record into the response.
+     */
+    void add(const char* key, uint32_t keySize, const char* value, uint32_t valueSize)
+    {
+        numRecords_++;
+        numBytes_ += append(key, keySize, value, valueSize);
+    }
+
+    /**
+     * Copies the current record of a scanPacked() response. Values the
+     * sink has to store compressed are stored uncompressed when the
+     * reader's aren't; the reverse isn't possible, so callers check
+     * that the reader's values aren't compressed if the sink's aren't.
+     */
+    void add(const PackedRecordReader& reader)
+    {
+        if (!compressedValues() || reader.compressedValues()) {
+            add(reader.key(), reader.keySize(), reader.value(), reader.valueSize());
+            return;
+        }
+        stored_.assign(1, (char)ValueCodec::NONE);
+        stored_.append(reader.value(), reader.valueSize());
+        add(reader.key(), reader.keySize(), stored_.data(), stored_.size());
+    }
+
+    /**
+     * Drops the records added so far, for scans that fail halfway.
+     */
+    void clear()
+    {
+        numRecords_ = 0;
+        numBytes_ = 0;
+        discard();
+    }
+
+    uint32_t size() const
+    {
+        return numRecords_;
+    }
+
+    /**
+     * Key and value bytes added so far, as encoded in the response.
+     */
+    int64_t bytes() const
+    {
+        return numBytes_;
+    }
+
+    /**
+     * Whether the response holds maxRecords records or maxBytes bytes;
+     * 0 means no limit.
+     */
+    bool full(int32_t maxRecords, int32_t maxBytes) const
+    {
+        return (maxRecords > 0 && numRecords_ >= (uint32_t)maxRecords) ||
+            (maxBytes > 0 && numBytes_ >= maxBytes);
+    }
+
+    /**
+     * Whether values go into the response as maps with compression store
+     * them, for clients that decompress them with ValueCodec.
+     */
+    virtual bool compressedValues() const
+    {
+        return false;
+    }
+
+    virtual void setResponseCode(mapkeeper::ResponseCode::type responseCode) = 0;
+    virtual void setResumeKey(const std::string& resumeKey) = 0;
+
+protected:
+    /**
+     * @returns the key and value bytes it took.
+     */
+    virtual uint32_t append(const char* key, uint32_t keySize, const char* value, uint32_t valueSize) = 0;
+    virtual void discard() = 0;
+
+private:
+    uint32_t numRecords_;
+    int64_t numBytes_;
+    std::string stored_;
+};
+
+class RecordListSink : public ScanSink {
+public:
+    RecordListSink(mapkeeper::RecordListResponse& response) :
+        response_(response)
+    {
+        response_.records.clear();
+        response_.resumeKey.clear();
+    }
+
+    void setResponseCode(mapkeeper::ResponseCode::type responseCode)
+    {
+        response_.responseCode = responseCode;
+    }
+
+    void setResumeKey(const std::string& resumeKey)
+    {
+        response_.resumeKey = resumeKey;
+    }
+
+protected:
+    uint32_t append(const char* key, uint32_t keySize, const char* value, uint32_t valueSize)
+    {
+        response_.records.push_back(mapkeeper::Record());
+        mapkeeper::Record& record = response_.records.back();
+        record.key.assign(key, keySize);
+        record.value.assign(value, valueSize);
+        return keySize + valueSize;
+    }
+
+    void discard()
+    {
+        response_.records.clear();
+    }
+
+private:
+    mapkeeper::RecordListResponse& response_;
+};
+
+/**
+ * Writes the records into one buffer (see PackedRecords.h). The header
+ * is filled in when the sink goes away. With shared key prefixes,
+ * maxBytes counts the key suffixes, so more records fit.
+ */
+class PackedRecordSink : public ScanSink {
+public:
+    PackedRecordSink(mapkeeper::PackedRecordListResponse& response, bool sharedKeyPrefixes,
+                     bool compressedValues = false) :
+        response_(response),
+        writer_(response.records, sharedKeyPrefixes, compressedValues),
+        compressedValues_(compressedValues)
+    {
+        response_.resumeKey.clear();
+    }
+
+    ~PackedRecordSink()
+    {
+        writer_.finish();
+    }
+
+    /**
+     * Whether scanPacked() with options returns values compressed, as it
+     * does when the client asks for them and for whole values.
+     */
+    static bool wantsCompressedValues(const mapkeeper::ScanOptions& options)
+    {
+        return options.compressedValues && !options.keysOnly &&
+            options.valueOffset <= 0 && options.valueLength < 0;
+    }
+
+    bool compressedValues() const
+    {
+        return compressedValues_;
+    }
+
+    void setResponseCode(mapkeeper::ResponseCode::type responseCode)
+    {
+        response_.responseCode = responseCode;
+    }
+
+    void setResumeKey(const std::string& resumeKey)
+    {
+        response_.resumeKey = resumeKey;
+    }
+
+protected:
+    uint32_t append(const char* key, uint32_t keySize, const char* value, uint32_t valueSize)
+    {
+        return writer_.add(key, keySize, value, valueSize);
+    }
+
+    void discard()
+    {
+        writer_.clear();
+    }
+
+private:
+    mapkeeper::PackedRecordListResponse& response_;
+    PackedRecordWriter writer_;
+    bool compressedValues_;
+};
+
+#endif // SCAN_SINK_H
@@ -0,0 +1,78 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "ServerOptions.h"
+
+ServerOptions::
+ServerOptions()
+{
+}
+
+void ServerOptions::
+parse(int& argc, char** argv)
+{
+    int numArgs = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0 || strlen(argv[i]) == 2) {
+            argv[numArgs++] = argv[i];
+            continue;
+        }
+        std::string option(argv[i] + 2);
+        size_t pos = option.find('=');
+        if (pos == std::string::npos) {
+            options_[option] = "true";
+        } else {
+            options_[option.substr(0, pos)] = option.substr(pos + 1);
+        }
+    }
+    argc = numArgs;
+    argv[argc] = NULL;
+}
+
+bool ServerOptions::
+has(const std::string& name) const
+{
+    return options_.find(name) != options_.end();
+}
+
+std::string ServerOptions::
+getString(const std::string& name, const std::string& defaultValue) const
+{
+    std::map<std::string, std::string>::const_iterator itr = options_.find(name);
+    if (itr == options_.end()) {
+        return defaultValue;
+    }
+    return itr->second;
+}
+
+int64_t ServerOptions::
+getInt(const std::string& name, int64_t defaultValue) const
+{
+    std::map<std::string, std::string>::const_iterator itr = options_.find(name);
+    if (itr == options_.end()) {
+        return defaultValue;
+    }
+    char* end = NULL;
+    int64_t value = strtoll(itr->second.c_str(), &end, 10);
+    if (end == itr->second.c_str() || *end != '\0') {
+        fprintf(stderr, "invalid value for --%s: %s\n", name.c_str(), itr->second.c_str());
+        exit(1);
+    }
+    return value;
+}
+
+bool ServerOptions::
+getBool(const std::string& name, bool defaultValue) const
+{
+    std::map<std::string, std::string>::const_iterator itr = options_.find(name);
+    if (itr == options_.end()) {
+        return defaultValue;
+    }
+    return itr->second == "true" || itr->second == "1" || itr->second == "yes";
+}
+
+void ServerOptions::
+set(const std::string& name, const std::string& value)
+{
+    options_[name] = value;
+}
@@ -0,0 +1,35 @@
+#ifndef SERVER_OPTIONS_H
+#define SERVER_OPTIONS_H
+
+#include <map>
+#include <string>
+#include <stdint.h>
+
+/**
+ * Command line options shared by all the servers.
+ *
+ * Options are given as --name=value (or just --name for a boolean).
+ * They are removed from argv, so each server can keep parsing its own
+ * positional arguments as before.
+ */
+class ServerOptions {
+public:
+    ServerOptions();
+
+    /**
+     * Parses and removes --name[=value] arguments from argv, and updates
+     * argc accordingly.
+     */
+    void parse(int& argc, char** argv);
+
+    bool has(const std::string& name) const;
+    std::string getString(const std::string& name, const std::string& defaultValue) const;
+    int64_t getInt(const std::string& name, int64_t defaultValue) const;
+    bool getBool(const std::string& name, bool defaultValue) const;
+    void set(const std::string& name, const std::string& value);
+
+private:
+    std::map<std::string, std::string> options_;
+};
+
+#endif // SERVER_OPTIONS_H
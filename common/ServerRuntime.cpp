@@ -0,0 +1,49 @@
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <protocol/TBinaryProtocol.h>
+#include <server/TThreadedServer.h>
+#include <transport/TServerSocket.h>
+#include <transport/TBufferTransports.h>
+#include "EpollServer.h"
+#include "ServerRuntime.h"
+
+using boost::shared_ptr;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::server;
+using namespace apache::thrift::transport;
+
+void
+runServer(shared_ptr<TProcessor> processor, const ServerOptions& options)
+{
+    std::string server = options.getString("server", "threaded");
+    int64_t port = options.getInt("port", 9090);
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "invalid port: %ld\n", port);
+        exit(1);
+    }
+    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
+    if (server == "threaded") {
+        shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
+        shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
+        TThreadedServer threadedServer(processor, serverTransport, transportFactory, protocolFactory);
+        threadedServer.serve();
+    } else if (server == "epoll") {
+        int64_t numIoThreads = options.getInt("io-threads", sysconf(_SC_NPROCESSORS_ONLN));
+        int64_t numWorkers = options.getInt("workers", 64);
+        int64_t maxQueued = options.getInt("max-queued", 4096);
+        int64_t maxFrameMb = options.getInt("max-frame-mb", 64);
+        if (numIoThreads <= 0 || numWorkers < 0 || maxQueued < 0 || maxFrameMb <= 0 || maxFrameMb > 2047) {
+            fprintf(stderr, "invalid epoll server options: io threads %ld, workers %ld, max queued %ld, "
+                    "max frame %ld MB\n", numIoThreads, numWorkers, maxQueued, maxFrameMb);
+            exit(1);
+        }
+        EpollServer epollServer(processor, protocolFactory, port, numIoThreads, numWorkers, maxQueued,
+                                maxFrameMb << 20);
+        epollServer.serve();
+    } else {
+        fprintf(stderr, "unknown server: %s (expected threaded or epoll)\n", server.c_str());
+        exit(1);
+    }
+}
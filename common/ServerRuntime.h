@@ -0,0 +1,28 @@
+#ifndef SERVER_RUNTIME_H
+#define SERVER_RUNTIME_H
+
+#include <boost/shared_ptr.hpp>
+#include <TProcessor.h>
+#include "ServerOptions.h"
+
+/**
+ * Serves processor with framed transport and binary protocol until the
+ * process exits, using the server chosen in options.
+ *
+ * Recognized options:
+ *
+ *   --server=threaded|epoll        threaded (the default) runs a thread per
+ *                                  connection; epoll runs EpollServer
+ *   --port=<port>                  default 9090
+ *   --io-threads=<n>               epoll threads (default: number of cores)
+ *   --workers=<n>                  threads that run requests (default 64)
+ *   --max-queued=<n>               requests that may wait for a worker
+ *                                  (default 4096); epoll stops reading
+ *                                  connections while the queue is full
+ *   --max-frame-mb=<n>             epoll closes connections that send a
+ *                                  larger frame (default 64)
+ */
+void runServer(boost::shared_ptr<apache::thrift::TProcessor> processor,
+               const ServerOptions& options);
+
+#endif // SERVER_RUNTIME_H
@@ -0,0 +1,178 @@
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+#include <map>
+#include <string>
+#include <boost/functional/hash.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/**
+ * Deduplicates concurrent calls with the same group and key.
+ *
+ * The first caller for a key (the leader) runs the call. Callers that
+ * arrive while the call is in flight wait for it and get a copy of
+ * the leader's result instead of running their own. If the leader
+ * throws, each waiter runs the call itself.
+ *
+ * Flights are kept in NUM_SHARDS independently locked shards, indexed
+ * by group, so that detaching a group only touches its own flights.
+ */
+template <typename Result>
+class SingleFlight {
+public:
+    /**
+     * @param shardByGroup keep all the flights of a group in one shard,
+     *                     so that detachGroup() locks only that shard.
+     *                     Otherwise flights are spread by group and key,
+     *                     and detachGroup() visits every shard.
+     */
+    explicit SingleFlight(bool shardByGroup) :
+        shardByGroup_(shardByGroup)
+    {
+    }
+
+    /**
+     * Runs call(result), or waits for an identical call that is already
+     * in flight. Returns true if this thread ran the call.
+     */
+    template <typename Call>
+    bool run(const std::string& group, const std::string& key, Result& result, Call call)
+    {
+        Shard& shard = getShard(group, key);
+        boost::shared_ptr<Flight> flight;
+        bool leader = false;
+        {
+            boost::mutex::scoped_lock lock(shard.mutex);
+            Flights& flights = shard.groups[group];
+            typename Flights::iterator itr = flights.find(key);
+            if (itr == flights.end()) {
+                flight.reset(new Flight());
+                flights.insert(std::make_pair(key, flight));
+                leader = true;
+            } else {
+                flight = itr->second;
+            }
+        }
+        if (leader) {
+            try {
+                call(flight->result);
+            } catch (...) {
+                finish(shard, group, key, flight, true);
+                throw;
+            }
+            finish(shard, group, key, flight, false);
+            result = flight->result;
+            return true;
+        }
+        {
+            boost::mutex::scoped_lock lock(flight->mutex);
+            while (!flight->finished) {
+                flight->done.wait(lock);
+            }
+        }
+        if (flight->failed) {
+            call(result);
+        } else {
+            result = flight->result;
+        }
+        return false;
+    }
+
+    /**
+     * Stops callers that arrive from now on from joining the call in
+     * flight for key. Used after a write that the call may not see.
+     */
+    void detach(const std::string& group, const std::string& key)
+    {
+        Shard& shard = getShard(group, key);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        typename Groups::iterator itr = shard.groups.find(group);
+        if (itr != shard.groups.end()) {
+            itr->second.erase(key);
+            if (itr->second.empty()) {
+                shard.groups.erase(itr);
+            }
+        }
+    }
+
+    /**
+     * Same as detach(), but for every key of group.
+     */
+    void detachGroup(const std::string& group)
+    {
+        if (shardByGroup_) {
+            clearGroup(getShard(group, std::string()), group);
+            return;
+        }
+        for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+            clearGroup(shards_[i], group);
+        }
+    }
+
+private:
+    static const uint32_t NUM_SHARDS = 16;
+
+    struct Flight {
+        Flight() : finished(false), failed(false) {}
+        boost::mutex mutex;
+        boost::condition_variable done;
+        bool finished;
+        bool failed;
+        Result result;
+    };
+    typedef boost::unordered_map<std::string, boost::shared_ptr<Flight> > Flights;
+    typedef std::map<std::string, Flights> Groups;
+
+    struct Shard {
+        boost::mutex mutex; // protects groups
+        Groups groups;      // groups without flights are removed
+    };
+
+    Shard& getShard(const std::string& group, const std::string& key)
+    {
+        size_t hash = boost::hash<std::string>()(group);
+        if (!shardByGroup_) {
+            boost::hash_combine(hash, key);
+        }
+        return shards_[hash % NUM_SHARDS];
+    }
+
+    static void clearGroup(Shard& shard, const std::string& group)
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        shard.groups.erase(group);
+    }
+
+    static void finish(Shard& shard, const std::string& group, const std::string& key,
+                       boost::shared_ptr<Flight> flight, bool failed)
+    {
+        {
+            boost::mutex::scoped_lock lock(shard.mutex);
+            typename Groups::iterator itr = shard.groups.find(group);
+            if (itr != shard.groups.end()) {
+                typename Flights::iterator flightItr = itr->second.find(key);
+                if (flightItr != itr->second.end() && flightItr->second == flight) {
+                    itr->second.erase(flightItr);
+                    if (itr->second.empty()) {
+                        shard.groups.erase(itr);
+                    }
+                }
+            }
+        }
+        boost::mutex::scoped_lock lock(flight->mutex);
+        flight->finished = true;
+        flight->failed = failed;
+        flight->done.notify_all();
+    }
+
+    SingleFlight(const SingleFlight&);
+    SingleFlight& operator=(const SingleFlight&);
+
+    bool shardByGroup_;
+    Shard shards_[NUM_SHARDS];
+};
+
+#endif // SINGLE_FLIGHT_H
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include "SpaceSaving.h"
+
+namespace {
+
+bool moreFrequent(const SpaceSaving::Entry& a, const SpaceSaving::Entry& b)
+{
+    return a.count > b.count;
+}
+
+}
+
+SpaceSaving::
+SpaceSaving(uint32_t capacity) :
+    capacity_(capacity == 0 ? 1 : capacity)
+{
+    heap_.reserve(capacity_);
+}
+
+/**
+ * Counts only grow, so an updated entry can only move down the heap.
+ */
+void SpaceSaving::
+add(const std::string& item, uint64_t count)
+{
+    boost::unordered_map<std::string, uint32_t>::iterator itr = positions_.find(item);
+    if (itr != positions_.end()) {
+        uint32_t pos = itr->second;
+        heap_[pos].count += count;
+        siftDown(pos);
+        return;
+    }
+    if (heap_.size() < capacity_) {
+        Entry entry;
+        entry.item = item;
+        entry.count = count;
+        entry.error = 0;
+        heap_.push_back(entry);
+
+        // a new entry may be smaller than its parents.
+        uint32_t pos = heap_.size() - 1;
+        positions_[item] = pos;
+        while (pos > 0 && heap_[(pos - 1) / 2].count > heap_[pos].count) {
+            swap(pos, (pos - 1) / 2);
+            pos = (pos - 1) / 2;
+        }
+        return;
+    }
+
+    // replace the least frequent item.
+    Entry& min = heap_[0];
+    positions_.erase(min.item);
+    min.item = item;
+    min.error = min.count;
+    min.count += count;
+    positions_[item] = 0;
+    siftDown(0);
+}
+
+/**
+ * Halving every count keeps the heap order.
+ */
+void SpaceSaving::
+decay()
+{
+    for (size_t i = 0; i < heap_.size(); i++) {
+        heap_[i].count /= 2;
+        heap_[i].error /= 2;
+    }
+}
+
+void SpaceSaving::
+getTop(uint32_t k, std::vector<Entry>& top) const
+{
+    top = heap_;
+    std::sort(top.begin(), top.end(), moreFrequent);
+    if (top.size() > k) {
+        top.resize(k);
+    }
+}
+
+void SpaceSaving::
+siftDown(uint32_t pos)
+{
+    uint32_t size = heap_.size();
+    while (true) {
+        uint32_t smallest = pos;
+        uint32_t left = 2 * pos + 1;
+        uint32_t right = left + 1;
+        if (left < size && heap_[left].count < heap_[smallest].count) {
+            smallest = left;
+        }
+        if (right < size && heap_[right].count < heap_[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == pos) {
+            return;
+        }
+        swap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+void SpaceSaving::
+swap(uint32_t a, uint32_t b)
+{
+    std::swap(heap_[a], heap_[b]);
+    positions_[heap_[a].item] = a;
+    positions_[heap_[b].item] = b;
+}
@@ -0,0 +1,53 @@
+#ifndef SPACE_SAVING_H
+#define SPACE_SAVING_H
+
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <stdint.h>
+
+/**
+ * Approximate top-k of a stream of strings in fixed memory, using the
+ * Space-Saving algorithm (Metwally et al., "Efficient Computation of
+ * Frequent and Top-k Elements in Data Streams").
+ *
+ * At most capacity items are tracked. An item that isn't tracked
+ * replaces the item with the smallest count and inherits its count, so
+ * counts are overestimates by at most the reported error. Any item
+ * whose true frequency is larger than (number of items / capacity) is
+ * guaranteed to be tracked.
+ *
+ * This class is not thread-safe.
+ */
+class SpaceSaving {
+public:
+    struct Entry {
+        std::string item;
+        uint64_t count;
+        uint64_t error;   // count - error is a lower bound on the true count
+    };
+
+    SpaceSaving(uint32_t capacity);
+
+    void add(const std::string& item, uint64_t count = 1);
+
+    /**
+     * Halves all the counts so that old traffic fades away.
+     */
+    void decay();
+
+    /**
+     * Returns up to k tracked items, most frequent first.
+     */
+    void getTop(uint32_t k, std::vector<Entry>& top) const;
+
+private:
+    void siftDown(uint32_t pos);
+    void swap(uint32_t a, uint32_t b);
+
+    uint32_t capacity_;
+    std::vector<Entry> heap_; // min-heap on count
+    boost::unordered_map<std::string, uint32_t> positions_; // item -> heap index
+};
+
+#endif // SPACE_SAVING_H
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include "SplitKeys.h"
+
+SplitKeySampler::
+SplitKeySampler(uint32_t numSplits) :
+    numSplits_(std::max<uint32_t>(1, std::min(numSplits, MAX_SPLITS))),
+    maxSamples_(std::max<uint32_t>(1024, 16 * numSplits_)),
+    stride_(1),
+    numRecords_(0),
+    bytes_(0)
+{
+}
+
+void SplitKeySampler::
+add(const std::string& key, uint64_t bytes)
+{
+    if (numRecords_ == 0) {
+        firstKey_ = key;
+    }
+    if (numRecords_ % stride_ == 0) {
+        if (samples_.size() == maxSamples_) {
+            for (size_t i = 0; i < samples_.size() / 2; i++) {
+                samples_[i] = samples_[2 * i];
+            }
+            samples_.resize(samples_.size() / 2);
+            stride_ *= 2;
+        }
+        if (numRecords_ % stride_ == 0) {
+            samples_.push_back(std::make_pair(bytes_, key));
+        }
+    }
+    numRecords_++;
+    bytes_ += bytes;
+}
+
+uint64_t SplitKeySampler::
+size() const
+{
+    return numRecords_;
+}
+
+const std::string& SplitKeySampler::
+firstKey() const
+{
+    return firstKey_;
+}
+
+void SplitKeySampler::
+getSplitKeys(std::vector<std::string>& splitKeys) const
+{
+    splitKeys.clear();
+    size_t next = 1;
+    for (uint32_t i = 1; i < numSplits_; i++) {
+        uint64_t target = bytes_ * i / numSplits_;
+        while (next < samples_.size() && samples_[next].first < target) {
+            next++;
+        }
+        if (next == samples_.size()) {
+            break;
+        }
+        // the first sample can't be a split key, or the first part would
+        // be empty.
+        if (splitKeys.empty() || splitKeys.back() != samples_[next].second) {
+            splitKeys.push_back(samples_[next].second);
+        }
+    }
+}
+
+static uint64_t toNumber(const std::string& key, size_t offset)
+{
+    uint64_t number = 0;
+    for (size_t i = 0; i < 8; i++) {
+        number <<= 8;
+        if (offset + i < key.size()) {
+            number |= (unsigned char)key[offset + i];
+        }
+    }
+    return number;
+}
+
+/**
+ * The inverse of toNumber(), without the trailing zero bytes, which
+ * doesn't change the key order.
+ */
+static std::string toKey(const std::string& prefix, uint64_t number)
+{
+    std::string key = prefix;
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        key.push_back((char)(number >> shift));
+    }
+    while (key.size() > prefix.size() && key[key.size() - 1] == '\0') {
+        key.erase(key.size() - 1);
+    }
+    return key;
+}
+
+bool
+bisectSplitKeys(const std::string& firstKey, const std::string& lastKey, uint32_t numSplits,
+                const boost::function<double (const std::string&)>& position,
+                std::vector<std::string>& splitKeys)
+{
+    splitKeys.clear();
+    numSplits = std::min(numSplits, MAX_SPLITS);
+    size_t prefixSize = 0;
+    while (prefixSize < firstKey.size() && prefixSize < lastKey.size() &&
+           firstKey[prefixSize] == lastKey[prefixSize]) {
+        prefixSize++;
+    }
+    std::string prefix = firstKey.substr(0, prefixSize);
+    uint64_t low = toNumber(firstKey, prefixSize);
+    uint64_t high = toNumber(lastKey, prefixSize);
+    for (uint32_t i = 1; i < numSplits; i++) {
+        double target = (double)i / numSplits;
+
+        // position(low) < target <= position(high)
+        uint64_t high2 = high;
+        while (high2 - low > 1) {
+            uint64_t middle = low + (high2 - low) / 2;
+            double p = position(toKey(prefix, middle));
+            if (p < 0) {
+                return false;
+            }
+            if (p < target) {
+                low = middle;
+            } else {
+                high2 = middle;
+            }
+        }
+        std::string key = toKey(prefix, high2);
+        if (key <= firstKey || key > lastKey) {
+            break;
+        }
+        if (splitKeys.empty() || splitKeys.back() < key) {
+            splitKeys.push_back(key);
+        }
+    }
+    return true;
+}
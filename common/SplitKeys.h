@@ -0,0 +1,78 @@
+#ifndef SPLIT_KEYS_H
+#define SPLIT_KEYS_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <boost/function.hpp>
+
+/**
+ * Helpers for getSplitKeys(), which cuts a key range into parts of
+ * about equal size.
+ */
+
+// getSplitKeys() makes at most this many parts.
+static const uint32_t MAX_SPLITS = 1024;
+
+// backends read ranges of up to this many records to split them exactly,
+// and estimate larger ones.
+static const uint32_t EXACT_SPLIT_RECORDS = 100000;
+
+/**
+ * Splits a range by reading it: records are added in ascending key
+ * order, and split keys are taken where the running total of their
+ * sizes crosses each 1/numSplits of the total.
+ *
+ * Memory is bounded: only every stride-th record is remembered, and the
+ * stride doubles whenever more than maxSamples are kept, which still
+ * leaves several samples per part.
+ */
+class SplitKeySampler {
+public:
+    SplitKeySampler(uint32_t numSplits);
+
+    void add(const std::string& key, uint64_t bytes);
+
+    /**
+     * Number of records added so far.
+     */
+    uint64_t size() const;
+
+    /**
+     * The first key added, or "" if there's none.
+     */
+    const std::string& firstKey() const;
+
+    void getSplitKeys(std::vector<std::string>& splitKeys) const;
+
+private:
+    uint32_t numSplits_;
+    uint32_t maxSamples_;
+    uint64_t stride_;
+    uint64_t numRecords_;
+    uint64_t bytes_;
+    std::string firstKey_;
+    // (bytes before the record, key) of every stride-th record.
+    std::vector<std::pair<uint64_t, std::string> > samples_;
+};
+
+/**
+ * Splits the range [firstKey, lastKey] without reading it, given
+ * position(key): the share of the range's data that comes before key,
+ * between 0 and 1 and nondecreasing in key. This is what storage
+ * engines can estimate from their indexes (LevelDB's approximate sizes,
+ * BDB's key_range, MySQL's row estimates).
+ *
+ * Keys between firstKey and lastKey are read as numbers: the bytes after
+ * their common prefix, 8 at a time. Each split key is found by bisecting
+ * those numbers, which takes up to 64 calls to position().
+ *
+ * @returns false if position() returned a negative value, which callers
+ *          use to report errors.
+ */
+bool bisectSplitKeys(const std::string& firstKey, const std::string& lastKey, uint32_t numSplits,
+                     const boost::function<double (const std::string&)>& position,
+                     std::vector<std::string>& splitKeys);
+
+#endif // SPLIT_KEYS_H
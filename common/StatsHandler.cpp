@@ -0,0 +1,589 @@
+#include <cstdio>
+#include <time.h>
+#include "StatsHandler.h"
+#include "StatsHttpServer.h"
+
+using namespace mapkeeper;
+
+static const char* METHOD_NAMES[] = {
+    "ping",
+    "addMap",
+    "dropMap",
+    "listMaps",
+    "scan",
+    "get",
+    "put",
+    "insert",
+    "update",
+    "remove",
+    "multiGet",
+    "multiPut",
+    "multiInsert",
+    "multiUpdate",
+    "multiRemove",
+    "getStats",
+    "getSplitKeys",
+    "estimateCount",
+    "estimateSize",
+    "scanWithOptions",
+    "scanPacked",
+    "getRange",
+    "putChunk",
+    "append",
+    "writeAt",
+};
+
+// latencies above a minute are recorded as a minute. two significant
+// digits keep a histogram around 20KB, which adds up with a thread per
+// connection.
+static const int64_t MAX_LATENCY_US = 60 * 1000 * 1000;
+static const int LATENCY_DIGITS = 2;
+
+StatsHandler::MapCounters::
+MapCounters() :
+    ops(0),
+    bytesRead(0),
+    bytesWritten(0)
+{
+}
+
+StatsHandler::ThreadStats::
+ThreadStats(StatsHandler* owner) :
+    owner(owner)
+{
+    for (int i = 0; i < NUM_METHODS; i++) {
+        latencies[i] = NULL;
+        errors[i] = 0;
+    }
+}
+
+StatsHandler::ThreadStats::
+~ThreadStats()
+{
+    for (int i = 0; i < NUM_METHODS; i++) {
+        delete latencies[i];
+    }
+}
+
+StatsHandler::Call::
+Call(StatsHandler& handler, Method method) :
+    stats_(handler.getThreadStats()),
+    method_(method),
+    mapName_(NULL),
+    mapNotFound_(false),
+    bytesRead_(0),
+    bytesWritten_(0),
+    done_(false),
+    error_(false),
+    startUs_(nowUs())
+{
+}
+
+StatsHandler::Call::
+~Call()
+{
+    Histogram* latency = stats_.latencies[method_];
+    if (latency == NULL) {
+        latency = newLatencyHistogram();
+        __atomic_store_n(&stats_.latencies[method_], latency, __ATOMIC_RELEASE);
+    }
+    latency->recordSingleWriter(nowUs() - startUs_);
+    if (!done_ || error_) {
+        addCounter(stats_.errors[method_], 1);
+    }
+    if (mapName_ != NULL && !mapNotFound_) {
+        // only this thread inserts into stats_.maps, so looking up
+        // without the lock can't race with a modification.
+        std::map<std::string, MapCounters>::iterator itr = stats_.maps.find(*mapName_);
+        if (itr == stats_.maps.end()) {
+            boost::mutex::scoped_lock lock(stats_.mutex);
+            itr = stats_.maps.insert(std::make_pair(*mapName_, MapCounters())).first;
+        }
+        addCounter(itr->second.ops, 1);
+        addCounter(itr->second.bytesRead, bytesRead_);
+        addCounter(itr->second.bytesWritten, bytesWritten_);
+    }
+}
+
+/**
+ * The map is recorded when the call ends, unless the backend says it
+ * doesn't exist.
+ */
+void StatsHandler::Call::
+setMap(const std::string& mapName)
+{
+    mapName_ = &mapName;
+}
+
+void StatsHandler::Call::
+addBytesRead(uint64_t bytes)
+{
+    bytesRead_ += bytes;
+}
+
+void StatsHandler::Call::
+addBytesWritten(uint64_t bytes)
+{
+    bytesWritten_ += bytes;
+}
+
+void StatsHandler::Call::
+done(ResponseCode::type rc)
+{
+    done_ = true;
+    error_ = (rc == ResponseCode::Error);
+    mapNotFound_ = (rc == ResponseCode::MapNotFound);
+}
+
+void StatsHandler::Call::
+done(const std::vector<ResponseCode::type>& rcs)
+{
+    done_ = true;
+    error_ = false;
+    mapNotFound_ = false;
+    for (std::vector<ResponseCode::type>::const_iterator itr = rcs.begin(); itr != rcs.end(); itr++) {
+        if (*itr == ResponseCode::Error) {
+            error_ = true;
+        } else if (*itr == ResponseCode::MapNotFound) {
+            mapNotFound_ = true;
+        }
+    }
+}
+
+StatsHandler::
+StatsHandler(boost::shared_ptr<MapKeeperIf> handler, uint16_t httpPort) :
+    ForwardingHandler(handler),
+    retired_(this),
+    threadStats_(retireThreadStats)
+{
+    if (httpPort != 0) {
+        httpServer_.reset(new StatsHttpServer(*this, httpPort));
+    }
+}
+
+StatsHandler::
+~StatsHandler()
+{
+}
+
+ResponseCode::type StatsHandler::
+ping()
+{
+    Call call(*this, PING);
+    ResponseCode::type rc = handler_->ping();
+    call.done(rc);
+    return rc;
+}
+
+ResponseCode::type StatsHandler::
+addMap(const std::string& mapName)
+{
+    Call call(*this, ADD_MAP);
+    call.setMap(mapName);
+    ResponseCode::type rc = handler_->addMap(mapName);
+    call.done(rc);
+    return rc;
+}
+
+ResponseCode::type StatsHandler::
+dropMap(const std::string& mapName)
+{
+    Call call(*this, DROP_MAP);
+    call.setMap(mapName);
+    ResponseCode::type rc = handler_->dropMap(mapName);
+    call.done(rc);
+    return rc;
+}
+
+void StatsHandler::
+listMaps(StringListResponse& _return)
+{
+    Call call(*this, LIST_MAPS);
+    handler_->listMaps(_return);
+    call.done(_return.responseCode);
+}
+
+void StatsHandler::
+scan(RecordListResponse& _return, const std::string& mapName,
+     const ScanOrder::type order,
+     const std::string& startKey, const bool startKeyIncluded,
+     const std::string& endKey, const bool endKeyIncluded,
+     const int32_t maxRecords, const int32_t maxBytes)
+{
+    Call call(*this, SCAN);
+    call.setMap(mapName);
+    handler_->scan(_return, mapName, order, startKey, startKeyIncluded,
+                   endKey, endKeyIncluded, maxRecords, maxBytes);
+    for (std::vector<Record>::const_iterator itr = _return.records.begin();
+         itr != _return.records.end(); itr++) {
+        call.addBytesRead(itr->key.size() + itr->value.size());
+    }
+    call.done(_return.responseCode);
+}
+
+void StatsHandler::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName,
+                const ScanOrder::type order,
+                const std::string& startKey, const bool startKeyIncluded,
+                const std::string& endKey, const bool endKeyIncluded,
+                const int32_t maxRecords, const int32_t maxBytes,
+                const ScanOptions& options)
+{
+    Call call(*this, SCAN_WITH_OPTIONS);
+    call.setMap(mapName);
+    handler_->scanWithOptions(_return, mapName, order, startKey, startKeyIncluded,
+                              endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    for (std::vector<Record>::const_iterator itr = _return.records.begin();
+         itr != _return.records.end(); itr++) {
+        call.addBytesRead(itr->key.size() + itr->value.size());
+    }
+    call.done(_return.responseCode);
+}
+
+void StatsHandler::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName,
+           const ScanOrder::type order,
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes,
+           const ScanOptions& options)
+{
+    Call call(*this, SCAN_PACKED);
+    call.setMap(mapName);
+    handler_->scanPacked(_return, mapName, order, startKey, startKeyIncluded,
+                         endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    // counts the sizes and offsets too, rather than walking the records.
+    call.addBytesRead(_return.records.size());
+    call.done(_return.responseCode);
+}
+
+void StatsHandler::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    Call call(*this, GET);
+    call.setMap(mapName);
+    handler_->get(_return, mapName, key);
+    call.addBytesRead(_return.value.size());
+    call.done(_return.responseCode);
+}
+
+void StatsHandler::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+         const int64_t offset, const int32_t length)
+{
+    Call call(*this, GET_RANGE);
+    call.setMap(mapName);
+    handler_->getRange(_return, mapName, key, offset, length);
+    call.addBytesRead(_return.value.size());
+    call.done(_return.responseCode);
+}
+
+ResponseCode::type StatsHandler::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    Call call(*this, PUT);
+    call.setMap(mapName);
+    call.addBytesWritten(key.size() + value.size());
+    ResponseCode::type rc = handler_->put(mapName, key, value);
+    call.done(rc);
+    return rc;
+}
+
+ResponseCode::type StatsHandler::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    Call call(*this, INSERT);
+    call.setMap(mapName);
+    call.addBytesWritten(key.size() + value.size());
+    ResponseCode::type rc = handler_->insert(mapName, key, value);
+    call.done(rc);
+    return rc;
+}
+
+ResponseCode::type StatsHandler::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    Call call(*this, UPDATE);
+    call.setMap(mapName);
+    call.addBytesWritten(key.size() + value.size());
+    ResponseCode::type rc = handler_->update(mapName, key, value);
+    call.done(rc);
+    return rc;
+}
+
+ResponseCode::type StatsHandler::
+putChunk(const std::string& mapName, const std::string& key,
+         const int64_t offset, const std::string& data, const bool last)
+{
+    Call call(*this, PUT_CHUNK);
+    call.setMap(mapName);
+    call.addBytesWritten(key.size() + data.size());
+    ResponseCode::type rc = handler_->putChunk(mapName, key, offset, data, last);
+    call.done(rc);
+    return rc;
+}
+
+ResponseCode::type StatsHandler::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    Call call(*this, APPEND);
+    call.setMap(mapName);
+    call.addBytesWritten(key.size() + data.size());
+    ResponseCode::type rc = handler_->append(mapName, key, data);
+    call.done(rc);
+    return rc;
+}
+
+ResponseCode::type StatsHandler::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+        const std::string& data)
+{
+    Call call(*this, WRITE_AT);
+    call.setMap(mapName);
+    call.addBytesWritten(key.size() + data.size());
+    ResponseCode::type rc = handler_->writeAt(mapName, key, offset, data);
+    call.done(rc);
+    return rc;
+}
+
+ResponseCode::type StatsHandler::
+remove(const std::string& mapName, const std::string& key)
+{
+    Call call(*this, REMOVE);
+    call.setMap(mapName);
+    call.addBytesWritten(key.size());
+    ResponseCode::type rc = handler_->remove(mapName, key);
+    call.done(rc);
+    return rc;
+}
+
+void StatsHandler::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName,
+         const std::vector<std::string>& keys)
+{
+    Call call(*this, MULTI_GET);
+    call.setMap(mapName);
+    handler_->multiGet(_return, mapName, keys);
+    std::vector<ResponseCode::type> rcs;
+    for (std::vector<BinaryResponse>::const_iterator itr = _return.begin(); itr != _return.end(); itr++) {
+        call.addBytesRead(itr->value.size());
+        rcs.push_back(itr->responseCode);
+    }
+    call.done(rcs);
+}
+
+void StatsHandler::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+         const std::vector<Record>& records)
+{
+    Call call(*this, MULTI_PUT);
+    call.setMap(mapName);
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        call.addBytesWritten(itr->key.size() + itr->value.size());
+    }
+    handler_->multiPut(_return, mapName, records);
+    call.done(_return);
+}
+
+void StatsHandler::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    Call call(*this, MULTI_INSERT);
+    call.setMap(mapName);
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        call.addBytesWritten(itr->key.size() + itr->value.size());
+    }
+    handler_->multiInsert(_return, mapName, records);
+    call.done(_return);
+}
+
+void StatsHandler::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    Call call(*this, MULTI_UPDATE);
+    call.setMap(mapName);
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        call.addBytesWritten(itr->key.size() + itr->value.size());
+    }
+    handler_->multiUpdate(_return, mapName, records);
+    call.done(_return);
+}
+
+void StatsHandler::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<std::string>& keys)
+{
+    Call call(*this, MULTI_REMOVE);
+    call.setMap(mapName);
+    for (std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++) {
+        call.addBytesWritten(itr->size());
+    }
+    handler_->multiRemove(_return, mapName, keys);
+    call.done(_return);
+}
+
+void StatsHandler::
+getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const int32_t numSplits)
+{
+    Call call(*this, GET_SPLIT_KEYS);
+    call.setMap(mapName);
+    handler_->getSplitKeys(_return, mapName, startKey, endKey, numSplits);
+    call.done(_return.responseCode);
+}
+
+void StatsHandler::
+estimateCount(EstimateResponse& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    Call call(*this, ESTIMATE_COUNT);
+    call.setMap(mapName);
+    handler_->estimateCount(_return, mapName, startKey, endKey, exact);
+    call.done(_return.responseCode);
+}
+
+void StatsHandler::
+estimateSize(EstimateResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    Call call(*this, ESTIMATE_SIZE);
+    call.setMap(mapName);
+    handler_->estimateSize(_return, mapName, startKey, endKey, exact);
+    call.done(_return.responseCode);
+}
+
+/**
+ * The backend's statistics come first so that ours win if a name
+ * collides.
+ */
+void StatsHandler::
+getStats(StatsResponse& _return)
+{
+    Call call(*this, GET_STATS);
+    handler_->getStats(_return);
+
+    ThreadStats total(this);
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        merge(total, retired_);
+        for (std::set<ThreadStats*>::iterator itr = threads_.begin(); itr != threads_.end(); itr++) {
+            merge(total, **itr);
+        }
+    }
+
+    std::map<std::string, int64_t>& counters = _return.counters;
+    for (int i = 0; i < NUM_METHODS; i++) {
+        const Histogram* latency = total.latencies[i];
+        if (latency == NULL) {
+            continue;
+        }
+        std::string prefix = METHOD_NAMES[i];
+        counters[prefix + ".count"] = latency->getCount();
+        counters[prefix + ".errors"] = total.errors[i];
+        counters[prefix + ".latency_us.mean"] = (int64_t)(latency->getMean() + 0.5);
+        counters[prefix + ".latency_us.p50"] = latency->getValueAtPercentile(50);
+        counters[prefix + ".latency_us.p90"] = latency->getValueAtPercentile(90);
+        counters[prefix + ".latency_us.p99"] = latency->getValueAtPercentile(99);
+        counters[prefix + ".latency_us.p999"] = latency->getValueAtPercentile(99.9);
+        counters[prefix + ".latency_us.max"] = latency->getMax();
+    }
+    for (std::map<std::string, MapCounters>::iterator itr = total.maps.begin();
+         itr != total.maps.end(); itr++) {
+        std::string prefix = "map." + itr->first;
+        counters[prefix + ".ops"] = itr->second.ops;
+        counters[prefix + ".bytes_read"] = itr->second.bytesRead;
+        counters[prefix + ".bytes_written"] = itr->second.bytesWritten;
+    }
+    call.done(_return.responseCode);
+}
+
+const char* StatsHandler::
+getMethodName(Method method)
+{
+    return METHOD_NAMES[method];
+}
+
+StatsHandler::ThreadStats& StatsHandler::
+getThreadStats()
+{
+    ThreadStats* stats = threadStats_.get();
+    if (stats == NULL) {
+        stats = new ThreadStats(this);
+        threadStats_.reset(stats);
+        boost::mutex::scoped_lock lock(mutex_);
+        threads_.insert(stats);
+    }
+    return *stats;
+}
+
+/**
+ * Called by boost when a thread exits.
+ */
+void StatsHandler::
+retireThreadStats(ThreadStats* stats)
+{
+    StatsHandler* owner = stats->owner;
+    {
+        boost::mutex::scoped_lock lock(owner->mutex_);
+        merge(owner->retired_, *stats);
+        owner->threads_.erase(stats);
+    }
+    delete stats;
+}
+
+int64_t StatsHandler::
+nowUs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+Histogram* StatsHandler::
+newLatencyHistogram()
+{
+    return new Histogram(MAX_LATENCY_US, LATENCY_DIGITS);
+}
+
+/**
+ * The counters have a single writer, so this doesn't need to be a
+ * locked add; the atomic store just keeps readers from seeing a torn
+ * value.
+ */
+void StatsHandler::
+addCounter(uint64_t& counter, uint64_t delta)
+{
+    if (delta != 0) {
+        __atomic_store_n(&counter, counter + delta, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Adds stats, which may be updated by its thread at the same time, to
+ * total, which must not be.
+ */
+void StatsHandler::
+merge(ThreadStats& total, ThreadStats& stats)
+{
+    for (int i = 0; i < NUM_METHODS; i++) {
+        const Histogram* latency = __atomic_load_n(&stats.latencies[i], __ATOMIC_ACQUIRE);
+        if (latency == NULL) {
+            continue;
+        }
+        if (total.latencies[i] == NULL) {
+            total.latencies[i] = newLatencyHistogram();
+        }
+        total.latencies[i]->addConcurrent(*latency);
+        total.errors[i] += __atomic_load_n(&stats.errors[i], __ATOMIC_RELAXED);
+    }
+    boost::mutex::scoped_lock lock(stats.mutex);
+    for (std::map<std::string, MapCounters>::iterator itr = stats.maps.begin();
+         itr != stats.maps.end(); itr++) {
+        MapCounters& counters = total.maps[itr->first];
+        counters.ops += __atomic_load_n(&itr->second.ops, __ATOMIC_RELAXED);
+        counters.bytesRead += __atomic_load_n(&itr->second.bytesRead, __ATOMIC_RELAXED);
+        counters.bytesWritten += __atomic_load_n(&itr->second.bytesWritten, __ATOMIC_RELAXED);
+    }
+}
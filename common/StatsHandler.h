@@ -0,0 +1,197 @@
+#ifndef STATS_HANDLER_H
+#define STATS_HANDLER_H
+
+#include <map>
+#include <set>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include "ForwardingHandler.h"
+#include "Histogram.h"
+
+class StatsHttpServer;
+
+/**
+ * Records the latency and outcome of every call, and per-map operation
+ * and byte counts, and reports them through getStats().
+ *
+ * Every thread records into its own histograms and counters, so the
+ * only shared state a request touches is the thread-local pointer.
+ * getStats() walks the registered threads and reads their data while
+ * they keep writing; a thread's data is folded into a shared total
+ * when the thread exits.
+ *
+ * getStats() reports, for every method:
+ *
+ *   <method>.count
+ *   <method>.errors                 calls that returned Error or threw
+ *   <method>.latency_us.<stat>      stat is mean, p50, p90, p99, p999 or max
+ *
+ * and for every map that has been accessed (calls that return
+ * MapNotFound aren't counted, so names of maps that don't exist don't
+ * pile up):
+ *
+ *   map.<mapName>.ops
+ *   map.<mapName>.bytes_read
+ *   map.<mapName>.bytes_written
+ */
+class StatsHandler : public ForwardingHandler {
+public:
+    enum Method {
+        PING,
+        ADD_MAP,
+        DROP_MAP,
+        LIST_MAPS,
+        SCAN,
+        GET,
+        PUT,
+        INSERT,
+        UPDATE,
+        REMOVE,
+        MULTI_GET,
+        MULTI_PUT,
+        MULTI_INSERT,
+        MULTI_UPDATE,
+        MULTI_REMOVE,
+        GET_STATS,
+        GET_SPLIT_KEYS,
+        ESTIMATE_COUNT,
+        ESTIMATE_SIZE,
+        SCAN_WITH_OPTIONS,
+        SCAN_PACKED,
+        GET_RANGE,
+        PUT_CHUNK,
+        APPEND,
+        WRITE_AT,
+        NUM_METHODS
+    };
+
+    /**
+     * @param httpPort if non-zero, the statistics are also served in the
+     *                 Prometheus text format on 127.0.0.1:httpPort.
+     */
+    StatsHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> handler, uint16_t httpPort);
+    ~StatsHandler();
+
+    mapkeeper::ResponseCode::type ping();
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName);
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName);
+    void listMaps(mapkeeper::StringListResponse& _return);
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+                         const mapkeeper::ScanOrder::type order,
+                         const std::string& startKey, const bool startKeyIncluded,
+                         const std::string& endKey, const bool endKeyIncluded,
+                         const int32_t maxRecords, const int32_t maxBytes,
+                         const mapkeeper::ScanOptions& options);
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName,
+                    const mapkeeper::ScanOrder::type order,
+                    const std::string& startKey, const bool startKeyIncluded,
+                    const std::string& endKey, const bool endKeyIncluded,
+                    const int32_t maxRecords, const int32_t maxBytes,
+                    const mapkeeper::ScanOptions& options);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+    void getRange(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length);
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key,
+                                           const int64_t offset, const std::string& data, const bool last);
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key,
+                                          const int64_t offset, const std::string& data);
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                  const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<std::string>& keys);
+    void getStats(mapkeeper::StatsResponse& _return);
+    void getSplitKeys(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const int32_t numSplits);
+    void estimateCount(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                       const std::string& startKey, const std::string& endKey, const bool exact);
+    void estimateSize(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const bool exact);
+
+    static const char* getMethodName(Method method);
+
+private:
+    struct MapCounters {
+        MapCounters();
+        uint64_t ops;
+        uint64_t bytesRead;
+        uint64_t bytesWritten;
+    };
+
+    /**
+     * Written only by its own thread. Readers load the fields with
+     * atomic loads; mutex serializes adding a map with readers walking
+     * maps, so the owner can look up maps it has seen without locking.
+     */
+    struct ThreadStats {
+        ThreadStats(StatsHandler* owner);
+        ~ThreadStats();
+        StatsHandler* owner;
+        Histogram* latencies[NUM_METHODS]; // allocated on first use
+        uint64_t errors[NUM_METHODS];
+        boost::mutex mutex;
+        std::map<std::string, MapCounters> maps;
+    };
+
+    /**
+     * Times one call and records it in the calling thread's stats when
+     * it goes out of scope. A call that exits with an exception is
+     * counted as an error. mapName passed to setMap() must outlive the
+     * call.
+     */
+    class Call {
+    public:
+        Call(StatsHandler& handler, Method method);
+        ~Call();
+        void setMap(const std::string& mapName);
+        void addBytesRead(uint64_t bytes);
+        void addBytesWritten(uint64_t bytes);
+        void done(mapkeeper::ResponseCode::type rc);
+        void done(const std::vector<mapkeeper::ResponseCode::type>& rcs);
+
+    private:
+        ThreadStats& stats_;
+        Method method_;
+        const std::string* mapName_; // NULL if the call has no map
+        bool mapNotFound_;
+        uint64_t bytesRead_;
+        uint64_t bytesWritten_;
+        bool done_;
+        bool error_;
+        int64_t startUs_;
+    };
+
+    ThreadStats& getThreadStats();
+    static void retireThreadStats(ThreadStats* stats);
+    static int64_t nowUs();
+    static Histogram* newLatencyHistogram();
+    static void addCounter(uint64_t& counter, uint64_t delta);
+    static void merge(ThreadStats& total, ThreadStats& stats);
+
+    boost::mutex mutex_; // protects threads_ and retired_
+    std::set<ThreadStats*> threads_;
+    ThreadStats retired_; // merged stats of the threads that exited
+
+    // must be destroyed before the members above: destroying it retires
+    // the current thread's stats.
+    boost::thread_specific_ptr<ThreadStats> threadStats_;
+    boost::scoped_ptr<StatsHttpServer> httpServer_;
+};
+
+#endif // STATS_HANDLER_H
@@ -0,0 +1,269 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include "StatsHttpServer.h"
+
+using namespace mapkeeper;
+
+namespace {
+
+struct Metric {
+    std::string type;
+    std::vector<std::string> samples;
+};
+
+typedef std::map<std::string, Metric> Metrics;
+
+void addSample(Metrics& metrics, const std::string& name, const std::string& type,
+               const std::string& labels, const std::string& value)
+{
+    Metric& metric = metrics[name];
+    metric.type = type;
+    metric.samples.push_back(name + labels + " " + value);
+}
+
+/**
+ * Maps the latency stat names used by StatsHandler to quantiles.
+ */
+const char* getQuantile(const std::string& stat)
+{
+    if (stat == "p50") {
+        return "0.5";
+    } else if (stat == "p90") {
+        return "0.9";
+    } else if (stat == "p99") {
+        return "0.99";
+    } else if (stat == "p999") {
+        return "0.999";
+    } else if (stat == "max") {
+        return "1";
+    }
+    return NULL;
+}
+
+}
+
+StatsHttpServer::
+StatsHttpServer(MapKeeperIf& handler, uint16_t port) :
+    handler_(handler),
+    listenFd_(-1),
+    stopped_(false)
+{
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) {
+        fprintf(stderr, "socket() failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    int on = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd_, 16) != 0) {
+        fprintf(stderr, "failed to listen on 127.0.0.1:%d for stats: %s\n", port, strerror(errno));
+        exit(1);
+    }
+    thread_.reset(new boost::thread(boost::bind(&StatsHttpServer::serve, this)));
+}
+
+StatsHttpServer::
+~StatsHttpServer()
+{
+    stopped_ = true;
+    thread_->join();
+    close(listenFd_);
+}
+
+void StatsHttpServer::
+format(const StatsResponse& stats, std::string& out)
+{
+    Metrics metrics;
+    for (std::map<std::string, int64_t>::const_iterator itr = stats.counters.begin();
+         itr != stats.counters.end(); itr++) {
+        const std::string& name = itr->first;
+        char value[32];
+        snprintf(value, sizeof(value), "%ld", (long)itr->second);
+
+        // <method>.count, <method>.errors, <method>.latency_us.<stat>
+        size_t dot = name.find('.');
+        std::string method = name.substr(0, dot);
+        std::string rest = dot == std::string::npos ? "" : name.substr(dot + 1);
+        std::string methodLabel = "{method=\"" + escapeLabel(method) + "\"";
+        if (rest == "count") {
+            addSample(metrics, "mapkeeper_requests_total", "counter", methodLabel + "}", value);
+            continue;
+        } else if (rest == "errors") {
+            addSample(metrics, "mapkeeper_request_errors_total", "counter", methodLabel + "}", value);
+            continue;
+        } else if (rest == "latency_us.mean") {
+            addSample(metrics, "mapkeeper_request_latency_us_mean", "gauge", methodLabel + "}", value);
+            continue;
+        } else if (rest.compare(0, 11, "latency_us.") == 0) {
+            const char* quantile = getQuantile(rest.substr(11));
+            if (quantile != NULL) {
+                addSample(metrics, "mapkeeper_request_latency_us", "summary",
+                          methodLabel + ",quantile=\"" + quantile + "\"}", value);
+                continue;
+            }
+        }
+
+        // map.<mapName>.<counter>; map names may contain dots.
+        size_t lastDot = name.rfind('.');
+        if (method == "map" && lastDot > dot) {
+            std::string mapLabel = "{map=\"" + escapeLabel(name.substr(dot + 1, lastDot - dot - 1)) + "\"}";
+            std::string counter = name.substr(lastDot + 1);
+            if (counter == "records") {
+                addSample(metrics, "mapkeeper_map_records", "gauge", mapLabel, value);
+            } else {
+                addSample(metrics, "mapkeeper_map_" + sanitize(counter) + "_total", "counter",
+                          mapLabel, value);
+            }
+            continue;
+        }
+        addSample(metrics, "mapkeeper_" + sanitize(name), "gauge", "", value);
+    }
+
+    // properties are mostly free-form text (e.g., leveldb.stats), which
+    // has no place in Prometheus; export only the numeric ones.
+    for (std::map<std::string, std::string>::const_iterator itr = stats.properties.begin();
+         itr != stats.properties.end(); itr++) {
+        const char* str = itr->second.c_str();
+        char* end = NULL;
+        strtod(str, &end);
+        if (itr->second.empty() || *end != '\0') {
+            continue;
+        }
+        addSample(metrics, "mapkeeper_" + sanitize(itr->first), "gauge", "", itr->second);
+    }
+
+    for (Metrics::iterator itr = metrics.begin(); itr != metrics.end(); itr++) {
+        out += "# TYPE " + itr->first + " " + itr->second.type + "\n";
+        for (size_t i = 0; i < itr->second.samples.size(); i++) {
+            out += itr->second.samples[i] + "\n";
+        }
+    }
+}
+
+void StatsHttpServer::
+serve()
+{
+    while (!stopped_) {
+        // wake up periodically to check whether we've been stopped.
+        struct pollfd pfd;
+        pfd.fd = listenFd_;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 500) <= 0) {
+            continue;
+        }
+        int fd = accept(listenFd_, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        handleConnection(fd);
+        close(fd);
+    }
+}
+
+/**
+ * Reads the request header and answers GET /metrics (or /). Slow
+ * clients are cut off after a second so that they can't stall the
+ * server.
+ */
+void StatsHttpServer::
+handleConnection(int fd)
+{
+    struct timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return;
+        }
+        request.append(buffer, n);
+    }
+
+    std::string status;
+    std::string body;
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+        StatsResponse stats;
+        try {
+            handler_.getStats(stats);
+            status = "200 OK";
+            format(stats, body);
+        } catch (std::exception& e) {
+            status = "500 Internal Server Error";
+            body = std::string(e.what()) + "\n";
+        }
+    } else {
+        status = "404 Not Found";
+        body = "try /metrics\n";
+    }
+
+    char header[256];
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 %s\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %lu\r\n"
+             "Connection: close\r\n"
+             "\r\n", status.c_str(), (unsigned long)body.size());
+    std::string response = header + body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return;
+        }
+        sent += n;
+    }
+}
+
+std::string StatsHttpServer::
+sanitize(const std::string& name)
+{
+    std::string sanitized = name;
+    for (size_t i = 0; i < sanitized.size(); i++) {
+        char c = sanitized[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '_')) {
+            sanitized[i] = '_';
+        }
+    }
+    return sanitized;
+}
+
+std::string StatsHttpServer::
+escapeLabel(const std::string& value)
+{
+    std::string escaped;
+    for (size_t i = 0; i < value.size(); i++) {
+        char c = value[i];
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
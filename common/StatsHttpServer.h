@@ -0,0 +1,48 @@
+#ifndef STATS_HTTP_SERVER_H
+#define STATS_HTTP_SERVER_H
+
+#include <string>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include "MapKeeper.h"
+
+/**
+ * Serves getStats() in the Prometheus text format on 127.0.0.1.
+ *
+ * Method counters and latencies become labeled metrics:
+ *
+ *   mapkeeper_requests_total{method="get"}
+ *   mapkeeper_request_errors_total{method="get"}
+ *   mapkeeper_request_latency_us{method="get",quantile="0.99"}
+ *   mapkeeper_map_ops_total{map="users"}
+ *
+ * Every other counter, and every property with a numeric value, is
+ * exported as a gauge named mapkeeper_<name> with the characters
+ * Prometheus doesn't allow replaced by '_'.
+ *
+ * Requests are served one at a time by a single thread. That's plenty
+ * for a scraper polling every few seconds.
+ */
+class StatsHttpServer {
+public:
+    StatsHttpServer(mapkeeper::MapKeeperIf& handler, uint16_t port);
+    ~StatsHttpServer();
+
+    /**
+     * Converts the output of getStats() to the Prometheus text format.
+     */
+    static void format(const mapkeeper::StatsResponse& stats, std::string& out);
+
+private:
+    void serve();
+    void handleConnection(int fd);
+    static std::string sanitize(const std::string& name);
+    static std::string escapeLabel(const std::string& value);
+
+    mapkeeper::MapKeeperIf& handler_;
+    int listenFd_;
+    volatile bool stopped_;
+    boost::scoped_ptr<boost::thread> thread_;
+};
+
+#endif // STATS_HTTP_SERVER_H
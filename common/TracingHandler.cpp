@@ -0,0 +1,141 @@
+#include <cstdio>
+#include "TracingHandler.h"
+
+using namespace mapkeeper;
+
+// a processor handles one request at a time on a given thread, so each
+// thread needs only one trace.
+static __thread RequestTrace threadTrace;
+static __thread bool threadTraceSampled;
+static __thread uint32_t numThreadRequests;
+
+TracingHandler::
+TracingHandler(boost::shared_ptr<MapKeeperIf> handler,
+               uint32_t sampleEvery, uint32_t slowRequestUs) :
+    ForwardingHandler(handler),
+    sampleEvery_(sampleEvery),
+    slowRequestCycles_((uint64_t)(slowRequestUs * CycleClock::getCyclesPerMicro())),
+    numSamples_(0),
+    numSlowRequests_(0)
+{
+    for (int i = 0; i < RequestTrace::NUM_STAGES; i++) {
+        stageCycles_[i] = 0;
+        stageCounts_[i] = 0;
+    }
+}
+
+void TracingHandler::
+getStats(StatsResponse& _return)
+{
+    handler_->getStats(_return);
+    _return.counters["trace.samples"] = __sync_fetch_and_add(&numSamples_, 0);
+    _return.counters["trace.slow_requests"] = __sync_fetch_and_add(&numSlowRequests_, 0);
+    for (int i = 0; i < RequestTrace::NUM_STAGES; i++) {
+        std::string prefix = std::string("trace.") + RequestTrace::getStageName((RequestTrace::Stage)i);
+        uint64_t cycles = __sync_fetch_and_add(&stageCycles_[i], 0);
+        _return.counters[prefix + ".us"] = (int64_t)CycleClock::toMicros(cycles);
+        _return.counters[prefix + ".count"] = __sync_fetch_and_add(&stageCounts_[i], 0);
+    }
+}
+
+void* TracingHandler::
+getContext(const char* fn_name, void* serverContext)
+{
+    bool sampled = sampleEvery_ != 0 && ++numThreadRequests % sampleEvery_ == 0;
+    if (!sampled && slowRequestCycles_ == 0) {
+        return NULL;
+    }
+    threadTraceSampled = sampled;
+    threadTrace.start();
+    RequestTrace::setCurrent(&threadTrace);
+    return &threadTrace;
+}
+
+void TracingHandler::
+freeContext(void* ctx, const char* fn_name)
+{
+    if (ctx == NULL) {
+        return;
+    }
+    RequestTrace::setCurrent(NULL);
+    RequestTrace& trace = *static_cast<RequestTrace*>(ctx);
+    uint64_t totalCycles = trace.getTotalCycles();
+    if (threadTraceSampled) {
+        uint64_t cycles[RequestTrace::NUM_STAGES];
+        uint32_t counts[RequestTrace::NUM_STAGES];
+        trace.getBreakdown(cycles, counts);
+        for (int i = 0; i < RequestTrace::NUM_STAGES; i++) {
+            if (counts[i] > 0) {
+                __sync_fetch_and_add(&stageCycles_[i], cycles[i]);
+                __sync_fetch_and_add(&stageCounts_[i], counts[i]);
+            }
+        }
+        __sync_fetch_and_add(&numSamples_, 1);
+    }
+    if (slowRequestCycles_ != 0 && totalCycles > slowRequestCycles_) {
+        __sync_fetch_and_add(&numSlowRequests_, 1);
+        logSlowRequest(trace, fn_name, totalCycles);
+    }
+}
+
+void TracingHandler::
+postRead(void* ctx, const char* fn_name, uint32_t bytes)
+{
+    if (ctx != NULL) {
+        static_cast<RequestTrace*>(ctx)->mark(RequestTrace::READ);
+    }
+}
+
+void TracingHandler::
+preWrite(void* ctx, const char* fn_name)
+{
+    if (ctx != NULL) {
+        static_cast<RequestTrace*>(ctx)->mark(RequestTrace::HANDLER);
+    }
+}
+
+void TracingHandler::
+postWrite(void* ctx, const char* fn_name, uint32_t bytes)
+{
+    if (ctx != NULL) {
+        static_cast<RequestTrace*>(ctx)->mark(RequestTrace::WRITE);
+    }
+}
+
+void TracingHandler::
+handlerError(void* ctx, const char* fn_name)
+{
+    if (ctx != NULL) {
+        RequestTrace& trace = *static_cast<RequestTrace*>(ctx);
+        trace.mark(RequestTrace::HANDLER);
+        trace.setError();
+    }
+}
+
+/**
+ * Formats the whole line first so that concurrent slow requests don't
+ * interleave their output.
+ */
+void TracingHandler::
+logSlowRequest(const RequestTrace& trace, const char* fn_name, uint64_t totalCycles)
+{
+    uint64_t cycles[RequestTrace::NUM_STAGES];
+    uint32_t counts[RequestTrace::NUM_STAGES];
+    trace.getBreakdown(cycles, counts);
+
+    char line[512];
+    int length = snprintf(line, sizeof(line), "slow request: %s %.0fus%s:", fn_name,
+                          CycleClock::toMicros(totalCycles), trace.hasError() ? " (error)" : "");
+    for (int i = 0; i < RequestTrace::NUM_STAGES && length < (int)sizeof(line); i++) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        length += snprintf(line + length, sizeof(line) - length, " %s=%.1fus",
+                           RequestTrace::getStageName((RequestTrace::Stage)i),
+                           CycleClock::toMicros(cycles[i]));
+        if (counts[i] > 1 && length < (int)sizeof(line)) {
+            length += snprintf(line + length, sizeof(line) - length, "(x%u)", counts[i]);
+        }
+    }
+    fprintf(stderr, "%s\n", line);
+}
@@ -0,0 +1,56 @@
+#ifndef TRACING_HANDLER_H
+#define TRACING_HANDLER_H
+
+#include <TProcessor.h>
+#include "ForwardingHandler.h"
+#include "RequestTrace.h"
+
+/**
+ * Breaks down the time spent on requests into stages (see
+ * RequestTrace).
+ *
+ * This is both the outermost handler and the processor's event handler:
+ * the processor hooks start a trace before the arguments are read and
+ * close it once the response has been written, and the handlers and
+ * storage engines mark the stages in between.
+ *
+ * Every sampleEvery-th request on each thread is traced, and the stage
+ * totals are reported by getStats() as
+ *
+ *   trace.samples
+ *   trace.<stage>.us        total time charged to the stage
+ *   trace.<stage>.count     number of times the stage was marked
+ *
+ * If slowRequestUs is non-zero every request is traced, and the
+ * breakdown of requests that took longer than that is logged to stderr.
+ * Their number is reported as trace.slow_requests.
+ *
+ * The time a request spends before the processor sees it (waiting for
+ * a worker thread, reading the frame) isn't visible to these hooks.
+ */
+class TracingHandler : public ForwardingHandler, public apache::thrift::TProcessorEventHandler {
+public:
+    TracingHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> handler,
+                   uint32_t sampleEvery, uint32_t slowRequestUs);
+
+    void getStats(mapkeeper::StatsResponse& _return);
+
+    void* getContext(const char* fn_name, void* serverContext);
+    void freeContext(void* ctx, const char* fn_name);
+    void postRead(void* ctx, const char* fn_name, uint32_t bytes);
+    void preWrite(void* ctx, const char* fn_name);
+    void postWrite(void* ctx, const char* fn_name, uint32_t bytes);
+    void handlerError(void* ctx, const char* fn_name);
+
+private:
+    void logSlowRequest(const RequestTrace& trace, const char* fn_name, uint64_t totalCycles);
+
+    uint32_t sampleEvery_;
+    uint64_t slowRequestCycles_;
+    uint64_t numSamples_;
+    uint64_t numSlowRequests_;
+    uint64_t stageCycles_[RequestTrace::NUM_STAGES];
+    uint64_t stageCounts_[RequestTrace::NUM_STAGES];
+};
+
+#endif // TRACING_HANDLER_H
@@ -0,0 +1,149 @@
+#include <cstdio>
+#include <cstring>
+#include <endian.h>
+#include <zlib.h>
+#include "ValueCodec.h"
+
+// codec byte and value size.
+static const uint32_t ZLIB_HEADER_SIZE = 1 + sizeof(uint32_t);
+
+/**
+ * A thread's zlib streams, which are reset between values instead of
+ * being set up again; a deflate stream alone allocates about 256KB.
+ */
+struct ValueCodec::Streams {
+    Streams(int level) :
+        deflateReady(false),
+        inflateReady(false)
+    {
+        memset(&deflater, 0, sizeof(deflater));
+        memset(&inflater, 0, sizeof(inflater));
+        int rc = deflateInit(&deflater, level);
+        if (rc != Z_OK) {
+            fprintf(stderr, "deflateInit failed: %d\n", rc);
+        } else {
+            deflateReady = true;
+        }
+        rc = inflateInit(&inflater);
+        if (rc != Z_OK) {
+            fprintf(stderr, "inflateInit failed: %d\n", rc);
+        } else {
+            inflateReady = true;
+        }
+    }
+
+    ~Streams()
+    {
+        if (deflateReady) {
+            deflateEnd(&deflater);
+        }
+        if (inflateReady) {
+            inflateEnd(&inflater);
+        }
+    }
+
+    z_stream deflater;
+    z_stream inflater;
+    bool deflateReady;
+    bool inflateReady;
+};
+
+ValueCodec::
+ValueCodec(Codec codec, int level, uint32_t minSize, const std::string& dictionary) :
+    codec_(codec),
+    level_(level),
+    minSize_(minSize),
+    dictionary_(dictionary)
+{
+}
+
+ValueCodec::
+~ValueCodec()
+{
+}
+
+bool ValueCodec::
+parseCodec(const std::string& name, Codec& codec)
+{
+    if (name == "none") {
+        codec = NONE;
+    } else if (name == "zlib") {
+        codec = ZLIB;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void ValueCodec::
+encode(const char* value, uint32_t size, std::string& stored) const
+{
+    if (codec_ == ZLIB && size >= minSize_) {
+        Streams& streams = getStreams();
+        z_stream& deflater = streams.deflater;
+        if (streams.deflateReady && deflateReset(&deflater) == Z_OK &&
+            (dictionary_.empty() ||
+             deflateSetDictionary(&deflater, (const Bytef*)dictionary_.data(), dictionary_.size()) == Z_OK)) {
+            stored.resize(ZLIB_HEADER_SIZE + deflateBound(&deflater, size));
+            deflater.next_in = (Bytef*)value;
+            deflater.avail_in = size;
+            deflater.next_out = (Bytef*)&stored[ZLIB_HEADER_SIZE];
+            deflater.avail_out = stored.size() - ZLIB_HEADER_SIZE;
+            if (deflate(&deflater, Z_FINISH) == Z_STREAM_END && deflater.total_out + 1 < size) {
+                stored.resize(ZLIB_HEADER_SIZE + deflater.total_out);
+                stored[0] = ZLIB;
+                uint32_t valueSize = htole32(size);
+                memcpy(&stored[1], &valueSize, sizeof(valueSize));
+                return;
+            }
+        }
+    }
+    stored.resize(1 + size);
+    stored[0] = NONE;
+    memcpy(&stored[1], value, size);
+}
+
+bool ValueCodec::
+decode(const char* stored, uint32_t size, std::string& value) const
+{
+    if (size >= 1 && stored[0] == NONE) {
+        value.assign(stored + 1, size - 1);
+        return true;
+    }
+    if (size < ZLIB_HEADER_SIZE || stored[0] != ZLIB) {
+        return false;
+    }
+    uint32_t valueSize;
+    memcpy(&valueSize, stored + 1, sizeof(valueSize));
+    valueSize = le32toh(valueSize);
+
+    Streams& streams = getStreams();
+    z_stream& inflater = streams.inflater;
+    if (!streams.inflateReady || inflateReset(&inflater) != Z_OK) {
+        return false;
+    }
+    value.resize(valueSize);
+    inflater.next_in = (Bytef*)stored + ZLIB_HEADER_SIZE;
+    inflater.avail_in = size - ZLIB_HEADER_SIZE;
+    inflater.next_out = (Bytef*)&value[0];
+    inflater.avail_out = valueSize;
+    int rc = inflate(&inflater, Z_FINISH);
+    if (rc == Z_NEED_DICT) {
+        if (dictionary_.empty() ||
+            inflateSetDictionary(&inflater, (const Bytef*)dictionary_.data(), dictionary_.size()) != Z_OK) {
+            fprintf(stderr, "value needs a zlib dictionary with adler32 %lu\n", inflater.adler);
+            return false;
+        }
+        rc = inflate(&inflater, Z_FINISH);
+    }
+    return rc == Z_STREAM_END && inflater.total_out == valueSize;
+}
+
+ValueCodec::Streams& ValueCodec::
+getStreams() const
+{
+    if (streams_.get() == NULL) {
+        streams_.reset(new Streams(level_));
+    }
+    return *streams_;
+}
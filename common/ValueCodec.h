@@ -0,0 +1,78 @@
+#ifndef VALUE_CODEC_H
+#define VALUE_CODEC_H
+
+#include <string>
+#include <stdint.h>
+#include <boost/thread/tss.hpp>
+
+/**
+ * Compresses the values of a map for CompressionHandler, and
+ * decompresses them for it and for clients that ask scanPacked() for
+ * compressed values.
+ *
+ * A stored value starts with a codec byte:
+ *
+ *   | NONE | value |
+ *   | ZLIB | value size | zlib stream |
+ *
+ * where the value size is a 32-bit little-endian integer. Values shorter
+ * than minSize, and values that don't get smaller, are stored with NONE.
+ *
+ * The zlib stream may start from a preset dictionary: bytes that values
+ * of the map tend to contain, most common last, which lets small values
+ * compress as if they followed them. zlib records which dictionary a
+ * value needs, so a map's dictionary can't change once values were
+ * written with it.
+ *
+ * Encoding and decoding are thread-safe; each thread keeps its own zlib
+ * streams.
+ */
+class ValueCodec {
+public:
+    enum Codec {
+        NONE = 0,
+        ZLIB = 1,
+    };
+
+    /**
+     * @param level       zlib level, 1 (fastest) to 9 (smallest).
+     * @param minSize     values shorter than this are stored as they are.
+     * @param dictionary  preset dictionary, or empty for none. zlib only
+     *                    uses the last 32KB.
+     */
+    ValueCodec(Codec codec, int level, uint32_t minSize, const std::string& dictionary);
+    ~ValueCodec();
+
+    /**
+     * Parses a codec name, "none" or "zlib".
+     *
+     * @returns false for an unknown name.
+     */
+    static bool parseCodec(const std::string& name, Codec& codec);
+
+    /**
+     * Sets stored to value as it should be stored.
+     */
+    void encode(const char* value, uint32_t size, std::string& stored) const;
+
+    /**
+     * Sets value to the value stored in stored.
+     *
+     * @returns false if stored is malformed or needs another dictionary.
+     */
+    bool decode(const char* stored, uint32_t size, std::string& value) const;
+
+private:
+    struct Streams;
+    ValueCodec(const ValueCodec&);
+    ValueCodec& operator=(const ValueCodec&);
+    Streams& getStreams() const;
+
+    Codec codec_;
+    int level_;
+    uint32_t minSize_;
+    std::string dictionary_;
+    mutable boost::thread_specific_ptr<Streams> streams_;
+};
+
+#endif // VALUE_CODEC_H
@@ -0,0 +1,48 @@
+#ifndef VALUE_PATCH_H
+#define VALUE_PATCH_H
+
+#include <string>
+#include <stdint.h>
+
+/**
+ * Helpers for append() and writeAt(), for storage engines and handlers
+ * that have to rewrite the whole value.
+ */
+
+/**
+ * Values can't grow past this through append() or writeAt(); it's the
+ * most a Thrift binary field holds.
+ */
+static const int64_t MAX_PATCHED_VALUE_SIZE = 0x7fffffff;
+
+/**
+ * Whether writing size bytes at offset keeps a value within
+ * MAX_PATCHED_VALUE_SIZE.
+ */
+inline bool validPatch(int64_t offset, size_t size)
+{
+    return offset >= 0 && (int64_t)size <= MAX_PATCHED_VALUE_SIZE &&
+        offset <= MAX_PATCHED_VALUE_SIZE - (int64_t)size;
+}
+
+/**
+ * Overwrites value from offset with data, as writeAt() does.
+ *
+ * @returns false if the patch isn't valid.
+ */
+inline bool patchValue(std::string& value, int64_t offset, const std::string& data)
+{
+    if (!validPatch(offset, data.size())) {
+        return false;
+    }
+    if (data.empty()) {
+        return true;
+    }
+    if (offset + data.size() > value.size()) {
+        value.resize(offset + data.size(), '\0');
+    }
+    value.replace(offset, data.size(), data);
+    return true;
+}
+
+#endif // VALUE_PATCH_H
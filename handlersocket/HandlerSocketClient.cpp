@@ -1,12 +1,33 @@
 #include <cassert>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <mysqld_error.h>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include "HandlerSocketClient.h"
+#include "Projection.h"
+#include "ScanFilter.h"
+#include "ScanSink.h"
+#include "SplitKeys.h"
 
 using namespace dena;
 
 const std::string HandlerSocketClient::DBNAME = "mapkeeper";
 const std::string HandlerSocketClient::FIELDS = "record_key,record_value";
+const std::string HandlerSocketClient::KEY_FIELDS = "record_key";
+
+// maximum number of requests we put on the wire with a single send.
+const size_t HandlerSocketClient::MAX_BATCH_SIZE = 256;
+
+// record_key is varbinary(512), so no key is larger than this.
+const std::string HandlerSocketClient::MAX_KEY(512, '\xff');
+
+// scans fetch INITIAL_SCAN_ROWS rows first, and then up to MAX_SCAN_ROWS 
+// rows per round trip, split into pipelined requests of SCAN_PAGE_SIZE rows.
+const uint32_t HandlerSocketClient::INITIAL_SCAN_ROWS = 16;
+const uint32_t HandlerSocketClient::MAX_SCAN_ROWS = 1024;
+const uint32_t HandlerSocketClient::SCAN_PAGE_SIZE = 128;
 
 HandlerSocketClient::
 HandlerSocketClient(const std::string& host, uint32_t mysqlPort, 
@@ -102,7 +123,7 @@ insert(const std::string& tableName, const std::string& key, const std::string&
     if (rc != Success) {
         return rc;
     }
-    writer_->request_buf_exec_generic(0, op_ref, &keyrefs[0], num_keys, limit, skip, string_ref(), 0, 0);
+    writer_->request_buf_exec_generic(id, op_ref, &keyrefs[0], num_keys, limit, skip, string_ref(), 0, 0);
     assert(writer_->request_send() == 0);
     if (writer_->response_recv(numflds) != 0) {
         // TODO handlersocket doesn't set error code properly, and it's
@@ -206,12 +227,618 @@ remove(const std::string& tableName, const std::string& key)
     return Success;
 }
 
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+getMany(const std::string& tableName, const std::vector<std::string>& keys,
+        std::vector<ResponseCode>& results, std::vector<std::string>& values)
+{
+    const std::string op = "=";
+    const string_ref op_ref(op.data(), op.size());
+    uint32_t id;
+    ResponseCode rc = getTableId(tableName, id);
+    if (rc != Success) {
+        return rc;
+    }
+    results.assign(keys.size(), Error);
+    values.resize(keys.size());
+    for (size_t begin = 0; begin < keys.size(); begin += MAX_BATCH_SIZE) {
+        size_t end = std::min(keys.size(), begin + MAX_BATCH_SIZE);
+        for (size_t i = begin; i < end; i++) {
+            const string_ref keyref(keys[i].data(), keys[i].size());
+            reader_->request_buf_exec_generic(id, op_ref, &keyref, 1, 1, 0, string_ref(), 0, 0);
+        }
+        if (reader_->request_send() != 0) {
+            // the batches before this one are done; this one and the
+            // rest keep their Error results.
+            fprintf(stderr, "request_send failed: %s\n", reader_->get_error().c_str());
+            break;
+        }
+        for (size_t i = begin; i < end; i++) {
+            size_t numflds = 0;
+            if (reader_->response_recv(numflds) != 0) {
+                fprintf(stderr, "response_recv failed: %s\n", reader_->get_error().c_str());
+                reader_->response_buf_remove();
+                continue;
+            }
+            const string_ref *const row = reader_->get_next_row();
+            if (row == 0) {
+                results[i] = RecordNotFound;
+            } else {
+                values[i].assign(row[1].begin(), row[1].size());
+                results[i] = Success;
+            }
+            reader_->response_buf_remove();
+        }
+    }
+    return Success;
+}
+
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+insertMany(const std::string& tableName, const std::vector<mapkeeper::Record>& records,
+           std::vector<ResponseCode>& results)
+{
+    const std::string op = "+";
+    const string_ref op_ref(op.data(), op.size());
+    uint32_t id;
+    ResponseCode rc = getTableId(tableName, id);
+    if (rc != Success) {
+        return rc;
+    }
+    results.assign(records.size(), Error);
+    for (size_t begin = 0; begin < records.size(); begin += MAX_BATCH_SIZE) {
+        size_t end = std::min(records.size(), begin + MAX_BATCH_SIZE);
+        for (size_t i = begin; i < end; i++) {
+            const string_ref refs[2] = {
+                string_ref(records[i].key.data(), records[i].key.size()),
+                string_ref(records[i].value.data(), records[i].value.size()),
+            };
+            writer_->request_buf_exec_generic(id, op_ref, refs, 2, 1, 0, string_ref(), 0, 0);
+        }
+        if (writer_->request_send() != 0) {
+            // the batches before this one are done; this one and the
+            // rest keep their Error results.
+            fprintf(stderr, "request_send failed: %s\n", writer_->get_error().c_str());
+            break;
+        }
+        for (size_t i = begin; i < end; i++) {
+            // TODO handlersocket doesn't set error code properly, and it's
+            // hard to tell why the request failed.
+            results[i] = recvModifyResponse(*writer_, RecordExists, false);
+        }
+    }
+    return Success;
+}
+
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+updateMany(const std::string& tableName, const std::vector<mapkeeper::Record>& records,
+           std::vector<ResponseCode>& results)
+{
+    const std::string op = "=";
+    const std::string modOp = "U";
+    const string_ref op_ref(op.data(), op.size());
+    const string_ref modop_ref(modOp.data(), modOp.size());
+    uint32_t id;
+    ResponseCode rc = getTableId(tableName, id);
+    if (rc != Success) {
+        return rc;
+    }
+    results.assign(records.size(), Error);
+    for (size_t begin = 0; begin < records.size(); begin += MAX_BATCH_SIZE) {
+        size_t end = std::min(records.size(), begin + MAX_BATCH_SIZE);
+        for (size_t i = begin; i < end; i++) {
+            const string_ref refs[2] = {
+                string_ref(records[i].key.data(), records[i].key.size()),
+                string_ref(records[i].value.data(), records[i].value.size()),
+            };
+            writer_->request_buf_exec_generic(id, op_ref, refs, 1, 1, 0, modop_ref, refs, 2);
+        }
+        if (writer_->request_send() != 0) {
+            // the batches before this one are done; this one and the
+            // rest keep their Error results.
+            fprintf(stderr, "request_send failed: %s\n", writer_->get_error().c_str());
+            break;
+        }
+        for (size_t i = begin; i < end; i++) {
+            results[i] = recvModifyResponse(*writer_, RecordNotFound, true);
+        }
+    }
+    return Success;
+}
+
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+removeMany(const std::string& tableName, const std::vector<std::string>& keys,
+           std::vector<ResponseCode>& results)
+{
+    const std::string op = "=";
+    const std::string modOp = "D";
+    const string_ref op_ref(op.data(), op.size());
+    const string_ref modop_ref(modOp.data(), modOp.size());
+    uint32_t id;
+    ResponseCode rc = getTableId(tableName, id);
+    if (rc != Success) {
+        return rc;
+    }
+    results.assign(keys.size(), Error);
+    for (size_t begin = 0; begin < keys.size(); begin += MAX_BATCH_SIZE) {
+        size_t end = std::min(keys.size(), begin + MAX_BATCH_SIZE);
+        for (size_t i = begin; i < end; i++) {
+            const string_ref keyref(keys[i].data(), keys[i].size());
+            writer_->request_buf_exec_generic(id, op_ref, &keyref, 1, 1, 0, modop_ref, 0, 0);
+        }
+        if (writer_->request_send() != 0) {
+            // the batches before this one are done; this one and the
+            // rest keep their Error results.
+            fprintf(stderr, "request_send failed: %s\n", writer_->get_error().c_str());
+            break;
+        }
+        for (size_t i = begin; i < end; i++) {
+            results[i] = recvModifyResponse(*writer_, RecordNotFound, true);
+        }
+    }
+    return Success;
+}
+
+/**
+ * Reads the response to a single insert, update or remove request.
+ *
+ * Update and remove return the number of modified rows, and we use it
+ * to tell whether the record existed if checkNumRows is set.
+ */
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+recvModifyResponse(hstcpcli_i& client, ResponseCode failureCode, bool checkNumRows)
+{
+    size_t numflds = 0;
+    int code = client.response_recv(numflds);
+    if (code != 0) {
+        client.response_buf_remove();
+        // negative codes mean the connection itself is broken.
+        return code < 0 ? Error : failureCode;
+    }
+    ResponseCode rc = Success;
+    if (checkNumRows) {
+        const string_ref *const row = client.get_next_row();
+        if (row != 0 && numflds == 1 && row[0].size() == 1 && row[0].begin()[0] == '0') {
+            rc = failureCode;
+        }
+    }
+    client.response_buf_remove();
+    return rc;
+}
+
+/**
+ * Scans use the index operators of HandlerSocket. An ascending scan starts
+ * with ">=" or ">" on startKey and a descending scan starts with "<=" or "<"
+ * on endKey. HandlerSocket only takes one bound, so the other end of the
+ * range and maxBytes are checked here as the rows come back.
+ *
+ * Each round trip sends several requests that share the same anchor key
+ * and use skip to fetch consecutive pages, so a large scan doesn't turn
+ * into one huge response. The next round continues with a strict operator
+ * on the last key we've seen.
+ */
 void HandlerSocketClient::
-scan(mapkeeper::RecordListResponse& _return, const std::string& tableName, const mapkeeper::ScanOrder::type order,
+scan(ScanSink& sink, const std::string& tableName, const mapkeeper::ScanOrder::type order,
         const std::string& startKey, const bool startKeyIncluded,
         const std::string& endKey, const bool endKeyIncluded,
-        const int32_t maxRecords, const int32_t maxBytes)
+        const int32_t maxRecords, const int32_t maxBytes,
+        const mapkeeper::ScanOptions& options)
 {
+    // filters are applied to the rows here; only the key prefix narrows
+    // the range that is read.
+    ScanFilter filter(options);
+    if (!filter.valid()) {
+        sink.setResponseCode(mapkeeper::ResponseCode::Error);
+        return;
+    }
+    std::string lowKey = startKey;
+    bool lowKeyIncluded = startKeyIncluded;
+    std::string highKey = endKey;
+    bool highKeyIncluded = endKeyIncluded;
+    if (!filter.narrowRange(lowKey, lowKeyIncluded, highKey, highKeyIncluded)) {
+        sink.setResponseCode(mapkeeper::ResponseCode::ScanEnded);
+        return;
+    }
+    bool readValues = !options.keysOnly || filter.needsValue();
+
+    uint32_t id;
+    ResponseCode rc = readValues ? getTableId(tableName, id) : getKeyIndexId(tableName, id);
+    if (rc == TableNotFound) {
+        sink.setResponseCode(mapkeeper::ResponseCode::MapNotFound);
+        return;
+    } else if (rc != Success) {
+        sink.setResponseCode(mapkeeper::ResponseCode::Error);
+        return;
+    }
+
+    bool descending = order == mapkeeper::ScanOrder::Descending;
+    std::string op;
+    std::string anchor;
+    if (!descending) {
+        op = lowKeyIncluded ? ">=" : ">";
+        anchor = lowKey;
+    } else if (highKey.empty()) {
+        op = "<=";
+        anchor = MAX_KEY;
+    } else {
+        op = highKeyIncluded ? "<=" : "<";
+        anchor = highKey;
+    }
+
+    uint32_t numRowsWanted = INITIAL_SCAN_ROWS;
+    while (true) {
+        if (maxRecords > 0) {
+            numRowsWanted = std::min(numRowsWanted, (uint32_t)maxRecords - sink.size());
+        }
+        const string_ref op_ref(op.data(), op.size());
+        const string_ref anchor_ref(anchor.data(), anchor.size());
+        uint32_t numPages = 0;
+        for (uint32_t skip = 0; skip < numRowsWanted; skip += SCAN_PAGE_SIZE) {
+            uint32_t limit = std::min(SCAN_PAGE_SIZE, numRowsWanted - skip);
+            reader_->request_buf_exec_generic(id, op_ref, &anchor_ref, 1, limit, skip, string_ref(), 0, 0);
+            numPages++;
+        }
+        if (reader_->request_send() != 0) {
+            fprintf(stderr, "request_send failed: %s\n", reader_->get_error().c_str());
+            sink.setResponseCode(mapkeeper::ResponseCode::Error);
+            return;
+        }
+
+        // all the pages have to be read off the connection even if we stop
+        // early, so we keep going through the responses and just drop rows.
+        uint32_t numRows = 0;
+        bool done = false;
+        bool ended = false;
+        bool failed = false;
+        for (uint32_t page = 0; page < numPages; page++) {
+            size_t numflds = 0;
+            if (reader_->response_recv(numflds) != 0) {
+                fprintf(stderr, "response_recv failed: %s\n", reader_->get_error().c_str());
+                reader_->response_buf_remove();
+                failed = true;
+                continue;
+            }
+            const string_ref* row;
+            while (!done && !ended && (row = reader_->get_next_row()) != 0) {
+                numRows++;
+                if (!descending && !highKey.empty()) {
+                    int result = compareKeys(row[0].begin(), row[0].size(), highKey.data(), highKey.size());
+                    if (result > 0 || (result == 0 && !highKeyIncluded)) {
+                        ended = true;
+                        break;
+                    }
+                } else if (descending) {
+                    int result = compareKeys(row[0].begin(), row[0].size(), lowKey.data(), lowKey.size());
+                    if (result < 0 || (result == 0 && !lowKeyIncluded)) {
+                        ended = true;
+                        break;
+                    }
+                }
+                ScanFilter::Verdict verdict = filter.examine(row[0].begin(), row[0].size(),
+                                                             readValues ? row[1].begin() : NULL,
+                                                             readValues ? row[1].size() : 0);
+                if (verdict == ScanFilter::Stop) {
+                    done = true;
+                    break;
+                } else if (verdict == ScanFilter::Reject) {
+                    continue;
+                }
+                size_t offset = 0;
+                size_t length = 0;
+                if (!options.keysOnly) {
+                    projectRange(options, row[1].size(), offset, length);
+                }
+                sink.add(row[0].begin(), row[0].size(), readValues ? row[1].begin() + offset : "", length);
+                if (sink.full(maxRecords, maxBytes)) {
+                    done = true;
+                }
+            }
+            reader_->response_buf_remove();
+        }
+        if (failed) {
+            sink.setResponseCode(mapkeeper::ResponseCode::Error);
+            return;
+        }
+        if (ended || (!done && numRows < numRowsWanted)) {
+            sink.setResponseCode(mapkeeper::ResponseCode::ScanEnded);
+            return;
+        }
+        if (done && descending && filter.lastExamined().empty()) {
+            // nothing is below the empty key, and an empty resumeKey
+            // would read as "no upper bound" to the caller.
+            sink.setResponseCode(mapkeeper::ResponseCode::ScanEnded);
+            return;
+        }
+        if (done) {
+            sink.setResponseCode(mapkeeper::ResponseCode::Success);
+            sink.setResumeKey(filter.lastExamined());
+            return;
+        }
+
+        // continue right after the last key we looked at.
+        anchor = filter.lastExamined();
+        op = descending ? "<" : ">";
+        numRowsWanted = MAX_SCAN_ROWS;
+        if (maxBytes > 0 && sink.size() > 0) {
+            int64_t averageRecordSize = std::max((int64_t)1, sink.bytes() / (int64_t)sink.size());
+            int64_t remainingRecords = (maxBytes - sink.bytes() + averageRecordSize - 1) / averageRecordSize;
+            numRowsWanted = (uint32_t)std::max((int64_t)1, std::min((int64_t)MAX_SCAN_ROWS, remainingRecords));
+        }
+    }
+}
+
+int HandlerSocketClient::
+compareKeys(const char* a, size_t alen, const char* b, size_t blen)
+{
+    int result = memcmp(a, b, std::min(alen, blen));
+    if (result == 0) {
+        result = alen < blen ? -1 : (alen > blen ? 1 : 0);
+    }
+    return result;
+}
+
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+getSplitKeys(const std::string& tableName, const std::string& startKey,
+             const std::string& endKey, uint32_t numSplits,
+             std::vector<std::string>& splitKeys)
+{
+    std::string where = keyRange(startKey, !endKey.empty(), endKey, true);
+    int64_t rows = 0;
+    ResponseCode rc = estimateRows(tableName, where, rows);
+    if (rc != Success) {
+        return rc;
+    }
+    if (rows > EXACT_SPLIT_RECORDS) {
+        std::string firstKey;
+        std::string lastKey;
+        rc = boundaryKey(tableName, where, false, firstKey);
+        if (rc == Success) {
+            rc = boundaryKey(tableName, where, true, lastKey);
+        }
+        if (rc != Success) {
+            return rc;
+        }
+        int64_t total = 0;
+        rc = estimateRows(tableName, keyRange(firstKey, true, lastKey, true), total);
+        if (rc != Success) {
+            return rc;
+        }
+        if (total > 0) {
+            return bisectSplitKeys(firstKey, lastKey, numSplits,
+                                   boost::bind(&HandlerSocketClient::keyPosition, this, tableName, firstKey, total, _1),
+                                   splitKeys) ? Success : Error;
+        }
+    }
+
+    std::string query = "select record_key, length(record_value) from " + escapeString(tableName) +
+        " where " + where + " order by record_key";
+    int result = mysql_real_query(&mysql_, query.c_str(), query.length());
+    if (result != 0) {
+        uint32_t error = mysql_errno(&mysql_);
+        if (error == ER_NO_SUCH_TABLE) {
+            return TableNotFound;
+        } else {
+            fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
+            return Error;
+        }
+    }
+    MYSQL_RES* res = mysql_use_result(&mysql_);
+    if (res == NULL) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        return Error;
+    }
+    SplitKeySampler sampler(numSplits);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res))) {
+        uint64_t* lengths = mysql_fetch_lengths(res);
+        sampler.add(std::string(row[0], lengths[0]), lengths[0] + strtoull(row[1], NULL, 10));
+    }
+    if (mysql_errno(&mysql_) != 0) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        mysql_free_result(res);
+        return Error;
+    }
+    mysql_free_result(res);
+    sampler.getSplitKeys(splitKeys);
+    return Success;
+}
+
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+estimateCount(const std::string& tableName, const std::string& startKey,
+              const std::string& endKey, bool exact, int64_t& count)
+{
+    std::string where = keyRange(startKey, !endKey.empty(), endKey, false);
+    std::vector<int64_t> numbers;
+    ResponseCode rc = Success;
+    if (exact) {
+        rc = queryNumbers("select count(*) from " + escapeString(tableName) + " where " + where, numbers);
+    } else if (startKey.empty() && endKey.empty()) {
+        rc = queryNumbers("select table_rows from information_schema.tables "
+                          "where table_schema = database() and table_name = '" +
+                          escapeString(tableName) + "'", numbers);
+    } else {
+        numbers.resize(1);
+        rc = estimateRows(tableName, where, numbers[0]);
+    }
+    if (rc == RecordNotFound) {
+        return TableNotFound;
+    } else if (rc != Success) {
+        return rc;
+    }
+    count = numbers[0];
+    return Success;
+}
+
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+estimateSize(const std::string& tableName, const std::string& startKey,
+             const std::string& endKey, bool exact, int64_t& bytes)
+{
+    std::string where = keyRange(startKey, !endKey.empty(), endKey, false);
+    std::vector<int64_t> numbers;
+    ResponseCode rc = Success;
+    if (exact) {
+        rc = queryNumbers("select sum(length(record_key) + length(record_value)) from " +
+                          escapeString(tableName) + " where " + where, numbers);
+        if (rc == Success) {
+            bytes = numbers[0];
+        }
+        return rc == RecordNotFound ? TableNotFound : rc;
+    }
+    rc = queryNumbers("select table_rows, avg_row_length from information_schema.tables "
+                      "where table_schema = database() and table_name = '" +
+                      escapeString(tableName) + "'", numbers);
+    if (rc == RecordNotFound) {
+        return TableNotFound;
+    } else if (rc != Success) {
+        return rc;
+    }
+    int64_t rows = numbers[0];
+    if (!startKey.empty() || !endKey.empty()) {
+        rc = estimateRows(tableName, where, rows);
+        if (rc != Success) {
+            return rc;
+        }
+    }
+    bytes = rows * numbers[1];
+    return Success;
+}
+
+/**
+ * Runs a query that returns one row of numbers, and reads them. NULL
+ * reads as 0.
+ *
+ * @returns RecordNotFound if the query returned no rows.
+ */
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+queryNumbers(const std::string& query, std::vector<int64_t>& numbers)
+{
+    int result = mysql_real_query(&mysql_, query.c_str(), query.length());
+    if (result != 0) {
+        uint32_t error = mysql_errno(&mysql_);
+        if (error == ER_NO_SUCH_TABLE) {
+            return TableNotFound;
+        } else {
+            fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
+            return Error;
+        }
+    }
+    MYSQL_RES* res = mysql_store_result(&mysql_);
+    if (res == NULL) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        return Error;
+    }
+    MYSQL_ROW row = mysql_fetch_row(res);
+    if (!row) {
+        mysql_free_result(res);
+        return RecordNotFound;
+    }
+    uint32_t numFields = mysql_num_fields(res);
+    numbers.clear();
+    for (uint32_t i = 0; i < numFields; i++) {
+        numbers.push_back(row[i] ? strtoll(row[i], NULL, 10) : 0);
+    }
+    mysql_free_result(res);
+    return Success;
+}
+
+/**
+ * Returns the condition for keys from lowKey (included) to highKey, or
+ * with no upper bound unless hasHighKey. The empty string is a key like
+ * any other, so it can't stand for "no bound" here.
+ */
+std::string HandlerSocketClient::
+keyRange(const std::string& lowKey, bool hasHighKey, const std::string& highKey, bool highKeyIncluded)
+{
+    std::string where = "record_key >= '" + escapeString(lowKey) + "'";
+    if (hasHighKey) {
+        where += std::string(" and record_key ") + (highKeyIncluded ? "<=" : "<") +
+            " '" + escapeString(highKey) + "'";
+    }
+    return where;
+}
+
+/**
+ * Reads the optimizer's estimate of the number of rows that match where
+ * from the rows column of EXPLAIN.
+ */
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+estimateRows(const std::string& tableName, const std::string& where, int64_t& rows)
+{
+    std::string query = "explain select record_key from " + escapeString(tableName) +
+        " where " + where;
+    int result = mysql_real_query(&mysql_, query.c_str(), query.length());
+    if (result != 0) {
+        uint32_t error = mysql_errno(&mysql_);
+        if (error == ER_NO_SUCH_TABLE) {
+            return TableNotFound;
+        } else {
+            fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
+            return Error;
+        }
+    }
+    MYSQL_RES* res = mysql_store_result(&mysql_);
+    if (res == NULL) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        return Error;
+    }
+    MYSQL_FIELD* fields = mysql_fetch_fields(res);
+    uint32_t numFields = mysql_num_fields(res);
+    MYSQL_ROW row = mysql_fetch_row(res);
+    rows = 0;
+    for (uint32_t i = 0; row && i < numFields; i++) {
+        if (strcmp(fields[i].name, "rows") == 0 && row[i]) {
+            rows = strtoll(row[i], NULL, 10);
+        }
+    }
+    mysql_free_result(res);
+    return Success;
+}
+
+/**
+ * Reads the first (or the last) key that matches where, or "" if there's
+ * none.
+ */
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+boundaryKey(const std::string& tableName, const std::string& where, bool last, std::string& key)
+{
+    std::string query = "select record_key from " + escapeString(tableName) +
+        " where " + where + " order by record_key" + (last ? " desc" : "") + " limit 1";
+    int result = mysql_real_query(&mysql_, query.c_str(), query.length());
+    if (result != 0) {
+        uint32_t error = mysql_errno(&mysql_);
+        if (error == ER_NO_SUCH_TABLE) {
+            return TableNotFound;
+        } else {
+            fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
+            return Error;
+        }
+    }
+    MYSQL_RES* res = mysql_store_result(&mysql_);
+    if (res == NULL) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        return Error;
+    }
+    MYSQL_ROW row = mysql_fetch_row(res);
+    key.clear();
+    if (row) {
+        uint64_t* lengths = mysql_fetch_lengths(res);
+        key.assign(row[0], lengths[0]);
+    }
+    mysql_free_result(res);
+    return Success;
+}
+
+/**
+ * The share of the total rows from firstKey that are less than key, or
+ * -1 on errors.
+ */
+double HandlerSocketClient::
+keyPosition(const std::string& tableName, const std::string& firstKey, int64_t total,
+            const std::string& key)
+{
+    int64_t rows = 0;
+    if (estimateRows(tableName, keyRange(firstKey, true, key, false), rows) != Success) {
+        return -1;
+    }
+    return std::min(1.0, (double)rows / total);
 }
 
 std::string HandlerSocketClient::
@@ -260,3 +887,29 @@ getTableId(const std::string& tableName, uint32_t& id)
     tableIds_[tableName] = id;
     return Success;
 }
+
+/**
+ * Like getTableId(), but opens the primary key with record_key only, on
+ * the reader.
+ */
+HandlerSocketClient::ResponseCode HandlerSocketClient::
+getKeyIndexId(const std::string& tableName, uint32_t& id)
+{
+    std::map<std::string, uint32_t>::iterator itr = keyIndexIds_.find(tableName);
+    if (itr != keyIndexIds_.end()) {
+        id = itr->second;
+        return Success;
+    }
+    size_t numFields = 0;
+    id = currentTableId_;
+    currentTableId_++;
+    reader_->request_buf_open_index(id, DBNAME.c_str(), tableName.c_str(), "PRIMARY", KEY_FIELDS.c_str());
+    assert(reader_->request_send() == 0);
+    if (reader_->response_recv(numFields) != 0) {
+        reader_->response_buf_remove();
+        return TableNotFound;
+    }
+    reader_->response_buf_remove();
+    keyIndexIds_[tableName] = id;
+    return Success;
+}
@@ -9,6 +9,8 @@
 
 using namespace dena;
 
+class ScanSink;
+
 class HandlerSocketClient {
 public:
     enum ResponseCode {
@@ -28,16 +30,80 @@ public:
     ResponseCode update(const std::string& tableName, const std::string& key, const std::string& value);
     ResponseCode get(const std::string& tableName, const std::string& key, std::string& value);
     ResponseCode remove(const std::string& tableName, const std::string& key);
-    void scan (mapkeeper::RecordListResponse& _return, const std::string& mapName, const mapkeeper::ScanOrder::type order,
+
+    /**
+     * Batched versions of get, insert, update and remove.
+     *
+     * Requests are queued in the request buffer and sent together, and the
+     * responses are read back in order, so a batch of N requests costs one
+     * round trip instead of N. The per-key result is stored in results, in
+     * the same order as the input. The return value is Success unless the
+     * whole batch failed (for example, TableNotFound). If a batch can't be
+     * sent, its keys and the ones after it get Error, and the results of
+     * the batches before it are kept.
+     */
+    ResponseCode getMany(const std::string& tableName, const std::vector<std::string>& keys,
+                         std::vector<ResponseCode>& results, std::vector<std::string>& values);
+    ResponseCode insertMany(const std::string& tableName, const std::vector<mapkeeper::Record>& records,
+                            std::vector<ResponseCode>& results);
+    ResponseCode updateMany(const std::string& tableName, const std::vector<mapkeeper::Record>& records,
+                            std::vector<ResponseCode>& results);
+    ResponseCode removeMany(const std::string& tableName, const std::vector<std::string>& keys,
+                            std::vector<ResponseCode>& results);
+    /**
+     * Keys-only scans read an index opened with record_key only, so the
+     * values never leave MySQL. HandlerSocket can't return part of a
+     * column, so other projections are applied here.
+     */
+    void scan (ScanSink& sink, const std::string& mapName, const mapkeeper::ScanOrder::type order,
             const std::string& startKey, const bool startKeyIncluded,
             const std::string& endKey, const bool endKeyIncluded,
-            const int32_t maxRecords, const int32_t maxBytes);
+            const int32_t maxRecords, const int32_t maxBytes,
+            const mapkeeper::ScanOptions& options = mapkeeper::ScanOptions());
+
+    /**
+     * Cuts [startKey, endKey] into numSplits parts. Tables of up to
+     * EXACT_SPLIT_RECORDS rows (as estimated by EXPLAIN) are read and
+     * split by the size of the records; larger ones are split by
+     * bisecting the row estimates of EXPLAIN, which InnoDB makes by
+     * diving into the primary key index.
+     */
+    ResponseCode getSplitKeys(const std::string& tableName, const std::string& startKey,
+                              const std::string& endKey, uint32_t numSplits,
+                              std::vector<std::string>& splitKeys);
+
+    /**
+     * Counts the records in [startKey, endKey), or adds up their sizes.
+     * Approximate answers come from the InnoDB table statistics in
+     * information_schema for whole tables, and from EXPLAIN for ranges.
+     */
+    ResponseCode estimateCount(const std::string& tableName, const std::string& startKey,
+                               const std::string& endKey, bool exact, int64_t& count);
+    ResponseCode estimateSize(const std::string& tableName, const std::string& startKey,
+                              const std::string& endKey, bool exact, int64_t& bytes);
 
 private:
     static const std::string DBNAME;
     static const std::string FIELDS;
+    static const std::string KEY_FIELDS;
+    static const size_t MAX_BATCH_SIZE;
+    static const std::string MAX_KEY;
+    static const uint32_t INITIAL_SCAN_ROWS;
+    static const uint32_t MAX_SCAN_ROWS;
+    static const uint32_t SCAN_PAGE_SIZE;
+    static int compareKeys(const char* a, size_t alen, const char* b, size_t blen);
     std::string escapeString(const std::string& str);
+    std::string keyRange(const std::string& lowKey, bool hasHighKey, const std::string& highKey,
+                         bool highKeyIncluded);
+    ResponseCode estimateRows(const std::string& tableName, const std::string& where, int64_t& rows);
+    ResponseCode queryNumbers(const std::string& query, std::vector<int64_t>& numbers);
+    ResponseCode boundaryKey(const std::string& tableName, const std::string& where, bool last,
+                             std::string& key);
+    double keyPosition(const std::string& tableName, const std::string& firstKey, int64_t total,
+                       const std::string& key);
     ResponseCode getTableId(const std::string& tableName, uint32_t& id);
+    ResponseCode getKeyIndexId(const std::string& tableName, uint32_t& id);
+    ResponseCode recvModifyResponse(hstcpcli_i& client, ResponseCode failureCode, bool checkNumRows);
     MYSQL mysql_;
     hstcpcli_ptr reader_;
     hstcpcli_ptr writer_;
@@ -47,6 +113,7 @@ private:
     uint32_t hsWriterPort_;
     uint32_t currentTableId_;
     std::map<std::string, uint32_t> tableIds_;
+    std::map<std::string, uint32_t> keyIndexIds_;
 };
 
 #endif
@@ -5,18 +5,19 @@
  * http://yoshinorimatsunobu.blogspot.com/search/label/handlersocket
  */
 #include "MapKeeper.h"
+#include "HandlerChain.h"
+#include "ServerRuntime.h"
 #include "HandlerSocketClient.h"
+#include "ScanSink.h"
+#include "ValuePatch.h"
 
 #include <boost/thread/tss.hpp>
 #include <protocol/TBinaryProtocol.h>
-#include <server/TThreadedServer.h>
-#include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
 
 using namespace ::apache::thrift;
 using namespace ::apache::thrift::protocol;
 using namespace ::apache::thrift::transport;
-using namespace ::apache::thrift::server;
 using namespace ::apache::thrift::concurrency;
 
 using boost::shared_ptr;
@@ -62,7 +63,29 @@ public:
               const bool startKeyIncluded, const std::string& endKey, 
               const bool endKeyIncluded, const int32_t maxRecords, 
               const int32_t maxBytes) {
-        _return.responseCode = ResponseCode::Success;
+        initClient();
+        RecordListSink sink(_return);
+        client_->scan(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+    }
+
+    void scanWithOptions(RecordListResponse& _return, const std::string& mapName, 
+              const ScanOrder::type order, const std::string& startKey, 
+              const bool startKeyIncluded, const std::string& endKey, 
+              const bool endKeyIncluded, const int32_t maxRecords, 
+              const int32_t maxBytes, const ScanOptions& options) {
+        initClient();
+        RecordListSink sink(_return);
+        client_->scan(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    }
+
+    void scanPacked(PackedRecordListResponse& _return, const std::string& mapName, 
+              const ScanOrder::type order, const std::string& startKey, 
+              const bool startKeyIncluded, const std::string& endKey, 
+              const bool endKeyIncluded, const int32_t maxRecords, 
+              const int32_t maxBytes, const ScanOptions& options) {
+        initClient();
+        PackedRecordSink sink(_return, options.sharedKeyPrefixes);
+        client_->scan(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
     }
 
     void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
@@ -81,6 +104,26 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
+    /**
+     * HandlerSocket returns whole columns, so this reads the whole value.
+     */
+    void getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length) {
+        if (offset < 0 || length < 0) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        get(_return, mapName, key);
+        if (_return.responseCode != ResponseCode::Success) {
+            return;
+        }
+        if ((uint64_t)offset >= _return.value.size()) {
+            _return.value.clear();
+            return;
+        }
+        _return.value = _return.value.substr(offset, length);
+    }
+
     ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
         return ResponseCode::Success;
     }
@@ -111,11 +154,198 @@ public:
         return ResponseCode::Success;
     }
 
+    ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data) {
+        return patch(mapName, key, -1, data);
+    }
+
+    ResponseCode::type writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+                               const std::string& data) {
+        if (offset < 0) {
+            return ResponseCode::Error;
+        }
+        return patch(mapName, key, offset, data);
+    }
+
+    ResponseCode::type putChunk(const std::string& mapName, const std::string& key, const int64_t offset,
+                                const std::string& data, const bool last) {
+        return ResponseCode::Error;
+    }
+
     ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+        initClient();
+        HandlerSocketClient::ResponseCode rc = client_->remove(mapName, key);
+        if (rc == HandlerSocketClient::TableNotFound) {
+            return ResponseCode::MapNotFound;
+        } else if (rc == HandlerSocketClient::RecordNotFound) {
+            return ResponseCode::RecordNotFound;
+        } else if (rc != HandlerSocketClient::Success) {
+            return ResponseCode::Error;
+        }
         return ResponseCode::Success;
     }
 
+    void multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        initClient();
+        std::vector<HandlerSocketClient::ResponseCode> results;
+        std::vector<std::string> values;
+        HandlerSocketClient::ResponseCode rc = client_->getMany(mapName, keys, results, values);
+        _return.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (rc != HandlerSocketClient::Success) {
+                _return[i].responseCode = convertResponseCode(rc);
+                continue;
+            }
+            _return[i].responseCode = convertResponseCode(results[i]);
+            _return[i].value.swap(values[i]);
+        }
+    }
+
+    /**
+     * HandlerSocket has no upsert, so the records are inserted in one
+     * batch, and the ones that already exist are updated in a second.
+     */
+    void multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records) {
+        initClient();
+        std::vector<HandlerSocketClient::ResponseCode> results;
+        HandlerSocketClient::ResponseCode rc = client_->insertMany(mapName, records, results);
+        convertResponseCodes(_return, rc, results, records.size());
+        if (rc != HandlerSocketClient::Success) {
+            return;
+        }
+        std::vector<size_t> existing;
+        std::vector<Record> updates;
+        for (size_t i = 0; i < records.size(); i++) {
+            if (results[i] == HandlerSocketClient::RecordExists) {
+                existing.push_back(i);
+                updates.push_back(records[i]);
+            }
+        }
+        if (updates.empty()) {
+            return;
+        }
+        rc = client_->updateMany(mapName, updates, results);
+        for (size_t i = 0; i < existing.size(); i++) {
+            _return[existing[i]] = convertResponseCode(rc != HandlerSocketClient::Success ? rc : results[i]);
+        }
+    }
+
+    void multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records) {
+        initClient();
+        std::vector<HandlerSocketClient::ResponseCode> results;
+        HandlerSocketClient::ResponseCode rc = client_->insertMany(mapName, records, results);
+        convertResponseCodes(_return, rc, results, records.size());
+    }
+
+    void multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records) {
+        initClient();
+        std::vector<HandlerSocketClient::ResponseCode> results;
+        HandlerSocketClient::ResponseCode rc = client_->updateMany(mapName, records, results);
+        convertResponseCodes(_return, rc, results, records.size());
+    }
+
+    void multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        initClient();
+        std::vector<HandlerSocketClient::ResponseCode> results;
+        HandlerSocketClient::ResponseCode rc = client_->removeMany(mapName, keys, results);
+        convertResponseCodes(_return, rc, results, keys.size());
+    }
+
+    void getStats(StatsResponse& _return) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const int32_t numSplits) {
+        initClient();
+        HandlerSocketClient::ResponseCode rc = client_->getSplitKeys(mapName, startKey, endKey, numSplits, _return.values);
+        if (rc == HandlerSocketClient::TableNotFound) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        } else if (rc != HandlerSocketClient::Success) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void estimateCount(EstimateResponse& _return, const std::string& mapName,
+                       const std::string& startKey, const std::string& endKey, const bool exact) {
+        initClient();
+        HandlerSocketClient::ResponseCode rc = client_->estimateCount(mapName, startKey, endKey, exact, _return.value);
+        if (rc == HandlerSocketClient::TableNotFound) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        } else if (rc != HandlerSocketClient::Success) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.exact = exact;
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void estimateSize(EstimateResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const bool exact) {
+        initClient();
+        HandlerSocketClient::ResponseCode rc = client_->estimateSize(mapName, startKey, endKey, exact, _return.value);
+        if (rc == HandlerSocketClient::TableNotFound) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        } else if (rc != HandlerSocketClient::Success) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.exact = exact;
+        _return.responseCode = ResponseCode::Success;
+    }
+
 private:
+    /**
+     * The HandlerSocket protocol can't modify part of a value, so the
+     * value is read and updated here, which isn't atomic. offset is
+     * negative for appends.
+     */
+    ResponseCode::type patch(const std::string& mapName, const std::string& key, int64_t offset,
+                             const std::string& data) {
+        BinaryResponse response;
+        get(response, mapName, key);
+        if (response.responseCode != ResponseCode::Success) {
+            return response.responseCode;
+        }
+        if (!patchValue(response.value, offset < 0 ? response.value.size() : offset, data)) {
+            return ResponseCode::Error;
+        }
+        return update(mapName, key, response.value);
+    }
+
+    static ResponseCode::type convertResponseCode(HandlerSocketClient::ResponseCode rc) {
+        switch (rc) {
+        case HandlerSocketClient::Success:
+            return ResponseCode::Success;
+        case HandlerSocketClient::TableNotFound:
+            return ResponseCode::MapNotFound;
+        case HandlerSocketClient::RecordExists:
+            return ResponseCode::RecordExists;
+        case HandlerSocketClient::RecordNotFound:
+            return ResponseCode::RecordNotFound;
+        default:
+            return ResponseCode::Error;
+        }
+    }
+
+    static void convertResponseCodes(std::vector<ResponseCode::type>& _return,
+                                     HandlerSocketClient::ResponseCode rc,
+                                     const std::vector<HandlerSocketClient::ResponseCode>& results,
+                                     size_t numRequests) {
+        if (rc != HandlerSocketClient::Success) {
+            _return.assign(numRequests, convertResponseCode(rc));
+            return;
+        }
+        _return.resize(numRequests);
+        for (size_t i = 0; i < numRequests; i++) {
+            _return[i] = convertResponseCode(results[i]);
+        }
+    }
+
     void initClient() {
         if (client_.get() == NULL) {
             printf("hello world\n");
@@ -126,13 +356,10 @@ private:
 };
 
 int main(int argc, char **argv) {
-    int port = 9090;
+    ServerOptions options;
+    options.parse(argc, argv);
     shared_ptr<HandlerSocketServer> handler(new HandlerSocketServer());
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer* server = new TThreadedServer(processor, serverTransport, transportFactory, protocolFactory);
-    server->serve();
+    shared_ptr<TProcessor> processor(buildProcessor(handler, options));
+    runServer(processor, options);
     return 0;
 }
@@ -1,262 +1,708 @@
-/**
- * This is a implementation of the mapkeeper interface that uses 
- * leveldb.
- *
- * http://leveldb.googlecode.com/svn/trunk/doc/index.html
- */
+#include <algorithm>
 #include <cstdio>
-#include "MapKeeper.h"
-#include <leveldb/db.h>
+#include <cassert>
+#include "LevelDbServer.h"
+#include "Projection.h"
+#include "RequestTrace.h"
+#include "SplitKeys.h"
+#include "ValuePatch.h"
 #include <leveldb/cache.h>
-#include <boost/ptr_container/ptr_map.hpp>
-#include <boost/thread/shared_mutex.hpp>
+#include <leveldb/write_batch.h>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/filesystem.hpp>
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
 
-#include <protocol/TBinaryProtocol.h>
-#include <server/TThreadedServer.h>
-#include <transport/TServerSocket.h>
-#include <transport/TBufferTransports.h>
-
+using namespace mapkeeper;
 
-using namespace ::apache::thrift;
-using namespace ::apache::thrift::protocol;
-using namespace ::apache::thrift::transport;
-using namespace ::apache::thrift::server;
-using namespace ::apache::thrift::concurrency;
+LevelDbServer::
+LevelDbServer(const std::string& directoryName, bool sync,
+              bool blindInsert, bool blindUpdate) :
+    directoryName_(directoryName),
+    sync_(sync),
+    blindInsert_(blindInsert),
+    blindUpdate_(blindUpdate)
+{
+    // open all the existing databases
+    leveldb::DB* db;
+    leveldb::Options options;
+    options.create_if_missing = false;
+    options.error_if_exists = false;
+    options.write_buffer_size = 500 * 1048576; // 500MB write buffer
+    options.block_cache = leveldb::NewLRUCache(10000L * 1048576L);  // 1.5GB cache
+    options.compression = leveldb::kNoCompression;
 
-using boost::shared_ptr;
-using namespace boost::filesystem;
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
 
-using namespace mapkeeper;
-
-int syncmode;
-int blindinsert;
-int blindupdate;
-class LevelDbServer: virtual public MapKeeperIf {
-public:
-    LevelDbServer(const std::string& directoryName) : 
-        directoryName_(directoryName) {
-
-        // open all the existing databases
-        leveldb::DB* db;
-        leveldb::Options options;
-        options.create_if_missing = false;
-        options.error_if_exists = false;
-        options.write_buffer_size = 500 * 1048576; // 500MB write buffer
-        options.block_cache = leveldb::NewLRUCache(10000L * 1048576L);  // 1.5GB cache
-        options.compression = leveldb::kNoCompression;
-
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-
-        directory_iterator end_itr;
-        for (directory_iterator itr(directoryName); itr != end_itr;itr++) {
-            if (is_directory(itr->status())) {
-                std::string mapName = itr->path().filename();
-                leveldb::Status status = leveldb::DB::Open(options, itr->path().string(), &db);
-                assert(status.ok());
-                maps_.insert(mapName, db);
-            }
+    boost::filesystem::directory_iterator end_itr;
+    for (boost::filesystem::directory_iterator itr(directoryName); itr != end_itr;itr++) {
+        if (boost::filesystem::is_directory(itr->status())) {
+            std::string mapName = itr->path().filename();
+            leveldb::Status status = leveldb::DB::Open(options, itr->path().string(), &db);
+            assert(status.ok());
+            maps_.insert(mapName, db);
         }
     }
+}
 
-    ResponseCode::type ping() {
-        return ResponseCode::Success;
-    }
+ResponseCode::type LevelDbServer::
+ping()
+{
+    return ResponseCode::Success;
+}
 
-    ResponseCode::type addMap(const std::string& mapName) {
-        leveldb::DB* db;
-        leveldb::Options options;
-        options.create_if_missing = true;
-        options.error_if_exists = true;
-        options.write_buffer_size = 500 * 1048576; // 500MB write buffer
-        options.block_cache = leveldb::NewLRUCache(1500 * 1048576);  // 1.5GB cache
-        leveldb::Status status = leveldb::DB::Open(options, directoryName_ + "/" + mapName, &db);
-        if (!status.ok()) {
-            // TODO check return code
-            printf("status: %s\n", status.ToString().c_str());
-            return ResponseCode::Error;
-        }
-        std::string mapName_ = mapName;
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-        maps_.insert(mapName_, db);
-        return ResponseCode::Success;
+ResponseCode::type LevelDbServer::
+addMap(const std::string& mapName)
+{
+    leveldb::DB* db;
+    leveldb::Options options;
+    options.create_if_missing = true;
+    options.error_if_exists = true;
+    options.write_buffer_size = 500 * 1048576; // 500MB write buffer
+    options.block_cache = leveldb::NewLRUCache(1500 * 1048576);  // 1.5GB cache
+    leveldb::Status status = leveldb::DB::Open(options, directoryName_ + "/" + mapName, &db);
+    if (!status.ok()) {
+        // TODO check return code
+        printf("status: %s\n", status.ToString().c_str());
+        return ResponseCode::Error;
     }
+    std::string mapName_ = mapName;
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    maps_.insert(mapName_, db);
+    return ResponseCode::Success;
+}
 
-    ResponseCode::type dropMap(const std::string& mapName) {
-        std::string mapName_ = mapName;
-        boost::ptr_map<std::string, leveldb::DB>::iterator itr;
-        boost::unique_lock< boost::shared_mutex> writeLock(mutex_);;
-        itr = maps_.find(mapName_);
-        if (itr == maps_.end()) {
-            return ResponseCode::MapNotFound;
-        }
-        maps_.erase(itr);
-        return ResponseCode::Success;
+ResponseCode::type LevelDbServer::
+dropMap(const std::string& mapName)
+{
+    std::string mapName_ = mapName;
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr;
+    boost::unique_lock< boost::shared_mutex> writeLock(mutex_);;
+    itr = maps_.find(mapName_);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
     }
+    maps_.erase(itr);
+    return ResponseCode::Success;
+}
 
-    void listMaps(StringListResponse& _return) {
-        DIR *dp;
-        struct dirent *dirp;
-        if((dp  = opendir(directoryName_.c_str())) == NULL) {
-            _return.responseCode = ResponseCode::Success;
-            return;
-        }
-
-        while ((dirp = readdir(dp)) != NULL) {
-            _return.values.push_back(std::string(dirp->d_name));
-        }
-        closedir(dp);
+void LevelDbServer::
+listMaps(StringListResponse& _return)
+{
+    DIR *dp;
+    struct dirent *dirp;
+    if((dp  = opendir(directoryName_.c_str())) == NULL) {
         _return.responseCode = ResponseCode::Success;
+        return;
     }
 
-    void scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
-              const std::string& startKey, const bool startKeyIncluded, 
-              const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+    while ((dirp = readdir(dp)) != NULL) {
+        _return.values.push_back(std::string(dirp->d_name));
     }
+    closedir(dp);
+    _return.responseCode = ResponseCode::Success;
+}
 
-    void scanAscending(RecordListResponse& _return, std::map<std::string, std::string>& map,
-              const std::string& startKey, const bool startKeyIncluded, 
-              const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
-        _return.responseCode = ResponseCode::ScanEnded;
-    }
+void LevelDbServer::
+scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+          const std::string& startKey, const bool startKeyIncluded, 
+          const std::string& endKey, const bool endKeyIncluded,
+          const int32_t maxRecords, const int32_t maxBytes)
+{
+    scanWithOptions(_return, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+                    maxRecords, maxBytes, ScanOptions());
+}
+
+void LevelDbServer::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+          const std::string& startKey, const bool startKeyIncluded, 
+          const std::string& endKey, const bool endKeyIncluded,
+          const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options)
+{
+    RecordListSink sink(_return);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
 
-    void scanDescending(RecordListResponse& _return, std::map<std::string, std::string>& map,
-              const std::string& startKey, const bool startKeyIncluded, 
-              const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
-        _return.responseCode = ResponseCode::ScanEnded;
+void LevelDbServer::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+          const std::string& startKey, const bool startKeyIncluded, 
+          const std::string& endKey, const bool endKeyIncluded,
+          const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options)
+{
+    PackedRecordSink sink(_return, options.sharedKeyPrefixes);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
+void LevelDbServer::
+scanInto(ScanSink& sink, const std::string& mapName, const ScanOrder::type order,
+          const std::string& startKey, const bool startKeyIncluded, 
+          const std::string& endKey, const bool endKeyIncluded,
+          const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        sink.setResponseCode(ResponseCode::MapNotFound);
+        return;
+    }
+    ScanFilter filter(options);
+    if (!filter.valid()) {
+        sink.setResponseCode(ResponseCode::Error);
+        return;
+    }
+    std::string start = startKey;
+    bool startIncluded = startKeyIncluded;
+    std::string end = endKey;
+    bool endIncluded = endKeyIncluded;
+    if (!filter.narrowRange(start, startIncluded, end, endIncluded)) {
+        sink.setResponseCode(ResponseCode::ScanEnded);
+        return;
     }
+    boost::scoped_ptr<leveldb::Iterator> dbItr(itr->second->NewIterator(leveldb::ReadOptions()));
+    if (order == ScanOrder::Ascending) {
+        scanAscending(sink, dbItr.get(), start, startIncluded, end, endIncluded, maxRecords, maxBytes, options, filter);
+    } else {
+        scanDescending(sink, dbItr.get(), start, startIncluded, end, endIncluded, maxRecords, maxBytes, options, filter);
+    }
+    TRACE_MARK(RequestTrace::ENGINE);
+}
 
-    void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
-        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
-        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
-        if (itr == maps_.end()) {
-            _return.responseCode = ResponseCode::MapNotFound;
+void LevelDbServer::
+scanAscending(ScanSink& sink, leveldb::Iterator* itr,
+          const std::string& startKey, const bool startKeyIncluded, 
+          const std::string& endKey, const bool endKeyIncluded,
+          const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options,
+          ScanFilter& filter)
+{
+    if (startKey.empty()) {
+        itr->SeekToFirst();
+    } else {
+        itr->Seek(startKey);
+        if (!startKeyIncluded && itr->Valid() && itr->key().compare(startKey) == 0) {
+            itr->Next();
+        }
+    }
+    for (; itr->Valid(); itr->Next()) {
+        if (sink.full(maxRecords, maxBytes)) {
+            sink.setResponseCode(ResponseCode::Success);
+            sink.setResumeKey(filter.lastExamined());
             return;
         }
-        leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &(_return.value));
-        if (status.IsNotFound()) {
-            _return.responseCode = ResponseCode::RecordNotFound;
+        leveldb::Slice key = itr->key();
+        if (!endKey.empty()) {
+            int result = key.compare(endKey);
+            if (result > 0 || (result == 0 && !endKeyIncluded)) {
+                break;
+            }
+        }
+        ScanFilter::Verdict verdict = filter.examine(key.data(), key.size(),
+                                                     itr->value().data(), itr->value().size());
+        if (verdict == ScanFilter::Stop) {
+            sink.setResponseCode(ResponseCode::Success);
+            sink.setResumeKey(filter.lastExamined());
             return;
-        } else if (!status.ok()) {
-            _return.responseCode = ResponseCode::Error;
+        } else if (verdict == ScanFilter::Accept) {
+            addRecord(sink, itr, options);
+        }
+    }
+    sink.setResponseCode(itr->status().ok() ? ResponseCode::ScanEnded : ResponseCode::Error);
+}
+
+void LevelDbServer::
+scanDescending(ScanSink& sink, leveldb::Iterator* itr,
+          const std::string& startKey, const bool startKeyIncluded, 
+          const std::string& endKey, const bool endKeyIncluded,
+          const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options,
+          ScanFilter& filter)
+{
+    if (endKey.empty()) {
+        itr->SeekToLast();
+    } else {
+        // Seek() lands on the first key >= endKey, so step back if 
+        // it's past the end of the range.
+        itr->Seek(endKey);
+        if (!itr->Valid()) {
+            itr->SeekToLast();
+        } else {
+            int result = itr->key().compare(endKey);
+            if (result > 0 || (result == 0 && !endKeyIncluded)) {
+                itr->Prev();
+            }
+        }
+    }
+    for (; itr->Valid(); itr->Prev()) {
+        if (sink.full(maxRecords, maxBytes)) {
+            sink.setResponseCode(ResponseCode::Success);
+            sink.setResumeKey(filter.lastExamined());
             return;
         }
-        _return.responseCode = ResponseCode::Success;
+        leveldb::Slice key = itr->key();
+        if (!startKey.empty()) {
+            int result = key.compare(startKey);
+            if (result < 0 || (result == 0 && !startKeyIncluded)) {
+                break;
+            }
+        }
+        ScanFilter::Verdict verdict = filter.examine(key.data(), key.size(),
+                                                     itr->value().data(), itr->value().size());
+        if (verdict == ScanFilter::Stop) {
+            sink.setResponseCode(ResponseCode::Success);
+            sink.setResumeKey(filter.lastExamined());
+            return;
+        } else if (verdict == ScanFilter::Accept) {
+            addRecord(sink, itr, options);
+        }
     }
+    sink.setResponseCode(itr->status().ok() ? ResponseCode::ScanEnded : ResponseCode::Error);
+}
 
-    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
-        std::string mapName_ = mapName;
-        boost::ptr_map<std::string, leveldb::DB>::iterator itr;
-        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+void LevelDbServer::
+addRecord(ScanSink& sink, leveldb::Iterator* itr, const ScanOptions& options)
+{
+    leveldb::Slice key = itr->key();
+    if (options.keysOnly) {
+        sink.add(key.data(), key.size(), "", 0);
+        return;
+    }
+    leveldb::Slice value = itr->value();
+    size_t offset;
+    size_t length;
+    projectRange(options, value.size(), offset, length);
+    sink.add(key.data(), key.size(), value.data() + offset, length);
+}
 
-        itr = maps_.find(mapName_);
-        if (itr == maps_.end()) {
-            return ResponseCode::MapNotFound;
-        }
+void LevelDbServer::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &(_return.value));
+    TRACE_MARK(RequestTrace::ENGINE);
+    if (status.IsNotFound()) {
+        _return.responseCode = ResponseCode::RecordNotFound;
+        return;
+    } else if (!status.ok()) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.responseCode = ResponseCode::Success;
+}
 
-        leveldb::WriteOptions options;
-        options.sync = syncmode ? true : false;
-        leveldb::Status status = itr->second->Put(options, key, value);
+void LevelDbServer::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key, const int64_t offset, const int32_t length)
+{
+    if (offset < 0 || length < 0) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    get(_return, mapName, key);
+    if (_return.responseCode != ResponseCode::Success) {
+        return;
+    }
+    if ((uint64_t)offset >= _return.value.size()) {
+        _return.value.clear();
+        return;
+    }
+    _return.value = _return.value.substr(offset, length);
+}
 
-        if (!status.ok()) {
-            return ResponseCode::Error;
-        }
-        return ResponseCode::Success;
+ResponseCode::type LevelDbServer::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    std::string mapName_ = mapName;
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr;
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+
+    itr = maps_.find(mapName_);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
     }
 
-    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value) {
-        // TODO Get and Put should be within a same transaction
-        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
-        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
-        if (itr == maps_.end()) {
-            return ResponseCode::MapNotFound;
-        }
-	if(!blindinsert) {
+    leveldb::WriteOptions options;
+    options.sync = sync_;
+    leveldb::Status status = itr->second->Put(options, key, value);
+    TRACE_MARK(RequestTrace::ENGINE);
+
+    if (!status.ok()) {
+        return ResponseCode::Error;
+    }
+    return ResponseCode::Success;
+}
+
+ResponseCode::type LevelDbServer::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    // TODO Get and Put should be within a same transaction
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+	if(!blindInsert_) {
 	  std::string recordValue;
 	  leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &recordValue);
+	  TRACE_MARK(RequestTrace::ENGINE);
 	  if (status.ok()) {
-            printf("Record exists!\n");
-            return ResponseCode::RecordExists;
+        printf("Record exists!\n");
+        return ResponseCode::RecordExists;
 	  } else if (!status.IsNotFound()) {
-            return ResponseCode::Error;
+        return ResponseCode::Error;
 	  }
 	}
-        leveldb::WriteOptions options;
-        options.sync = syncmode ? true : false;
+    leveldb::WriteOptions options;
+    options.sync = sync_;
 	leveldb::Status status = itr->second->Put(options, key, value);
-        if (!status.ok()) {
-            printf("insert not ok! %s\n", status.ToString().c_str());
-            return ResponseCode::Error;
-        }
-        return ResponseCode::Success;
+	TRACE_MARK(RequestTrace::ENGINE);
+    if (!status.ok()) {
+        printf("insert not ok! %s\n", status.ToString().c_str());
+        return ResponseCode::Error;
     }
+    return ResponseCode::Success;
+}
 
-    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value) {
-        // TODO Get and Put should be within a same transaction
-        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
-        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
-        if (itr == maps_.end()) {
-            return ResponseCode::MapNotFound;
-        }
-        std::string recordValue;
-	if(!blindupdate) {
+ResponseCode::type LevelDbServer::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    // TODO Get and Put should be within a same transaction
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    std::string recordValue;
+	if(!blindUpdate_) {
 	  leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &recordValue);
+	  TRACE_MARK(RequestTrace::ENGINE);
 	  if (status.IsNotFound()) {
-            return ResponseCode::RecordNotFound;
+        return ResponseCode::RecordNotFound;
 	  } else if (!status.ok()) {
-            return ResponseCode::Error;
+        return ResponseCode::Error;
 	  }
 	}
-        leveldb::WriteOptions options;
-        options.sync = syncmode ? true : false;
+    leveldb::WriteOptions options;
+    options.sync = sync_;
 	leveldb::Status status = itr->second->Put(options, key, value);
-        if (!status.ok()) {
-            return ResponseCode::Error;
-        }
-        return ResponseCode::Success;
+	TRACE_MARK(RequestTrace::ENGINE);
+    if (!status.ok()) {
+        return ResponseCode::Error;
+    }
+    return ResponseCode::Success;
+}
+
+ResponseCode::type LevelDbServer::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    return patch(mapName, key, -1, data);
+}
+
+ResponseCode::type LevelDbServer::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset, const std::string& data)
+{
+    if (offset < 0) {
+        return ResponseCode::Error;
+    }
+    return patch(mapName, key, offset, data);
+}
+
+ResponseCode::type LevelDbServer::
+putChunk(const std::string& mapName, const std::string& key, const int64_t offset, const std::string& data, const bool last)
+{
+    return ResponseCode::Error;
+}
+
+ResponseCode::type LevelDbServer::
+remove(const std::string& mapName, const std::string& key)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    leveldb::WriteOptions options;
+    options.sync = false;
+    leveldb::Status status = itr->second->Delete(options, key);
+    TRACE_MARK(RequestTrace::ENGINE);
+    if (status.IsNotFound()) {
+        return ResponseCode::RecordNotFound;
+    } else if (!status.ok()) {
+        return ResponseCode::Error;
     }
+    return ResponseCode::Success;
+}
 
-    ResponseCode::type remove(const std::string& mapName, const std::string& key) {
-        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
-        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+void LevelDbServer::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName, const std::vector<std::string>& keys)
+{
+    _return.resize(keys.size());
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    for (size_t i = 0; i < keys.size(); i++) {
         if (itr == maps_.end()) {
-            return ResponseCode::MapNotFound;
+            _return[i].responseCode = ResponseCode::MapNotFound;
+            continue;
         }
-        leveldb::WriteOptions options;
-        options.sync = false;
-        leveldb::Status status = itr->second->Delete(options, key);
+        leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), keys[i], &(_return[i].value));
+        TRACE_MARK(RequestTrace::ENGINE);
         if (status.IsNotFound()) {
-            return ResponseCode::RecordNotFound;
+            _return[i].responseCode = ResponseCode::RecordNotFound;
         } else if (!status.ok()) {
-            return ResponseCode::Error;
+            _return[i].responseCode = ResponseCode::Error;
+        } else {
+            _return[i].responseCode = ResponseCode::Success;
+        }
+    }
+}
+
+void LevelDbServer::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        _return.assign(records.size(), ResponseCode::MapNotFound);
+        return;
+    }
+
+    // puts don't depend on the existing records, so the whole batch
+    // goes in with a single write.
+    leveldb::WriteBatch batch;
+    for (std::vector<Record>::const_iterator record = records.begin(); record != records.end(); record++) {
+        batch.Put(record->key, record->value);
+    }
+    leveldb::WriteOptions options;
+    options.sync = sync_;
+    leveldb::Status status = itr->second->Write(options, &batch);
+    TRACE_MARK(RequestTrace::ENGINE);
+    _return.assign(records.size(), status.ok() ? ResponseCode::Success : ResponseCode::Error);
+}
+
+void LevelDbServer::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records)
+{
+    _return.clear();
+    for (std::vector<Record>::const_iterator record = records.begin(); record != records.end(); record++) {
+        _return.push_back(insert(mapName, record->key, record->value));
+    }
+}
+
+void LevelDbServer::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records)
+{
+    _return.clear();
+    for (std::vector<Record>::const_iterator record = records.begin(); record != records.end(); record++) {
+        _return.push_back(update(mapName, record->key, record->value));
+    }
+}
+
+void LevelDbServer::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<std::string>& keys)
+{
+    _return.clear();
+    for (std::vector<std::string>::const_iterator key = keys.begin(); key != keys.end(); key++) {
+        _return.push_back(remove(mapName, *key));
+    }
+}
+
+void LevelDbServer::
+getStats(StatsResponse& _return)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    for (boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.begin(); itr != maps_.end(); itr++) {
+        std::string prefix = "leveldb." + itr->first;
+        std::string value;
+        if (itr->second->GetProperty("leveldb.stats", &value)) {
+            _return.properties[prefix + ".stats"] = value;
+        }
+        if (itr->second->GetProperty("leveldb.sstables", &value)) {
+            _return.properties[prefix + ".sstables"] = value;
+        }
+    }
+    _return.counters["leveldb.maps"] = maps_.size();
+    _return.responseCode = ResponseCode::Success;
+}
+
+void LevelDbServer::
+getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+                  const std::string& startKey, const std::string& endKey, const int32_t numSplits)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    leveldb::DB* db = itr->second;
+    boost::scoped_ptr<leveldb::Iterator> dbItr(db->NewIterator(leveldb::ReadOptions()));
+    SplitKeySampler sampler(numSplits);
+    for (dbItr->Seek(startKey); inRange(dbItr.get(), endKey) &&
+         sampler.size() < EXACT_SPLIT_RECORDS; dbItr->Next()) {
+        sampler.add(dbItr->key().ToString(), dbItr->key().size() + dbItr->value().size());
+    }
+    if (inRange(dbItr.get(), endKey)) {
+        boost::scoped_ptr<leveldb::Iterator> lastItr(db->NewIterator(leveldb::ReadOptions()));
+        if (endKey.empty()) {
+            lastItr->SeekToLast();
+        } else {
+            lastItr->Seek(endKey);
+            if (!lastItr->Valid()) {
+                lastItr->SeekToLast();
+            } else if (lastItr->key().compare(endKey) > 0) {
+                lastItr->Prev();
+            }
+        }
+        std::string firstKey = sampler.firstKey();
+        std::string lastKey = lastItr->key().ToString();
+        uint64_t total = approximateSize(db, firstKey, lastKey + '\0');
+        if (total > 0) {
+            bisectSplitKeys(firstKey, lastKey, numSplits,
+                            boost::bind(&LevelDbServer::position, db, firstKey, total, _1),
+                            _return.values);
+            TRACE_MARK(RequestTrace::ENGINE);
+            _return.responseCode = ResponseCode::Success;
+            return;
+        }
+        // the range is all in the memtable, which has no size
+        // estimates, so keep reading.
+        for (; inRange(dbItr.get(), endKey); dbItr->Next()) {
+            sampler.add(dbItr->key().ToString(), dbItr->key().size() + dbItr->value().size());
+        }
+    }
+    sampler.getSplitKeys(_return.values);
+    TRACE_MARK(RequestTrace::ENGINE);
+    _return.responseCode = ResponseCode::Success;
+}
+
+void LevelDbServer::
+estimateCount(EstimateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, mapName, startKey, endKey, exact, true);
+}
+
+void LevelDbServer::
+estimateSize(EstimateResponse& _return, const std::string& mapName,
+                  const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, mapName, startKey, endKey, exact, false);
+}
+
+void LevelDbServer::
+estimate(EstimateResponse& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey, bool exact, bool count)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    leveldb::DB* db = itr->second;
+    boost::scoped_ptr<leveldb::Iterator> dbItr(db->NewIterator(leveldb::ReadOptions()));
+    uint64_t numRecords = 0;
+    uint64_t bytes = 0;
+    bool keysOnly = exact && count;
+    dbItr->Seek(startKey);
+    for (; beforeEnd(dbItr.get(), endKey) && (exact || numRecords < ESTIMATE_SAMPLE_RECORDS); dbItr->Next()) {
+        numRecords++;
+        bytes += dbItr->key().size() + (keysOnly ? 0 : dbItr->value().size());
+    }
+    _return.exact = true;
+    if (beforeEnd(dbItr.get(), endKey)) {
+        std::string limit = endKey;
+        if (limit.empty()) {
+            boost::scoped_ptr<leveldb::Iterator> lastItr(db->NewIterator(leveldb::ReadOptions()));
+            lastItr->SeekToLast();
+            limit = lastItr->key().ToString() + '\0';
+        }
+        uint64_t size = approximateSize(db, startKey, limit);
+        if (size > 0) {
+            numRecords = size * numRecords / bytes;
+            bytes = size;
+            _return.exact = false;
+        } else {
+            for (; beforeEnd(dbItr.get(), endKey); dbItr->Next()) {
+                numRecords++;
+                bytes += dbItr->key().size() + dbItr->value().size();
+            }
         }
-        return ResponseCode::Success;
-    }
-
-private:
-    std::string directoryName_; // directory to store db files.
-    boost::ptr_map<std::string, leveldb::DB> maps_;
-    boost::shared_mutex mutex_; // protect map_
-};
-
-int main(int argc, char **argv) {
-    if(argc != 4) { printf("Usage: %s <sync:0 or 1> <blindinsert:0 or 1> <blindupdate:0 or 1>\n", argv[0]); }
-    syncmode    = atoi(argv[1]);
-    blindinsert = atoi(argv[2]);
-    blindupdate = atoi(argv[3]);
-    int port = 9090;
-    shared_ptr<LevelDbServer> handler(new LevelDbServer("data"));
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server (processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
-    return 0;
+    }
+    _return.value = count ? numRecords : bytes;
+    TRACE_MARK(RequestTrace::ENGINE);
+    _return.responseCode = ResponseCode::Success;
+}
+
+ResponseCode::type LevelDbServer::
+patch(const std::string& mapName, const std::string& key, int64_t offset, const std::string& data)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    TRACE_MARK(RequestTrace::LOCK);
+    boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    boost::mutex::scoped_lock patchLock(patchMutexes_[boost::hash<std::string>()(key) % NUM_PATCH_MUTEXES]);
+    std::string value;
+    leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &value);
+    if (status.IsNotFound()) {
+        return ResponseCode::RecordNotFound;
+    } else if (!status.ok()) {
+        return ResponseCode::Error;
+    }
+    if (!patchValue(value, offset < 0 ? value.size() : offset, data)) {
+        return ResponseCode::Error;
+    }
+    leveldb::WriteOptions options;
+    options.sync = sync_;
+    status = itr->second->Put(options, key, value);
+    TRACE_MARK(RequestTrace::ENGINE);
+    if (!status.ok()) {
+        return ResponseCode::Error;
+    }
+    return ResponseCode::Success;
+}
+
+bool LevelDbServer::
+beforeEnd(leveldb::Iterator* itr, const std::string& endKey)
+{
+    return itr->Valid() && (endKey.empty() || itr->key().compare(endKey) < 0);
+}
+
+bool LevelDbServer::
+inRange(leveldb::Iterator* itr, const std::string& endKey)
+{
+    return itr->Valid() && (endKey.empty() || itr->key().compare(endKey) <= 0);
+}
+
+uint64_t LevelDbServer::
+approximateSize(leveldb::DB* db, const std::string& start, const std::string& limit)
+{
+    leveldb::Range range(start, limit);
+    uint64_t size = 0;
+    db->GetApproximateSizes(&range, 1, &size);
+    return size;
+}
+
+double LevelDbServer::
+position(leveldb::DB* db, const std::string& firstKey, uint64_t total,
+                       const std::string& key)
+{
+    return std::min(1.0, (double)approximateSize(db, firstKey, key) / total);
 }
@@ -0,0 +1,144 @@
+/**
+ * This is a implementation of the mapkeeper interface that uses 
+ * leveldb.
+ *
+ * http://leveldb.googlecode.com/svn/trunk/doc/index.html
+ */
+#ifndef LEVELDB_SERVER_H
+#define LEVELDB_SERVER_H
+
+#include <string>
+#include "MapKeeper.h"
+#include "ScanFilter.h"
+#include "ScanSink.h"
+#include <leveldb/db.h>
+#include <boost/ptr_container/ptr_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+class LevelDbServer: virtual public mapkeeper::MapKeeperIf {
+public:
+    /**
+     * sync makes every write wait for the disk. blindInsert and
+     * blindUpdate skip the existence check before writing.
+     */
+    LevelDbServer(const std::string& directoryName, bool sync = false,
+                  bool blindInsert = false, bool blindUpdate = false);
+
+    mapkeeper::ResponseCode::type ping();
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName);
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName);
+    void listMaps(mapkeeper::StringListResponse& _return);
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName, const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes);
+
+    /**
+     * Keys-only scans never touch the values. leveldb still reads them
+     * from disk with the keys, but doesn't copy them, and filters look
+     * at the iterator's key and value in place.
+     */
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName, const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes, const mapkeeper::ScanOptions& options);
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName, const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes, const mapkeeper::ScanOptions& options);
+    void scanInto(ScanSink& sink, const std::string& mapName, const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes, const mapkeeper::ScanOptions& options);
+    void scanAscending(ScanSink& sink, leveldb::Iterator* itr,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes, const mapkeeper::ScanOptions& options,
+              ScanFilter& filter);
+    void scanDescending(ScanSink& sink, leveldb::Iterator* itr,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes, const mapkeeper::ScanOptions& options,
+              ScanFilter& filter);
+    void addRecord(ScanSink& sink, leveldb::Iterator* itr, const mapkeeper::ScanOptions& options);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+
+    /**
+     * LevelDB has no partial reads, so this reads the whole value; with
+     * ChunkingHandler, that's at most a chunk.
+     */
+    void getRange(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key, const int64_t offset, const int32_t length);
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+
+    /**
+     * leveldb has no merge operator, so appends and partial writes read
+     * the value and put it back, here rather than in the client.
+     */
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key, const int64_t offset, const std::string& data);
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key, const int64_t offset, const std::string& data, const bool last);
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName, const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, const std::vector<std::string>& keys);
+    void getStats(mapkeeper::StatsResponse& _return);
+
+    /**
+     * Ranges of up to EXACT_SPLIT_RECORDS records are read and split
+     * exactly. Larger ones are split by bisecting GetApproximateSizes(),
+     * which leveldb answers from the index blocks of the sstables without
+     * reading any data.
+     */
+    void getSplitKeys(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const int32_t numSplits);
+    void estimateCount(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                       const std::string& startKey, const std::string& endKey, const bool exact);
+    void estimateSize(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const bool exact);
+
+private:
+    // approximate estimates read this many records to find the average
+    // record size, and answer exactly if the range is no bigger.
+    static const uint64_t ESTIMATE_SAMPLE_RECORDS = 1000;
+
+    /**
+     * The approximate size is GetApproximateSizes() of the range, which
+     * only covers the sstables. If it's 0, the range is all in the
+     * memtable, which is small enough to read. The approximate count is
+     * the size over the average size of the first records.
+     *
+     * Exact counts never look at the values, although leveldb reads
+     * them from disk along with the keys.
+     */
+    void estimate(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                  const std::string& startKey, const std::string& endKey, bool exact, bool count);
+
+    static const uint32_t NUM_PATCH_MUTEXES = 64;
+
+    /**
+     * Writes data at offset, or at the end of the value if offset is
+     * negative. Patches of the same key are serialized, but like
+     * update(), they can lose a concurrent put.
+     */
+    mapkeeper::ResponseCode::type patch(const std::string& mapName, const std::string& key, int64_t offset, const std::string& data);
+    static bool beforeEnd(leveldb::Iterator* itr, const std::string& endKey);
+    static bool inRange(leveldb::Iterator* itr, const std::string& endKey);
+    static uint64_t approximateSize(leveldb::DB* db, const std::string& start, const std::string& limit);
+    static double position(leveldb::DB* db, const std::string& firstKey, uint64_t total,
+                           const std::string& key);
+
+    std::string directoryName_; // directory to store db files.
+    bool sync_;
+    bool blindInsert_;
+    bool blindUpdate_;
+    boost::ptr_map<std::string, leveldb::DB> maps_;
+    boost::shared_mutex mutex_; // protect map_
+    boost::mutex patchMutexes_[NUM_PATCH_MUTEXES]; // serialize patches of a key
+};
+
+#endif // LEVELDB_SERVER_H
@@ -0,0 +1,30 @@
+/**
+ * Runs LevelDbServer behind a Thrift server.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "LevelDbServer.h"
+#include "HandlerChain.h"
+#include "ServerRuntime.h"
+
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+
+
+using namespace ::apache::thrift;
+using namespace ::apache::thrift::protocol;
+using namespace ::apache::thrift::transport;
+using namespace ::apache::thrift::concurrency;
+
+using boost::shared_ptr;
+
+int main(int argc, char **argv) {
+    ServerOptions options;
+    options.parse(argc, argv);
+    if(argc != 4) { printf("Usage: %s <sync:0 or 1> <blindinsert:0 or 1> <blindupdate:0 or 1>\n", argv[0]); }
+    shared_ptr<LevelDbServer> handler(new LevelDbServer("data", atoi(argv[1]) != 0,
+                                                        atoi(argv[2]) != 0, atoi(argv[3]) != 0));
+    shared_ptr<TProcessor> processor(buildProcessor(handler, options));
+    runServer(processor, options);
+    return 0;
+}
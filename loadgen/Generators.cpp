@@ -0,0 +1,141 @@
+#include <cmath>
+#include "Generators.h"
+
+uint64_t 
+fnvHash64(uint64_t value)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < 8; i++) {
+        hash ^= value & 0xff;
+        hash *= 1099511628211ULL;
+        value >>= 8;
+    }
+
+    // YCSB computes this with signed longs and takes the absolute value.
+    return (int64_t)hash < 0 ? 0 - hash : hash;
+}
+
+Random::
+Random(uint64_t seed) :
+    state_(seed ? seed : 0x9E3779B97F4A7C15ULL)
+{
+}
+
+uint64_t Random::
+next()
+{
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 2685821657736338717ULL;
+}
+
+double Random::
+nextDouble()
+{
+    return (next() >> 11) * (1.0 / (1ULL << 53));
+}
+
+uint64_t Random::
+nextInt(uint64_t bound)
+{
+    return bound == 0 ? 0 : next() % bound;
+}
+
+const double ZipfianGenerator::ZIPFIAN_CONSTANT = 0.99;
+
+ZipfianGenerator::
+ZipfianGenerator(uint64_t items, double theta) :
+    theta_(theta)
+{
+    init(items, zeta(0, items, theta, 0));
+}
+
+ZipfianGenerator::
+ZipfianGenerator(uint64_t items, double theta, double zetan) :
+    theta_(theta)
+{
+    init(items, zetan);
+}
+
+void ZipfianGenerator::
+init(uint64_t items, double zetan)
+{
+    items_ = items;
+    zeta2Theta_ = zeta(0, 2, theta_, 0);
+    alpha_ = 1.0 / (1.0 - theta_);
+    zetan_ = zetan;
+    eta_ = (1 - pow(2.0 / items_, 1 - theta_)) / (1 - zeta2Theta_ / zetan_);
+}
+
+double ZipfianGenerator::
+zeta(uint64_t start, uint64_t end, double theta, double initialSum)
+{
+    double sum = initialSum;
+    for (uint64_t i = start; i < end; i++) {
+        sum += 1 / pow(i + 1, theta);
+    }
+    return sum;
+}
+
+uint64_t ZipfianGenerator::
+next(Random& random)
+{
+    return next(random, items_);
+}
+
+uint64_t ZipfianGenerator::
+next(Random& random, uint64_t items)
+{
+    if (items > items_) {
+        // the item count only grows, so extend the sum instead of 
+        // recomputing it from scratch.
+        zetan_ = zeta(items_, items, theta_, zetan_);
+        items_ = items;
+        eta_ = (1 - pow(2.0 / items_, 1 - theta_)) / (1 - zeta2Theta_ / zetan_);
+    }
+    double u = random.nextDouble();
+    double uz = u * zetan_;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, theta_)) {
+        return 1;
+    }
+    uint64_t ret = (uint64_t)(items_ * pow(eta_ * u - eta_ + 1, alpha_));
+    return ret < items_ ? ret : items_ - 1;
+}
+
+namespace {
+
+// same constants as YCSB's ScrambledZipfianGenerator: draw from a huge
+// zipfian (whose zeta is precomputed) and hash into the item range.
+const uint64_t SCRAMBLED_ITEM_COUNT = 10000000000ULL;
+const double SCRAMBLED_ZETAN = 26.46902820178302;
+
+}
+
+ScrambledZipfianGenerator::
+ScrambledZipfianGenerator(uint64_t items) :
+    items_(items),
+    zipfian_(SCRAMBLED_ITEM_COUNT, ZipfianGenerator::ZIPFIAN_CONSTANT, SCRAMBLED_ZETAN)
+{
+}
+
+uint64_t ScrambledZipfianGenerator::
+next(Random& random)
+{
+    return fnvHash64(zipfian_.next(random)) % items_;
+}
+
+SkewedLatestGenerator::
+SkewedLatestGenerator(uint64_t items) :
+    zipfian_(items)
+{
+}
+
+uint64_t SkewedLatestGenerator::
+next(Random& random, uint64_t items)
+{
+    return items - 1 - zipfian_.next(random, items);
+}
@@ -0,0 +1,106 @@
+#ifndef GENERATORS_H
+#define GENERATORS_H
+
+#include <stdint.h>
+
+/**
+ * Random number and key generators for the load generator. They follow
+ * the definitions in YCSB's CoreWorkload so that results are comparable
+ * with the Java driver.
+ *
+ * None of these classes are thread-safe; each worker thread owns its own
+ * generators.
+ */
+
+/**
+ * YCSB's 64-bit FNV hash, used to scatter sequential key numbers.
+ */
+uint64_t fnvHash64(uint64_t value);
+
+/**
+ * xorshift64* generator. Much cheaper than rand_r() and good enough
+ * for picking keys and operations.
+ */
+class Random {
+public:
+    Random(uint64_t seed);
+    uint64_t next();
+
+    /**
+     * Returns a number in [0, 1).
+     */
+    double nextDouble();
+
+    /**
+     * Returns a number in [0, bound).
+     */
+    uint64_t nextInt(uint64_t bound);
+
+private:
+    uint64_t state_;
+};
+
+/**
+ * Zipfian distribution over [base, base + items) with the most popular
+ * item first, using the algorithm from Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases". The number of items may grow
+ * between calls; zeta is then updated incrementally.
+ */
+class ZipfianGenerator {
+public:
+    static const double ZIPFIAN_CONSTANT;
+
+    ZipfianGenerator(uint64_t items, double theta = ZIPFIAN_CONSTANT);
+
+    /**
+     * Same as above, but with a precomputed zeta(items, theta) for item
+     * counts that are too large to compute it.
+     */
+    ZipfianGenerator(uint64_t items, double theta, double zetan);
+
+    uint64_t next(Random& random);
+    uint64_t next(Random& random, uint64_t items);
+
+private:
+    static double zeta(uint64_t start, uint64_t end, double theta, double initialSum);
+    void init(uint64_t items, double zetan);
+
+    uint64_t items_;
+    double theta_;
+    double zeta2Theta_;
+    double alpha_;
+    double zetan_;
+    double eta_;
+};
+
+/**
+ * Zipfian popularity, but with popular items scattered across the key
+ * space instead of clustered at the beginning.
+ */
+class ScrambledZipfianGenerator {
+public:
+    ScrambledZipfianGenerator(uint64_t items);
+    uint64_t next(Random& random);
+
+private:
+    uint64_t items_;
+    ZipfianGenerator zipfian_;
+};
+
+/**
+ * Zipfian distribution favoring the most recently inserted items.
+ */
+class SkewedLatestGenerator {
+public:
+    SkewedLatestGenerator(uint64_t items);
+
+    /**
+     * @param items current number of items.
+     */
+    uint64_t next(Random& random, uint64_t items);
+
+private:
+    ZipfianGenerator zipfian_;
+};
+
+#endif // GENERATORS_H
@@ -0,0 +1,646 @@
+/**
+ * A load generator for MapKeeper servers.
+ *
+ * It reads YCSB workload files and talks to the server through the
+ * generated C++ client, so it can push a lot more load per client
+ * machine than the Java driver. Each thread owns one connection.
+ *
+ * Without -target, every thread issues its next request as soon as the
+ * previous one returns (closed loop). With -target, requests are issued
+ * on a fixed schedule (open loop) and latency is measured from the time
+ * a request was supposed to be sent, so a stalled server shows up in the
+ * latency numbers instead of silently lowering the request rate.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/resource.h>
+#include <string>
+#include <vector>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include "MapKeeper.h"
+#include "Histogram.h"
+#include "Generators.h"
+#include "Workload.h"
+#include <protocol/TBinaryProtocol.h>
+#include <protocol/TCompactProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TBufferTransports.h>
+
+using namespace ::apache::thrift;
+using namespace ::apache::thrift::protocol;
+using namespace ::apache::thrift::transport;
+
+using boost::shared_ptr;
+
+using namespace mapkeeper;
+
+namespace {
+
+enum Operation {
+    READ,
+    UPDATE,
+    INSERT,
+    SCAN,
+    READ_MODIFY_WRITE,
+    NUM_OPERATIONS
+};
+
+const char* OPERATION_NAMES[NUM_OPERATIONS] = {
+    "READ",
+    "UPDATE",
+    "INSERT",
+    "SCAN",
+    "READ-MODIFY-WRITE",
+};
+
+// latencies are recorded in microseconds, up to a minute.
+const int64_t MAX_LATENCY_US = 60 * 1000 * 1000;
+const int LATENCY_SIGNIFICANT_DIGITS = 3;
+
+struct Options {
+    Options() :
+        host("localhost"),
+        port(9090),
+        numThreads(1),
+        targetOpsPerSec(0),
+        load(false),
+        durationSec(0),
+        statusIntervalSec(0),
+        format("text"),
+        protocol("binary"),
+        transport("framed") {}
+
+    std::string host;
+    int port;
+    uint32_t numThreads;
+    double targetOpsPerSec;
+    bool load;
+    uint32_t durationSec;
+    uint32_t statusIntervalSec;
+    std::string format;
+    std::string protocol;
+    std::string transport;
+    Properties properties;
+};
+
+/**
+ * State shared by all the worker threads.
+ */
+struct Shared {
+    Shared(const Workload& workload) :
+        workload(workload),
+        nextLoad(workload.insertStart),
+        nextInsert(workload.insertStart + workload.recordCount),
+        stop(false) {}
+
+    const Workload& workload;
+    uint64_t nextLoad;   // key number of the next insert in the load phase
+    uint64_t nextInsert; // key number of the next insert in the run phase
+    volatile bool stop;
+};
+
+uint64_t 
+nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void 
+sleepUntilNs(uint64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+/**
+ * Creates a client protocol over the transport selected in options.
+ * The transport is not opened.
+ */
+shared_ptr<TProtocol> 
+connect(const Options& options, shared_ptr<TTransport>& transport)
+{
+    shared_ptr<TSocket> socket(new TSocket(options.host, options.port));
+    if (options.transport == "buffered") {
+        transport.reset(new TBufferedTransport(socket));
+    } else {
+        transport.reset(new TFramedTransport(socket));
+    }
+    if (options.protocol == "compact") {
+        return shared_ptr<TProtocol>(new TCompactProtocol(transport));
+    }
+    return shared_ptr<TProtocol>(new TBinaryProtocol(transport));
+}
+
+class Worker {
+public:
+    Worker(uint32_t id, const Options& options, Shared& shared, 
+           uint64_t numOps, boost::barrier& barrier) :
+        id_(id),
+        options_(options),
+        shared_(shared),
+        workload_(shared.workload),
+        numOps_(numOps),
+        barrier_(barrier),
+        random_(nowNs() ^ ((uint64_t)(id + 1) << 32)),
+        numDone_(0),
+        startNs_(0),
+        endNs_(0)
+    {
+        memset(errors_, 0, sizeof(errors_));
+        if (workload_.requestDistribution == Workload::ZIPFIAN) {
+            zipfian_.reset(new ScrambledZipfianGenerator(workload_.recordCount));
+        } else if (workload_.requestDistribution == Workload::LATEST) {
+            latest_.reset(new SkewedLatestGenerator(workload_.recordCount));
+        }
+        if (workload_.scanLengthDistribution == Workload::ZIPFIAN) {
+            scanLength_.reset(new ZipfianGenerator(workload_.maxScanLength));
+        }
+        value_.resize(workload_.valueSize);
+        for (size_t i = 0; i < value_.size(); i++) {
+            value_[i] = 'a' + random_.nextInt(26);
+        }
+    }
+
+    void run()
+    {
+        shared_ptr<TProtocol> protocol = connect(options_, transport_);
+        client_.reset(new MapKeeperClient(protocol));
+        try {
+            transport_->open();
+        } catch (const TException& e) {
+            fprintf(stderr, "thread %u failed to connect: %s\n", id_, e.what());
+            exit(1);
+        }
+
+        barrier_.wait();
+        uint64_t intervalNs = 0;
+        if (options_.targetOpsPerSec > 0) {
+            intervalNs = (uint64_t)(1e9 * options_.numThreads / options_.targetOpsPerSec);
+        }
+
+        // stagger the threads so that their requests don't arrive in bursts.
+        startNs_ = nowNs() + intervalNs * id_ / options_.numThreads;
+        for (uint64_t i = 0; !shared_.stop && (numOps_ == 0 || i < numOps_); i++) {
+            uint64_t intendedNs = startNs_ + i * intervalNs;
+            if (intervalNs > 0) {
+                sleepUntilNs(intendedNs);
+            } else {
+                intendedNs = nowNs();
+            }
+            Operation operation = options_.load ? INSERT : chooseOperation();
+            bool success = execute(operation);
+            if (!success && options_.load && shared_.stop) {
+                break;
+            }
+            uint64_t latencyUs = (nowNs() - intendedNs) / 1000;
+            if (!histograms_[operation]) {
+                histograms_[operation].reset(
+                    new Histogram(MAX_LATENCY_US, LATENCY_SIGNIFICANT_DIGITS));
+            }
+            histograms_[operation]->record(latencyUs);
+            if (!success) {
+                errors_[operation]++;
+            }
+            numDone_ = i + 1;
+        }
+        endNs_ = nowNs();
+        transport_->close();
+    }
+
+    uint64_t getNumDone() const
+    {
+        return numDone_;
+    }
+
+    uint64_t getStartNs() const
+    {
+        return startNs_;
+    }
+
+    uint64_t getEndNs() const
+    {
+        return endNs_;
+    }
+
+    const Histogram* getHistogram(Operation operation) const
+    {
+        return histograms_[operation].get();
+    }
+
+    uint64_t getErrors(Operation operation) const
+    {
+        return errors_[operation];
+    }
+
+private:
+    Operation chooseOperation()
+    {
+        double r = random_.nextDouble() * (workload_.readProportion + 
+            workload_.updateProportion + workload_.insertProportion + 
+            workload_.scanProportion + workload_.readModifyWriteProportion);
+        if ((r -= workload_.readProportion) < 0) {
+            return READ;
+        } else if ((r -= workload_.updateProportion) < 0) {
+            return UPDATE;
+        } else if ((r -= workload_.insertProportion) < 0) {
+            return INSERT;
+        } else if ((r -= workload_.scanProportion) < 0) {
+            return SCAN;
+        }
+        return READ_MODIFY_WRITE;
+    }
+
+    /**
+     * Picks an existing key according to the request distribution.
+     */
+    uint64_t chooseKey()
+    {
+        uint64_t numInserted = shared_.nextInsert - workload_.insertStart;
+        switch (workload_.requestDistribution) {
+        case Workload::ZIPFIAN:
+            return workload_.insertStart + zipfian_->next(random_);
+        case Workload::LATEST:
+            return workload_.insertStart + latest_->next(random_, numInserted);
+        default:
+            return workload_.insertStart + random_.nextInt(numInserted);
+        }
+    }
+
+    void buildKey(uint64_t keyNumber)
+    {
+        if (!workload_.orderedInserts) {
+            keyNumber = fnvHash64(keyNumber);
+        }
+        char buffer[32];
+        int length = snprintf(buffer, sizeof(buffer), "user%lu", keyNumber);
+        key_.assign(buffer, length);
+    }
+
+    /**
+     * Changes the first few bytes of the value so that consecutive
+     * writes don't store identical values.
+     */
+    void touchValue()
+    {
+        uint64_t bits = random_.next();
+        for (size_t i = 0; i < sizeof(bits) && i < value_.size(); i++) {
+            value_[i] = 'a' + (bits >> (8 * i)) % 26;
+        }
+    }
+
+    bool execute(Operation operation)
+    {
+        try {
+            switch (operation) {
+            case READ:
+                buildKey(chooseKey());
+                client_->get(getResponse_, workload_.table, key_);
+                return getResponse_.responseCode == ResponseCode::Success;
+            case UPDATE:
+                buildKey(chooseKey());
+                touchValue();
+                return client_->update(workload_.table, key_, value_) == ResponseCode::Success;
+            case INSERT:
+                return executeInsert();
+            case SCAN:
+                return executeScan();
+            case READ_MODIFY_WRITE:
+                buildKey(chooseKey());
+                client_->get(getResponse_, workload_.table, key_);
+                if (getResponse_.responseCode != ResponseCode::Success) {
+                    return false;
+                }
+                touchValue();
+                return client_->update(workload_.table, key_, value_) == ResponseCode::Success;
+            default:
+                return false;
+            }
+        } catch (const TException& e) {
+            reconnect();
+            return false;
+        }
+    }
+
+    bool executeInsert()
+    {
+        uint64_t keyNumber;
+        if (options_.load) {
+            // the load phase inserts [insertStart, insertStart + recordCount).
+            keyNumber = __sync_fetch_and_add(&shared_.nextLoad, 1);
+            if (keyNumber >= workload_.insertStart + workload_.recordCount) {
+                shared_.stop = true;
+                return false;
+            }
+        } else {
+            keyNumber = __sync_fetch_and_add(&shared_.nextInsert, 1);
+        }
+        buildKey(keyNumber);
+        touchValue();
+        return client_->insert(workload_.table, key_, value_) == ResponseCode::Success;
+    }
+
+    bool executeScan()
+    {
+        buildKey(chooseKey());
+        uint32_t length;
+        if (scanLength_) {
+            length = scanLength_->next(random_) + 1;
+        } else {
+            length = random_.nextInt(workload_.maxScanLength) + 1;
+        }
+        client_->scan(scanResponse_, workload_.table, ScanOrder::Ascending, 
+                      key_, true, "", true, length, 0);
+        return scanResponse_.responseCode == ResponseCode::Success ||
+               scanResponse_.responseCode == ResponseCode::ScanEnded;
+    }
+
+    void reconnect()
+    {
+        try {
+            transport_->close();
+            transport_->open();
+        } catch (const TException& e) {
+            // keep going; the next request fails and retries.
+        }
+    }
+
+    uint32_t id_;
+    const Options& options_;
+    Shared& shared_;
+    const Workload& workload_;
+    uint64_t numOps_;
+    boost::barrier& barrier_;
+    Random random_;
+    boost::scoped_ptr<ScrambledZipfianGenerator> zipfian_;
+    boost::scoped_ptr<SkewedLatestGenerator> latest_;
+    boost::scoped_ptr<ZipfianGenerator> scanLength_;
+    shared_ptr<TTransport> transport_;
+    boost::scoped_ptr<MapKeeperClient> client_;
+    std::string key_;
+    std::string value_;
+    BinaryResponse getResponse_;
+    RecordListResponse scanResponse_;
+    boost::scoped_ptr<Histogram> histograms_[NUM_OPERATIONS];
+    uint64_t errors_[NUM_OPERATIONS];
+    volatile uint64_t numDone_;
+    uint64_t startNs_;
+    volatile uint64_t endNs_;
+};
+
+void 
+usage(const char* program)
+{
+    fprintf(stderr, 
+        "Usage: %s [options]\n"
+        "  -P <file>          YCSB workload file (may be repeated)\n"
+        "  -p <name=value>    override a workload property\n"
+        "  -load              insert recordcount records instead of running the workload\n"
+        "  -t                 run the workload (default)\n"
+        "  -threads <n>       number of threads, each with its own connection (default 1)\n"
+        "  -target <ops/sec>  open-loop target throughput across all threads\n"
+        "                     (default: closed loop, as fast as possible)\n"
+        "  -duration <sec>    stop after this many seconds\n"
+        "  -s                 print status to stderr every 10 seconds\n"
+        "  -host <host>       server host (default localhost)\n"
+        "  -port <port>       server port (default 9090)\n"
+        "  -format <format>   text, csv or json (default text)\n"
+        "  -protocol <name>   binary or compact (default binary)\n"
+        "  -transport <name>  framed or buffered (default framed)\n",
+        program);
+    exit(1);
+}
+
+void 
+parseArgs(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-load") {
+            options.load = true;
+        } else if (arg == "-t") {
+            options.load = false;
+        } else if (arg == "-s") {
+            options.statusIntervalSec = 10;
+        } else if (arg == "-P" && hasValue) {
+            options.properties.load(argv[++i]);
+        } else if (arg == "-p" && hasValue) {
+            options.properties.set(argv[++i]);
+        } else if (arg == "-threads" && hasValue) {
+            options.numThreads = atoi(argv[++i]);
+        } else if (arg == "-target" && hasValue) {
+            options.targetOpsPerSec = atof(argv[++i]);
+        } else if (arg == "-duration" && hasValue) {
+            options.durationSec = atoi(argv[++i]);
+        } else if (arg == "-host" && hasValue) {
+            options.host = argv[++i];
+        } else if (arg == "-port" && hasValue) {
+            options.port = atoi(argv[++i]);
+        } else if (arg == "-format" && hasValue) {
+            options.format = argv[++i];
+        } else if (arg == "-protocol" && hasValue) {
+            options.protocol = argv[++i];
+        } else if (arg == "-transport" && hasValue) {
+            options.transport = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (options.numThreads == 0 || options.targetOpsPerSec < 0 ||
+        (options.format != "text" && options.format != "csv" && options.format != "json") ||
+        (options.protocol != "binary" && options.protocol != "compact") ||
+        (options.transport != "framed" && options.transport != "buffered")) {
+        usage(argv[0]);
+    }
+}
+
+void 
+printOperation(const Options& options, const char* name, const Histogram& histogram, 
+               uint64_t errors, double runtimeSec, bool first, const std::string& cpuUsPerOp)
+{
+    uint64_t count = histogram.getCount();
+    double throughput = runtimeSec > 0 ? count / runtimeSec : 0;
+    if (options.format == "csv") {
+        printf("%s,%lu,%lu,%.1f,%.1f,%ld,%ld,%ld,%ld,%ld,%ld,%s\n", 
+               name, count, errors, throughput, histogram.getMean(), histogram.getMin(),
+               histogram.getValueAtPercentile(50), histogram.getValueAtPercentile(90),
+               histogram.getValueAtPercentile(99), histogram.getValueAtPercentile(99.9),
+               histogram.getMax(), cpuUsPerOp.c_str());
+    } else if (options.format == "json") {
+        printf("%s\n    {\"operation\": \"%s\", \"count\": %lu, \"errors\": %lu, "
+               "\"throughput\": %.1f, \"mean_us\": %.1f, \"min_us\": %ld, "
+               "\"p50_us\": %ld, \"p90_us\": %ld, \"p99_us\": %ld, "
+               "\"p999_us\": %ld, \"max_us\": %ld}",
+               first ? "" : ",", name, count, errors, throughput, 
+               histogram.getMean(), histogram.getMin(),
+               histogram.getValueAtPercentile(50), histogram.getValueAtPercentile(90),
+               histogram.getValueAtPercentile(99), histogram.getValueAtPercentile(99.9),
+               histogram.getMax());
+    } else {
+        printf("[%s], Operations, %lu\n", name, count);
+        printf("[%s], Errors, %lu\n", name, errors);
+        printf("[%s], AverageLatency(us), %.1f\n", name, histogram.getMean());
+        printf("[%s], MinLatency(us), %ld\n", name, histogram.getMin());
+        printf("[%s], MaxLatency(us), %ld\n", name, histogram.getMax());
+        printf("[%s], 50thPercentileLatency(us), %ld\n", name, histogram.getValueAtPercentile(50));
+        printf("[%s], 90thPercentileLatency(us), %ld\n", name, histogram.getValueAtPercentile(90));
+        printf("[%s], 99thPercentileLatency(us), %ld\n", name, histogram.getValueAtPercentile(99));
+        printf("[%s], 99.9thPercentileLatency(us), %ld\n", name, histogram.getValueAtPercentile(99.9));
+    }
+}
+
+/**
+ * Returns user + system CPU time used by this process so far.
+ */
+double 
+getCpuSec()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void 
+printReport(const Options& options, const boost::ptr_vector<Worker>& workers, double cpuSec)
+{
+    uint64_t startNs = workers[0].getStartNs();
+    uint64_t endNs = 0;
+    uint64_t numOps = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        startNs = std::min(startNs, workers[i].getStartNs());
+        endNs = std::max(endNs, workers[i].getEndNs());
+        numOps += workers[i].getNumDone();
+    }
+    double runtimeSec = (endNs - startNs) / 1e9;
+    double throughput = runtimeSec > 0 ? numOps / runtimeSec : 0;
+    double cpuUsPerOp = numOps > 0 ? cpuSec * 1e6 / numOps : 0;
+
+    if (options.format == "csv") {
+        printf("operation,count,errors,throughput,mean_us,min_us,p50_us,p90_us,"
+               "p99_us,p999_us,max_us,client_cpu_us_per_op\n");
+    } else if (options.format == "json") {
+        printf("{\n  \"runtime_ms\": %.0f,\n  \"throughput\": %.1f,\n"
+               "  \"client_cpu_us_per_op\": %.2f,\n  \"operations\": [", 
+               runtimeSec * 1000, throughput, cpuUsPerOp);
+    } else {
+        printf("[OVERALL], RunTime(ms), %.0f\n", runtimeSec * 1000);
+        printf("[OVERALL], Throughput(ops/sec), %.1f\n", throughput);
+        printf("[OVERALL], ClientCpu(us/op), %.2f\n", cpuUsPerOp);
+    }
+
+    Histogram overall(MAX_LATENCY_US, LATENCY_SIGNIFICANT_DIGITS);
+    uint64_t overallErrors = 0;
+    bool first = true;
+    for (int op = 0; op < NUM_OPERATIONS; op++) {
+        Histogram histogram(MAX_LATENCY_US, LATENCY_SIGNIFICANT_DIGITS);
+        uint64_t errors = 0;
+        for (size_t i = 0; i < workers.size(); i++) {
+            const Histogram* workerHistogram = workers[i].getHistogram((Operation)op);
+            if (workerHistogram) {
+                histogram.add(*workerHistogram);
+            }
+            errors += workers[i].getErrors((Operation)op);
+        }
+        if (histogram.getCount() == 0) {
+            continue;
+        }
+        printOperation(options, OPERATION_NAMES[op], histogram, errors, runtimeSec, first, "");
+        overall.add(histogram);
+        overallErrors += errors;
+        first = false;
+    }
+
+    // machine-readable formats also get the latency across all operations.
+    if (options.format != "text") {
+        char cpu[32];
+        snprintf(cpu, sizeof(cpu), "%.2f", cpuUsPerOp);
+        printOperation(options, "OVERALL", overall, overallErrors, runtimeSec, first, cpu);
+    }
+    if (options.format == "json") {
+        printf("\n  ]\n}\n");
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    parseArgs(argc, argv, options);
+    Workload workload(options.properties);
+    if (workload.recordCount == 0) {
+        fprintf(stderr, "recordcount must be set\n");
+        exit(1);
+    }
+    Shared shared(workload);
+
+    if (options.load) {
+        shared_ptr<TTransport> transport;
+        MapKeeperClient client(connect(options, transport));
+        transport->open();
+        ResponseCode::type rc = client.addMap(workload.table);
+        if (rc != ResponseCode::Success && rc != ResponseCode::MapExists) {
+            fprintf(stderr, "failed to create map %s: %d\n", workload.table.c_str(), rc);
+            exit(1);
+        }
+        transport->close();
+    }
+
+    // in the load phase the threads share a key counter instead.
+    uint64_t totalOps = options.load ? 0 : workload.operationCount;
+    if (totalOps > 0 && totalOps < options.numThreads) {
+        options.numThreads = totalOps;
+    }
+    boost::barrier barrier(options.numThreads + 1);
+    boost::ptr_vector<Worker> workers;
+    boost::thread_group threads;
+    for (uint32_t i = 0; i < options.numThreads; i++) {
+        uint64_t numOps = totalOps / options.numThreads + (i < totalOps % options.numThreads);
+        workers.push_back(new Worker(i, options, shared, numOps, barrier));
+        threads.create_thread(boost::bind(&Worker::run, &workers.back()));
+    }
+    barrier.wait();
+
+    double startCpuSec = getCpuSec();
+    uint64_t startNs = nowNs();
+    uint64_t lastNs = startNs;
+    uint64_t lastOps = 0;
+    bool done = false;
+    while (!done) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        uint64_t now = nowNs();
+        if (options.durationSec > 0 && now - startNs >= options.durationSec * 1000000000ULL) {
+            shared.stop = true;
+        }
+        done = true;
+        uint64_t numOps = 0;
+        for (size_t i = 0; i < workers.size(); i++) {
+            numOps += workers[i].getNumDone();
+            if (workers[i].getEndNs() == 0) {
+                done = false;
+            }
+        }
+        if (options.statusIntervalSec > 0 && now - lastNs >= options.statusIntervalSec * 1000000000ULL) {
+            fprintf(stderr, "%lu sec: %lu operations; %.1f current ops/sec\n",
+                    (uint64_t)((now - startNs) / 1000000000ULL), numOps, 
+                    (numOps - lastOps) * 1e9 / (now - lastNs));
+            lastNs = now;
+            lastOps = numOps;
+        }
+    }
+    threads.join_all();
+    printReport(options, workers, getCpuSec() - startCpuSec);
+    return 0;
+}
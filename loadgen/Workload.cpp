@@ -0,0 +1,137 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include "Workload.h"
+
+namespace {
+
+std::string 
+trim(const std::string& str)
+{
+    size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = str.find_last_not_of(" \t\r");
+    return str.substr(begin, end - begin + 1);
+}
+
+Workload::Distribution 
+parseDistribution(const std::string& name, const std::string& value)
+{
+    if (value == "uniform") {
+        return Workload::UNIFORM;
+    } else if (value == "zipfian") {
+        return Workload::ZIPFIAN;
+    } else if (value == "latest") {
+        return Workload::LATEST;
+    }
+    fprintf(stderr, "unsupported %s: %s\n", name.c_str(), value.c_str());
+    exit(1);
+}
+
+}
+
+void Properties::
+load(const std::string& fileName)
+{
+    std::ifstream file(fileName.c_str());
+    if (!file) {
+        fprintf(stderr, "failed to open workload file %s\n", fileName.c_str());
+        exit(1);
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        set(line);
+    }
+}
+
+void Properties::
+set(const std::string& nameValue)
+{
+    size_t pos = nameValue.find('=');
+    if (pos == std::string::npos) {
+        fprintf(stderr, "invalid property: %s\n", nameValue.c_str());
+        exit(1);
+    }
+    properties_[trim(nameValue.substr(0, pos))] = trim(nameValue.substr(pos + 1));
+}
+
+std::string Properties::
+getString(const std::string& name, const std::string& defaultValue) const
+{
+    std::map<std::string, std::string>::const_iterator itr = properties_.find(name);
+    if (itr == properties_.end()) {
+        return defaultValue;
+    }
+    return itr->second;
+}
+
+int64_t Properties::
+getInt(const std::string& name, int64_t defaultValue) const
+{
+    std::map<std::string, std::string>::const_iterator itr = properties_.find(name);
+    if (itr == properties_.end()) {
+        return defaultValue;
+    }
+    char* end;
+    int64_t value = strtoll(itr->second.c_str(), &end, 10);
+    if (itr->second.empty() || *end != '\0') {
+        fprintf(stderr, "invalid integer for %s: %s\n", name.c_str(), itr->second.c_str());
+        exit(1);
+    }
+    return value;
+}
+
+double Properties::
+getDouble(const std::string& name, double defaultValue) const
+{
+    std::map<std::string, std::string>::const_iterator itr = properties_.find(name);
+    if (itr == properties_.end()) {
+        return defaultValue;
+    }
+    char* end;
+    double value = strtod(itr->second.c_str(), &end);
+    if (itr->second.empty() || *end != '\0') {
+        fprintf(stderr, "invalid number for %s: %s\n", name.c_str(), itr->second.c_str());
+        exit(1);
+    }
+    return value;
+}
+
+/**
+ * Defaults are the same as YCSB's CoreWorkload.
+ */
+Workload::
+Workload(const Properties& properties) :
+    table(properties.getString("table", "usertable")),
+    recordCount(properties.getInt("recordcount", 0)),
+    operationCount(properties.getInt("operationcount", 0)),
+    insertStart(properties.getInt("insertstart", 0)),
+    valueSize(properties.getInt("fieldcount", 10) * properties.getInt("fieldlength", 100)),
+    orderedInserts(properties.getString("insertorder", "hashed") == "ordered"),
+    readProportion(properties.getDouble("readproportion", 0.95)),
+    updateProportion(properties.getDouble("updateproportion", 0.05)),
+    insertProportion(properties.getDouble("insertproportion", 0)),
+    scanProportion(properties.getDouble("scanproportion", 0)),
+    readModifyWriteProportion(properties.getDouble("readmodifywriteproportion", 0)),
+    requestDistribution(parseDistribution("requestdistribution", 
+        properties.getString("requestdistribution", "uniform"))),
+    maxScanLength(properties.getInt("maxscanlength", 1000)),
+    scanLengthDistribution(parseDistribution("scanlengthdistribution", 
+        properties.getString("scanlengthdistribution", "uniform")))
+{
+    if (scanLengthDistribution == LATEST) {
+        fprintf(stderr, "unsupported scanlengthdistribution: latest\n");
+        exit(1);
+    }
+    if (readProportion + updateProportion + insertProportion + 
+        scanProportion + readModifyWriteProportion <= 0) {
+        fprintf(stderr, "all operation proportions are zero\n");
+        exit(1);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <map>
+#include <string>
+#include <stdint.h>
+
+/**
+ * Key/value properties in the format of YCSB workload files:
+ *
+ *   # comment
+ *   name=value
+ */
+class Properties {
+public:
+    /**
+     * Loads properties from a file, overriding existing ones. Exits on
+     * error.
+     */
+    void load(const std::string& fileName);
+
+    /**
+     * Parses a single "name=value" string, as given to -p.
+     */
+    void set(const std::string& nameValue);
+
+    std::string getString(const std::string& name, const std::string& defaultValue) const;
+    int64_t getInt(const std::string& name, int64_t defaultValue) const;
+    double getDouble(const std::string& name, double defaultValue) const;
+
+private:
+    std::map<std::string, std::string> properties_;
+};
+
+/**
+ * The subset of YCSB's CoreWorkload that maps to MapKeeper operations.
+ */
+struct Workload {
+    enum Distribution {
+        UNIFORM,
+        ZIPFIAN,
+        LATEST
+    };
+
+    Workload(const Properties& properties);
+
+    std::string table;
+    uint64_t recordCount;
+    uint64_t operationCount;
+    uint64_t insertStart;
+    uint32_t valueSize;
+    bool orderedInserts;
+    double readProportion;
+    double updateProportion;
+    double insertProportion;
+    double scanProportion;
+    double readModifyWriteProportion;
+    Distribution requestDistribution;
+    uint32_t maxScanLength;
+    Distribution scanLengthDistribution;
+};
+
+#endif // WORKLOAD_H
@@ -0,0 +1,48 @@
+#include <cstddef>
+#include "AllocCounter.h"
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+}
+
+namespace {
+
+__thread uint64_t numAllocations = 0;
+__thread uint64_t numBytes = 0;
+
+}
+
+extern "C" void* 
+malloc(size_t size)
+{
+    numAllocations++;
+    numBytes += size;
+    return __libc_malloc(size);
+}
+
+extern "C" void* 
+calloc(size_t num, size_t size)
+{
+    numAllocations++;
+    numBytes += num * size;
+    return __libc_calloc(num, size);
+}
+
+extern "C" void* 
+realloc(void* ptr, size_t size)
+{
+    numAllocations++;
+    numBytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+AllocCounts 
+getAllocCounts()
+{
+    AllocCounts counts;
+    counts.numAllocations = numAllocations;
+    counts.numBytes = numBytes;
+    return counts;
+}
@@ -0,0 +1,21 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stdint.h>
+
+/**
+ * Counts heap allocations made by the calling thread.
+ *
+ * Linking AllocCounter.cpp into an executable replaces malloc, calloc
+ * and realloc with versions that bump thread-local counters before
+ * calling into glibc. operator new goes through malloc, so C++
+ * allocations are counted too. Memory is not tracked on free.
+ */
+struct AllocCounts {
+    uint64_t numAllocations;
+    uint64_t numBytes;
+};
+
+AllocCounts getAllocCounts();
+
+#endif // ALLOC_COUNTER_H
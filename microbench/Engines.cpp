@@ -0,0 +1,229 @@
+#include <cstdio>
+#include <cstdlib>
+#include <boost/thread/tss.hpp>
+#include "Engines.h"
+#include "Bdb.h"
+#include "BdbIterator.h"
+#include "RecordBuffer.h"
+#include "LevelDbServer.h"
+#include "ScanSink.h"
+#include "StlMapServer.h"
+
+using namespace mapkeeper;
+
+namespace {
+
+const std::string MAP_NAME = "microbench";
+
+/**
+ * Drives Bdb and BdbIterator directly, the same way BdbServerHandler
+ * does, minus the map lookup.
+ */
+class BdbEngine : public Engine {
+public:
+    BdbEngine(const std::string& directory) :
+        env_(new DbEnv(DB_CXX_NO_EXCEPTIONS))
+    {
+        u_int32_t flags =
+            DB_THREAD         |
+            DB_CREATE         |
+            DB_READ_COMMITTED |
+            DB_INIT_TXN       |
+            DB_INIT_LOCK      |
+            DB_INIT_LOG       |
+            DB_INIT_MPOOL     ;
+        int rc = env_->log_set_config(DB_LOG_AUTO_REMOVE, 1);
+        if (rc == 0) {
+            rc = env_->open(directory.c_str(), flags, 0);
+        }
+        if (rc != 0) {
+            fprintf(stderr, "failed to open bdb environment in %s: %s\n", 
+                    directory.c_str(), db_strerror(rc));
+            exit(1);
+        }
+        if (bdb_.open(env_, MAP_NAME, 16, 100) != Bdb::Success &&
+            bdb_.create(env_, MAP_NAME, 16, 100) != Bdb::Success) {
+            fprintf(stderr, "failed to open bdb database %s\n", MAP_NAME.c_str());
+            exit(1);
+        }
+    }
+
+    ResponseCode::type get(const std::string& key, std::string& value)
+    {
+        return convertResponseCode(bdb_.get(key, value));
+    }
+
+    /**
+     * Bdb has no upsert, so this overwrites through update(). Keys that
+     * don't exist yet are inserted instead.
+     */
+    ResponseCode::type put(const std::string& key, const std::string& value)
+    {
+        Bdb::ResponseCode rc = bdb_.update(key, value);
+        if (rc == Bdb::KeyNotFound) {
+            rc = bdb_.insert(key, value);
+        }
+        return convertResponseCode(rc);
+    }
+
+    ResponseCode::type insert(const std::string& key, const std::string& value)
+    {
+        return convertResponseCode(bdb_.insert(key, value));
+    }
+
+    ResponseCode::type update(const std::string& key, const std::string& value)
+    {
+        return convertResponseCode(bdb_.update(key, value));
+    }
+
+    uint32_t scan(const std::string& startKey, uint32_t numRecords)
+    {
+        if (buffer_.get() == NULL) {
+            buffer_.reset(new RecordBuffer(1000, 100000));
+        }
+        BdbIterator itr;
+        if (itr.init(&bdb_, startKey, true, "", true, ScanOrder::Ascending) != BdbIterator::Success) {
+            return 0;
+        }
+        uint32_t numRead = 0;
+        while (numRead < numRecords && itr.next(*buffer_) == BdbIterator::Success) {
+            numRead++;
+        }
+        return numRead;
+    }
+
+    void scan(const std::string& startKey, uint32_t numRecords, RecordListResponse& response)
+    {
+        RecordListSink sink(response);
+        scan(startKey, numRecords, sink);
+    }
+
+    void scan(const std::string& startKey, uint32_t numRecords, bool sharedKeyPrefixes,
+              PackedRecordListResponse& response)
+    {
+        PackedRecordSink sink(response, sharedKeyPrefixes);
+        scan(startKey, numRecords, sink);
+    }
+
+private:
+    void scan(const std::string& startKey, uint32_t numRecords, ScanSink& sink)
+    {
+        if (buffer_.get() == NULL) {
+            buffer_.reset(new RecordBuffer(1000, 100000));
+        }
+        BdbIterator itr;
+        if (itr.init(&bdb_, startKey, true, "", true, ScanOrder::Ascending) != BdbIterator::Success) {
+            sink.setResponseCode(ResponseCode::Error);
+            return;
+        }
+        ResponseCode::type responseCode = ResponseCode::Success;
+        while (!sink.full(numRecords, 0)) {
+            if (itr.next(*buffer_) != BdbIterator::Success) {
+                responseCode = ResponseCode::ScanEnded;
+                break;
+            }
+            sink.add(buffer_->getKeyBuffer(), buffer_->getKeySize(),
+                     buffer_->getValueBuffer(), buffer_->getValueSize());
+        }
+        sink.setResponseCode(responseCode);
+    }
+
+    static ResponseCode::type convertResponseCode(Bdb::ResponseCode rc)
+    {
+        switch (rc) {
+        case Bdb::Success:
+            return ResponseCode::Success;
+        case Bdb::KeyExists:
+            return ResponseCode::RecordExists;
+        case Bdb::KeyNotFound:
+            return ResponseCode::RecordNotFound;
+        default:
+            return ResponseCode::Error;
+        }
+    }
+
+    boost::shared_ptr<DbEnv> env_;
+    Bdb bdb_;
+    boost::thread_specific_ptr<RecordBuffer> buffer_;
+};
+
+/**
+ * Runs the MapKeeperIf handlers that don't need any more setup than
+ * their constructor (LevelDbServer and StlMapServer).
+ */
+class HandlerEngine : public Engine {
+public:
+    HandlerEngine(MapKeeperIf* handler) :
+        handler_(handler)
+    {
+        ResponseCode::type rc = handler_->addMap(MAP_NAME);
+        if (rc != ResponseCode::Success && rc != ResponseCode::MapExists) {
+            fprintf(stderr, "failed to create map %s: %d\n", MAP_NAME.c_str(), rc);
+            exit(1);
+        }
+    }
+
+    ResponseCode::type get(const std::string& key, std::string& value)
+    {
+        BinaryResponse response;
+        handler_->get(response, MAP_NAME, key);
+        value.swap(response.value);
+        return response.responseCode;
+    }
+
+    ResponseCode::type put(const std::string& key, const std::string& value)
+    {
+        return handler_->put(MAP_NAME, key, value);
+    }
+
+    ResponseCode::type insert(const std::string& key, const std::string& value)
+    {
+        return handler_->insert(MAP_NAME, key, value);
+    }
+
+    ResponseCode::type update(const std::string& key, const std::string& value)
+    {
+        return handler_->update(MAP_NAME, key, value);
+    }
+
+    uint32_t scan(const std::string& startKey, uint32_t numRecords)
+    {
+        RecordListResponse response;
+        handler_->scan(response, MAP_NAME, ScanOrder::Ascending, startKey, true, "", true, numRecords, 0);
+        return response.records.size();
+    }
+
+    void scan(const std::string& startKey, uint32_t numRecords, RecordListResponse& response)
+    {
+        handler_->scanWithOptions(response, MAP_NAME, ScanOrder::Ascending, startKey, true, "", true,
+                                  numRecords, 0, ScanOptions());
+    }
+
+    void scan(const std::string& startKey, uint32_t numRecords, bool sharedKeyPrefixes,
+              PackedRecordListResponse& response)
+    {
+        ScanOptions options;
+        options.sharedKeyPrefixes = sharedKeyPrefixes;
+        handler_->scanPacked(response, MAP_NAME, ScanOrder::Ascending, startKey, true, "", true,
+                             numRecords, 0, options);
+    }
+
+private:
+    boost::scoped_ptr<MapKeeperIf> handler_;
+};
+
+}
+
+Engine* 
+createEngine(const std::string& name, const std::string& directory)
+{
+    if (name == "bdb") {
+        return new BdbEngine(directory);
+    } else if (name == "leveldb") {
+        // LevelDbServer only opens subdirectories of an existing directory.
+        return new HandlerEngine(new LevelDbServer(directory));
+    } else if (name == "stlmap") {
+        return new HandlerEngine(new StlMapServer());
+    }
+    return NULL;
+}
@@ -0,0 +1,44 @@
+#ifndef ENGINES_H
+#define ENGINES_H
+
+#include <string>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include "MapKeeper.h"
+
+/**
+ * A storage engine driven directly by the microbenchmark, without any
+ * Thrift serialization or networking in between. All the methods must
+ * be thread-safe.
+ */
+class Engine {
+public:
+    virtual ~Engine() {}
+    virtual mapkeeper::ResponseCode::type get(const std::string& key, std::string& value) = 0;
+    virtual mapkeeper::ResponseCode::type put(const std::string& key, const std::string& value) = 0;
+    virtual mapkeeper::ResponseCode::type insert(const std::string& key, const std::string& value) = 0;
+    virtual mapkeeper::ResponseCode::type update(const std::string& key, const std::string& value) = 0;
+
+    /**
+     * Reads up to numRecords records starting at startKey in ascending
+     * order, and returns the number of records read.
+     */
+    virtual uint32_t scan(const std::string& startKey, uint32_t numRecords) = 0;
+
+    /**
+     * Scans like scan(), into the response scanWithOptions() or
+     * scanPacked() would send.
+     */
+    virtual void scan(const std::string& startKey, uint32_t numRecords,
+                      mapkeeper::RecordListResponse& response) = 0;
+    virtual void scan(const std::string& startKey, uint32_t numRecords, bool sharedKeyPrefixes,
+                      mapkeeper::PackedRecordListResponse& response) = 0;
+};
+
+/**
+ * Creates an engine named "bdb", "leveldb" or "stlmap" that stores its
+ * data under directory. Returns NULL for an unknown name.
+ */
+Engine* createEngine(const std::string& name, const std::string& directory);
+
+#endif // ENGINES_H
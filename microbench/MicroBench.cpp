@@ -0,0 +1,427 @@
+/**
+ * Storage engine microbenchmarks.
+ *
+ * Runs point and scan operations directly against Bdb, LevelDbServer and
+ * StlMapServer in-process, so that engine and locking costs can be told
+ * apart from Thrift serialization and networking. For each test it
+ * reports throughput, latency percentiles and heap allocations per
+ * operation. The list-scan, packed-scan and prefix-scan tests add
+ * serialization back in, to compare the scan response formats.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include "AllocCounter.h"
+#include "Engines.h"
+#include "Histogram.h"
+#include "PackedRecords.h"
+
+using namespace mapkeeper;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+
+namespace {
+
+enum Test {
+    GET,
+    PUT,
+    INSERT_EXISTING,
+    UPDATE_MISSING,
+    SHORT_SCAN,
+    LONG_SCAN,
+    LIST_SCAN,
+    PACKED_SCAN,
+    PREFIX_SCAN,
+    NUM_TESTS
+};
+
+const char* TEST_NAMES[NUM_TESTS] = {
+    "get",
+    "put",
+    "insert-existing",
+    "update-missing",
+    "short-scan",
+    "long-scan",
+    "list-scan",
+    "packed-scan",
+    "prefix-scan",
+};
+
+// latencies are recorded in nanoseconds, up to 10 seconds.
+const int64_t MAX_LATENCY_NS = 10LL * 1000 * 1000 * 1000;
+
+struct Options {
+    Options() :
+        engine("stlmap"),
+        directory("data"),
+        numThreads(1),
+        numRecords(100000),
+        numOps(100000),
+        keySize(16),
+        valueSize(100),
+        shortScanLength(10),
+        longScanLength(1000) {}
+
+    std::string engine;
+    std::string directory;
+    std::vector<uint32_t> threadCounts;
+    uint32_t numThreads;
+    uint64_t numRecords;
+    uint64_t numOps;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t shortScanLength;
+    uint32_t longScanLength;
+    std::vector<Test> tests;
+};
+
+uint64_t 
+nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Key number n as a fixed size, zero-padded decimal string so that keys
+ * sort in numeric order.
+ */
+void 
+buildKey(uint64_t n, uint32_t keySize, std::string& key)
+{
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%020lu", n);
+    key.assign(keySize > (uint32_t)length ? keySize - length : 0, '0');
+    key.append(buffer, length);
+}
+
+/**
+ * One benchmark thread. Latencies and allocations are recorded locally
+ * and merged after all the threads are done.
+ */
+class Worker {
+public:
+    Worker(uint32_t id, const Options& options, Engine& engine, Test test, boost::barrier& barrier) :
+        options_(options),
+        engine_(engine),
+        test_(test),
+        barrier_(barrier),
+        seed_(id * 7919 + 1),
+        histogram_(MAX_LATENCY_NS, 3),
+        numErrors_(0),
+        numRecordsRead_(0),
+        buffer_(new TMemoryBuffer()),
+        protocol_(buffer_)
+    {
+        value_.assign(options_.valueSize, 'v');
+    }
+
+    void run()
+    {
+        barrier_.wait();
+        AllocCounts before = getAllocCounts();
+        for (uint64_t i = 0; i < options_.numOps; i++) {
+            uint64_t keyNumber = rand_r(&seed_) % options_.numRecords;
+            if (test_ == UPDATE_MISSING) {
+                keyNumber += options_.numRecords;
+            }
+            buildKey(keyNumber, options_.keySize, key_);
+            uint64_t startNs = nowNs();
+            bool success = execute();
+            histogram_.record(nowNs() - startNs);
+            if (!success) {
+                numErrors_++;
+            }
+        }
+        AllocCounts after = getAllocCounts();
+        allocs_.numAllocations = after.numAllocations - before.numAllocations;
+        allocs_.numBytes = after.numBytes - before.numBytes;
+    }
+
+    const Histogram& getHistogram() const
+    {
+        return histogram_;
+    }
+
+    const AllocCounts& getAllocs() const
+    {
+        return allocs_;
+    }
+
+    uint64_t getNumErrors() const
+    {
+        return numErrors_;
+    }
+
+    uint64_t getNumRecordsRead() const
+    {
+        return numRecordsRead_;
+    }
+
+private:
+    /**
+     * Returns true if the engine returned the expected result.
+     */
+    bool execute()
+    {
+        switch (test_) {
+        case GET:
+            return engine_.get(key_, result_) == ResponseCode::Success;
+        case PUT:
+            return engine_.put(key_, value_) == ResponseCode::Success;
+        case INSERT_EXISTING:
+            return engine_.insert(key_, value_) == ResponseCode::RecordExists;
+        case UPDATE_MISSING:
+            return engine_.update(key_, value_) == ResponseCode::RecordNotFound;
+        case SHORT_SCAN:
+            numRecordsRead_ += engine_.scan(key_, options_.shortScanLength);
+            return true;
+        case LONG_SCAN:
+            numRecordsRead_ += engine_.scan(key_, options_.longScanLength);
+            return true;
+        case LIST_SCAN:
+            return listScan();
+        case PACKED_SCAN:
+            return packedScan(false);
+        case PREFIX_SCAN:
+            return packedScan(true);
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * A long scan as the client of scanWithOptions() sees it: the
+     * response is written with the binary protocol and read back into
+     * a list of Records.
+     */
+    bool listScan()
+    {
+        RecordListResponse response;
+        engine_.scan(key_, options_.longScanLength, response);
+        buffer_->resetBuffer();
+        response.write(&protocol_);
+        RecordListResponse received;
+        received.read(&protocol_);
+        numRecordsRead_ += received.records.size();
+        return received.responseCode == response.responseCode;
+    }
+
+    /**
+     * The same for scanPacked(), reading every record in place.
+     */
+    bool packedScan(bool sharedKeyPrefixes)
+    {
+        PackedRecordListResponse response;
+        engine_.scan(key_, options_.longScanLength, sharedKeyPrefixes, response);
+        buffer_->resetBuffer();
+        response.write(&protocol_);
+        PackedRecordListResponse received;
+        received.read(&protocol_);
+        PackedRecordReader reader(received.records);
+        while (reader.next()) {
+            numRecordsRead_++;
+        }
+        return reader.valid() && received.responseCode == response.responseCode;
+    }
+
+    const Options& options_;
+    Engine& engine_;
+    Test test_;
+    boost::barrier& barrier_;
+    unsigned int seed_;
+    std::string key_;
+    std::string value_;
+    std::string result_;
+    Histogram histogram_;
+    AllocCounts allocs_;
+    uint64_t numErrors_;
+    uint64_t numRecordsRead_;
+    boost::shared_ptr<TMemoryBuffer> buffer_;
+    TBinaryProtocol protocol_;
+};
+
+void 
+runTest(const Options& options, Engine& engine, Test test, uint32_t numThreads)
+{
+    boost::barrier barrier(numThreads + 1);
+    boost::ptr_vector<Worker> workers;
+    boost::thread_group threads;
+    for (uint32_t i = 0; i < numThreads; i++) {
+        workers.push_back(new Worker(i, options, engine, test, barrier));
+        threads.create_thread(boost::bind(&Worker::run, &workers.back()));
+    }
+    barrier.wait();
+    uint64_t startNs = nowNs();
+    threads.join_all();
+    double elapsedSec = (nowNs() - startNs) / 1e9;
+
+    Histogram histogram(MAX_LATENCY_NS, 3);
+    uint64_t numAllocations = 0;
+    uint64_t numBytes = 0;
+    uint64_t numErrors = 0;
+    uint64_t numRecordsRead = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        histogram.add(workers[i].getHistogram());
+        numAllocations += workers[i].getAllocs().numAllocations;
+        numBytes += workers[i].getAllocs().numBytes;
+        numErrors += workers[i].getNumErrors();
+        numRecordsRead += workers[i].getNumRecordsRead();
+    }
+    uint64_t numOps = histogram.getCount();
+    printf("%-8s %-16s %7u %12.0f %10.2f %10.2f %10.2f %12.1f %10.2f %8lu %10.1f\n",
+           options.engine.c_str(), TEST_NAMES[test], numThreads, numOps / elapsedSec,
+           histogram.getValueAtPercentile(50) / 1e3, histogram.getValueAtPercentile(99) / 1e3,
+           histogram.getValueAtPercentile(99.9) / 1e3,
+           (double)numBytes / numOps, (double)numAllocations / numOps, numErrors,
+           (double)numRecordsRead / numOps);
+    fflush(stdout);
+}
+
+void 
+load(const Options& options, Engine& engine)
+{
+    std::string key;
+    std::string value(options.valueSize, 'v');
+    uint64_t startNs = nowNs();
+    for (uint64_t i = 0; i < options.numRecords; i++) {
+        buildKey(i, options.keySize, key);
+        if (engine.put(key, value) != ResponseCode::Success) {
+            fprintf(stderr, "failed to load record %lu\n", i);
+            exit(1);
+        }
+    }
+    fprintf(stderr, "loaded %lu records in %.1f sec\n", 
+            options.numRecords, (nowNs() - startNs) / 1e9);
+}
+
+void 
+usage(const char* program)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -engine <name>        bdb, leveldb or stlmap (default stlmap)\n"
+        "  -dir <directory>      existing directory for bdb and leveldb files (default data)\n"
+        "  -threads <n[,n...]>   thread counts to run each test with (default 1)\n"
+        "  -records <n>          number of records to load (default 100000)\n"
+        "  -ops <n>              operations per thread per test (default 100000)\n"
+        "  -key-size <bytes>     (default 16)\n"
+        "  -value-size <bytes>   (default 100)\n"
+        "  -short-scan <n>       records per short scan (default 10)\n"
+        "  -long-scan <n>        records per long scan (default 1000)\n"
+        "  -tests <t[,t...]>     subset of get, put, insert-existing, update-missing,\n"
+        "                        short-scan, long-scan, list-scan, packed-scan and\n"
+        "                        prefix-scan\n"
+        "                        (default all)\n",
+        program);
+    exit(1);
+}
+
+std::vector<std::string> 
+split(const std::string& str)
+{
+    std::vector<std::string> tokens;
+    std::istringstream stream(str);
+    std::string token;
+    while (std::getline(stream, token, ',')) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+void 
+parseArgs(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        std::string value = argv[++i];
+        if (arg == "-engine") {
+            options.engine = value;
+        } else if (arg == "-dir") {
+            options.directory = value;
+        } else if (arg == "-threads") {
+            std::vector<std::string> counts = split(value);
+            for (size_t j = 0; j < counts.size(); j++) {
+                options.threadCounts.push_back(atoi(counts[j].c_str()));
+            }
+        } else if (arg == "-records") {
+            options.numRecords = strtoull(value.c_str(), NULL, 10);
+        } else if (arg == "-ops") {
+            options.numOps = strtoull(value.c_str(), NULL, 10);
+        } else if (arg == "-key-size") {
+            options.keySize = atoi(value.c_str());
+        } else if (arg == "-value-size") {
+            options.valueSize = atoi(value.c_str());
+        } else if (arg == "-short-scan") {
+            options.shortScanLength = atoi(value.c_str());
+        } else if (arg == "-long-scan") {
+            options.longScanLength = atoi(value.c_str());
+        } else if (arg == "-tests") {
+            std::vector<std::string> names = split(value);
+            for (size_t j = 0; j < names.size(); j++) {
+                int test = 0;
+                while (test < NUM_TESTS && names[j] != TEST_NAMES[test]) {
+                    test++;
+                }
+                if (test == NUM_TESTS) {
+                    usage(argv[0]);
+                }
+                options.tests.push_back((Test)test);
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (options.threadCounts.empty()) {
+        options.threadCounts.push_back(1);
+    }
+    if (options.tests.empty()) {
+        for (int test = 0; test < NUM_TESTS; test++) {
+            options.tests.push_back((Test)test);
+        }
+    }
+    for (size_t i = 0; i < options.threadCounts.size(); i++) {
+        if (options.threadCounts[i] == 0) {
+            usage(argv[0]);
+        }
+    }
+    if (options.numRecords == 0 || options.numOps == 0) {
+        usage(argv[0]);
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    parseArgs(argc, argv, options);
+    boost::scoped_ptr<Engine> engine(createEngine(options.engine, options.directory));
+    if (!engine) {
+        usage(argv[0]);
+    }
+    load(options, *engine);
+
+    printf("%-8s %-16s %7s %12s %10s %10s %10s %12s %10s %8s %10s\n",
+           "engine", "test", "threads", "ops/sec", "p50_us", "p99_us", "p999_us",
+           "bytes/op", "allocs/op", "errors", "records/op");
+    for (size_t i = 0; i < options.tests.size(); i++) {
+        for (size_t j = 0; j < options.threadCounts.size(); j++) {
+            runTest(options, *engine, options.tests[i], options.threadCounts[j]);
+        }
+    }
+    return 0;
+}
@@ -1,7 +1,20 @@
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
 #include <mysqld_error.h>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include "MySqlClient.h"
+#include "Projection.h"
+#include "ScanFilter.h"
+#include "ScanSink.h"
+#include "SplitKeys.h"
+
+const uint32_t MySqlClient::INITIAL_SCAN_PAGE_SIZE = 16;
+const uint32_t MySqlClient::MAX_SCAN_PAGE_SIZE = 1024;
+const uint32_t MySqlClient::MAX_KEYS_PER_QUERY = 1000;
 
 MySqlClient::
 MySqlClient(const std::string& host, uint32_t port) :
@@ -22,7 +35,7 @@ MySqlClient(const std::string& host, uint32_t port) :
         NULL,           // default database
         port_,          // port 
         NULL,           // unix socket
-        0               // flags
+        CLIENT_FOUND_ROWS // flags
     ));
     assert(0 == mysql_query(&mysql_, "create database if not exists mapkeeper"));
     assert(0 == mysql_query(&mysql_, "use mapkeeper"));
@@ -87,8 +100,41 @@ insert(const std::string& tableName, const std::string& key, const std::string&
 MySqlClient::ResponseCode MySqlClient::
 update(const std::string& tableName, const std::string& key, const std::string& value)
 {
-    std::string query = "update " + escapeString(tableName) + " set record_value = '" + 
-        escapeString(value) + "' where record_key = '" +  escapeString(key) + "'";
+    return updateValue(tableName, key, "'" + escapeString(value) + "'");
+}
+
+MySqlClient::ResponseCode MySqlClient::
+append(const std::string& tableName, const std::string& key, const std::string& data)
+{
+    return updateValue(tableName, key, "concat(record_value, '" + escapeString(data) + "')");
+}
+
+MySqlClient::ResponseCode MySqlClient::
+writeAt(const std::string& tableName, const std::string& key,
+        int64_t offset, const std::string& data)
+{
+    if (data.empty()) {
+        return updateValue(tableName, key, "record_value");
+    }
+    // the bytes before offset, padded, data, and the bytes after it;
+    // substring() counts from 1.
+    std::string offsetString = boost::lexical_cast<std::string>(offset);
+    std::string expression = "concat(rpad(left(record_value, " + offsetString + "), " +
+        offsetString + ", x'00'), '" + escapeString(data) + "', substring(record_value, " +
+        boost::lexical_cast<std::string>(offset + data.size() + 1) + "))";
+    return updateValue(tableName, key, expression);
+}
+
+/**
+ * Sets record_value to expression, which may refer to the old value.
+ * The connection counts matched rather than changed rows, so setting a
+ * value to what it was still finds the record.
+ */
+MySqlClient::ResponseCode MySqlClient::
+updateValue(const std::string& tableName, const std::string& key, const std::string& expression)
+{
+    std::string query = "update " + escapeString(tableName) + " set record_value = " +
+        expression + " where record_key = '" +  escapeString(key) + "'";
     int result = mysql_real_query(&mysql_, query.c_str(), query.length());
     if (result != 0) {
         uint32_t error = mysql_errno(&mysql_);
@@ -113,7 +159,24 @@ update(const std::string& tableName, const std::string& key, const std::string&
 MySqlClient::ResponseCode MySqlClient::
 get(const std::string& tableName, const std::string& key, std::string& value)
 {
-    std::string query = "select record_value from " + escapeString(tableName) + 
+    return selectValue("record_value", tableName, key, value);
+}
+
+MySqlClient::ResponseCode MySqlClient::
+getRange(const std::string& tableName, const std::string& key,
+         int64_t offset, int32_t length, std::string& value)
+{
+    // substring() counts from 1.
+    std::string column = "substring(record_value, " + boost::lexical_cast<std::string>(offset + 1) +
+        ", " + boost::lexical_cast<std::string>(length) + ")";
+    return selectValue(column, tableName, key, value);
+}
+
+MySqlClient::ResponseCode MySqlClient::
+selectValue(const std::string& column, const std::string& tableName,
+            const std::string& key, std::string& value)
+{
+    std::string query = "select " + column + " from " + escapeString(tableName) + 
         " where record_key = '" + escapeString(key) + "'";
     int result = mysql_real_query(&mysql_, query.c_str(), query.length());
     if (result != 0) {
@@ -168,60 +231,481 @@ remove(const std::string& tableName, const std::string& key)
     return Success;
 }
 
+MySqlClient::ResponseCode MySqlClient::
+getMany(const std::string& tableName, const std::vector<std::string>& keys,
+        std::vector<ResponseCode>& results, std::vector<std::string>& values)
+{
+    results.assign(keys.size(), RecordNotFound);
+    values.resize(keys.size());
+    for (size_t begin = 0; begin < keys.size(); begin += MAX_KEYS_PER_QUERY) {
+        size_t end = std::min(keys.size(), begin + MAX_KEYS_PER_QUERY);
+        std::string query = "select record_key, record_value from " + escapeString(tableName) + 
+            " where record_key in (";
+        for (size_t i = begin; i < end; i++) {
+            if (i != begin) {
+                query += ",";
+            }
+            query += "'" + escapeString(keys[i]) + "'";
+        }
+        query += ")";
+        int result = mysql_real_query(&mysql_, query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(&mysql_);
+            if (error == ER_NO_SUCH_TABLE) {
+                return TableNotFound;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
+                return Error;
+            }
+        }
+        MYSQL_RES* res = mysql_store_result(&mysql_);
+        if (res == NULL) {
+            fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+            return Error;
+        }
+
+        // rows come back in index order, and the same key may be requested 
+        // more than once, so match them up by key.
+        std::map<std::string, size_t> rowIndex;
+        std::vector<std::string> rowValues;
+        MYSQL_ROW row;
+        while ((row = mysql_fetch_row(res))) {
+            uint64_t* lengths = mysql_fetch_lengths(res);
+            rowIndex[std::string(row[0], lengths[0])] = rowValues.size();
+            rowValues.push_back(std::string(row[1], lengths[1]));
+        }
+        mysql_free_result(res);
+        for (size_t i = begin; i < end; i++) {
+            std::map<std::string, size_t>::iterator itr = rowIndex.find(keys[i]);
+            if (itr != rowIndex.end()) {
+                values[i] = rowValues[itr->second];
+                results[i] = Success;
+            }
+        }
+    }
+    return Success;
+}
+
 void MySqlClient::
-scan(mapkeeper::RecordListResponse& _return, const std::string& tableName, const mapkeeper::ScanOrder::type order,
+scan(ScanSink& sink, const std::string& tableName, const mapkeeper::ScanOrder::type order,
         const std::string& startKey, const bool startKeyIncluded,
         const std::string& endKey, const bool endKeyIncluded,
-        const int32_t maxRecords, const int32_t maxBytes)
+        const int32_t maxRecords, const int32_t maxBytes,
+        const mapkeeper::ScanOptions& options)
 {
-    std::string query = "select record_key, record_value from " + 
-        escapeString(tableName) + " where record_key " + 
-        (startKeyIncluded ? ">=" : ">") + " '" + escapeString(startKey) + "'";
-    if (!endKey.empty()) {
-        query += " and record_key " +
-            (endKeyIncluded ? std::string("<=") : std::string("<")) + "'" + escapeString(endKey) + "'";
+    // The scan is split into pages. Each page continues from the last key
+    // returned by the previous one (keyset pagination), so we never use
+    // OFFSET and MySQL never has to walk over rows we already returned.
+    // Pages are sized from the remaining byte budget, so a scan with a small
+    // maxBytes doesn't pull the whole LIMIT over the wire.
+    //
+    // Filters are applied to the rows here; only the key prefix narrows
+    // the query itself.
+    std::string lowKey = startKey;
+    bool lowKeyIncluded = startKeyIncluded;
+    std::string highKey = endKey;
+    bool highKeyIncluded = endKeyIncluded;
+    bool descending = order == mapkeeper::ScanOrder::Descending;
+    ScanFilter filter(options);
+    if (!filter.valid()) {
+        sink.setResponseCode(mapkeeper::ResponseCode::Error);
+        return;
     }
-    query += " order by record_key";
-    if (order == mapkeeper::ScanOrder::Descending) {
-        query += " desc";
+    if (!filter.narrowRange(lowKey, lowKeyIncluded, highKey, highKeyIncluded)) {
+        sink.setResponseCode(mapkeeper::ResponseCode::ScanEnded);
+        return;
     }
-    if (maxRecords > 0) {
-        query += " limit " + boost::lexical_cast<std::string>(maxRecords);
+    // an empty endKey means no upper bound, but once a descending scan
+    // continues below a key, that key is the bound even if it's empty.
+    bool hasHighKey = !highKey.empty();
+    bool readValues = !options.keysOnly || filter.needsValue();
+    std::string columns = "record_key";
+    if (readValues) {
+        if (wholeValues(options) || filter.needsValue()) {
+            columns += ", record_value";
+        } else {
+            // substring() counts from 1.
+            columns += ", substring(record_value, " +
+                boost::lexical_cast<std::string>(std::max(options.valueOffset, 0) + 1);
+            if (options.valueLength >= 0) {
+                columns += ", " + boost::lexical_cast<std::string>(options.valueLength);
+            }
+            columns += ")";
+        }
     }
-//    fprintf(stderr, "%s\n", query.c_str());
 
+    uint32_t pageSize = INITIAL_SCAN_PAGE_SIZE;
+    while (true) {
+        uint32_t limit = pageSize;
+        if (maxRecords > 0) {
+            limit = std::min(limit, (uint32_t)maxRecords - sink.size());
+        }
+        std::string query = "select " + columns + " from " + 
+            escapeString(tableName) + " where record_key " + 
+            (lowKeyIncluded ? ">=" : ">") + " '" + escapeString(lowKey) + "'";
+        if (hasHighKey) {
+            query += " and record_key " +
+                (highKeyIncluded ? std::string("<=") : std::string("<")) + "'" + escapeString(highKey) + "'";
+        }
+        query += " order by record_key";
+        if (descending) {
+            query += " desc";
+        }
+        query += " limit " + boost::lexical_cast<std::string>(limit);
+
+        int result = mysql_real_query(&mysql_, query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(&mysql_);
+            if (error == ER_NO_SUCH_TABLE) {
+                sink.setResponseCode(mapkeeper::ResponseCode::MapNotFound);
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
+                sink.setResponseCode(mapkeeper::ResponseCode::Error);
+            }
+            return;
+        }
+
+        // Stream rows instead of buffering the whole page with mysql_store_result.
+        MYSQL_RES* res = mysql_use_result(&mysql_);
+        if (res == NULL) {
+            fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+            sink.setResponseCode(mapkeeper::ResponseCode::Error);
+            return;
+        }
+        MYSQL_ROW row;
+        uint32_t numRows = 0;
+        bool done = false;
+        while ((row = mysql_fetch_row(res))) {
+            uint64_t* lengths = mysql_fetch_lengths(res);
+            numRows++;
+            ScanFilter::Verdict verdict = filter.examine(row[0], lengths[0],
+                                                         readValues ? row[1] : NULL,
+                                                         readValues ? lengths[1] : 0);
+            if (verdict == ScanFilter::Stop) {
+                done = true;
+                break;
+            } else if (verdict == ScanFilter::Reject) {
+                continue;
+            }
+            size_t offset = 0;
+            size_t length = 0;
+            if (filter.needsValue()) {
+                projectRange(options, lengths[1], offset, length);
+            } else if (!options.keysOnly) {
+                length = lengths[1];
+            }
+            sink.add(row[0], lengths[0], readValues ? row[1] + offset : "", length);
+            if (sink.full(maxRecords, maxBytes)) {
+                done = true;
+                break;
+            }
+        }
+        if (!done && mysql_errno(&mysql_) != 0) {
+            fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+            mysql_free_result(res);
+            sink.setResponseCode(mapkeeper::ResponseCode::Error);
+            return;
+        }
+        // mysql_free_result reads whatever is left of the page off the wire.
+        mysql_free_result(res);
+        if (done && descending && filter.lastExamined().empty()) {
+            // nothing is below the empty key, and an empty resumeKey
+            // would read as "no upper bound" to the caller.
+            sink.setResponseCode(mapkeeper::ResponseCode::ScanEnded);
+            return;
+        }
+        if (done) {
+            sink.setResponseCode(mapkeeper::ResponseCode::Success);
+            sink.setResumeKey(filter.lastExamined());
+            return;
+        }
+        if (numRows < limit) {
+            sink.setResponseCode(mapkeeper::ResponseCode::ScanEnded);
+            return;
+        }
+
+        // continue right after the last key we looked at.
+        if (descending) {
+            highKey = filter.lastExamined();
+            highKeyIncluded = false;
+            hasHighKey = true;
+        } else {
+            lowKey = filter.lastExamined();
+            lowKeyIncluded = false;
+        }
+        pageSize = MAX_SCAN_PAGE_SIZE;
+        if (maxBytes > 0 && sink.size() > 0) {
+            int64_t averageRecordSize = std::max((int64_t)1, sink.bytes() / (int64_t)sink.size());
+            int64_t remainingRecords = (maxBytes - sink.bytes() + averageRecordSize - 1) / averageRecordSize;
+            pageSize = (uint32_t)std::max((int64_t)1, std::min((int64_t)MAX_SCAN_PAGE_SIZE, remainingRecords));
+        }
+    }
+}
+
+MySqlClient::ResponseCode MySqlClient::
+getSplitKeys(const std::string& tableName, const std::string& startKey,
+             const std::string& endKey, uint32_t numSplits,
+             std::vector<std::string>& splitKeys)
+{
+    std::string where = keyRange(startKey, !endKey.empty(), endKey, true);
+    int64_t rows = 0;
+    ResponseCode rc = estimateRows(tableName, where, rows);
+    if (rc != Success) {
+        return rc;
+    }
+    if (rows > EXACT_SPLIT_RECORDS) {
+        std::string firstKey;
+        std::string lastKey;
+        rc = boundaryKey(tableName, where, false, firstKey);
+        if (rc == Success) {
+            rc = boundaryKey(tableName, where, true, lastKey);
+        }
+        if (rc != Success) {
+            return rc;
+        }
+        int64_t total = 0;
+        rc = estimateRows(tableName, keyRange(firstKey, true, lastKey, true), total);
+        if (rc != Success) {
+            return rc;
+        }
+        if (total > 0) {
+            return bisectSplitKeys(firstKey, lastKey, numSplits,
+                                   boost::bind(&MySqlClient::keyPosition, this, tableName, firstKey, total, _1),
+                                   splitKeys) ? Success : Error;
+        }
+    }
+
+    std::string query = "select record_key, length(record_value) from " + escapeString(tableName) +
+        " where " + where + " order by record_key";
     int result = mysql_real_query(&mysql_, query.c_str(), query.length());
     if (result != 0) {
         uint32_t error = mysql_errno(&mysql_);
         if (error == ER_NO_SUCH_TABLE) {
-            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
-            return;
+            return TableNotFound;
         } else {
             fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
-            _return.responseCode = mapkeeper::ResponseCode::Error;
-            return;
+            return Error;
         }
     }
-
-    MYSQL_RES* res = mysql_store_result(&mysql_);
+    MYSQL_RES* res = mysql_use_result(&mysql_);
+    if (res == NULL) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        return Error;
+    }
+    SplitKeySampler sampler(numSplits);
     MYSQL_ROW row;
-
-    int32_t numBytes = 0;
     while ((row = mysql_fetch_row(res))) {
         uint64_t* lengths = mysql_fetch_lengths(res);
-        mapkeeper::Record record;
-        record.key = std::string(row[0], lengths[0]);
-        record.value = std::string(row[1], lengths[1]);
-        numBytes += lengths[0] + lengths[1];
-        _return.records.push_back(record);
-        if (_return.records.size() >= (uint32_t)maxRecords || numBytes >= maxBytes) {
-            mysql_free_result(res);
-            _return.responseCode = mapkeeper::ResponseCode::Success;
-            return;
+        sampler.add(std::string(row[0], lengths[0]), lengths[0] + strtoull(row[1], NULL, 10));
+    }
+    if (mysql_errno(&mysql_) != 0) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        mysql_free_result(res);
+        return Error;
+    }
+    mysql_free_result(res);
+    sampler.getSplitKeys(splitKeys);
+    return Success;
+}
+
+MySqlClient::ResponseCode MySqlClient::
+estimateCount(const std::string& tableName, const std::string& startKey,
+              const std::string& endKey, bool exact, int64_t& count)
+{
+    std::string where = keyRange(startKey, !endKey.empty(), endKey, false);
+    std::vector<int64_t> numbers;
+    ResponseCode rc = Success;
+    if (exact) {
+        rc = queryNumbers("select count(*) from " + escapeString(tableName) + " where " + where, numbers);
+    } else if (startKey.empty() && endKey.empty()) {
+        rc = queryNumbers("select table_rows from information_schema.tables "
+                          "where table_schema = database() and table_name = '" +
+                          escapeString(tableName) + "'", numbers);
+    } else {
+        numbers.resize(1);
+        rc = estimateRows(tableName, where, numbers[0]);
+    }
+    if (rc == RecordNotFound) {
+        return TableNotFound;
+    } else if (rc != Success) {
+        return rc;
+    }
+    count = numbers[0];
+    return Success;
+}
+
+MySqlClient::ResponseCode MySqlClient::
+estimateSize(const std::string& tableName, const std::string& startKey,
+             const std::string& endKey, bool exact, int64_t& bytes)
+{
+    std::string where = keyRange(startKey, !endKey.empty(), endKey, false);
+    std::vector<int64_t> numbers;
+    ResponseCode rc = Success;
+    if (exact) {
+        rc = queryNumbers("select sum(length(record_key) + length(record_value)) from " +
+                          escapeString(tableName) + " where " + where, numbers);
+        if (rc == Success) {
+            bytes = numbers[0];
+        }
+        return rc == RecordNotFound ? TableNotFound : rc;
+    }
+    rc = queryNumbers("select table_rows, avg_row_length from information_schema.tables "
+                      "where table_schema = database() and table_name = '" +
+                      escapeString(tableName) + "'", numbers);
+    if (rc == RecordNotFound) {
+        return TableNotFound;
+    } else if (rc != Success) {
+        return rc;
+    }
+    int64_t rows = numbers[0];
+    if (!startKey.empty() || !endKey.empty()) {
+        rc = estimateRows(tableName, where, rows);
+        if (rc != Success) {
+            return rc;
+        }
+    }
+    bytes = rows * numbers[1];
+    return Success;
+}
+
+/**
+ * Runs a query that returns one row of numbers, and reads them. NULL
+ * reads as 0.
+ *
+ * @returns RecordNotFound if the query returned no rows.
+ */
+MySqlClient::ResponseCode MySqlClient::
+queryNumbers(const std::string& query, std::vector<int64_t>& numbers)
+{
+    int result = mysql_real_query(&mysql_, query.c_str(), query.length());
+    if (result != 0) {
+        uint32_t error = mysql_errno(&mysql_);
+        if (error == ER_NO_SUCH_TABLE) {
+            return TableNotFound;
+        } else {
+            fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
+            return Error;
         }
     }
+    MYSQL_RES* res = mysql_store_result(&mysql_);
+    if (res == NULL) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        return Error;
+    }
+    MYSQL_ROW row = mysql_fetch_row(res);
+    if (!row) {
+        mysql_free_result(res);
+        return RecordNotFound;
+    }
+    uint32_t numFields = mysql_num_fields(res);
+    numbers.clear();
+    for (uint32_t i = 0; i < numFields; i++) {
+        numbers.push_back(row[i] ? strtoll(row[i], NULL, 10) : 0);
+    }
     mysql_free_result(res);
-    _return.responseCode = mapkeeper::ResponseCode::ScanEnded;
+    return Success;
+}
+
+/**
+ * Returns the condition for keys from lowKey (included) to highKey, or
+ * with no upper bound unless hasHighKey. The empty string is a key like
+ * any other, so it can't stand for "no bound" here.
+ */
+std::string MySqlClient::
+keyRange(const std::string& lowKey, bool hasHighKey, const std::string& highKey, bool highKeyIncluded)
+{
+    std::string where = "record_key >= '" + escapeString(lowKey) + "'";
+    if (hasHighKey) {
+        where += std::string(" and record_key ") + (highKeyIncluded ? "<=" : "<") +
+            " '" + escapeString(highKey) + "'";
+    }
+    return where;
+}
+
+/**
+ * Reads the optimizer's estimate of the number of rows that match where
+ * from the rows column of EXPLAIN.
+ */
+MySqlClient::ResponseCode MySqlClient::
+estimateRows(const std::string& tableName, const std::string& where, int64_t& rows)
+{
+    std::string query = "explain select record_key from " + escapeString(tableName) +
+        " where " + where;
+    int result = mysql_real_query(&mysql_, query.c_str(), query.length());
+    if (result != 0) {
+        uint32_t error = mysql_errno(&mysql_);
+        if (error == ER_NO_SUCH_TABLE) {
+            return TableNotFound;
+        } else {
+            fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
+            return Error;
+        }
+    }
+    MYSQL_RES* res = mysql_store_result(&mysql_);
+    if (res == NULL) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        return Error;
+    }
+    MYSQL_FIELD* fields = mysql_fetch_fields(res);
+    uint32_t numFields = mysql_num_fields(res);
+    MYSQL_ROW row = mysql_fetch_row(res);
+    rows = 0;
+    for (uint32_t i = 0; row && i < numFields; i++) {
+        if (strcmp(fields[i].name, "rows") == 0 && row[i]) {
+            rows = strtoll(row[i], NULL, 10);
+        }
+    }
+    mysql_free_result(res);
+    return Success;
+}
+
+/**
+ * Reads the first (or the last) key that matches where, or "" if there's
+ * none.
+ */
+MySqlClient::ResponseCode MySqlClient::
+boundaryKey(const std::string& tableName, const std::string& where, bool last, std::string& key)
+{
+    std::string query = "select record_key from " + escapeString(tableName) +
+        " where " + where + " order by record_key" + (last ? " desc" : "") + " limit 1";
+    int result = mysql_real_query(&mysql_, query.c_str(), query.length());
+    if (result != 0) {
+        uint32_t error = mysql_errno(&mysql_);
+        if (error == ER_NO_SUCH_TABLE) {
+            return TableNotFound;
+        } else {
+            fprintf(stderr, "%d %s\n", error, mysql_error(&mysql_));
+            return Error;
+        }
+    }
+    MYSQL_RES* res = mysql_store_result(&mysql_);
+    if (res == NULL) {
+        fprintf(stderr, "%d %s\n", mysql_errno(&mysql_), mysql_error(&mysql_));
+        return Error;
+    }
+    MYSQL_ROW row = mysql_fetch_row(res);
+    key.clear();
+    if (row) {
+        uint64_t* lengths = mysql_fetch_lengths(res);
+        key.assign(row[0], lengths[0]);
+    }
+    mysql_free_result(res);
+    return Success;
+}
+
+/**
+ * The share of the total rows from firstKey that are less than key, or
+ * -1 on errors.
+ */
+double MySqlClient::
+keyPosition(const std::string& tableName, const std::string& firstKey, int64_t total,
+            const std::string& key)
+{
+    int64_t rows = 0;
+    if (estimateRows(tableName, keyRange(firstKey, true, key, false), rows) != Success) {
+        return -1;
+    }
+    return std::min(1.0, (double)rows / total);
 }
 
 std::string MySqlClient::
@@ -1,7 +1,10 @@
 #include <string>
+#include <vector>
 #include <mysql.h>
 #include "MapKeeper.h"
 
+class ScanSink;
+
 #ifndef MYSQLCLIENT_H
 #define MYSQLCLIENT_H
 
@@ -22,15 +25,83 @@ public:
     ResponseCode dropTable(const std::string& tableName);
     ResponseCode insert(const std::string& tableName, const std::string& key, const std::string& value);
     ResponseCode update(const std::string& tableName, const std::string& key, const std::string& value);
+
+    /**
+     * Appends to record_value with concat(), so the old value stays in
+     * the server.
+     */
+    ResponseCode append(const std::string& tableName, const std::string& key, const std::string& data);
+
+    /**
+     * Splices data into record_value at offset, padding it with zero
+     * bytes up to offset.
+     */
+    ResponseCode writeAt(const std::string& tableName, const std::string& key,
+                         int64_t offset, const std::string& data);
     ResponseCode get(const std::string& tableName, const std::string& key, std::string& value);
+
+    /**
+     * Selects length bytes of record_value from offset, so the rest of
+     * a large value stays in the server.
+     */
+    ResponseCode getRange(const std::string& tableName, const std::string& key,
+                          int64_t offset, int32_t length, std::string& value);
     ResponseCode remove(const std::string& tableName, const std::string& key);
-    void scan (mapkeeper::RecordListResponse& _return, const std::string& mapName, const mapkeeper::ScanOrder::type order,
+
+    /**
+     * Retrieves multiple records with a single query. The per-key result
+     * is stored in results in the same order as keys.
+     */
+    ResponseCode getMany(const std::string& tableName, const std::vector<std::string>& keys,
+                         std::vector<ResponseCode>& results, std::vector<std::string>& values);
+    /**
+     * Only selects the columns, or the part of record_value, that
+     * options ask for.
+     */
+    void scan (ScanSink& sink, const std::string& mapName, const mapkeeper::ScanOrder::type order,
             const std::string& startKey, const bool startKeyIncluded,
             const std::string& endKey, const bool endKeyIncluded,
-            const int32_t maxRecords, const int32_t maxBytes);
+            const int32_t maxRecords, const int32_t maxBytes,
+            const mapkeeper::ScanOptions& options = mapkeeper::ScanOptions());
+
+    /**
+     * Cuts [startKey, endKey] into numSplits parts. Tables of up to
+     * EXACT_SPLIT_RECORDS rows (as estimated by EXPLAIN) are read and
+     * split by the size of the records; larger ones are split by
+     * bisecting the row estimates of EXPLAIN, which InnoDB makes by
+     * diving into the primary key index.
+     */
+    ResponseCode getSplitKeys(const std::string& tableName, const std::string& startKey,
+                              const std::string& endKey, uint32_t numSplits,
+                              std::vector<std::string>& splitKeys);
+
+    /**
+     * Counts the records in [startKey, endKey), or adds up their sizes.
+     * Approximate answers come from the InnoDB table statistics in
+     * information_schema for whole tables, and from EXPLAIN for ranges.
+     */
+    ResponseCode estimateCount(const std::string& tableName, const std::string& startKey,
+                               const std::string& endKey, bool exact, int64_t& count);
+    ResponseCode estimateSize(const std::string& tableName, const std::string& startKey,
+                              const std::string& endKey, bool exact, int64_t& bytes);
 
 private:
+    static const uint32_t INITIAL_SCAN_PAGE_SIZE;
+    static const uint32_t MAX_SCAN_PAGE_SIZE;
+    static const uint32_t MAX_KEYS_PER_QUERY;
     std::string escapeString(const std::string& str);
+    ResponseCode updateValue(const std::string& tableName, const std::string& key,
+                             const std::string& expression);
+    ResponseCode selectValue(const std::string& column, const std::string& tableName,
+                             const std::string& key, std::string& value);
+    std::string keyRange(const std::string& lowKey, bool hasHighKey, const std::string& highKey,
+                         bool highKeyIncluded);
+    ResponseCode estimateRows(const std::string& tableName, const std::string& where, int64_t& rows);
+    ResponseCode queryNumbers(const std::string& query, std::vector<int64_t>& numbers);
+    ResponseCode boundaryKey(const std::string& tableName, const std::string& where, bool last,
+                             std::string& key);
+    double keyPosition(const std::string& tableName, const std::string& firstKey, int64_t total,
+                       const std::string& key);
     MYSQL mysql_;
     std::string host_;
     uint32_t port_;
@@ -4,19 +4,20 @@
  */
 #include <cstdio>
 #include "MapKeeper.h"
+#include "HandlerChain.h"
+#include "ServerRuntime.h"
 #include <boost/thread/tss.hpp>
 #include "MySqlClient.h"
+#include "ScanSink.h"
+#include "ValuePatch.h"
 
 #include <protocol/TBinaryProtocol.h>
-#include <server/TThreadedServer.h>
-#include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
 
 
 using namespace ::apache::thrift;
 using namespace ::apache::thrift::protocol;
 using namespace ::apache::thrift::transport;
-using namespace ::apache::thrift::server;
 using namespace ::apache::thrift::concurrency;
 
 using boost::shared_ptr;
@@ -65,7 +66,28 @@ public:
               const std::string& endKey, const bool endKeyIncluded,
               const int32_t maxRecords, const int32_t maxBytes) {
         initMySqlClient();
-        mysql_->scan(_return, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+        RecordListSink sink(_return);
+        mysql_->scan(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+    }
+
+    void scanWithOptions(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
+        initMySqlClient();
+        RecordListSink sink(_return);
+        mysql_->scan(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    }
+
+    void scanPacked(PackedRecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
+        initMySqlClient();
+        PackedRecordSink sink(_return, options.sharedKeyPrefixes);
+        mysql_->scan(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
     }
 
     void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
@@ -84,6 +106,27 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
+    void getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length) {
+        if (offset < 0 || length < 0) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        initMySqlClient();
+        MySqlClient::ResponseCode rc = mysql_->getRange(mapName, key, offset, length, _return.value);
+        if (rc == MySqlClient::TableNotFound) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        } else if (rc == MySqlClient::RecordNotFound) {
+            _return.responseCode = ResponseCode::RecordNotFound;
+            return;
+        } else if (rc != MySqlClient::Success) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
     ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
         return ResponseCode::Success;
     }
@@ -114,6 +157,41 @@ public:
         return ResponseCode::Success;
     }
 
+    ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data) {
+        initMySqlClient();
+        MySqlClient::ResponseCode rc = mysql_->append(mapName, key, data);
+        if (rc == MySqlClient::TableNotFound) {
+            return ResponseCode::MapNotFound;
+        } else if (rc == MySqlClient::RecordNotFound) {
+            return ResponseCode::RecordNotFound;
+        } else if (rc != MySqlClient::Success) {
+            return ResponseCode::Error;
+        }
+        return ResponseCode::Success;
+    }
+
+    ResponseCode::type writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+                               const std::string& data) {
+        if (!validPatch(offset, data.size())) {
+            return ResponseCode::Error;
+        }
+        initMySqlClient();
+        MySqlClient::ResponseCode rc = mysql_->writeAt(mapName, key, offset, data);
+        if (rc == MySqlClient::TableNotFound) {
+            return ResponseCode::MapNotFound;
+        } else if (rc == MySqlClient::RecordNotFound) {
+            return ResponseCode::RecordNotFound;
+        } else if (rc != MySqlClient::Success) {
+            return ResponseCode::Error;
+        }
+        return ResponseCode::Success;
+    }
+
+    ResponseCode::type putChunk(const std::string& mapName, const std::string& key, const int64_t offset,
+                                const std::string& data, const bool last) {
+        return ResponseCode::Error;
+    }
+
     ResponseCode::type remove(const std::string& mapName, const std::string& key) {
         initMySqlClient();
         MySqlClient::ResponseCode rc = mysql_->remove(mapName, key);
@@ -127,6 +205,102 @@ public:
         return ResponseCode::Success;
     }
 
+    void multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        initMySqlClient();
+        std::vector<MySqlClient::ResponseCode> results;
+        std::vector<std::string> values;
+        MySqlClient::ResponseCode rc = mysql_->getMany(mapName, keys, results, values);
+        _return.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (rc == MySqlClient::TableNotFound) {
+                _return[i].responseCode = ResponseCode::MapNotFound;
+            } else if (rc != MySqlClient::Success) {
+                _return[i].responseCode = ResponseCode::Error;
+            } else if (results[i] == MySqlClient::RecordNotFound) {
+                _return[i].responseCode = ResponseCode::RecordNotFound;
+            } else {
+                _return[i].responseCode = ResponseCode::Success;
+                _return[i].value.swap(values[i]);
+            }
+        }
+    }
+
+    void multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records) {
+        _return.clear();
+        for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+            _return.push_back(put(mapName, itr->key, itr->value));
+        }
+    }
+
+    void multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records) {
+        _return.clear();
+        for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+            _return.push_back(insert(mapName, itr->key, itr->value));
+        }
+    }
+
+    void multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records) {
+        _return.clear();
+        for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+            _return.push_back(update(mapName, itr->key, itr->value));
+        }
+    }
+
+    void multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        _return.clear();
+        for (std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++) {
+            _return.push_back(remove(mapName, *itr));
+        }
+    }
+
+    void getStats(StatsResponse& _return) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const int32_t numSplits) {
+        initMySqlClient();
+        MySqlClient::ResponseCode rc = mysql_->getSplitKeys(mapName, startKey, endKey, numSplits, _return.values);
+        if (rc == MySqlClient::TableNotFound) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        } else if (rc != MySqlClient::Success) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void estimateCount(EstimateResponse& _return, const std::string& mapName,
+                       const std::string& startKey, const std::string& endKey, const bool exact) {
+        initMySqlClient();
+        MySqlClient::ResponseCode rc = mysql_->estimateCount(mapName, startKey, endKey, exact, _return.value);
+        if (rc == MySqlClient::TableNotFound) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        } else if (rc != MySqlClient::Success) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.exact = exact;
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void estimateSize(EstimateResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const bool exact) {
+        initMySqlClient();
+        MySqlClient::ResponseCode rc = mysql_->estimateSize(mapName, startKey, endKey, exact, _return.value);
+        if (rc == MySqlClient::TableNotFound) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        } else if (rc != MySqlClient::Success) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.exact = exact;
+        _return.responseCode = ResponseCode::Success;
+    }
+
 private:
     void initMySqlClient() {
         if (mysql_.get() == NULL) {
@@ -140,13 +314,10 @@ private:
 };
 
 int main(int argc, char **argv) {
-    int port = 9090;
+    ServerOptions options;
+    options.parse(argc, argv);
     shared_ptr<MySqlServer> handler(new MySqlServer("localhost", 3306));
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server (processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
+    shared_ptr<TProcessor> processor(buildProcessor(handler, options));
+    runServer(processor, options);
     return 0;
 }
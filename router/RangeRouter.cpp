@@ -0,0 +1,1441 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include "RangeRouter.h"
+#include "ScanFilter.h"
+#include "ScanSink.h"
+#include "SplitKeys.h"
+
+using namespace mapkeeper;
+
+// holds the partition table of each map, on the first backend.
+static const std::string META_MAP = "__mapkeeper_router";
+
+// every SAMPLE_EVERY-th key on each thread is kept for choosing split
+// keys, up to MAX_SAMPLES per partition.
+static const uint32_t SAMPLE_EVERY = 16;
+static const uint32_t MAX_SAMPLES = 64;
+
+// keys per multiGet, multiPut or multiRemove while moving a partition.
+static const uint32_t COPY_BATCH_KEYS = 1000;
+
+// a move cuts over once a catch up round copies fewer keys than this, or
+// after MAX_CATCH_UP_ROUNDS rounds.
+static const uint32_t CUT_OVER_KEYS = 1000;
+static const uint32_t MAX_CATCH_UP_ROUNDS = 10;
+
+static __thread uint32_t numThreadCalls;
+
+/**
+ * A partition that balance() wants to split.
+ */
+struct Candidate {
+    std::string mapName;
+    std::string startKey;
+    bool hot;
+};
+
+static const std::string& keyOf(const std::string& key)
+{
+    return key;
+}
+
+static const std::string& keyOf(const Record& record)
+{
+    return record.key;
+}
+
+static size_t bytesOf(const std::string& key)
+{
+    return 0;
+}
+
+static size_t bytesOf(const Record& record)
+{
+    return record.key.size() + record.value.size();
+}
+
+static void appendUint32(std::string& out, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back((char)(value >> shift));
+    }
+}
+
+static bool readUint32(const std::string& in, size_t& pos, uint32_t& value)
+{
+    if (pos + 4 > in.size()) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        value = (value << 8) | (unsigned char)in[pos++];
+    }
+    return true;
+}
+
+static std::string escape(const std::string& data)
+{
+    std::string out;
+    for (size_t i = 0; i < data.size(); i++) {
+        unsigned char c = data[i];
+        if (c > ' ' && c < 0x7f && c != '\\') {
+            out.push_back(c);
+        } else {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\x%02x", c);
+            out.append(buf);
+        }
+    }
+    return out;
+}
+
+RangeRouter::Options::
+Options() :
+    splitBytes(64 * 1024 * 1024),
+    splitOpsPerSec(5000),
+    balanceSec(10),
+    copyBatchBytes(1024 * 1024)
+{
+}
+
+RangeRouter::Partition::
+Partition(uint32_t backend) :
+    backend(backend),
+    ops(0),
+    opsPerSec(0),
+    bytes(0),
+    migrating(false)
+{
+}
+
+RangeRouter::
+RangeRouter(const std::vector<std::string>& backends,
+            const MultiplexedClient::Options& clientOptions,
+            const Options& options) :
+    backendNames_(backends),
+    options_(options),
+    numSplits_(0),
+    numMigrations_(0),
+    numMigratedRecords_(0),
+    numErrors_(0),
+    lastBalance_(boost::get_system_time())
+{
+    if (backends.empty()) {
+        fprintf(stderr, "RangeRouter needs at least one backend\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < backends.size(); i++) {
+        size_t colon = backends[i].rfind(':');
+        if (colon == std::string::npos) {
+            fprintf(stderr, "invalid backend: %s (expected host:port)\n", backends[i].c_str());
+            exit(1);
+        }
+        uint16_t port = atoi(backends[i].c_str() + colon + 1);
+        backends_.push_back(new MultiplexedClient(backends[i].substr(0, colon), port, clientOptions));
+    }
+    load();
+    if (options_.balanceSec > 0) {
+        balancer_.reset(new boost::thread(&RangeRouter::run, this));
+    }
+}
+
+RangeRouter::
+~RangeRouter()
+{
+    if (balancer_) {
+        balancer_->interrupt();
+        balancer_->join();
+    }
+}
+
+ResponseCode::type RangeRouter::
+ping()
+{
+    std::vector<Future<ResponseCode::type> > futures;
+    for (size_t i = 0; i < backends_.size(); i++) {
+        futures.push_back(backends_[i].ping());
+    }
+    try {
+        for (size_t i = 0; i < futures.size(); i++) {
+            if (futures[i].get() != ResponseCode::Success) {
+                return futures[i].get();
+            }
+        }
+    } catch (const std::exception& e) {
+        fail("ping", e);
+        return ResponseCode::Error;
+    }
+    return ResponseCode::Success;
+}
+
+ResponseCode::type RangeRouter::
+addMap(const std::string& mapName)
+{
+    if (mapName == META_MAP) {
+        return ResponseCode::MapExists;
+    }
+    boost::unique_lock<boost::shared_mutex> lock(mapsMutex_);
+    if (maps_.find(mapName) != maps_.end()) {
+        return ResponseCode::MapExists;
+    }
+    // the drop would remove what this adds.
+    if (droppingMaps_.count(mapName) > 0) {
+        fprintf(stderr, "addMap of %s while it's being dropped\n", mapName.c_str());
+        return ResponseCode::Error;
+    }
+    std::vector<Future<ResponseCode::type> > futures;
+    for (size_t i = 0; i < backends_.size(); i++) {
+        futures.push_back(backends_[i].addMap(mapName));
+    }
+    try {
+        for (size_t i = 0; i < futures.size(); i++) {
+            // a backend may still have the map from an earlier dropMap
+            // that didn't reach it.
+            if (futures[i].get() != ResponseCode::Success &&
+                futures[i].get() != ResponseCode::MapExists) {
+                return futures[i].get();
+            }
+        }
+    } catch (const std::exception& e) {
+        fail("addMap", e);
+        return ResponseCode::Error;
+    }
+    boost::shared_ptr<RangeMap> map(new RangeMap());
+    uint32_t backend = boost::hash<std::string>()(mapName) % backends_.size();
+    map->partitions.insert(std::make_pair(std::string(), Partition(backend)));
+    ResponseCode::type rc = save(mapName, *map);
+    if (rc == ResponseCode::Success) {
+        maps_[mapName] = map;
+    }
+    return rc;
+}
+
+ResponseCode::type RangeRouter::
+dropMap(const std::string& mapName)
+{
+    boost::shared_ptr<RangeMap> map;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mapsMutex_);
+        std::map<std::string, boost::shared_ptr<RangeMap> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        map = itr->second;
+        maps_.erase(itr);
+        droppingMaps_.insert(mapName);
+    }
+
+    ResponseCode::type rc = ResponseCode::Success;
+    {
+        // wait for the calls in progress.
+        boost::unique_lock<boost::shared_mutex> lock(map->mutex);
+        map->dropped = true;
+        std::vector<Future<ResponseCode::type> > futures;
+        futures.push_back(backends_[0].remove(META_MAP, mapName));
+        for (size_t i = 0; i < backends_.size(); i++) {
+            futures.push_back(backends_[i].dropMap(mapName));
+        }
+        // every call has to be over before the name can be added again.
+        for (size_t i = 0; i < futures.size(); i++) {
+            try {
+                futures[i].get();
+            } catch (const std::exception& e) {
+                fail("dropMap", e);
+                rc = ResponseCode::Error;
+            }
+        }
+    }
+    boost::unique_lock<boost::shared_mutex> lock(mapsMutex_);
+    droppingMaps_.erase(mapName);
+    return rc;
+}
+
+void RangeRouter::
+listMaps(StringListResponse& _return)
+{
+    boost::shared_lock<boost::shared_mutex> lock(mapsMutex_);
+    _return.values.clear();
+    for (std::map<std::string, boost::shared_ptr<RangeMap> >::iterator itr = maps_.begin();
+         itr != maps_.end(); itr++) {
+        _return.values.push_back(itr->first);
+    }
+    _return.responseCode = ResponseCode::Success;
+}
+
+void RangeRouter::
+scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+     const std::string& startKey, const bool startKeyIncluded,
+     const std::string& endKey, const bool endKeyIncluded,
+     const int32_t maxRecords, const int32_t maxBytes)
+{
+    scanWithOptions(_return, mapName, order, startKey, startKeyIncluded,
+                    endKey, endKeyIncluded, maxRecords, maxBytes, ScanOptions());
+}
+
+void RangeRouter::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+                const std::string& startKey, const bool startKeyIncluded,
+                const std::string& endKey, const bool endKeyIncluded,
+                const int32_t maxRecords, const int32_t maxBytes,
+                const ScanOptions& options)
+{
+    RecordListSink sink(_return);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+void RangeRouter::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
+           const std::string& startKey, const bool startKeyIncluded,
+           const std::string& endKey, const bool endKeyIncluded,
+           const int32_t maxRecords, const int32_t maxBytes,
+           const ScanOptions& options)
+{
+    PackedRecordSink sink(_return, options.sharedKeyPrefixes,
+                          PackedRecordSink::wantsCompressedValues(options));
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+}
+
+/**
+ * Scans the overlapping partitions one after the other in scan order,
+ * each one clamped to its own range, until one of them has more records
+ * than fit in the response. Filters run on the backends, so maxExamined
+ * applies to each partition's scan. Backends return packed records,
+ * which are copied into the sink once.
+ */
+void RangeRouter::
+scanInto(ScanSink& sink, const std::string& mapName, const ScanOrder::type order,
+         const std::string& startKey, const bool startKeyIncluded,
+         const std::string& endKey, const bool endKeyIncluded,
+         const int32_t maxRecords, const int32_t maxBytes,
+         const ScanOptions& options)
+{
+    ScanFilter filter(options);
+    if (!filter.valid()) {
+        sink.setResponseCode(ResponseCode::Error);
+        return;
+    }
+
+    // only the partitions that can hold keys with the prefix are visited.
+    std::string low = startKey;
+    bool lowIncluded = startKeyIncluded;
+    std::string high = endKey;
+    bool highIncluded = endKeyIncluded;
+    if (!filter.narrowRange(low, lowIncluded, high, highIncluded)) {
+        sink.setResponseCode(ResponseCode::ScanEnded);
+        return;
+    }
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        sink.setResponseCode(ResponseCode::MapNotFound);
+        return;
+    }
+    boost::shared_lock<boost::shared_mutex> lock(map->mutex);
+    if (map->dropped) {
+        sink.setResponseCode(ResponseCode::MapNotFound);
+        return;
+    }
+
+    // [first, last] are the partitions that overlap the range.
+    Partitions::iterator first = findPartition(*map, low);
+    Partitions::iterator last = high.empty() ? --map->partitions.end() : findPartition(*map, high);
+    if (!high.empty() && !highIncluded && last->first == high && last != first) {
+        last--;
+    }
+    if (!low.empty() && !high.empty() && low > high) {
+        last = first;
+    }
+    ScanOptions backendOptions = options;
+    backendOptions.compressedValues = sink.compressedValues();
+    bool ascending = order == ScanOrder::Ascending;
+    Partitions::iterator itr = ascending ? first : last;
+    std::string lastKey;    // of the last record added
+    while (true) {
+        Partition& partition = itr->second;
+        std::string partitionEnd = endOf(*map, itr);
+        std::string start = low;
+        bool startIncluded = lowIncluded;
+        if (itr->first > low) {
+            start = itr->first;
+            startIncluded = true;
+        }
+        std::string end = high;
+        bool endIncluded = highIncluded;
+        if (!partitionEnd.empty() && (high.empty() || partitionEnd <= high)) {
+            end = partitionEnd;
+            endIncluded = false;
+        }
+        record(partition, start, 0);
+        PackedRecordListResponse response;
+        try {
+            response = backends_[partition.backend].scanPacked(
+                mapName, order, start, startIncluded, end, endIncluded,
+                maxRecords > 0 ? maxRecords - (int32_t)sink.size() : 0,
+                maxBytes > 0 ? maxBytes - (int32_t)sink.bytes() : 0, backendOptions).get();
+        } catch (const std::exception& e) {
+            fail("scan", e);
+            sink.clear();
+            sink.setResponseCode(ResponseCode::Error);
+            return;
+        }
+        if (response.responseCode != ResponseCode::Success &&
+            response.responseCode != ResponseCode::ScanEnded) {
+            sink.clear();
+            sink.setResponseCode(response.responseCode);
+            return;
+        }
+        PackedRecordReader reader(response.records);
+        if (!reader.valid() || (reader.compressedValues() && !sink.compressedValues())) {
+            fprintf(stderr, "malformed scanPacked response from backend %u\n", partition.backend);
+            sink.clear();
+            sink.setResponseCode(ResponseCode::Error);
+            return;
+        }
+        while (reader.next()) {
+            sink.add(reader);
+            lastKey.assign(reader.key(), reader.keySize());
+        }
+        if (response.responseCode == ResponseCode::Success || itr == (ascending ? last : first)) {
+            sink.setResponseCode(response.responseCode);
+            if (response.responseCode == ResponseCode::Success) {
+                sink.setResumeKey(response.resumeKey.empty() ? lastKey : response.resumeKey);
+            }
+            return;
+        }
+        if (sink.full(maxRecords, maxBytes)) {
+            sink.setResponseCode(ResponseCode::Success);
+            sink.setResumeKey(lastKey);
+            return;
+        }
+        if (ascending) {
+            itr++;
+        } else {
+            itr--;
+        }
+    }
+}
+
+void RangeRouter::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    boost::shared_lock<boost::shared_mutex> lock(map->mutex);
+    if (map->dropped) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    Partition& partition = findPartition(*map, key)->second;
+    record(partition, key, 0);
+    try {
+        _return = backends_[partition.backend].get(mapName, key).get();
+    } catch (const std::exception& e) {
+        fail("get", e);
+        _return.responseCode = ResponseCode::Error;
+    }
+}
+
+void RangeRouter::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+         const int64_t offset, const int32_t length)
+{
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    boost::shared_lock<boost::shared_mutex> lock(map->mutex);
+    if (map->dropped) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    Partition& partition = findPartition(*map, key)->second;
+    record(partition, key, 0);
+    try {
+        _return = backends_[partition.backend].getRange(mapName, key, offset, length).get();
+    } catch (const std::exception& e) {
+        fail("getRange", e);
+        _return.responseCode = ResponseCode::Error;
+    }
+}
+
+ResponseCode::type RangeRouter::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return write(mapName, key, key.size() + value.size(),
+                 boost::bind(&MultiplexedClient::put, _1, mapName, key, value));
+}
+
+ResponseCode::type RangeRouter::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return write(mapName, key, key.size() + value.size(),
+                 boost::bind(&MultiplexedClient::insert, _1, mapName, key, value));
+}
+
+ResponseCode::type RangeRouter::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    return write(mapName, key, key.size() + value.size(),
+                 boost::bind(&MultiplexedClient::update, _1, mapName, key, value));
+}
+
+/**
+ * The pieces of an upload go to the partition's backend like other
+ * writes. An upload that a migration moves midway fails with Error, and
+ * starts over at offset 0 on the new backend.
+ */
+ResponseCode::type RangeRouter::
+putChunk(const std::string& mapName, const std::string& key, const int64_t offset,
+         const std::string& data, const bool last)
+{
+    return write(mapName, key, key.size() + data.size(),
+                 boost::bind(&MultiplexedClient::putChunk, _1, mapName, key, offset, data, last));
+}
+
+ResponseCode::type RangeRouter::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    return write(mapName, key, key.size() + data.size(),
+                 boost::bind(&MultiplexedClient::append, _1, mapName, key, data));
+}
+
+ResponseCode::type RangeRouter::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+        const std::string& data)
+{
+    return write(mapName, key, key.size() + data.size(),
+                 boost::bind(&MultiplexedClient::writeAt, _1, mapName, key, offset, data));
+}
+
+ResponseCode::type RangeRouter::
+remove(const std::string& mapName, const std::string& key)
+{
+    return write(mapName, key, 0, boost::bind(&MultiplexedClient::remove, _1, mapName, key));
+}
+
+void RangeRouter::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName,
+         const std::vector<std::string>& keys)
+{
+    _return.assign(keys.size(), BinaryResponse());
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            _return[i].responseCode = ResponseCode::MapNotFound;
+        }
+        return;
+    }
+    boost::shared_lock<boost::shared_mutex> lock(map->mutex);
+    if (map->dropped) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            _return[i].responseCode = ResponseCode::MapNotFound;
+        }
+        return;
+    }
+    std::vector<std::vector<std::string> > keysByBackend(backends_.size());
+    std::vector<std::vector<size_t> > positionsByBackend(backends_.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        Partition& partition = findPartition(*map, keys[i])->second;
+        record(partition, keys[i], 0);
+        keysByBackend[partition.backend].push_back(keys[i]);
+        positionsByBackend[partition.backend].push_back(i);
+    }
+    std::vector<Future<std::vector<BinaryResponse> > > futures(backends_.size());
+    for (size_t i = 0; i < backends_.size(); i++) {
+        if (!keysByBackend[i].empty()) {
+            futures[i] = backends_[i].multiGet(mapName, keysByBackend[i]);
+        }
+    }
+    for (size_t i = 0; i < backends_.size(); i++) {
+        if (!futures[i].valid()) {
+            continue;
+        }
+        try {
+            const std::vector<BinaryResponse>& responses = futures[i].get();
+            for (size_t j = 0; j < positionsByBackend[i].size(); j++) {
+                if (j < responses.size()) {
+                    _return[positionsByBackend[i][j]] = responses[j];
+                } else {
+                    _return[positionsByBackend[i][j]].responseCode = ResponseCode::Error;
+                }
+            }
+        } catch (const std::exception& e) {
+            fail("multiGet", e);
+            for (size_t j = 0; j < positionsByBackend[i].size(); j++) {
+                _return[positionsByBackend[i][j]].responseCode = ResponseCode::Error;
+            }
+        }
+    }
+}
+
+void RangeRouter::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+         const std::vector<Record>& records)
+{
+    multiWrite(_return, &MultiplexedClient::multiPut, mapName, records);
+}
+
+void RangeRouter::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    multiWrite(_return, &MultiplexedClient::multiInsert, mapName, records);
+}
+
+void RangeRouter::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<Record>& records)
+{
+    multiWrite(_return, &MultiplexedClient::multiUpdate, mapName, records);
+}
+
+void RangeRouter::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName,
+            const std::vector<std::string>& keys)
+{
+    multiWrite(_return, &MultiplexedClient::multiRemove, mapName, keys);
+}
+
+void RangeRouter::
+getStats(StatsResponse& _return)
+{
+    std::string lines;
+    int64_t numPartitions = 0;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mapsMutex_);
+        for (std::map<std::string, boost::shared_ptr<RangeMap> >::iterator itr = maps_.begin();
+             itr != maps_.end(); itr++) {
+            boost::shared_lock<boost::shared_mutex> mapLock(itr->second->mutex);
+            Partitions& partitions = itr->second->partitions;
+            for (Partitions::iterator partition = partitions.begin();
+                 partition != partitions.end(); partition++) {
+                char buf[128];
+                snprintf(buf, sizeof(buf), " %s %lu %lu%s\n",
+                         backendNames_[partition->second.backend].c_str(),
+                         (unsigned long)__atomic_load_n(&partition->second.opsPerSec, __ATOMIC_RELAXED),
+                         (unsigned long)__atomic_load_n(&partition->second.bytes, __ATOMIC_RELAXED),
+                         partition->second.migrating ? " migrating" : "");
+                lines += escape(itr->first) + " " + escape(partition->first) + buf;
+                numPartitions++;
+            }
+        }
+    }
+    _return.counters["router.splits"] = numSplits_;
+    _return.counters["router.migrations"] = numMigrations_;
+    _return.counters["router.migratedRecords"] = numMigratedRecords_;
+    _return.counters["router.partitions"] = numPartitions;
+    _return.counters["router.errors"] = numErrors_;
+    _return.properties["router.partitions"] = lines;
+    _return.responseCode = ResponseCode::Success;
+}
+
+void RangeRouter::
+getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const int32_t numSplits)
+{
+    _return.values.clear();
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    boost::shared_lock<boost::shared_mutex> lock(map->mutex);
+    if (map->dropped) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+
+    Partitions::iterator first = findPartition(*map, startKey);
+    Partitions::iterator last = endKey.empty() ? --map->partitions.end() : findPartition(*map, endKey);
+    if (!endKey.empty() && startKey > endKey) {
+        last = first;
+    }
+    last++;
+    std::vector<Partitions::iterator> partitions;
+    std::vector<Future<BinaryListResponse> > futures;
+    for (Partitions::iterator itr = first; itr != last; itr++) {
+        std::string start = std::max(startKey, itr->first);
+        std::string end = endOf(*map, itr);
+        if (end.empty() || (!endKey.empty() && endKey < end)) {
+            end = endKey;
+        }
+        partitions.push_back(itr);
+        futures.push_back(backends_[itr->second.backend].getSplitKeys(mapName, start, end, numSplits));
+    }
+
+    // (bytes before the key, key) of every candidate split key.
+    std::vector<std::pair<double, std::string> > candidates;
+    double total = 0;
+    _return.responseCode = ResponseCode::Success;
+    for (size_t i = 0; i < futures.size(); i++) {
+        BinaryListResponse response;
+        try {
+            response = futures[i].get();
+        } catch (const std::exception& e) {
+            fail("getSplitKeys", e);
+            _return.responseCode = ResponseCode::Error;
+            continue;
+        }
+        if (response.responseCode != ResponseCode::Success) {
+            _return.responseCode = response.responseCode;
+            continue;
+        }
+        if (partitions[i]->first > startKey) {
+            candidates.push_back(std::make_pair(total, partitions[i]->first));
+        }
+        double bytes = std::max((uint64_t)1, __atomic_load_n(&partitions[i]->second.bytes, __ATOMIC_RELAXED));
+        size_t numKeys = response.values.size();
+        for (size_t j = 0; j < numKeys; j++) {
+            candidates.push_back(std::make_pair(total + bytes * (j + 1) / (numKeys + 1),
+                                                response.values[j]));
+        }
+        total += bytes;
+    }
+    if (_return.responseCode != ResponseCode::Success) {
+        return;
+    }
+    int32_t parts = std::min(std::max(numSplits, 1), (int32_t)MAX_SPLITS);
+    size_t next = 0;
+    for (int32_t i = 1; i < parts && next < candidates.size(); i++) {
+        double target = total * i / parts;
+        while (next + 1 < candidates.size() && candidates[next].first < target) {
+            next++;
+        }
+        if (_return.values.empty() || _return.values.back() < candidates[next].second) {
+            _return.values.push_back(candidates[next].second);
+        }
+        next++;
+    }
+}
+
+void RangeRouter::
+estimateCount(EstimateResponse& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, &MultiplexedClient::estimateCount, mapName, startKey, endKey, exact);
+}
+
+void RangeRouter::
+estimateSize(EstimateResponse& _return, const std::string& mapName,
+             const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, &MultiplexedClient::estimateSize, mapName, startKey, endKey, exact);
+}
+
+ResponseCode::type RangeRouter::
+split(const std::string& mapName, const std::string& splitKey)
+{
+    boost::mutex::scoped_lock lock(balanceMutex_);
+    return splitLocked(mapName, splitKey);
+}
+
+ResponseCode::type RangeRouter::
+migrate(const std::string& mapName, const std::string& startKey, uint32_t backend)
+{
+    boost::mutex::scoped_lock lock(balanceMutex_);
+    return migrateLocked(mapName, startKey, backend);
+}
+
+void RangeRouter::
+balance()
+{
+    boost::mutex::scoped_lock balanceLock(balanceMutex_);
+    boost::system_time now = boost::get_system_time();
+    uint64_t elapsedSec = std::max<int64_t>((now - lastBalance_).total_seconds(), 1);
+    lastBalance_ = now;
+
+    std::vector<std::pair<std::string, boost::shared_ptr<RangeMap> > > maps;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mapsMutex_);
+        maps.assign(maps_.begin(), maps_.end());
+    }
+    std::vector<Candidate> candidates;
+    for (size_t i = 0; i < maps.size(); i++) {
+        boost::shared_lock<boost::shared_mutex> lock(maps[i].second->mutex);
+        Partitions& partitions = maps[i].second->partitions;
+        for (Partitions::iterator itr = partitions.begin(); itr != partitions.end(); itr++) {
+            Partition& partition = itr->second;
+            uint64_t opsPerSec = __sync_fetch_and_and(&partition.ops, 0) / elapsedSec;
+            __atomic_store_n(&partition.opsPerSec, opsPerSec, __ATOMIC_RELAXED);
+            if (partition.migrating) {
+                continue;
+            }
+            if (opsPerSec > options_.splitOpsPerSec ||
+                __atomic_load_n(&partition.bytes, __ATOMIC_RELAXED) > options_.splitBytes) {
+                Candidate candidate;
+                candidate.mapName = maps[i].first;
+                candidate.startKey = itr->first;
+                candidate.hot = opsPerSec > options_.splitOpsPerSec;
+                candidates.push_back(candidate);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const Candidate& candidate = candidates[i];
+        boost::shared_ptr<RangeMap> map = findMap(candidate.mapName);
+        std::string splitKey;
+        if (!map || !chooseSplitKey(candidate.mapName, *map, candidate.startKey, candidate.hot, splitKey) ||
+            splitLocked(candidate.mapName, splitKey) != ResponseCode::Success) {
+            continue;
+        }
+        uint32_t backend;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(map->mutex);
+            backend = map->partitions.find(splitKey)->second.backend;
+        }
+        uint32_t target = leastLoadedBackend(backend);
+        if (target != backend) {
+            migrateLocked(candidate.mapName, splitKey, target);
+        }
+    }
+}
+
+boost::shared_ptr<RangeRouter::RangeMap> RangeRouter::
+findMap(const std::string& mapName)
+{
+    boost::shared_lock<boost::shared_mutex> lock(mapsMutex_);
+    std::map<std::string, boost::shared_ptr<RangeMap> >::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return boost::shared_ptr<RangeMap>();
+    }
+    return itr->second;
+}
+
+RangeRouter::Partitions::iterator RangeRouter::
+findPartition(RangeMap& map, const std::string& key)
+{
+    // the first partition starts at "", so there's always one.
+    Partitions::iterator itr = map.partitions.upper_bound(key);
+    return --itr;
+}
+
+/**
+ * Returns the key the partition ends at (excluded), or "" for the last
+ * partition.
+ */
+std::string RangeRouter::
+endOf(RangeMap& map, Partitions::iterator partition)
+{
+    partition++;
+    return partition == map.partitions.end() ? std::string() : partition->first;
+}
+
+void RangeRouter::
+record(Partition& partition, const std::string& key, size_t bytes)
+{
+    __sync_fetch_and_add(&partition.ops, 1);
+    if (bytes > 0) {
+        __sync_fetch_and_add(&partition.bytes, bytes);
+    }
+    if (++numThreadCalls % SAMPLE_EVERY == 0) {
+        boost::mutex::scoped_lock lock(samplesMutex_);
+        if (partition.samples.size() < MAX_SAMPLES) {
+            partition.samples.push_back(key);
+        } else {
+            partition.samples[rand() % MAX_SAMPLES] = key;
+        }
+    }
+}
+
+void RangeRouter::
+estimate(EstimateResponse& _return, EstimateCall method, const std::string& mapName,
+         const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    _return.value = 0;
+    _return.exact = true;
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    boost::shared_lock<boost::shared_mutex> lock(map->mutex);
+    if (map->dropped) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+
+    Partitions::iterator first = findPartition(*map, startKey);
+    Partitions::iterator last = endKey.empty() ? --map->partitions.end() : findPartition(*map, endKey);
+    if (!endKey.empty() && last->first == endKey && last != first) {
+        last--;
+    }
+    if (!endKey.empty() && startKey > endKey) {
+        last = first;
+    }
+    last++;
+    std::vector<Future<EstimateResponse> > futures;
+    for (Partitions::iterator itr = first; itr != last; itr++) {
+        std::string start = std::max(startKey, itr->first);
+        std::string end = endOf(*map, itr);
+        if (end.empty() || (!endKey.empty() && endKey < end)) {
+            end = endKey;
+        }
+        futures.push_back((backends_[itr->second.backend].*method)(mapName, start, end, exact));
+    }
+    _return.responseCode = ResponseCode::Success;
+    for (size_t i = 0; i < futures.size(); i++) {
+        try {
+            const EstimateResponse& response = futures[i].get();
+            if (response.responseCode != ResponseCode::Success) {
+                _return.responseCode = response.responseCode;
+            }
+            _return.value += response.value;
+            _return.exact = _return.exact && response.exact;
+        } catch (const std::exception& e) {
+            fail("estimate", e);
+            _return.responseCode = ResponseCode::Error;
+        }
+    }
+}
+
+void RangeRouter::
+logChange(Partition& partition, const std::string& key)
+{
+    if (partition.migrating) {
+        boost::mutex::scoped_lock lock(changesMutex_);
+        partition.changes.insert(key);
+    }
+}
+
+ResponseCode::type RangeRouter::
+write(const std::string& mapName, const std::string& key, size_t bytes, const WriteCall& call)
+{
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        return ResponseCode::MapNotFound;
+    }
+    boost::shared_lock<boost::shared_mutex> lock(map->mutex);
+    if (map->dropped) {
+        return ResponseCode::MapNotFound;
+    }
+    Partition& partition = findPartition(*map, key)->second;
+    record(partition, key, bytes);
+    ResponseCode::type rc;
+    try {
+        rc = call(backends_[partition.backend]).get();
+    } catch (const std::exception& e) {
+        fail("write", e);
+        rc = ResponseCode::Error;
+    }
+    // logged even if it failed, since it may have reached the backend.
+    logChange(partition, key);
+    return rc;
+}
+
+template <class Item>
+void RangeRouter::
+multiWrite(std::vector<ResponseCode::type>& _return,
+           Future<std::vector<ResponseCode::type> >
+               (MultiplexedClient::*method)(const std::string&, const std::vector<Item>&),
+           const std::string& mapName, const std::vector<Item>& items)
+{
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        _return.assign(items.size(), ResponseCode::MapNotFound);
+        return;
+    }
+    boost::shared_lock<boost::shared_mutex> lock(map->mutex);
+    if (map->dropped) {
+        _return.assign(items.size(), ResponseCode::MapNotFound);
+        return;
+    }
+    std::vector<Partition*> partitions(items.size());
+    std::vector<std::vector<Item> > itemsByBackend(backends_.size());
+    std::vector<std::vector<size_t> > positionsByBackend(backends_.size());
+    for (size_t i = 0; i < items.size(); i++) {
+        partitions[i] = &findPartition(*map, keyOf(items[i]))->second;
+        record(*partitions[i], keyOf(items[i]), bytesOf(items[i]));
+        itemsByBackend[partitions[i]->backend].push_back(items[i]);
+        positionsByBackend[partitions[i]->backend].push_back(i);
+    }
+    std::vector<Future<std::vector<ResponseCode::type> > > futures(backends_.size());
+    for (size_t i = 0; i < backends_.size(); i++) {
+        if (!itemsByBackend[i].empty()) {
+            futures[i] = (backends_[i].*method)(mapName, itemsByBackend[i]);
+        }
+    }
+    _return.assign(items.size(), ResponseCode::Error);
+    for (size_t i = 0; i < backends_.size(); i++) {
+        if (!futures[i].valid()) {
+            continue;
+        }
+        try {
+            const std::vector<ResponseCode::type>& results = futures[i].get();
+            for (size_t j = 0; j < positionsByBackend[i].size() && j < results.size(); j++) {
+                _return[positionsByBackend[i][j]] = results[j];
+            }
+        } catch (const std::exception& e) {
+            fail("multi-key write", e);
+        }
+    }
+    for (size_t i = 0; i < items.size(); i++) {
+        logChange(*partitions[i], keyOf(items[i]));
+    }
+}
+
+ResponseCode::type RangeRouter::
+splitLocked(const std::string& mapName, const std::string& splitKey)
+{
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        return ResponseCode::MapNotFound;
+    }
+    boost::unique_lock<boost::shared_mutex> lock(map->mutex);
+    if (map->dropped) {
+        return ResponseCode::MapNotFound;
+    }
+    Partitions::iterator itr = findPartition(*map, splitKey);
+    if (itr->first == splitKey) {
+        return ResponseCode::Success;
+    }
+    Partition& lower = itr->second;
+    if (lower.migrating) {
+        return ResponseCode::Error;
+    }
+    Partition& upper = map->partitions.insert(std::make_pair(splitKey, Partition(lower.backend))).first->second;
+    upper.opsPerSec = lower.opsPerSec / 2;
+    lower.opsPerSec -= upper.opsPerSec;
+    upper.bytes = lower.bytes / 2;
+    lower.bytes -= upper.bytes;
+    {
+        boost::mutex::scoped_lock samplesLock(samplesMutex_);
+        std::vector<std::string> samples;
+        samples.swap(lower.samples);
+        for (size_t i = 0; i < samples.size(); i++) {
+            (samples[i] < splitKey ? lower : upper).samples.push_back(samples[i]);
+        }
+    }
+    __sync_fetch_and_add(&numSplits_, 1);
+    return save(mapName, *map);
+}
+
+ResponseCode::type RangeRouter::
+migrateLocked(const std::string& mapName, const std::string& startKey, uint32_t target)
+{
+    if (target >= backends_.size()) {
+        return ResponseCode::Error;
+    }
+    boost::shared_ptr<RangeMap> map = findMap(mapName);
+    if (!map) {
+        return ResponseCode::MapNotFound;
+    }
+    Partition* partition;
+    uint32_t source;
+    std::string endKey;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(map->mutex);
+        Partitions::iterator itr = map->partitions.find(startKey);
+        if (map->dropped || itr == map->partitions.end()) {
+            return ResponseCode::RecordNotFound;
+        }
+        partition = &itr->second;
+        if (partition->backend == target) {
+            return ResponseCode::Success;
+        }
+        source = partition->backend;
+        endKey = endOf(*map, itr);
+        // from now on, writes to the partition are logged.
+        partition->migrating = true;
+        boost::mutex::scoped_lock changesLock(changesMutex_);
+        partition->changes.clear();
+    }
+    fprintf(stderr, "moving %s [%s, %s) from %s to %s\n", escape(mapName).c_str(),
+            escape(startKey).c_str(), escape(endKey).c_str(),
+            backendNames_[source].c_str(), backendNames_[target].c_str());
+
+    uint64_t numRecords = 0;
+    try {
+        // left over from a move that didn't finish.
+        deleteRange(target, mapName, startKey, endKey);
+        numRecords = copyRange(source, target, mapName, startKey, endKey);
+        for (uint32_t round = 0; round < MAX_CATCH_UP_ROUNDS; round++) {
+            std::set<std::string> keys;
+            {
+                boost::mutex::scoped_lock changesLock(changesMutex_);
+                keys.swap(partition->changes);
+            }
+            copyKeys(source, target, mapName, keys);
+            if (keys.size() < CUT_OVER_KEYS) {
+                break;
+            }
+        }
+
+        boost::unique_lock<boost::shared_mutex> lock(map->mutex);
+        if (map->dropped) {
+            return ResponseCode::MapNotFound;
+        }
+        std::set<std::string> keys;
+        {
+            boost::mutex::scoped_lock changesLock(changesMutex_);
+            keys.swap(partition->changes);
+        }
+        copyKeys(source, target, mapName, keys);
+        partition->backend = target;
+        partition->migrating = false;
+        if (save(mapName, *map) != ResponseCode::Success) {
+            // keep the data where the stored table says it is.
+            partition->backend = source;
+            throw std::runtime_error("failed to save the partition table");
+        }
+    } catch (const std::exception& e) {
+        fail("move", e);
+        boost::unique_lock<boost::shared_mutex> lock(map->mutex);
+        partition->migrating = false;
+        boost::mutex::scoped_lock changesLock(changesMutex_);
+        partition->changes.clear();
+        return ResponseCode::Error;
+    }
+    try {
+        deleteRange(source, mapName, startKey, endKey);
+    } catch (const std::exception& e) {
+        fail("cleanup after move", e);
+    }
+    __sync_fetch_and_add(&numMigrations_, 1);
+    __sync_fetch_and_add(&numMigratedRecords_, numRecords);
+    return ResponseCode::Success;
+}
+
+/**
+ * Splits a hot partition at the median of its sampled keys, and a large
+ * one at the median of its data, which is found by scanning it. Returns
+ * false if the partition can't or shouldn't be split.
+ */
+bool RangeRouter::
+chooseSplitKey(const std::string& mapName, RangeMap& map, const std::string& startKey,
+               bool hot, std::string& splitKey)
+{
+    uint32_t backend;
+    std::string endKey;
+    std::vector<std::string> samples;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(map.mutex);
+        Partitions::iterator itr = map.partitions.find(startKey);
+        if (map.dropped || itr == map.partitions.end()) {
+            return false;
+        }
+        backend = itr->second.backend;
+        endKey = endOf(map, itr);
+        boost::mutex::scoped_lock samplesLock(samplesMutex_);
+        samples = itr->second.samples;
+    }
+
+    if (hot) {
+        std::sort(samples.begin(), samples.end());
+        std::vector<std::string>::iterator median = samples.begin() + samples.size() / 2;
+        median = std::upper_bound(median, samples.end(), startKey);
+        if (median == samples.end() || (!endKey.empty() && *median >= endKey)) {
+            return false;
+        }
+        splitKey = *median;
+        return true;
+    }
+
+    // the first key of every page, with the bytes before it. A partition
+    // worth splitting has at least 64 pages.
+    std::vector<std::pair<uint64_t, std::string> > pages;
+    int32_t pageBytes = std::min<uint64_t>(options_.copyBatchBytes,
+                                           std::max<uint64_t>(options_.splitBytes / 64, 1));
+    uint64_t bytes = 0;
+    std::string cursor = startKey;
+    bool included = true;
+    try {
+        while (true) {
+            RecordListResponse response = backends_[backend].scan(
+                mapName, ScanOrder::Ascending, cursor, included, endKey, false,
+                0, pageBytes).get();
+            if (response.responseCode != ResponseCode::Success &&
+                response.responseCode != ResponseCode::ScanEnded) {
+                return false;
+            }
+            if (!response.records.empty()) {
+                pages.push_back(std::make_pair(bytes, response.records[0].key));
+                for (size_t i = 0; i < response.records.size(); i++) {
+                    bytes += response.records[i].key.size() + response.records[i].value.size();
+                }
+                cursor = response.records.back().key;
+                included = false;
+            }
+            if (response.responseCode == ResponseCode::ScanEnded || response.records.empty()) {
+                break;
+            }
+        }
+    } catch (const std::exception& e) {
+        fail("measuring a partition", e);
+        return false;
+    }
+    {
+        boost::shared_lock<boost::shared_mutex> lock(map.mutex);
+        Partitions::iterator itr = map.partitions.find(startKey);
+        if (itr != map.partitions.end()) {
+            __atomic_store_n(&itr->second.bytes, bytes, __ATOMIC_RELAXED);
+        }
+    }
+    if (bytes <= options_.splitBytes) {
+        return false;
+    }
+    for (size_t i = 1; i < pages.size(); i++) {
+        if (pages[i].first >= bytes / 2) {
+            splitKey = pages[i].second;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Returns the backend with the fewest calls per second, or the given
+ * backend if no other one has fewer.
+ */
+uint32_t RangeRouter::
+leastLoadedBackend(uint32_t backend)
+{
+    std::vector<uint64_t> loads(backends_.size(), 0);
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mapsMutex_);
+        for (std::map<std::string, boost::shared_ptr<RangeMap> >::iterator itr = maps_.begin();
+             itr != maps_.end(); itr++) {
+            boost::shared_lock<boost::shared_mutex> mapLock(itr->second->mutex);
+            Partitions& partitions = itr->second->partitions;
+            for (Partitions::iterator partition = partitions.begin();
+                 partition != partitions.end(); partition++) {
+                loads[partition->second.backend] +=
+                    __atomic_load_n(&partition->second.opsPerSec, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    uint32_t leastLoaded = backend;
+    for (uint32_t i = 0; i < loads.size(); i++) {
+        if (loads[i] < loads[leastLoaded]) {
+            leastLoaded = i;
+        }
+    }
+    return leastLoaded;
+}
+
+/**
+ * Copies the records in [startKey, endKey) and returns how many there
+ * were. Throws std::exception if a backend call fails.
+ */
+uint64_t RangeRouter::
+copyRange(uint32_t from, uint32_t to, const std::string& mapName,
+          const std::string& startKey, const std::string& endKey)
+{
+    uint64_t numRecords = 0;
+    std::string cursor = startKey;
+    bool included = true;
+    while (true) {
+        RecordListResponse response = backends_[from].scan(
+            mapName, ScanOrder::Ascending, cursor, included, endKey, false,
+            COPY_BATCH_KEYS, options_.copyBatchBytes).get();
+        if (response.responseCode != ResponseCode::Success &&
+            response.responseCode != ResponseCode::ScanEnded) {
+            throw std::runtime_error("scan failed");
+        }
+        if (!response.records.empty()) {
+            std::vector<ResponseCode::type> results =
+                backends_[to].multiPut(mapName, response.records).get();
+            for (size_t i = 0; i < results.size(); i++) {
+                if (results[i] != ResponseCode::Success) {
+                    throw std::runtime_error("multiPut failed");
+                }
+            }
+            numRecords += response.records.size();
+            cursor = response.records.back().key;
+            included = false;
+        }
+        if (response.responseCode == ResponseCode::ScanEnded || response.records.empty()) {
+            return numRecords;
+        }
+    }
+}
+
+/**
+ * Makes keys on backend to the same as on backend from.
+ */
+void RangeRouter::
+copyKeys(uint32_t from, uint32_t to, const std::string& mapName,
+         const std::set<std::string>& keys)
+{
+    std::set<std::string>::const_iterator itr = keys.begin();
+    while (itr != keys.end()) {
+        std::vector<std::string> batch;
+        for (; itr != keys.end() && batch.size() < COPY_BATCH_KEYS; itr++) {
+            batch.push_back(*itr);
+        }
+        std::vector<BinaryResponse> values = backends_[from].multiGet(mapName, batch).get();
+        std::vector<Record> puts;
+        std::vector<std::string> removes;
+        for (size_t i = 0; i < batch.size() && i < values.size(); i++) {
+            if (values[i].responseCode == ResponseCode::Success) {
+                puts.push_back(Record());
+                puts.back().key = batch[i];
+                puts.back().value = values[i].value;
+            } else if (values[i].responseCode == ResponseCode::RecordNotFound) {
+                removes.push_back(batch[i]);
+            } else {
+                throw std::runtime_error("multiGet failed");
+            }
+        }
+        if (!puts.empty()) {
+            std::vector<ResponseCode::type> results = backends_[to].multiPut(mapName, puts).get();
+            for (size_t i = 0; i < results.size(); i++) {
+                if (results[i] != ResponseCode::Success) {
+                    throw std::runtime_error("multiPut failed");
+                }
+            }
+        }
+        if (!removes.empty()) {
+            std::vector<ResponseCode::type> results = backends_[to].multiRemove(mapName, removes).get();
+            for (size_t i = 0; i < results.size(); i++) {
+                if (results[i] != ResponseCode::Success && results[i] != ResponseCode::RecordNotFound) {
+                    throw std::runtime_error("multiRemove failed");
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Removes the records in [startKey, endKey) from backend. Throws
+ * std::exception if a backend call fails.
+ */
+void RangeRouter::
+deleteRange(uint32_t backend, const std::string& mapName,
+            const std::string& startKey, const std::string& endKey)
+{
+    // only the keys are needed, so the values stay on the backend.
+    ScanOptions keysOnly;
+    keysOnly.keysOnly = true;
+    std::string cursor = startKey;
+    bool included = true;
+    while (true) {
+        RecordListResponse response = backends_[backend].scanWithOptions(
+            mapName, ScanOrder::Ascending, cursor, included, endKey, false,
+            COPY_BATCH_KEYS, options_.copyBatchBytes, keysOnly).get();
+        if (response.responseCode != ResponseCode::Success &&
+            response.responseCode != ResponseCode::ScanEnded) {
+            throw std::runtime_error("scan failed");
+        }
+        if (!response.records.empty()) {
+            std::vector<std::string> keys;
+            for (size_t i = 0; i < response.records.size(); i++) {
+                keys.push_back(response.records[i].key);
+            }
+            std::vector<ResponseCode::type> results = backends_[backend].multiRemove(mapName, keys).get();
+            for (size_t i = 0; i < results.size(); i++) {
+                if (results[i] != ResponseCode::Success && results[i] != ResponseCode::RecordNotFound) {
+                    throw std::runtime_error("multiRemove failed");
+                }
+            }
+            cursor = keys.back();
+            included = false;
+        }
+        if (response.responseCode == ResponseCode::ScanEnded || response.records.empty()) {
+            return;
+        }
+    }
+}
+
+/**
+ * Reads the partition tables from META_MAP. Each value is a list of
+ * <start key size> <start key> <backend>, with sizes and backends as
+ * 32-bit big endian integers.
+ */
+void RangeRouter::
+load()
+{
+    try {
+        ResponseCode::type rc = backends_[0].addMap(META_MAP).get();
+        if (rc != ResponseCode::Success && rc != ResponseCode::MapExists) {
+            fprintf(stderr, "failed to create %s on %s\n", META_MAP.c_str(), backendNames_[0].c_str());
+            exit(1);
+        }
+        std::string cursor;
+        bool included = true;
+        while (true) {
+            RecordListResponse response = backends_[0].scan(
+                META_MAP, ScanOrder::Ascending, cursor, included, "", false, 1000, 0).get();
+            if (response.responseCode != ResponseCode::Success &&
+                response.responseCode != ResponseCode::ScanEnded) {
+                fprintf(stderr, "failed to read %s from %s\n", META_MAP.c_str(), backendNames_[0].c_str());
+                exit(1);
+            }
+            for (size_t i = 0; i < response.records.size(); i++) {
+                const Record& record = response.records[i];
+                boost::shared_ptr<RangeMap> map(new RangeMap());
+                size_t pos = 0;
+                uint32_t size, backend;
+                while (readUint32(record.value, pos, size) && pos + size <= record.value.size()) {
+                    std::string startKey = record.value.substr(pos, size);
+                    pos += size;
+                    if (!readUint32(record.value, pos, backend) || backend >= backends_.size()) {
+                        fprintf(stderr, "invalid partition table for %s\n", escape(record.key).c_str());
+                        exit(1);
+                    }
+                    map->partitions.insert(std::make_pair(startKey, Partition(backend)));
+                }
+                if (map->partitions.empty() || map->partitions.begin()->first != "") {
+                    fprintf(stderr, "invalid partition table for %s\n", escape(record.key).c_str());
+                    exit(1);
+                }
+                maps_[record.key] = map;
+            }
+            if (response.responseCode == ResponseCode::ScanEnded || response.records.empty()) {
+                break;
+            }
+            cursor = response.records.back().key;
+            included = false;
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "failed to load the partition tables from %s: %s\n",
+                backendNames_[0].c_str(), e.what());
+        exit(1);
+    }
+}
+
+ResponseCode::type RangeRouter::
+save(const std::string& mapName, RangeMap& map)
+{
+    std::string value;
+    for (Partitions::iterator itr = map.partitions.begin(); itr != map.partitions.end(); itr++) {
+        appendUint32(value, itr->first.size());
+        value.append(itr->first);
+        appendUint32(value, itr->second.backend);
+    }
+    try {
+        ResponseCode::type rc = backends_[0].put(META_MAP, mapName, value).get();
+        if (rc != ResponseCode::Success) {
+            fprintf(stderr, "failed to save the partition table of %s\n", escape(mapName).c_str());
+        }
+        return rc;
+    } catch (const std::exception& e) {
+        fail("saving a partition table", e);
+        return ResponseCode::Error;
+    }
+}
+
+void RangeRouter::
+fail(const std::string& what, const std::exception& e)
+{
+    __sync_fetch_and_add(&numErrors_, 1);
+    fprintf(stderr, "%s failed: %s\n", what.c_str(), e.what());
+}
+
+void RangeRouter::
+run()
+{
+    while (true) {
+        boost::this_thread::sleep(boost::posix_time::seconds(options_.balanceSec));
+        balance();
+    }
+}
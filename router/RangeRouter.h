@@ -0,0 +1,248 @@
+#ifndef RANGE_ROUTER_H
+#define RANGE_ROUTER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "MapKeeper.h"
+#include "MultiplexedClient.h"
+
+class ScanSink;
+
+/**
+ * A MapKeeperIf that spreads every map over several backend servers by
+ * key range.
+ *
+ * Each map is cut into partitions, contiguous key ranges that each live
+ * on one backend. Single and multi key calls go to the backends that own
+ * the keys; scans only visit the partitions that overlap the scanned
+ * range, in order, so results come back sorted as from a single server.
+ * Every backend has every map, and holds the records of the partitions
+ * it owns.
+ *
+ * A new map starts as one partition. Every balanceSec seconds, a
+ * partition that got more than splitOpsPerSec calls per second is split
+ * at the median of its sampled keys, and one that has grown past
+ * splitBytes at the median of its data. The upper half then moves to the
+ * least loaded backend, online:
+ *
+ *   1. copy: the range is scanned on the old backend with a cursor and
+ *      written to the new one in multiPuts, while calls keep going to
+ *      the old backend. Keys written in the meantime are logged.
+ *   2. catch up: the logged keys are read from the old backend and
+ *      written (or removed) on the new one, until few are left.
+ *   3. cut over: calls on the map are held while the last logged keys
+ *      are copied and the partition changes owner, then the range is
+ *      deleted from the old backend.
+ *
+ * The partition table is stored in the __mapkeeper_router map on the
+ * first backend and loaded at startup. A router that stops during a
+ * migration leaves the partition on the old backend; the partial copy
+ * is never read and is overwritten by the next migration.
+ *
+ * Backends are reached through MultiplexedClient, so they have to run
+ * with --server=epoll. Calls return Error if a backend can't be reached.
+ *
+ * getStats() reports router.splits, router.migrations,
+ * router.migratedRecords, router.partitions and router.errors counters,
+ * and a router.partitions property with one line per partition:
+ * <map> <start key> <backend> <calls/sec> <estimated bytes>.
+ */
+class RangeRouter : public mapkeeper::MapKeeperIf {
+public:
+    struct Options {
+        Options();
+        uint64_t splitBytes;     // default 64MB
+        uint32_t splitOpsPerSec; // default 5000
+        uint32_t balanceSec;     // default 10, 0 disables splits and moves
+        uint32_t copyBatchBytes; // default 1MB
+    };
+
+    /**
+     * @param backends "host:port" of each backend.
+     */
+    RangeRouter(const std::vector<std::string>& backends,
+                const MultiplexedClient::Options& clientOptions,
+                const Options& options);
+    ~RangeRouter();
+
+    mapkeeper::ResponseCode::type ping();
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName);
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName);
+    void listMaps(mapkeeper::StringListResponse& _return);
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+                         const mapkeeper::ScanOrder::type order,
+                         const std::string& startKey, const bool startKeyIncluded,
+                         const std::string& endKey, const bool endKeyIncluded,
+                         const int32_t maxRecords, const int32_t maxBytes,
+                         const mapkeeper::ScanOptions& options);
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName,
+                    const mapkeeper::ScanOrder::type order,
+                    const std::string& startKey, const bool startKeyIncluded,
+                    const std::string& endKey, const bool endKeyIncluded,
+                    const int32_t maxRecords, const int32_t maxBytes,
+                    const mapkeeper::ScanOptions& options);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+    void getRange(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length);
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key,
+                                           const int64_t offset, const std::string& data, const bool last);
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key,
+                                          const int64_t offset, const std::string& data);
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                  const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName,
+                     const std::vector<std::string>& keys);
+    void getStats(mapkeeper::StatsResponse& _return);
+
+    /**
+     * Asks the backend of every partition that overlaps the range for
+     * numSplits parts of its piece, and picks the split keys from those
+     * and the partition boundaries, weighing each partition by its
+     * estimated bytes (in full, even if the range only covers part of
+     * it).
+     */
+    void getSplitKeys(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const int32_t numSplits);
+
+    /**
+     * Sums the answers of the backends for each partition that overlaps
+     * the range, clamped to the partition.
+     */
+    void estimateCount(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                       const std::string& startKey, const std::string& endKey, const bool exact);
+    void estimateSize(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const bool exact);
+
+    /**
+     * Splits the partition that contains splitKey so that a new one
+     * starts at splitKey, on the same backend.
+     */
+    mapkeeper::ResponseCode::type split(const std::string& mapName, const std::string& splitKey);
+
+    /**
+     * Moves the partition that starts at startKey to backend, as
+     * described above. Returns once the move is done.
+     */
+    mapkeeper::ResponseCode::type migrate(const std::string& mapName, const std::string& startKey,
+                                          uint32_t backend);
+
+    /**
+     * Splits hot and large partitions and moves them to the least
+     * loaded backend. Runs every balanceSec seconds.
+     */
+    void balance();
+
+private:
+    struct Partition {
+        Partition(uint32_t backend);
+        uint32_t backend;
+        uint64_t ops;          // calls since the last balance()
+        uint64_t opsPerSec;    // as of the last balance()
+        uint64_t bytes;        // grows with writes, measured before splits
+        // ops, opsPerSec and bytes change under the shared map lock, so
+        // they're read and written atomically.
+        bool migrating;
+        std::set<std::string> changes;    // keys written while migrating;
+                                          // protected by changesMutex_
+        std::vector<std::string> samples; // protected by samplesMutex_
+    };
+
+    // by start key; a partition ends where the next one starts.
+    typedef std::map<std::string, Partition> Partitions;
+
+    struct RangeMap {
+        RangeMap() : dropped(false) {}
+        // held shared by calls, and exclusively to change the partitions.
+        boost::shared_mutex mutex;
+        Partitions partitions;
+        bool dropped;
+    };
+
+    typedef boost::function<Future<mapkeeper::ResponseCode::type> (MultiplexedClient&)> WriteCall;
+    typedef Future<mapkeeper::EstimateResponse> (MultiplexedClient::*EstimateCall)(
+        const std::string&, const std::string&, const std::string&, const bool);
+
+    void scanInto(ScanSink& sink, const std::string& mapName, const mapkeeper::ScanOrder::type order,
+                  const std::string& startKey, const bool startKeyIncluded,
+                  const std::string& endKey, const bool endKeyIncluded,
+                  const int32_t maxRecords, const int32_t maxBytes,
+                  const mapkeeper::ScanOptions& options);
+    boost::shared_ptr<RangeMap> findMap(const std::string& mapName);
+    Partitions::iterator findPartition(RangeMap& map, const std::string& key);
+    static std::string endOf(RangeMap& map, Partitions::iterator partition);
+    void record(Partition& partition, const std::string& key, size_t bytes);
+    void estimate(mapkeeper::EstimateResponse& _return, EstimateCall method, const std::string& mapName,
+                  const std::string& startKey, const std::string& endKey, const bool exact);
+    void logChange(Partition& partition, const std::string& key);
+    mapkeeper::ResponseCode::type write(const std::string& mapName, const std::string& key,
+                                        size_t bytes, const WriteCall& call);
+    template <class Item>
+    void multiWrite(std::vector<mapkeeper::ResponseCode::type>& _return,
+                    Future<std::vector<mapkeeper::ResponseCode::type> >
+                        (MultiplexedClient::*method)(const std::string&, const std::vector<Item>&),
+                    const std::string& mapName, const std::vector<Item>& items);
+
+    mapkeeper::ResponseCode::type splitLocked(const std::string& mapName, const std::string& splitKey);
+    mapkeeper::ResponseCode::type migrateLocked(const std::string& mapName, const std::string& startKey,
+                                                uint32_t backend);
+    bool chooseSplitKey(const std::string& mapName, RangeMap& map, const std::string& startKey,
+                        bool hot, std::string& splitKey);
+    uint32_t leastLoadedBackend(uint32_t backend);
+    uint64_t copyRange(uint32_t from, uint32_t to, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey);
+    void copyKeys(uint32_t from, uint32_t to, const std::string& mapName,
+                  const std::set<std::string>& keys);
+    void deleteRange(uint32_t backend, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey);
+    void load();
+    mapkeeper::ResponseCode::type save(const std::string& mapName, RangeMap& map);
+    void fail(const std::string& what, const std::exception& e);
+    void run();
+
+    std::vector<std::string> backendNames_;
+    boost::ptr_vector<MultiplexedClient> backends_;
+    Options options_;
+
+    boost::shared_mutex mapsMutex_;   // protects maps_ and droppingMaps_
+    std::map<std::string, boost::shared_ptr<RangeMap> > maps_;
+    std::set<std::string> droppingMaps_; // until the backends have dropped them
+
+    boost::mutex changesMutex_;
+    boost::mutex samplesMutex_;
+    boost::mutex balanceMutex_;       // one split or move at a time
+
+    uint64_t numSplits_;
+    uint64_t numMigrations_;
+    uint64_t numMigratedRecords_;
+    uint64_t numErrors_;
+    boost::system_time lastBalance_;
+    boost::scoped_ptr<boost::thread> balancer_;
+};
+
+#endif // RANGE_ROUTER_H
@@ -0,0 +1,62 @@
+/**
+ * Runs RangeRouter behind a Thrift server.
+ *
+ *   mapkeeper_router --backends=host:port[,host:port...] [options]
+ *
+ * Recognized options, in addition to the ones in common/HandlerChain.h
+ * and common/ServerRuntime.h:
+ *
+ *   --backends=<list>              backend servers, which have to run with
+ *                                  --server=epoll
+ *   --backend-connections=<n>      connections to each backend (default 2)
+ *   --backend-timeout-ms=<ms>      deadline for backend calls (default 0,
+ *                                  no deadline)
+ *   --split-mb=<n>                 split partitions larger than this
+ *                                  (default 64)
+ *   --split-ops=<n>                split partitions that get more calls
+ *                                  per second than this (default 5000)
+ *   --balance-sec=<sec>            look for partitions to split and move
+ *                                  this often (default 10, 0 disables it)
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "RangeRouter.h"
+#include "HandlerChain.h"
+#include "ServerRuntime.h"
+
+using namespace ::apache::thrift;
+
+using boost::shared_ptr;
+
+int main(int argc, char **argv) {
+    ServerOptions options;
+    options.parse(argc, argv);
+    std::string list = options.getString("backends", "");
+    if (list.empty()) {
+        fprintf(stderr, "usage: %s --backends=host:port[,host:port...] [options]\n", argv[0]);
+        exit(1);
+    }
+    std::vector<std::string> backends;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        backends.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+
+    MultiplexedClient::Options clientOptions;
+    clientOptions.numConnections = options.getInt("backend-connections", clientOptions.numConnections);
+    clientOptions.timeoutMs = options.getInt("backend-timeout-ms", clientOptions.timeoutMs);
+    RangeRouter::Options routerOptions;
+    routerOptions.splitBytes = options.getInt("split-mb", routerOptions.splitBytes >> 20) << 20;
+    routerOptions.splitOpsPerSec = options.getInt("split-ops", routerOptions.splitOpsPerSec);
+    routerOptions.balanceSec = options.getInt("balance-sec", routerOptions.balanceSec);
+
+    shared_ptr<RangeRouter> handler(new RangeRouter(backends, clientOptions, routerOptions));
+    shared_ptr<TProcessor> processor(buildProcessor(handler, options));
+    runServer(processor, options);
+    return 0;
+}
@@ -1,150 +1,403 @@
-/**
- * This is a stub implementation of the mapkeeper interface that uses 
- * std::map. Data is not persisted. The server is not thread-safe.
- */
-#include <cstdio>
-#include "MapKeeper.h"
-
-#include <boost/thread/shared_mutex.hpp>
-#include <protocol/TBinaryProtocol.h>
-#include <server/TThreadedServer.h>
-#include <transport/TServerSocket.h>
-#include <transport/TBufferTransports.h>
-
-using namespace ::apache::thrift;
-using namespace ::apache::thrift::protocol;
-using namespace ::apache::thrift::transport;
-using namespace ::apache::thrift::server;
-using namespace ::apache::thrift::concurrency;
-
-using boost::shared_ptr;
+#include "StlMapServer.h"
+#include "Projection.h"
+#include "SplitKeys.h"
+#include "ValuePatch.h"
 
 using namespace mapkeeper;
 
-class StlMapServer: virtual public MapKeeperIf {
-public:
-    StlMapServer() {
-    }
+StlMapServer::
+StlMapServer()
+{
+}
+
+ResponseCode::type StlMapServer::
+ping()
+{
+    return ResponseCode::Success;
+}
 
-    ResponseCode::type ping() {
-        return ResponseCode::Success;
+ResponseCode::type StlMapServer::
+addMap(const std::string& mapName)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ != maps_.end()) {
+        return ResponseCode::MapExists;
     }
+    std::map<std::string, std::string> newMap;
+    std::pair<std::string, std::map<std::string, std::string> > entry(mapName, newMap);
+    maps_.insert(entry);
+    return ResponseCode::Success;
+}
 
-    ResponseCode::type addMap(const std::string& mapName) {
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-        itr_ = maps_.find(mapName);
-        if (itr_ != maps_.end()) {
-            return ResponseCode::MapExists;
-        }
-        std::map<std::string, std::string> newMap;
-        std::pair<std::string, std::map<std::string, std::string> > entry(mapName, newMap);
-        maps_.insert(entry);
-        return ResponseCode::Success;
+ResponseCode::type StlMapServer::
+dropMap(const std::string& mapName)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        return ResponseCode::MapNotFound;
     }
+    maps_.erase(itr_);
+    return ResponseCode::Success;
+}
 
-    ResponseCode::type dropMap(const std::string& mapName) {
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-        itr_ = maps_.find(mapName);
-        if (itr_ == maps_.end()) {
-            return ResponseCode::MapNotFound;
-        }
-        maps_.erase(itr_);
-        return ResponseCode::Success;
+void StlMapServer::
+listMaps(StringListResponse& _return)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    for (itr_ = maps_.begin(); itr_ != maps_.end(); itr_++) {
+        _return.values.push_back(itr_->first);
     }
+    _return.responseCode = ResponseCode::Success;
+}
 
-    void listMaps(StringListResponse& _return) {
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-        for (itr_ = maps_.begin(); itr_ != maps_.end(); itr_++) {
-            _return.values.push_back(itr_->first);
-        }
-        _return.responseCode = ResponseCode::Success;
+void StlMapServer::
+scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order, const std::string& startKey, const bool startKeyIncluded, const std::string& endKey, const bool endKeyIncluded, const int32_t maxRecords, const int32_t maxBytes)
+{
+    scanWithOptions(_return, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, ScanOptions());
+}
+
+void StlMapServer::
+scanWithOptions(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order, const std::string& startKey, const bool startKeyIncluded, const std::string& endKey, const bool endKeyIncluded, const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options)
+{
+    RecordListSink sink(_return);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
+void StlMapServer::
+scanPacked(PackedRecordListResponse& _return, const std::string& mapName, const ScanOrder::type order, const std::string& startKey, const bool startKeyIncluded, const std::string& endKey, const bool endKeyIncluded, const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options)
+{
+    PackedRecordSink sink(_return, options.sharedKeyPrefixes);
+    scanInto(sink, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
+void StlMapServer::
+scanInto(ScanSink& sink, const std::string& mapName, const ScanOrder::type order, const std::string& startKey, const bool startKeyIncluded, const std::string& endKey, const bool endKeyIncluded, const int32_t maxRecords, const int32_t maxBytes, const ScanOptions& options)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        sink.setResponseCode(ResponseCode::MapNotFound);
+        return;
+    }
+    std::map<std::string, std::string>& map = itr_->second;
+    ScanFilter filter(options);
+    if (!filter.valid()) {
+        sink.setResponseCode(ResponseCode::Error);
+        return;
+    }
+    std::string start = startKey;
+    bool startIncluded = startKeyIncluded;
+    std::string stop = endKey;
+    bool stopIncluded = endKeyIncluded;
+    if (!filter.narrowRange(start, startIncluded, stop, stopIncluded)) {
+        sink.setResponseCode(ResponseCode::ScanEnded);
+        return;
     }
 
-    void scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order, const std::string& startKey, const bool startKeyIncluded, const std::string& endKey, const bool endKeyIncluded, const int32_t maxRecords, const int32_t maxBytes) {
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    // [begin, end) is the range of records to return.
+    std::map<std::string, std::string>::iterator begin = map.begin();
+    if (!start.empty()) {
+        begin = startIncluded ? map.lower_bound(start) : map.upper_bound(start);
     }
+    std::map<std::string, std::string>::iterator end = map.end();
+    if (!stop.empty()) {
+        end = stopIncluded ? map.upper_bound(stop) : map.lower_bound(stop);
+    }
+    if (!start.empty() && !stop.empty() && start > stop) {
+        end = begin;
+    }
+    if (order == ScanOrder::Ascending) {
+        scanRange(sink, begin, end, maxRecords, maxBytes, options, filter);
+    } else {
+        scanRange(sink, std::map<std::string, std::string>::reverse_iterator(end),
+                  std::map<std::string, std::string>::reverse_iterator(begin), maxRecords, maxBytes, options, filter);
+    }
+}
 
-    void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-        itr_ = maps_.find(mapName);
-        if (itr_ == maps_.end()) {
-            _return.responseCode = ResponseCode::MapNotFound;
+template <typename Iterator>
+void StlMapServer::
+scanRange(ScanSink& sink, Iterator begin, Iterator end, const int32_t maxRecords, const int32_t maxBytes,
+               const ScanOptions& options, ScanFilter& filter)
+{
+    for (Iterator itr = begin; itr != end; itr++) {
+        if (sink.full(maxRecords, maxBytes)) {
+            sink.setResponseCode(ResponseCode::Success);
+            sink.setResumeKey(filter.lastExamined());
             return;
         }
-        recordIterator_ = itr_->second.find(key);
-        if (recordIterator_ == itr_->second.end()) {
-            _return.responseCode = ResponseCode::RecordNotFound;
+        ScanFilter::Verdict verdict = filter.examine(itr->first.data(), itr->first.size(),
+                                                     itr->second.data(), itr->second.size());
+        if (verdict == ScanFilter::Stop) {
+            sink.setResponseCode(ResponseCode::Success);
+            sink.setResumeKey(filter.lastExamined());
             return;
+        } else if (verdict == ScanFilter::Reject) {
+            continue;
         }
-        _return.responseCode = ResponseCode::Success;
-        _return.value = recordIterator_->second;
+        size_t offset;
+        size_t length;
+        projectRange(options, itr->second.size(), offset, length);
+        sink.add(itr->first.data(), itr->first.size(), itr->second.data() + offset, length);
     }
+    sink.setResponseCode(ResponseCode::ScanEnded);
+}
 
-    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-        itr_ = maps_.find(mapName);
-        if (itr_ == maps_.end()) {
-            return ResponseCode::MapNotFound;
-        }
-        itr_->second[key] = value;
-        return ResponseCode::Success;
+void StlMapServer::
+get(BinaryResponse& _return, const std::string& mapName, const std::string& key)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    recordIterator_ = itr_->second.find(key);
+    if (recordIterator_ == itr_->second.end()) {
+        _return.responseCode = ResponseCode::RecordNotFound;
+        return;
     }
+    _return.responseCode = ResponseCode::Success;
+    _return.value = recordIterator_->second;
+}
 
-    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value) {
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-        itr_ = maps_.find(mapName);
-        if (itr_ == maps_.end()) {
-            return ResponseCode::MapNotFound;
-        }
-        if (itr_->second.find(key) != itr_->second.end()) {
-            return ResponseCode::RecordExists;
-        }
-        itr_->second.insert(std::pair<std::string, std::string>(key, value));
-        return ResponseCode::Success;
+void StlMapServer::
+getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key, const int64_t offset, const int32_t length)
+{
+    if (offset < 0 || length < 0) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
     }
+    recordIterator_ = itr_->second.find(key);
+    if (recordIterator_ == itr_->second.end()) {
+        _return.responseCode = ResponseCode::RecordNotFound;
+        return;
+    }
+    _return.responseCode = ResponseCode::Success;
+    const std::string& value = recordIterator_->second;
+    if ((uint64_t)offset < value.size()) {
+        _return.value.assign(value, offset, length);
+    }
+}
 
-    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value) {
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-        itr_ = maps_.find(mapName);
-        if (itr_ == maps_.end()) {
-            return ResponseCode::MapNotFound;
-        }
-        if (itr_->second.find(key) == itr_->second.end()) {
-            return ResponseCode::RecordNotFound;
-        }
-        itr_->second[key] = value;
-        return ResponseCode::Success;
+ResponseCode::type StlMapServer::
+put(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        return ResponseCode::MapNotFound;
     }
+    itr_->second[key] = value;
+    return ResponseCode::Success;
+}
 
-    ResponseCode::type remove(const std::string& mapName, const std::string& key) {
-        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
-        itr_ = maps_.find(mapName);
-        if (itr_ == maps_.end()) {
-            return ResponseCode::MapNotFound;
-        }
-        recordIterator_ = itr_->second.find(key);
-        if (recordIterator_  == itr_->second.end()) {
-            return ResponseCode::RecordNotFound;
-        }
-        itr_->second.erase(recordIterator_);
-        return ResponseCode::Success;
-    }
-
-private:
-    std::map<std::string, std::map<std::string, std::string> > maps_;
-    boost::shared_mutex mutex_; // protect map_
-    std::map<std::string, std::map<std::string, std::string> >::iterator itr_;
-    std::map<std::string, std::string>::iterator recordIterator_;
-};
-
-int main(int argc, char **argv) {
-    int port = 9090;
-    shared_ptr<StlMapServer> handler(new StlMapServer());
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server(processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
-    return 0;
+ResponseCode::type StlMapServer::
+insert(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    if (itr_->second.find(key) != itr_->second.end()) {
+        return ResponseCode::RecordExists;
+    }
+    itr_->second.insert(std::pair<std::string, std::string>(key, value));
+    return ResponseCode::Success;
+}
+
+ResponseCode::type StlMapServer::
+update(const std::string& mapName, const std::string& key, const std::string& value)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    if (itr_->second.find(key) == itr_->second.end()) {
+        return ResponseCode::RecordNotFound;
+    }
+    itr_->second[key] = value;
+    return ResponseCode::Success;
+}
+
+ResponseCode::type StlMapServer::
+append(const std::string& mapName, const std::string& key, const std::string& data)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    recordIterator_ = itr_->second.find(key);
+    if (recordIterator_ == itr_->second.end()) {
+        return ResponseCode::RecordNotFound;
+    }
+    std::string& value = recordIterator_->second;
+    if (!patchValue(value, value.size(), data)) {
+        return ResponseCode::Error;
+    }
+    return ResponseCode::Success;
+}
+
+ResponseCode::type StlMapServer::
+writeAt(const std::string& mapName, const std::string& key, const int64_t offset, const std::string& data)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    recordIterator_ = itr_->second.find(key);
+    if (recordIterator_ == itr_->second.end()) {
+        return ResponseCode::RecordNotFound;
+    }
+    if (!patchValue(recordIterator_->second, offset, data)) {
+        return ResponseCode::Error;
+    }
+    return ResponseCode::Success;
+}
+
+ResponseCode::type StlMapServer::
+putChunk(const std::string& mapName, const std::string& key, const int64_t offset, const std::string& data, const bool last)
+{
+    return ResponseCode::Error;
+}
+
+ResponseCode::type StlMapServer::
+remove(const std::string& mapName, const std::string& key)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    recordIterator_ = itr_->second.find(key);
+    if (recordIterator_  == itr_->second.end()) {
+        return ResponseCode::RecordNotFound;
+    }
+    itr_->second.erase(recordIterator_);
+    return ResponseCode::Success;
+}
+
+void StlMapServer::
+multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName, const std::vector<std::string>& keys)
+{
+    _return.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        get(_return[i], mapName, keys[i]);
+    }
+}
+
+void StlMapServer::
+multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records)
+{
+    _return.clear();
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        _return.push_back(put(mapName, itr->key, itr->value));
+    }
+}
+
+void StlMapServer::
+multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records)
+{
+    _return.clear();
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        _return.push_back(insert(mapName, itr->key, itr->value));
+    }
+}
+
+void StlMapServer::
+multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records)
+{
+    _return.clear();
+    for (std::vector<Record>::const_iterator itr = records.begin(); itr != records.end(); itr++) {
+        _return.push_back(update(mapName, itr->key, itr->value));
+    }
+}
+
+void StlMapServer::
+multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<std::string>& keys)
+{
+    _return.clear();
+    for (std::vector<std::string>::const_iterator itr = keys.begin(); itr != keys.end(); itr++) {
+        _return.push_back(remove(mapName, *itr));
+    }
+}
+
+void StlMapServer::
+getStats(StatsResponse& _return)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    for (itr_ = maps_.begin(); itr_ != maps_.end(); itr_++) {
+        _return.counters["map." + itr_->first + ".records"] = itr_->second.size();
+    }
+    _return.responseCode = ResponseCode::Success;
+}
+
+void StlMapServer::
+getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+                  const std::string& startKey, const std::string& endKey, const int32_t numSplits)
+{
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    itr_ = maps_.find(mapName);
+    if (itr_ == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    std::map<std::string, std::string>& map = itr_->second;
+    std::map<std::string, std::string>::iterator end = 
+        endKey.empty() ? map.end() : map.upper_bound(endKey);
+    SplitKeySampler sampler(numSplits);
+    for (recordIterator_ = map.lower_bound(startKey); recordIterator_ != end; recordIterator_++) {
+        sampler.add(recordIterator_->first, recordIterator_->first.size() + recordIterator_->second.size());
+    }
+    sampler.getSplitKeys(_return.values);
+    _return.responseCode = ResponseCode::Success;
+}
+
+void StlMapServer::
+estimateCount(EstimateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, mapName, startKey, endKey, true);
+}
+
+void StlMapServer::
+estimateSize(EstimateResponse& _return, const std::string& mapName,
+                  const std::string& startKey, const std::string& endKey, const bool exact)
+{
+    estimate(_return, mapName, startKey, endKey, false);
+}
+
+void StlMapServer::
+estimate(EstimateResponse& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey, bool count)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    std::map<std::string, std::map<std::string, std::string> >::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    std::map<std::string, std::string>& map = itr->second;
+    _return.value = 0;
+    _return.exact = true;
+    _return.responseCode = ResponseCode::Success;
+    if (count && startKey.empty() && endKey.empty()) {
+        _return.value = map.size();
+        return;
+    }
+    for (std::map<std::string, std::string>::const_iterator record = map.lower_bound(startKey);
+         record != map.end() && (endKey.empty() || record->first < endKey); record++) {
+        _return.value += count ? 1 : record->first.size() + record->second.size();
+    }
 }
@@ -0,0 +1,70 @@
+/**
+ * This is a stub implementation of the mapkeeper interface that uses 
+ * std::map. Data is not persisted. The server is not thread-safe.
+ */
+#ifndef STL_MAP_SERVER_H
+#define STL_MAP_SERVER_H
+
+#include <map>
+#include <string>
+#include "MapKeeper.h"
+#include "ScanFilter.h"
+#include "ScanSink.h"
+#include <boost/thread/shared_mutex.hpp>
+
+class StlMapServer: virtual public mapkeeper::MapKeeperIf {
+public:
+    StlMapServer();
+    mapkeeper::ResponseCode::type ping();
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName);
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName);
+    void listMaps(mapkeeper::StringListResponse& _return);
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName, const mapkeeper::ScanOrder::type order, const std::string& startKey, const bool startKeyIncluded, const std::string& endKey, const bool endKeyIncluded, const int32_t maxRecords, const int32_t maxBytes);
+    void scanWithOptions(mapkeeper::RecordListResponse& _return, const std::string& mapName, const mapkeeper::ScanOrder::type order, const std::string& startKey, const bool startKeyIncluded, const std::string& endKey, const bool endKeyIncluded, const int32_t maxRecords, const int32_t maxBytes, const mapkeeper::ScanOptions& options);
+    void scanPacked(mapkeeper::PackedRecordListResponse& _return, const std::string& mapName, const mapkeeper::ScanOrder::type order, const std::string& startKey, const bool startKeyIncluded, const std::string& endKey, const bool endKeyIncluded, const int32_t maxRecords, const int32_t maxBytes, const mapkeeper::ScanOptions& options);
+    void scanInto(ScanSink& sink, const std::string& mapName, const mapkeeper::ScanOrder::type order, const std::string& startKey, const bool startKeyIncluded, const std::string& endKey, const bool endKeyIncluded, const int32_t maxRecords, const int32_t maxBytes, const mapkeeper::ScanOptions& options);
+
+    template <typename Iterator>
+    void scanRange(ScanSink& sink, Iterator begin, Iterator end, const int32_t maxRecords, const int32_t maxBytes,
+                   const mapkeeper::ScanOptions& options, ScanFilter& filter);
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key);
+    void getRange(mapkeeper::BinaryResponse& _return, const std::string& mapName, const std::string& key, const int64_t offset, const int32_t length);
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value);
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data);
+    mapkeeper::ResponseCode::type writeAt(const std::string& mapName, const std::string& key, const int64_t offset, const std::string& data);
+
+    /**
+     * Uploads are staged in chunk records, which ChunkingHandler
+     * keeps on top of the map.
+     */
+    mapkeeper::ResponseCode::type putChunk(const std::string& mapName, const std::string& key, const int64_t offset, const std::string& data, const bool last);
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key);
+    void multiGet(std::vector<mapkeeper::BinaryResponse>& _return, const std::string& mapName, const std::vector<std::string>& keys);
+    void multiPut(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, const std::vector<mapkeeper::Record>& records);
+    void multiInsert(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, const std::vector<mapkeeper::Record>& records);
+    void multiUpdate(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, const std::vector<mapkeeper::Record>& records);
+    void multiRemove(std::vector<mapkeeper::ResponseCode::type>& _return, const std::string& mapName, const std::vector<std::string>& keys);
+    void getStats(mapkeeper::StatsResponse& _return);
+    void getSplitKeys(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const int32_t numSplits);
+    void estimateCount(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                       const std::string& startKey, const std::string& endKey, const bool exact);
+    void estimateSize(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const bool exact);
+
+private:
+    /**
+     * Everything is in memory, so the answers are always exact.
+     */
+    void estimate(mapkeeper::EstimateResponse& _return, const std::string& mapName,
+                  const std::string& startKey, const std::string& endKey, bool count);
+
+    std::map<std::string, std::map<std::string, std::string> > maps_;
+    boost::shared_mutex mutex_; // protect map_
+    std::map<std::string, std::map<std::string, std::string> >::iterator itr_;
+    std::map<std::string, std::string>::iterator recordIterator_;
+};
+
+#endif // STL_MAP_SERVER_H
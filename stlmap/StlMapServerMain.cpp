@@ -0,0 +1,20 @@
+/**
+ * Runs StlMapServer behind a Thrift server.
+ */
+#include <cstdio>
+#include "StlMapServer.h"
+#include "HandlerChain.h"
+#include "ServerRuntime.h"
+
+using namespace ::apache::thrift;
+
+using boost::shared_ptr;
+
+int main(int argc, char **argv) {
+    ServerOptions options;
+    options.parse(argc, argv);
+    shared_ptr<StlMapServer> handler(new StlMapServer());
+    shared_ptr<TProcessor> processor(buildProcessor(handler, options));
+    runServer(processor, options);
+    return 0;
+}
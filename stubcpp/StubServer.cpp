@@ -2,9 +2,14 @@
  * This is a stub implementation of the mapkeeper interface that
  * doesn't do anything.
  */
+#include <unistd.h>
 #include "MapKeeper.h"
+#include "EpollServer.h"
+#include "PackedRecords.h"
+#include "ServerOptions.h"
 
 #include <protocol/TBinaryProtocol.h>
+#include <protocol/TCompactProtocol.h>
 #include <server/TServer.h>
 #include <server/TThreadPoolServer.h>
 #include <server/TNonblockingServer.h>
@@ -25,7 +30,12 @@ using namespace mapkeeper;
 
 class StubServer: virtual public MapKeeperIf {
 public:
-    StubServer() {
+    /**
+     * @param valueSize size of the value returned by get and of each
+     *                  record returned by multiGet.
+     */
+    StubServer(uint32_t valueSize) :
+        value_(valueSize, 'v') {
     }
 
     ResponseCode::type ping() {
@@ -52,8 +62,34 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
+    void scanWithOptions(RecordListResponse& _return, const std::string& mapName, 
+              const ScanOrder::type order, const std::string& startKey, 
+              const bool startKeyIncluded, const std::string& endKey, 
+              const bool endKeyIncluded, const int32_t maxRecords, 
+              const int32_t maxBytes, const ScanOptions& options) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void scanPacked(PackedRecordListResponse& _return, const std::string& mapName, 
+              const ScanOrder::type order, const std::string& startKey, 
+              const bool startKeyIncluded, const std::string& endKey, 
+              const bool endKeyIncluded, const int32_t maxRecords, 
+              const int32_t maxBytes, const ScanOptions& options) {
+        PackedRecordWriter(_return.records).finish();
+        _return.responseCode = ResponseCode::Success;
+    }
+
     void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
         _return.responseCode = ResponseCode::Success;
+        _return.value = value_;
+    }
+
+    void getRange(BinaryResponse& _return, const std::string& mapName, const std::string& key,
+                  const int64_t offset, const int32_t length) {
+        _return.responseCode = ResponseCode::Success;
+        if (offset >= 0 && (uint64_t)offset < value_.size()) {
+            _return.value = value_.substr(offset, length);
+        }
     }
 
     ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
@@ -68,33 +104,140 @@ public:
         return ResponseCode::Success;
     }
 
+    ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& data) {
+        return ResponseCode::Success;
+    }
+
+    ResponseCode::type writeAt(const std::string& mapName, const std::string& key, const int64_t offset,
+                               const std::string& data) {
+        return ResponseCode::Success;
+    }
+
+    ResponseCode::type putChunk(const std::string& mapName, const std::string& key, const int64_t offset,
+                                const std::string& data, const bool last) {
+        return ResponseCode::Success;
+    }
+
     ResponseCode::type remove(const std::string& mapName, const std::string& key) {
         return ResponseCode::Success;
     }
+
+    void multiGet(std::vector<BinaryResponse>& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        _return.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            _return[i].responseCode = ResponseCode::Success;
+            _return[i].value = value_;
+        }
+    }
+
+    void multiPut(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records) {
+        _return.assign(records.size(), ResponseCode::Success);
+    }
+
+    void multiInsert(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records) {
+        _return.assign(records.size(), ResponseCode::Success);
+    }
+
+    void multiUpdate(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<Record>& records) {
+        _return.assign(records.size(), ResponseCode::Success);
+    }
+
+    void multiRemove(std::vector<ResponseCode::type>& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        _return.assign(keys.size(), ResponseCode::Success);
+    }
+
+    void getStats(StatsResponse& _return) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void getSplitKeys(BinaryListResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const int32_t numSplits) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void estimateCount(EstimateResponse& _return, const std::string& mapName,
+                       const std::string& startKey, const std::string& endKey, const bool exact) {
+        _return.value = 0;
+        _return.exact = true;
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void estimateSize(EstimateResponse& _return, const std::string& mapName,
+                      const std::string& startKey, const std::string& endKey, const bool exact) {
+        _return.value = 0;
+        _return.exact = true;
+        _return.responseCode = ResponseCode::Success;
+    }
+
+private:
+    std::string value_;
 };
 
 void usage(char* programName) {
-    fprintf(stderr, "%s [nonblocking|threaded|threadpool]\n", programName);
+    fprintf(stderr, "%s [nonblocking|threaded|threadpool|epoll] [options]\n"
+                    "  --protocol=binary|compact   (default binary)\n"
+                    "  --transport=framed|buffered (default framed; nonblocking and epoll are always framed)\n"
+                    "  --port=<port>               (default 9090)\n"
+                    "  --threads=<n>               worker threads for nonblocking, threadpool and epoll (default 32)\n"
+                    "  --io-threads=<n>            epoll threads (default: number of cores)\n"
+                    "  --max-queued=<n>            requests that may wait for an epoll worker (default 4096)\n"
+                    "  --max-frame-mb=<n>          epoll closes connections that send a larger frame (default 64)\n"
+                    "  --value-size=<bytes>        size of the values returned by get (default 0)\n",
+                    programName);
     exit(1);
 }
 
 int main(int argc, char **argv) {
+    ServerOptions options;
+    options.parse(argc, argv);
     if (argc != 2) {
         usage(argv[0]);
     }
-    int port = 9090;
-    size_t numThreads = 32;
-    shared_ptr<StubServer> handler(new StubServer());
+    int port = options.getInt("port", 9090);
+    size_t numThreads = options.getInt("threads", 32);
+    std::string protocol = options.getString("protocol", "binary");
+    std::string transport = options.getString("transport", "framed");
+    shared_ptr<StubServer> handler(new StubServer(options.getInt("value-size", 0)));
     shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
     shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
+    shared_ptr<TTransportFactory> transportFactory;
+    if (transport == "framed") {
+        transportFactory.reset(new TFramedTransportFactory());
+    } else if (transport == "buffered") {
+        transportFactory.reset(new TBufferedTransportFactory());
+    } else {
+        usage(argv[0]);
+    }
+    shared_ptr<TProtocolFactory> protocolFactory;
+    if (protocol == "binary") {
+        protocolFactory.reset(new TBinaryProtocolFactory());
+    } else if (protocol == "compact") {
+        protocolFactory.reset(new TCompactProtocolFactory());
+    } else {
+        usage(argv[0]);
+    }
+    if (strcmp(argv[1], "epoll") == 0) {
+        if (transport != "framed") {
+            fprintf(stderr, "EpollServer only supports framed transport\n");
+            exit(1);
+        }
+        EpollServer server(processor, protocolFactory, port,
+                           options.getInt("io-threads", sysconf(_SC_NPROCESSORS_ONLN)),
+                           numThreads, options.getInt("max-queued", 4096),
+                           options.getInt("max-frame-mb", 64) << 20);
+        server.serve();
+        return 0;
+    }
     shared_ptr<ThreadManager> threadManager = ThreadManager::newSimpleThreadManager(numThreads);
     shared_ptr<ThreadFactory> threadFactory(new PosixThreadFactory());
     threadManager->threadFactory(threadFactory);
     threadManager->start();
     TServer* server = NULL;
     if (strcmp(argv[1], "nonblocking") == 0) {
+        if (transport != "framed") {
+            fprintf(stderr, "TNonblockingServer only supports framed transport\n");
+            exit(1);
+        }
         server = new TNonblockingServer(processor, protocolFactory, port, threadManager);
     } else if (strcmp(argv[1], "threaded") == 0) {
         server = new TThreadedServer(processor, serverTransport, transportFactory, protocolFactory);
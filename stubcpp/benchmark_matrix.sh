@@ -0,0 +1,93 @@
+#!/bin/bash
+#
+# Measures the Thrift ceiling: runs mapkeeper_loadgen against the stub
+# server for every combination of server model, protocol, transport,
+# value size and connection count, and prints one CSV row per run.
+#
+# $ make && make -C ../loadgen
+# $ ./benchmark_matrix.sh > matrix.csv
+#
+# Each dimension can be narrowed through the environment, e.g.,
+#
+# $ SERVERS=threaded SIZES="100 1000" CONNECTIONS="1 64" DURATION=10 ./benchmark_matrix.sh
+#
+# To compare how the server models scale with the number of connections:
+#
+# $ SERVERS="threaded epoll" PROTOCOLS=binary TRANSPORTS=framed SIZES=256 \
+#   CONNECTIONS="100 1000 10000" ./benchmark_matrix.sh
+#
+# 10,000 connections need "ulimit -n" above 10,000 on both ends, and the
+# threaded server and the load generator both run a thread per connection.
+#
+# The workload is 50% get and 50% update over uniformly distributed keys.
+# server_cpu_us_per_op is the user + system CPU time of the stub server
+# divided by the number of completed operations; client_cpu_us_per_op is
+# the same for the load generator. Run the client on a different machine
+# (HOST=...) to keep it from competing with the server for CPU; server
+# CPU is then read over ssh.
+
+SERVERS=${SERVERS:-"nonblocking threaded threadpool epoll"}
+PROTOCOLS=${PROTOCOLS:-"binary compact"}
+TRANSPORTS=${TRANSPORTS:-"framed buffered"}
+SIZES=${SIZES:-"16 256 4096 65536"}
+CONNECTIONS=${CONNECTIONS:-"1 8 64 256"}
+DURATION=${DURATION:-30}
+HOST=${HOST:-localhost}
+PORT=${PORT:-9090}
+SERVER_THREADS=${SERVER_THREADS:-32}
+STUB=${STUB:-$(pwd)/mapkeeper_stubcpp}
+LOADGEN=${LOADGEN:-../loadgen/mapkeeper_loadgen}
+
+export LD_LIBRARY_PATH=/usr/local/lib:../thrift/gen-cpp:$LD_LIBRARY_PATH
+CLK_TCK=$(getconf CLK_TCK)
+
+# runs a command where the stub server runs.
+on_server() {
+    if [ "$HOST" = localhost ]; then
+        bash -c "$1"
+    else
+        ssh $HOST "$1"
+    fi
+}
+
+# user + system CPU ticks of a process. utime and stime are the 14th and
+# 15th fields of /proc/<pid>/stat.
+cpu_ticks() {
+    on_server "awk '{print \$14 + \$15}' /proc/$1/stat"
+}
+
+echo "server,protocol,transport,value_size,connections,throughput,mean_us,p50_us,p90_us,p99_us,p999_us,max_us,errors,server_cpu_us_per_op,client_cpu_us_per_op"
+for server in $SERVERS; do
+for protocol in $PROTOCOLS; do
+for transport in $TRANSPORTS; do
+    if [ $server = nonblocking -o $server = epoll ] && [ $transport != framed ]; then
+        # TNonblockingServer and EpollServer only speak framed transport.
+        continue
+    fi
+for size in $SIZES; do
+for connections in $CONNECTIONS; do
+    pid=$(on_server "$STUB $server --protocol=$protocol --transport=$transport \
+        --port=$PORT --threads=$SERVER_THREADS --value-size=$size > /dev/null 2>&1 & echo \$!")
+    sleep 1
+    start_ticks=$(cpu_ticks $pid)
+    overall=$($LOADGEN -t -host $HOST -port $PORT -threads $connections -duration $DURATION \
+        -protocol $protocol -transport $transport -format csv \
+        -p recordcount=1000000 -p operationcount=0 \
+        -p readproportion=0.5 -p updateproportion=0.5 \
+        -p fieldcount=1 -p fieldlength=$size -p requestdistribution=uniform \
+        | grep '^OVERALL,')
+    end_ticks=$(cpu_ticks $pid)
+    on_server "kill $pid"
+    sleep 1
+
+    # OVERALL,count,errors,throughput,mean,min,p50,p90,p99,p999,max,client_cpu
+    echo "$overall" | awk -F, -v prefix="$server,$protocol,$transport,$size,$connections" \
+        -v ticks=$((end_ticks - start_ticks)) -v clk_tck=$CLK_TCK '{
+        server_cpu = $2 > 0 ? ticks * 1000000 / clk_tck / $2 : 0
+        printf "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%.2f,%s\n", prefix, $4, $5, $7, $8, $9, $10, $11, $3, server_cpu, $12
+    }'
+done
+done
+done
+done
+done
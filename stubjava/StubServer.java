@@ -1,4 +1,6 @@
 import java.util.List;
+import java.util.ArrayList;
+import java.util.Collections;
 import java.nio.ByteBuffer;
 import com.yahoo.mapkeeper.*;
 import org.apache.thrift.*;
@@ -39,6 +41,28 @@ class StubServer implements MapKeeper.Iface {
         return response;
     }
 
+    public RecordListResponse scanWithOptions(String databaseName, ScanOrder order,
+        ByteBuffer startKey, boolean startKeyIncluded,
+        ByteBuffer endKey, boolean endKeyIncluded,
+        int maxRecords, int maxBytes, ScanOptions options) throws TException
+    {
+        RecordListResponse response = new RecordListResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public PackedRecordListResponse scanPacked(String databaseName, ScanOrder order,
+        ByteBuffer startKey, boolean startKeyIncluded,
+        ByteBuffer endKey, boolean endKeyIncluded,
+        int maxRecords, int maxBytes, ScanOptions options) throws TException
+    {
+        PackedRecordListResponse response = new PackedRecordListResponse();
+        response.responseCode = ResponseCode.Success;
+        // no records and no flags.
+        response.records = ByteBuffer.allocate(8);
+        return response;
+    }
+
     public BinaryResponse get(String databaseName, ByteBuffer recordKey) throws TException
     {
         BinaryResponse response = new BinaryResponse();
@@ -46,6 +70,14 @@ class StubServer implements MapKeeper.Iface {
         return response;
     }
 
+    public BinaryResponse getRange(String databaseName, ByteBuffer recordKey, long offset, int length)
+        throws TException
+    {
+        BinaryResponse response = new BinaryResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
     public ResponseCode put(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
     {
         return ResponseCode.Success;
@@ -65,11 +97,90 @@ class StubServer implements MapKeeper.Iface {
         return ResponseCode.Success;
     }
 
+    public ResponseCode append(String databaseName, ByteBuffer recordKey, ByteBuffer data) throws TException
+    {
+        return ResponseCode.Success;
+    }
+
+    public ResponseCode writeAt(String databaseName, ByteBuffer recordKey, long offset, ByteBuffer data)
+        throws TException
+    {
+        return ResponseCode.Success;
+    }
+
+    public ResponseCode putChunk(String databaseName, ByteBuffer recordKey, long offset,
+        ByteBuffer data, boolean last) throws TException
+    {
+        return ResponseCode.Success;
+    }
+
     public ResponseCode remove(String databaseName, ByteBuffer recordKey) throws TException
     {
         return ResponseCode.Success;
     }
 
+    public List<BinaryResponse> multiGet(String databaseName, List<ByteBuffer> recordKeys) throws TException
+    {
+        List<BinaryResponse> responses = new ArrayList<BinaryResponse>(recordKeys.size());
+        for (int i = 0; i < recordKeys.size(); i++) {
+            BinaryResponse response = new BinaryResponse();
+            response.responseCode = ResponseCode.Success;
+            responses.add(response);
+        }
+        return responses;
+    }
+
+    public List<ResponseCode> multiPut(String databaseName, List<Record> records) throws TException
+    {
+        return Collections.nCopies(records.size(), ResponseCode.Success);
+    }
+
+    public List<ResponseCode> multiInsert(String databaseName, List<Record> records) throws TException
+    {
+        return Collections.nCopies(records.size(), ResponseCode.Success);
+    }
+
+    public List<ResponseCode> multiUpdate(String databaseName, List<Record> records) throws TException
+    {
+        return Collections.nCopies(records.size(), ResponseCode.Success);
+    }
+
+    public List<ResponseCode> multiRemove(String databaseName, List<ByteBuffer> recordKeys) throws TException
+    {
+        return Collections.nCopies(recordKeys.size(), ResponseCode.Success);
+    }
+
+    public StatsResponse getStats() throws TException
+    {
+        StatsResponse response = new StatsResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public BinaryListResponse getSplitKeys(String databaseName, ByteBuffer startKey,
+        ByteBuffer endKey, int numSplits) throws TException
+    {
+        BinaryListResponse response = new BinaryListResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public EstimateResponse estimateCount(String databaseName, ByteBuffer startKey,
+        ByteBuffer endKey, boolean exact) throws TException
+    {
+        EstimateResponse response = new EstimateResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public EstimateResponse estimateSize(String databaseName, ByteBuffer startKey,
+        ByteBuffer endKey, boolean exact) throws TException
+    {
+        EstimateResponse response = new EstimateResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
     public static void usage() {
         System.err.println("Usage: java -jar stub_server.jar [hsha|nonblocking|threadpool]");
         System.exit(1);
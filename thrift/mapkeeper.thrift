@@ -22,6 +22,17 @@ enum ScanOrder
     Descending,
 }
 
+enum CompareOp
+{
+    Equal,
+    NotEqual,
+    Less,
+    LessOrEqual,
+    Greater,
+    GreaterOrEqual,
+    Contains,
+}
+
 struct Record 
 {
     1:binary key,
@@ -32,6 +43,24 @@ struct RecordListResponse
 {
     1:ResponseCode responseCode,
     2:list<Record> records,
+
+    /**
+     * Set by scanWithOptions when responseCode is Success: the last key
+     * the scan examined, which the next scan should start after. With
+     * filters it can be past the last returned record.
+     */
+    3:binary resumeKey,
+}
+
+/**
+ * The records of a scan packed into one buffer; see
+ * common/PackedRecords.h for the layout and a reader.
+ */
+struct PackedRecordListResponse
+{
+    1:ResponseCode responseCode,
+    2:binary records,
+    3:binary resumeKey,
 }
 
 struct BinaryResponse 
@@ -46,6 +75,99 @@ struct StringListResponse
     2:list<string> values,
 }
 
+struct BinaryListResponse
+{
+    1:ResponseCode responseCode,
+    2:list<binary> values,
+}
+
+struct EstimateResponse
+{
+    1:ResponseCode responseCode,
+    2:i64 value,
+    3:bool exact,
+}
+
+/**
+ * Compares bytes [offset, offset + length) of a value, or fewer if the
+ * value ends first, with operand. A negative length means up to the end
+ * of the value. The comparison is bytewise, like the key order;
+ * Contains checks whether operand appears in those bytes.
+ */
+struct ValueFilter
+{
+    1:i32 offset = 0,
+    2:i32 length = -1,
+    3:CompareOp op,
+    4:binary operand,
+}
+
+/**
+ * Which records a scan returns, and which part of each.
+ */
+struct ScanOptions
+{
+    /**
+     * Return the keys with empty values.
+     */
+    1:bool keysOnly = false,
+
+    /**
+     * Return valueLength bytes of each value starting at valueOffset, or
+     * fewer if the value ends first. A negative valueLength means up to
+     * the end of the value.
+     */
+    2:i32 valueOffset = 0,
+    3:i32 valueLength = -1,
+
+    /**
+     * Return only the records whose key starts with keyPrefix.
+     */
+    4:binary keyPrefix = "",
+
+    /**
+     * Return only the records whose key matches this POSIX extended
+     * regular expression somewhere. The whole key is matched, including
+     * any NUL bytes.
+     */
+    5:string keyRegex = "",
+
+    /**
+     * Return only the records whose values pass all of these.
+     */
+    6:list<ValueFilter> valueFilters,
+
+    /**
+     * Stop after looking at this many records, returned or not, with
+     * responseCode Success and resumeKey set. 0 means the server's
+     * default, which only applies to filtered scans.
+     */
+    7:i32 maxExamined = 0,
+
+    /**
+     * scanPacked only: store each key as the length of the prefix it
+     * shares with the previous key plus the rest. maxBytes then counts
+     * the stored part of the keys. The length takes 4 bytes per record,
+     * so this pays off when keys share more than that.
+     */
+    8:bool sharedKeyPrefixes = false,
+
+    /**
+     * scanPacked only: return values of maps with compression as the
+     * server stores them, for the client to decompress, unless part of
+     * each value or no value is asked for. The response's flags say
+     * whether it did; maxBytes then counts the compressed values.
+     */
+    9:bool compressedValues = false,
+}
+
+struct StatsResponse
+{
+    1:ResponseCode responseCode,
+    2:map<string, i64> counters,
+    3:map<string, string> properties,
+}
+
 /**
  * Note about map name:
  * Thrift string type translates to std::string in C++ and String in 
@@ -144,6 +266,39 @@ service MapKeeper
                             7:i32 maxRecords,
                             8:i32 maxBytes),
 
+    /**
+     * Same as scan, but returns only the records and the parts of them
+     * that options asks for. The storage engines skip reading what
+     * isn't returned where they can, and maxBytes counts the returned
+     * bytes. Filters are applied on the server, so rejected records
+     * don't cross the network.
+     */
+    RecordListResponse scanWithOptions(1:string mapName,
+                                       2:ScanOrder order,
+                                       3:binary startKey,
+                                       4:bool startKeyIncluded,
+                                       5:binary endKey,
+                                       6:bool endKeyIncluded,
+                                       7:i32 maxRecords,
+                                       8:i32 maxBytes,
+                                       9:ScanOptions options),
+
+    /**
+     * Same as scanWithOptions, but returns the records packed into one
+     * buffer. Servers build it as they scan and clients read it in
+     * place, which saves two allocations and copies per record on
+     * either side.
+     */
+    PackedRecordListResponse scanPacked(1:string mapName,
+                                        2:ScanOrder order,
+                                        3:binary startKey,
+                                        4:bool startKeyIncluded,
+                                        5:binary endKey,
+                                        6:bool endKeyIncluded,
+                                        7:i32 maxRecords,
+                                        8:i32 maxBytes,
+                                        9:ScanOptions options),
+
     /**
      * Retrieves a record from a map.
      *
@@ -158,6 +313,26 @@ service MapKeeper
      */
     BinaryResponse get(1:string mapName, 2:binary key),
 
+    /**
+     * Retrieves part of a record's value, reading no more of it than
+     * the storage engine has to. Large values are downloaded by asking
+     * for consecutive ranges until one comes back shorter than length.
+     *
+     * @param mapName map name
+     * @param key record to retrieve.
+     * @param offset first byte of the value to return.
+     * @param length number of bytes to return, or fewer if the value
+     *               ends first.
+     * @returns BinaryResponse
+     *              responseCode - Success
+     *                             MapNotFound database doesn't exist.
+     *                             RecordNotFound record doesn't exist.
+     *                             Error on any other errors, including
+     *                             a negative offset or length.
+     *              value - the bytes of the value.
+     */
+    BinaryResponse getRange(1:string mapName, 2:binary key, 3:i64 offset, 4:i32 length),
+
     /**
      * Puts a record into a map.
      *
@@ -200,6 +375,65 @@ service MapKeeper
      */
     ResponseCode update(1:string mapName, 2:binary key, 3:binary value),
 
+    /**
+     * Appends bytes to the value of a record, without sending the rest
+     * of the value back and forth.
+     *
+     * @param mapName map name
+     * @param key record to append to.
+     * @param data bytes to append.
+     * @returns Success
+     *          MapNotFound map doesn't exist.
+     *          RecordNotFound record doesn't exist.
+     *          Error on any other errors, including a value that would
+     *          grow past 2^31 - 1 bytes.
+     */
+    ResponseCode append(1:string mapName, 2:binary key, 3:binary data),
+
+    /**
+     * Overwrites bytes of the value of a record from offset. The value
+     * grows if data goes past its end, with zero bytes between the old
+     * end and offset. Empty data leaves the value as it is.
+     *
+     * @param mapName map name
+     * @param key record to write to.
+     * @param offset where data goes in the value.
+     * @param data bytes to write.
+     * @returns Success
+     *          MapNotFound map doesn't exist.
+     *          RecordNotFound record doesn't exist.
+     *          Error on any other errors, including a negative offset
+     *          and a value that would grow past 2^31 - 1 bytes.
+     */
+    ResponseCode writeAt(1:string mapName, 2:binary key, 3:i64 offset, 4:binary data),
+
+    /**
+     * Uploads a value in pieces, for values too large to send, or to
+     * hold in memory, at once.
+     *
+     * The piece at offset 0 starts the upload, dropping any unfinished
+     * upload of the key, and each later piece has to start where the
+     * previous one ended. The value replaces the record, or creates it,
+     * when the piece with last set arrives; until then the record keeps
+     * its old value. Unfinished uploads don't survive a server restart.
+     *
+     * Only maps with chunked storage take uploads (see
+     * common/ChunkingHandler.h).
+     *
+     * @param mapName map name
+     * @param key record to put.
+     * @param offset where data goes in the value.
+     * @param data the next piece of the value.
+     * @param last whether this is the last piece.
+     * @returns Success
+     *          MapNotFound map doesn't exist.
+     *          Error on any other errors, including a piece that
+     *          doesn't continue an upload, and maps without chunked
+     *          storage.
+     */
+    ResponseCode putChunk(1:string mapName, 2:binary key, 3:i64 offset,
+                          4:binary data, 5:bool last),
+
     /**
      * Removes a record from a map.
      *
@@ -211,4 +445,132 @@ service MapKeeper
      *          Error
      */
     ResponseCode remove(1:string mapName, 2:binary key),
+
+    /**
+     * Retrieves multiple records from a map.
+     *
+     * @param mapName map name
+     * @param keys records to retrieve.
+     * @returns list of BinaryResponse, one per key in the same order as keys.
+     *          See get() for the meaning of each response.
+     */
+    list<BinaryResponse> multiGet(1:string mapName, 2:list<binary> keys),
+
+    /**
+     * Puts multiple records into a map.
+     *
+     * @param mapName map name
+     * @param records records to put
+     * @returns list of response codes, one per record in the same order as
+     *          records. See put() for the meaning of each code.
+     */
+    list<ResponseCode> multiPut(1:string mapName, 2:list<Record> records),
+
+    /**
+     * Inserts multiple records into a map.
+     *
+     * @param mapName map name
+     * @param records records to insert
+     * @returns list of response codes, one per record in the same order as
+     *          records. See insert() for the meaning of each code.
+     */
+    list<ResponseCode> multiInsert(1:string mapName, 2:list<Record> records),
+
+    /**
+     * Updates multiple records in a map.
+     *
+     * @param mapName map name
+     * @param records records to update
+     * @returns list of response codes, one per record in the same order as
+     *          records. See update() for the meaning of each code.
+     */
+    list<ResponseCode> multiUpdate(1:string mapName, 2:list<Record> records),
+
+    /**
+     * Removes multiple records from a map.
+     *
+     * @param mapName map name
+     * @param keys records to remove
+     * @returns list of response codes, one per key in the same order as
+     *          keys. See remove() for the meaning of each code.
+     */
+    list<ResponseCode> multiRemove(1:string mapName, 2:list<binary> keys),
+
+    /**
+     * Returns statistics about the server.
+     *
+     * Counter and property names are dot-separated, e.g., "get.count",
+     * "get.latency_us.p99", "map.<mapName>.bytes_read" or
+     * "leveldb.<mapName>.stats". Which ones are present depends on the
+     * backend and on the options the server was started with.
+     *
+     * @returns StatsResponse
+     *              responseCode - Success
+     *                             Error on any errors.
+     *              counters - numeric statistics.
+     *              properties - free-form text, such as storage engine 
+     *                           status reports.
+     */
+    StatsResponse getStats(),
+
+    /**
+     * Returns keys that cut a key range into numSplits parts of about
+     * equal size, so that clients can scan the parts in parallel.
+     *
+     * The keys are in ascending order, greater than startKey and not
+     * greater than endKey, and may be keys that aren't in the map. With
+     * keys k1 ... kn, the parts are [startKey, k1), [k1, k2), ...,
+     * [kn, endKey]. Fewer than numSplits - 1 keys come back if the range
+     * is too small to cut that many times. Sizes are estimated from the
+     * storage engine's statistics where it keeps them, so the parts may
+     * differ by a few tens of percent.
+     *
+     * @param mapName map name
+     * @param startKey start of the range. If it's empty, the range starts
+     *                 at the smallest key in the map.
+     * @param endKey end of the range, included. If it's empty, the range
+     *               ends at the largest key in the map.
+     * @param numSplits number of parts, at most 1024.
+     * @returns BinaryListResponse
+     *              responseCode - Success
+     *                             MapNotFound map doesn't exist.
+     *                             Error on any other errors.
+     *              values - split keys.
+     */
+    BinaryListResponse getSplitKeys(1:string mapName, 2:binary startKey,
+                                    3:binary endKey, 4:i32 numSplits),
+
+    /**
+     * Returns the number of records in [startKey, endKey).
+     *
+     * An approximate answer comes from the storage engine's statistics
+     * (LevelDB's approximate sizes, BDB's btree statistics, InnoDB's
+     * table statistics) and doesn't scan the range, except for ranges
+     * small enough to count exactly anyway. An exact answer scans the
+     * keys of the range without reading the values where the storage
+     * engine allows.
+     *
+     * @param mapName map name
+     * @param startKey start of the range, included. If it's empty, the
+     *                 range starts at the smallest key in the map.
+     * @param endKey end of the range, excluded. If it's empty, the range
+     *               ends after the largest key in the map.
+     * @param exact whether to count the records exactly.
+     * @returns EstimateResponse
+     *              responseCode - Success
+     *                             MapNotFound map doesn't exist.
+     *                             Error on any other errors.
+     *              value - number of records.
+     *              exact - whether value is exact.
+     */
+    EstimateResponse estimateCount(1:string mapName, 2:binary startKey,
+                                   3:binary endKey, 4:bool exact),
+
+    /**
+     * Returns the total size of the keys and values in [startKey,
+     * endKey), in bytes. Parameters and responses are the same as
+     * estimateCount, but an exact answer has to read the values.
+     */
+    EstimateResponse estimateSize(1:string mapName, 2:binary startKey,
+                                  3:binary endKey, 4:bool exact),
 }